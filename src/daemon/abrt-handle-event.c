@@ -36,7 +36,7 @@ static char *crash_dump_dup_name = NULL;
 
 static void dup_corebt_fini(void);
 
-static char* load_backtrace(const struct dump_dir *dd)
+static char* load_backtrace(struct dump_dir *dd)
 {
     const char *filename = FILENAME_BACKTRACE;
     if (strcmp(type, "CCpp") == 0)
@@ -44,12 +44,46 @@ static char* load_backtrace(const struct dump_dir *dd)
         filename = FILENAME_CORE_BACKTRACE;
     }
 
-    return dd_load_text_ext(dd, filename,
+    return dd_snapshot_load_text(dd, filename,
         DD_FAIL_QUIETLY_ENOENT|DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
 }
 
+/* Kerneloops have the frames parsed by the dumper */
+static struct sr_stacktrace *load_koops_stacktrace(struct dump_dir *dd)
+{
+    struct abrt_koops_info *info = dd_load_koops_info(dd);
+    if (!info)
+        return NULL;
+
+    struct sr_stacktrace *stacktrace = koops_info_to_stacktrace(info);
+    koops_info_free(info);
+    return stacktrace;
+}
+
+static struct sr_stacktrace *load_stacktrace(struct dump_dir *dd, enum sr_report_type report_type)
+{
+    if (report_type == SR_REPORT_KERNELOOPS)
+        return load_koops_stacktrace(dd);
+
+    char *text = load_backtrace(dd);
+    if (!text)
+        return NULL; /* no backtrace */
+
+    /* sr_stacktrace_parse moves the pointer */
+    char *error_message;
+    struct sr_stacktrace *stacktrace = sr_stacktrace_parse(report_type, text, &error_message);
+    if (!stacktrace)
+    {
+        log_notice("Failed to parse backtrace: %s", error_message);
+        free(error_message);
+    }
+
+    free(text);
+    return stacktrace;
+}
+
 static int core_backtrace_is_duplicate(struct sr_stacktrace *bt1,
-                                       const char *bt2_text)
+                                       struct dump_dir *dd)
 {
     struct sr_thread *thread1 = sr_stacktrace_find_crash_thread(bt1);
 
@@ -61,13 +95,10 @@ static int core_backtrace_is_duplicate(struct sr_stacktrace *bt1,
     }
 
     int result;
-    char *error_message;
-    struct sr_stacktrace *bt2 = sr_stacktrace_parse(sr_abrt_type_from_type(type),
-                                                    bt2_text, &error_message);
+    struct sr_stacktrace *bt2 = load_stacktrace(dd, sr_abrt_type_from_type(type));
     if (bt2 == NULL)
     {
-        log_notice("Failed to parse backtrace, considering it not duplicate: %s", error_message);
-        free(error_message);
+        log_notice("Failed to load backtrace, considering it not duplicate");
         return 0;
     }
 
@@ -109,7 +140,7 @@ static void dup_uuid_init(const struct dump_dir *dd)
     );
 }
 
-static int dup_uuid_compare(const struct dump_dir *dd)
+static int dup_uuid_compare(struct dump_dir *dd)
 {
     char *dd_uuid;
     int different;
@@ -125,7 +156,7 @@ static int dup_uuid_compare(const struct dump_dir *dd)
     if (corebt)
         return 0;
 
-    dd_uuid = dd_load_text_ext(dd, FILENAME_UUID, DD_FAIL_QUIETLY_ENOENT);
+    dd_uuid = dd_snapshot_load_text(dd, FILENAME_UUID, DD_FAIL_QUIETLY_ENOENT);
     different = strcmp(uuid, dd_uuid);
     free(dd_uuid);
 
@@ -141,15 +172,11 @@ static void dup_uuid_fini(void)
     uuid = NULL;
 }
 
-static void dup_corebt_init(const struct dump_dir *dd)
+static void dup_corebt_init(struct dump_dir *dd)
 {
     if (corebt)
         return; /* already loaded */
 
-    char *corebt_text = load_backtrace(dd);
-    if (!corebt_text)
-        return; /* no backtrace */
-
     enum sr_report_type report_type = sr_abrt_type_from_type(type);
     if (report_type == SR_REPORT_INVALID)
     {
@@ -158,31 +185,15 @@ static void dup_corebt_init(const struct dump_dir *dd)
         return;
     }
 
-    /* sr_stacktrace_parse moves the pointer */
-    char *error_message;
-    corebt = sr_stacktrace_parse(report_type, corebt_text, &error_message);
-    if (!corebt)
-    {
-        log_notice("Failed to load core stacktrace: %s", error_message);
-        free(error_message);
-    }
-
-    free(corebt_text);
+    corebt = load_stacktrace(dd, report_type);
 }
 
-static int dup_corebt_compare(const struct dump_dir *dd)
+static int dup_corebt_compare(struct dump_dir *dd)
 {
     if (!corebt)
         return 0;
 
-    int isdup;
-
-    char *dd_corebt = load_backtrace(dd);
-    if (!dd_corebt)
-        return 0;
-
-    isdup = core_backtrace_is_duplicate(corebt, dd_corebt);
-    free(dd_corebt);
+    int isdup = core_backtrace_is_duplicate(corebt, dd);
 
     if (isdup)
         log_notice("Duplicate: core backtrace");
@@ -273,27 +284,28 @@ static int is_crash_a_dup(const char *dump_dir_name, void *param)
         int sv_logmode = logmode;
         /* Silently ignore any error in the silent log level. */
         logmode = g_verbose == 0 ? 0 : sv_logmode;
-        dd = dd_opendir(dump_dir_name2, /*flags:*/ DD_FAIL_QUIETLY_ENOENT | DD_OPEN_READONLY);
+        /* Read the candidates without locking them, see dd_snapshot_load_text() */
+        dd = dd_opendir(dump_dir_name2, /*flags:*/ DD_FAIL_QUIETLY_ENOENT | DD_OPEN_FD_ONLY);
         logmode = sv_logmode;
         if (!dd)
             goto next;
 
         /* crashes of different users are not considered duplicates */
-        dd_uid = dd_load_text_ext(dd, FILENAME_UID, DD_FAIL_QUIETLY_ENOENT);
+        dd_uid = dd_snapshot_load_text(dd, FILENAME_UID, DD_FAIL_QUIETLY_ENOENT);
         if (strcmp(uid, dd_uid))
         {
             goto next;
         }
 
         /* different crash types are not duplicates */
-        dd_type = dd_load_text_ext(dd, FILENAME_TYPE, DD_FAIL_QUIETLY_ENOENT);
+        dd_type = dd_snapshot_load_text(dd, FILENAME_TYPE, DD_FAIL_QUIETLY_ENOENT);
         if (strcmp(type, dd_type))
         {
             goto next;
         }
 
         /* different executables are not duplicates */
-        dd_executable = dd_load_text_ext(dd, FILENAME_EXECUTABLE, DD_FAIL_QUIETLY_ENOENT);
+        dd_executable = dd_snapshot_load_text(dd, FILENAME_EXECUTABLE, DD_FAIL_QUIETLY_ENOENT);
         if (     (executable != NULL && dd_executable == NULL)
              ||  (executable == NULL && dd_executable != NULL)
              || ((executable != NULL && dd_executable != NULL)
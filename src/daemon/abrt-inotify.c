@@ -153,6 +153,15 @@ abrt_inotify_watch_reset(struct abrt_inotify_watch *watch, const char *path, int
         error_msg_and_die("inotify_add_watch failed on '%s'", path);
 }
 
+int
+abrt_inotify_watch_add(struct abrt_inotify_watch *watch, const char *path, int inotify_flags)
+{
+    const int wd = inotify_add_watch(watch->inotify_fd, path, inotify_flags);
+    if (wd < 0)
+        perror_msg("inotify_add_watch failed on '%s'", path);
+    return wd;
+}
+
 void
 abrt_inotify_watch_destroy(struct abrt_inotify_watch *watch)
 {
@@ -37,4 +37,10 @@ abrt_inotify_watch_destroy(struct abrt_inotify_watch *watch);
 void
 abrt_inotify_watch_reset(struct abrt_inotify_watch *watch, const char *path, int inotify_flags);
 
+/* Watches one more path with the same handler. Returns the watch descriptor
+ * the handler gets in event->wd or -1. The kernel removes the watch when the
+ * path is deleted. */
+int
+abrt_inotify_watch_add(struct abrt_inotify_watch *watch, const char *path, int inotify_flags);
+
 #endif /*_ABRT_INOTIFY_H_*/
@@ -0,0 +1,548 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <netdb.h>
+#include <grp.h>
+
+#include "abrt-inotify.h"
+#include "abrt_glib.h"
+#include "libabrt.h"
+
+#define STRINGIZE_DETAIL(str) #str
+#define STRINGIZE(str) STRINGIZE_DETAIL(str)
+
+#define DEFAULT_SENDER_STATE VAR_STATE"/replication.state"
+#define DEFAULT_RECEIVER_STATE VAR_STATE"/replication"
+#define DEFAULT_RECEIVER_SOCKET VAR_RUN"/abrt/replication.socket"
+#define DEFAULT_RETRY_SEC 5
+/* Items of a problem are written one by one, send them together */
+#define SYNC_DELAY_MSEC 500
+#define MAX_CLIENT_COUNT 64
+
+static volatile sig_atomic_t s_exiting;
+/* Wakes up the main loop of the sender */
+static int s_signal_pipe[2] = { -1, -1 };
+
+static void handle_signal(int signo)
+{
+    s_exiting = 1;
+
+    if (s_signal_pipe[1] >= 0)
+    {
+        const int save_errno = errno;
+        uint8_t sig_caught = signo;
+        if (write(s_signal_pipe[1], &sig_caught, 1))
+            /* we ignore result, if () shuts up stupid compiler */;
+        errno = save_errno;
+    }
+}
+
+/* ENDPOINT is a path of a Unix socket or HOST:PORT */
+static int resolve_endpoint(const char *endpoint, bool passive, struct addrinfo **result)
+{
+    if (endpoint[0] == '/')
+    {
+        struct sockaddr_un *un = xzalloc(sizeof(*un));
+        un->sun_family = AF_UNIX;
+        if (strlen(endpoint) >= sizeof(un->sun_path))
+        {
+            error_msg("Socket path '%s' is too long", endpoint);
+            free(un);
+            return -1;
+        }
+        strcpy(un->sun_path, endpoint);
+
+        struct addrinfo *ai = xzalloc(sizeof(*ai));
+        ai->ai_family = AF_UNIX;
+        ai->ai_socktype = SOCK_STREAM;
+        ai->ai_addr = (struct sockaddr *)un;
+        ai->ai_addrlen = sizeof(*un);
+        *result = ai;
+        return 0;
+    }
+
+    const char *colon = strrchr(endpoint, ':');
+    if (colon == NULL)
+    {
+        error_msg("Endpoint '%s' is neither a socket path nor HOST:PORT", endpoint);
+        return -1;
+    }
+
+    char *host = xstrndup(endpoint, colon - endpoint);
+    struct addrinfo hints = {
+        .ai_flags = passive ? AI_PASSIVE : 0,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    const int r = getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, result);
+    free(host);
+    if (r != 0)
+    {
+        error_msg("Can't resolve '%s': %s", endpoint, gai_strerror(r));
+        return -1;
+    }
+
+    return 1;
+}
+
+static void free_endpoint(struct addrinfo *ai, int kind)
+{
+    if (kind == 0)
+    {
+        free(ai->ai_addr);
+        free(ai);
+    }
+    else if (kind > 0)
+        freeaddrinfo(ai);
+}
+
+static int connect_endpoint(const char *endpoint)
+{
+    struct addrinfo *result;
+    const int kind = resolve_endpoint(endpoint, /*passive*/false, &result);
+    if (kind < 0)
+        return -1;
+
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    free_endpoint(result, kind);
+
+    if (fd < 0)
+        perror_msg("Can't connect to '%s'", endpoint);
+    return fd;
+}
+
+static int listen_endpoint(const char *endpoint)
+{
+    struct addrinfo *result;
+    const int kind = resolve_endpoint(endpoint, /*passive*/true, &result);
+    if (kind < 0)
+        return -1;
+
+    /* Nodes are not authenticated, they are recognized by the address */
+    if (kind > 0 && g_settings_replication_allowed_peers == NULL)
+    {
+        error_msg("Refusing to listen on '%s', ReplicationAllowedPeers is empty", endpoint);
+        free_endpoint(result, kind);
+        return -1;
+    }
+
+    if (kind == 0)
+        unlink(endpoint); /* not caring about the result */
+
+    int fd = xsocket(result->ai_family, result->ai_socktype, 0);
+    close_on_exec_on(fd);
+    const int on = 1;
+    if (kind > 0)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    xbind(fd, result->ai_addr, result->ai_addrlen);
+    if (kind == 0 && chmod(endpoint, 0600) != 0)
+        perror_msg_and_die("chmod '%s'", endpoint);
+    xlisten(fd, MAX_CLIENT_COUNT);
+    free_endpoint(result, kind);
+
+    return fd;
+}
+
+/* Only root on the Unix socket and the allowed addresses over TCP */
+static bool peer_is_allowed(int fd, const struct sockaddr_storage *addr, socklen_t addrlen)
+{
+    if (addr->ss_family == AF_UNIX)
+    {
+        struct ucred cr;
+        socklen_t crlen = sizeof(cr);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &crlen) != 0 || crlen != sizeof(cr))
+        {
+            perror_msg("getsockopt(SO_PEERCRED)");
+            return false;
+        }
+        if (cr.uid != 0)
+        {
+            error_msg("Refusing replication from uid %lu", (unsigned long)cr.uid);
+            return false;
+        }
+        return true;
+    }
+
+    char host[NI_MAXHOST];
+    if (getnameinfo((const struct sockaddr *)addr, addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+        return false;
+
+    /* IPv4 nodes connected to an IPv6 socket */
+    const char *address = strncmp(host, "::ffff:", strlen("::ffff:")) == 0 && strchr(host, '.')
+            ? host + strlen("::ffff:") : host;
+    for (GList *l = g_settings_replication_allowed_peers; l; l = l->next)
+    {
+        if (strcmp(address, (const char *)l->data) == 0)
+            return true;
+    }
+
+    error_msg("Refusing replication from '%s', not in ReplicationAllowedPeers", address);
+    return false;
+}
+
+/* Every node is served by a child, the nodes are independent */
+static int run_receiver(const char *endpoint, const char *state_dir,
+        const struct abrt_replication_receiver_conf *conf)
+{
+    if (g_mkdir_with_parents(state_dir, 0700) != 0)
+        perror_msg_and_die("Can't create '%s'", state_dir);
+
+    const int listen_fd = listen_endpoint(endpoint);
+    if (listen_fd < 0)
+        return 1;
+
+    /* Don't leave zombies */
+    signal(SIGCHLD, SIG_IGN);
+
+    log_info("Waiting for nodes on '%s'", endpoint);
+    while (!s_exiting)
+    {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        const int fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen);
+        if (fd < 0)
+        {
+            if (errno != EINTR)
+                perror_msg("accept");
+            continue;
+        }
+
+        if (!peer_is_allowed(fd, &addr, addrlen))
+        {
+            close(fd);
+            continue;
+        }
+
+        const pid_t pid = fork();
+        if (pid < 0)
+            perror_msg("fork");
+        else if (pid == 0)
+        {
+            close(listen_fd);
+            struct abrt_replication_receiver *receiver = replication_receiver_new(state_dir, conf);
+            const int r = replication_receiver_serve(receiver, fd);
+            replication_receiver_free(receiver);
+            _exit(r == 0 ? 0 : 1);
+        }
+        close(fd);
+    }
+
+    close(listen_fd);
+    if (endpoint[0] == '/')
+        unlink(endpoint);
+    return 0;
+}
+
+struct sender
+{
+    struct abrt_replication_sender *sender;
+    const char *endpoint;
+    unsigned retry_sec;
+    int fd;
+    GMainLoop *main_loop;
+    struct abrt_inotify_watch *watch;
+    /* Watch descriptors of the problem directories, the rest is DumpLocation */
+    GHashTable *problem_wds;
+    guint sync_source;
+};
+
+/* abrtd completes a problem by saving its count after post-create and
+ * counters are rewritten in place, neither changes DumpLocation */
+#define PROBLEM_DIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+
+static void watch_problem_dir(struct sender *s, const char *name)
+{
+    if (name[0] == '.')
+        return;
+
+    char *path = concat_path_file(g_settings_dump_location, name);
+    const int wd = abrt_inotify_watch_add(s->watch, path, PROBLEM_DIR_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+    free(path);
+
+    if (wd >= 0)
+        g_hash_table_add(s->problem_wds, GINT_TO_POINTER(wd));
+}
+
+/* Adding a watch twice only returns the same descriptor */
+static void watch_problem_dirs(struct sender *s)
+{
+    DIR *dp = opendir(g_settings_dump_location);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", g_settings_dump_location);
+        return;
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+        if (dent->d_type == DT_DIR || dent->d_type == DT_UNKNOWN)
+            watch_problem_dir(s, dent->d_name);
+    closedir(dp);
+}
+
+static void sync_changes(struct sender *s)
+{
+    replication_sender_scan(s->sender);
+
+    /* Connects only when there is something to send */
+    if (replication_sender_pending(s->sender) != 0)
+    {
+        if (s->fd < 0 && (s->fd = connect_endpoint(s->endpoint)) >= 0
+            && replication_sender_resume(s->sender, s->fd) != 0)
+        {
+            close(s->fd);
+            s->fd = -1;
+        }
+
+        /* Sent again after the next connection */
+        if (s->fd >= 0 && replication_sender_send(s->sender, s->fd) < 0)
+        {
+            log_notice("Disconnected from '%s'", s->endpoint);
+            close(s->fd);
+            s->fd = -1;
+        }
+    }
+
+    replication_sender_save(s->sender);
+}
+
+static gboolean sync_changes_cb(gpointer user_data)
+{
+    struct sender *s = user_data;
+    s->sync_source = 0;
+
+    sync_changes(s);
+
+    /* Nothing changes until the collector is reachable again */
+    if (replication_sender_pending(s->sender) != 0)
+        s->sync_source = g_timeout_add_seconds(s->retry_sec, sync_changes_cb, s);
+
+    return FALSE;
+}
+
+static void schedule_sync(struct sender *s)
+{
+    if (s->sync_source == 0)
+        s->sync_source = g_timeout_add(SYNC_DELAY_MSEC, sync_changes_cb, s);
+}
+
+static void handle_inotify_cb(struct abrt_inotify_watch *watch, struct inotify_event *event, void *user_data)
+{
+    struct sender *s = user_data;
+
+    if (event->mask & IN_IGNORED)
+    {
+        g_hash_table_remove(s->problem_wds, GINT_TO_POINTER(event->wd));
+        return;
+    }
+
+    /* Missed events, look for the problems again */
+    if (event->mask & IN_Q_OVERFLOW)
+        watch_problem_dirs(s);
+    /* Locks and temporary files, our own scan takes the locks too */
+    else if (event->len == 0 || event->name[0] == '.')
+        return;
+    /* A new problem in DumpLocation */
+    else if (!g_hash_table_contains(s->problem_wds, GINT_TO_POINTER(event->wd))
+             && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+        watch_problem_dir(s, event->name);
+
+    schedule_sync(s);
+}
+
+static gboolean handle_signal_pipe_cb(GIOChannel *gio, GIOCondition condition, gpointer user_data)
+{
+    struct sender *s = user_data;
+    g_main_loop_quit(s->main_loop);
+    return TRUE; /* removed by run_sender() */
+}
+
+static int run_sender(const char *endpoint, const char *state_file, const char *node,
+        unsigned long bytes_per_sec, unsigned retry_sec)
+{
+    struct sender s = {
+        .sender = replication_sender_new(state_file, g_settings_dump_location, node, bytes_per_sec),
+        .endpoint = endpoint,
+        .retry_sec = retry_sec,
+        .fd = -1,
+        .main_loop = g_main_loop_new(NULL, FALSE),
+        .problem_wds = g_hash_table_new(g_direct_hash, g_direct_equal),
+    };
+
+    xpipe(s_signal_pipe);
+    close_on_exec_on(s_signal_pipe[0]);
+    close_on_exec_on(s_signal_pipe[1]);
+    ndelay_on(s_signal_pipe[1]);
+    GIOChannel *channel_signal = abrt_gio_channel_unix_new(s_signal_pipe[0]);
+    const guint signal_source = g_io_add_watch(channel_signal, G_IO_IN | G_IO_HUP,
+            handle_signal_pipe_cb, &s);
+
+    /* Never returns NULL; it will die if an error occurs */
+    s.watch = abrt_inotify_watch_init(g_settings_dump_location,
+            IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR,
+            handle_inotify_cb, &s);
+    watch_problem_dirs(&s);
+
+    /* Changes made while not running */
+    sync_changes_cb(&s);
+
+    if (!s_exiting)
+        g_main_loop_run(s.main_loop);
+
+    if (s.sync_source != 0)
+        g_source_remove(s.sync_source);
+    abrt_inotify_watch_destroy(s.watch);
+    g_source_remove(signal_source);
+    g_io_channel_unref(channel_signal);
+    close(s_signal_pipe[1]);
+    close(s_signal_pipe[0]);
+    s_signal_pipe[0] = s_signal_pipe[1] = -1;
+
+    if (s.fd >= 0)
+        close(s.fd);
+    replication_sender_save(s.sender);
+    replication_sender_free(s.sender);
+    g_hash_table_destroy(s.problem_wds);
+    g_main_loop_unref(s.main_loop);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    /* I18n */
+    setlocale(LC_ALL, "");
+#if ENABLE_NLS
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+#endif
+
+    abrt_init(argv);
+
+    /* Can't keep these strings/structs static: _() doesn't support that */
+    const char *program_usage_string = _(
+        "& [-vs] [-n NODE] [-i SEC] [-S STATE] [ENDPOINT]\n"
+        "or:\n"
+        "& -l [-vs] [-S STATE] [ENDPOINT]\n"
+        "\n"
+        "Streams new problems and changes of the existing ones from DumpLocation\n"
+        "to the collector at ENDPOINT, a path of a Unix socket or HOST:PORT.\n"
+        "Repeated occurrences are sent as counters only. After a disconnection,\n"
+        "the stream continues where the collector has stopped.\n"
+        "\n"
+        "If ENDPOINT is not provided, uses a value of ReplicationCollector option\n"
+        "from abrt.conf, ReplicationBandwidthLimit caps the traffic.\n"
+        "\n"
+        "With -l, runs the collector: accepts the streams at ENDPOINT, by default\n"
+        "a Unix socket "DEFAULT_RECEIVER_SOCKET" open only to root, and creates\n"
+        "the problems in DumpLocation. Over TCP, only the nodes listed in\n"
+        "ReplicationAllowedPeers are accepted."
+    );
+    enum {
+        OPT_v = 1 << 0,
+        OPT_s = 1 << 1,
+        OPT_l = 1 << 2,
+        OPT_n = 1 << 3,
+        OPT_i = 1 << 4,
+        OPT_S = 1 << 5,
+    };
+
+    char *node = NULL;
+    int retry = DEFAULT_RETRY_SEC;
+    char *state = NULL;
+
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_BOOL(   's', NULL, NULL, _("Log to syslog")),
+        OPT_BOOL(   'l', NULL, NULL, _("Run the collector")),
+        OPT_STRING( 'n', NULL, &node, "NODE", _("Name of this node on the collector. Default is the host name")),
+        OPT_INTEGER('i', NULL, &retry, _("Retry sending to an unreachable collector every SEC seconds. Default is "STRINGIZE(DEFAULT_RETRY_SEC))),
+        OPT_STRING( 'S', NULL, &state, "STATE", _("State file of the node or state directory of the collector")),
+        OPT_END()
+    };
+    unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
+
+    argv += optind;
+    if (argv[0] && argv[1])
+        show_usage_and_die(program_usage_string, program_options);
+
+    if (retry <= 0)
+        error_msg_and_die("Invalid interval: %d", retry);
+
+    msg_prefix = g_progname;
+    if ((opts & OPT_s) || getenv("ABRT_SYSLOG"))
+        logmode = LOGMODE_JOURNAL;
+
+    log_info("Loading settings");
+    if (load_abrt_conf() != 0)
+        return 1;
+
+    const char *endpoint = argv[0];
+    if (endpoint == NULL)
+        endpoint = (opts & OPT_l) ? DEFAULT_RECEIVER_SOCKET : g_settings_replication_collector;
+    if (endpoint == NULL)
+        error_msg_and_die("Neither ENDPOINT nor ReplicationCollector was specified");
+
+    signal(SIGTERM, handle_signal);
+    signal(SIGINT, handle_signal);
+    /* A broken connection is reported by write() */
+    signal(SIGPIPE, SIG_IGN);
+
+    int r;
+    if (opts & OPT_l)
+    {
+        struct abrt_replication_receiver_conf conf = {
+            .dump_location = g_settings_dump_location,
+            .dir_mode = DEFAULT_DUMP_DIR_MODE | S_IXUSR | S_IXGRP,
+            .item_mode = DEFAULT_DUMP_DIR_MODE,
+            .max_size = (unsigned long long)g_settings_nMaxCrashReportsSize * 1024 * 1024,
+        };
+        struct group *gr = getgrnam("abrt");
+        if (gr)
+            conf.fs_group = gr->gr_gid;
+        else
+            error_msg("Failed to get GID of 'abrt' (using 0 instead)");
+
+        r = run_receiver(endpoint, state ? state : DEFAULT_RECEIVER_STATE, &conf);
+    }
+    else
+    {
+        struct utsname uts;
+        if (node == NULL && uname(&uts) == 0)
+            node = uts.nodename;
+        if (node == NULL || !replication_node_name_is_valid(node))
+            error_msg_and_die("Invalid node name '%s'", node ? node : "");
+
+        r = run_sender(endpoint, state ? state : DEFAULT_SENDER_STATE, node,
+                g_settings_nReplicationBandwidthLimit * 1024UL, retry);
+    }
+
+    free_abrt_conf_data();
+    return r;
+}
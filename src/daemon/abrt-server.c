@@ -114,7 +114,7 @@ static int delete_path(const char *dump_dir_name)
     dd = dd_fdopendir(dd, /*flags:*/ 0);
     if (dd)
     {
-        if (dd_delete(dd) != 0)
+        if (dd_trash(dd) != 0)
         {
             error_msg("Failed to delete problem directory '%s'", dump_dir_name);
             dd_close(dd);
@@ -199,7 +199,7 @@ static int run_post_create(const char *dirname)
             if (g_settings_debug_level == 0)
             {
                 error_msg("Removing problem provoked by ABRT(pid:%s): '%s'", provoker, dirname);
-                dd_delete(dd);
+                dd_trash(dd);
             }
             else
             {
@@ -369,9 +369,22 @@ static int run_post_create(const char *dirname)
         }
     }
 
+    /* The new problem won't be touched by post-create events any more,
+     * so it is safe to shrink its large text elements now. */
+    if (!dup_of_dir && g_settings_nItemCompressionThreshold > 0)
+        dd_compress_items(dd, g_settings_nItemCompressionThreshold * 1024UL);
+
     /* Reset mode/uig/gid to correct values for all files created by event run */
     dd_sanitize_mode_and_owner(dd);
 
+    /* Must go after sanitizing, the clones copy mode and owner of the items */
+    if (!dup_of_dir && g_settings_nItemDeduplicationThreshold > 0)
+    {
+        char *blob_dir = blob_store_location(g_settings_dump_location);
+        dd_deduplicate_items(dd, blob_dir, g_settings_nItemDeduplicationThreshold * 1024UL);
+        free(blob_dir);
+    }
+
     dd_close(dd);
 
     if (!dup_of_dir)
@@ -381,7 +394,7 @@ static int run_post_create(const char *dirname)
         log_warning("Deleting problem directory %s (dup of %s)",
                     strrchr(dirname, '/') + 1,
                     strrchr(dup_of_dir, '/') + 1);
-        delete_dump_dir(dirname);
+        trash_dump_dir(dirname);
     }
 
     /* Run "notify[-dup]" event */
@@ -401,7 +414,7 @@ static int run_post_create(const char *dirname)
 
  delete_bad_dir:
     log_warning("Deleting problem directory '%s'", dirname);
-    delete_dump_dir(dirname);
+    trash_dump_dir(dirname);
 
  ret:
     strbuf_free(cmd_output);
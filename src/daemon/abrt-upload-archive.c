@@ -0,0 +1,812 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "libabrt.h"
+#include "abrt-upload-archive.h"
+
+#define UPLOAD_READ_BLOCK (64 * 1024)
+/* Chunks in flight between the reader and the writer of an archive */
+#define UPLOAD_PIPELINE_CHUNKS 64
+/* Archives of this size and bigger are decompressed in several threads */
+#define UPLOAD_PARALLEL_DECOMPRESS_SIZE (16 * 1024 * 1024)
+
+#define UPLOAD_ITEM_REMOTE "remote"
+#define UPLOAD_ITEM_REMOTE_COUNT "remote_count"
+
+static const char *const s_archive_suffixes[] = {
+    ".tar.gz",
+    ".tgz",
+    ".tar.bz2",
+    ".tar.xz",
+    NULL
+};
+
+static struct abrt_upload_stats s_stats;
+
+static void stats_add(struct abrt_upload_stage_stats *stage, uint64_t items, uint64_t bytes, uint64_t usec)
+{
+    __sync_fetch_and_add(&stage->items, items);
+    __sync_fetch_and_add(&stage->bytes, bytes);
+    __sync_fetch_and_add(&stage->usec, usec);
+}
+
+/* Makes names of the directories unique among the threads of the process */
+static unsigned next_sequence(void)
+{
+    static unsigned s_sequence;
+    return __sync_fetch_and_add(&s_sequence, 1);
+}
+
+bool
+abrt_upload_archive_name_is_valid(const char *name)
+{
+    const char *reason = NULL;
+    if (name[0] == '/')
+        reason = "starts with slash";
+    else if (name[0] == '.')
+        reason = "starts with dot";
+    else if (strstr(name, "..") != NULL)
+        reason = "contains ..";
+    else if (strchr(name, ' ') != NULL)
+        reason = "contains space";
+    else if (strchr(name, '\t') != NULL)
+        reason = "contains tab";
+
+    if (reason != NULL)
+    {
+        error_msg(_("Skipping: '%s' (%s)"), name, reason);
+        return false;
+    }
+
+    const size_t len = strlen(name);
+    for (const char *const *suffix = s_archive_suffixes; *suffix; ++suffix)
+    {
+        const size_t suffix_len = strlen(*suffix);
+        if (len > suffix_len && strcmp(name + len - suffix_len, *suffix) == 0)
+            return true;
+    }
+
+    error_msg(_("Unknown file type: '%s'"), name);
+    return false;
+}
+
+/* Removes the directory and everything in it, the unpacked directories are
+ * at most three levels deep */
+static void remove_tree_at(int parent_fd, const char *name)
+{
+    int dir_fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd < 0)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", name);
+        return;
+    }
+
+    DIR *dp = fdopendir(dir_fd);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", name);
+        close(dir_fd);
+        return;
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        if (unlinkat(dir_fd, dent->d_name, 0) != 0 && (errno == EISDIR || errno == EPERM))
+            remove_tree_at(dir_fd, dent->d_name);
+    }
+    closedir(dp);
+
+    if (unlinkat(parent_fd, name, AT_REMOVEDIR) != 0 && errno != ENOENT)
+        perror_msg("Can't remove '%s'", name);
+}
+
+static void remove_tree(const char *path)
+{
+    remove_tree_at(AT_FDCWD, path);
+}
+
+/*
+ * Splits the path of an archive member to the problem directory and the item
+ * name, "." components are ignored.
+ *
+ * @returns the number of components or 0 if the member can't be a part of
+ * problem data
+ */
+static int split_member_path(char *path, char *components[2])
+{
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *c = strtok_r(path, "/", &saveptr); c; c = strtok_r(NULL, "/", &saveptr))
+    {
+        if (strcmp(c, ".") == 0)
+            continue;
+
+        if (count == 2 || !str_is_correct_filename(c))
+            return 0;
+
+        components[count++] = c;
+    }
+
+    return count;
+}
+
+/*
+ * Decompress stage
+ *
+ * The reader thread passes the members of the archive to the writer in
+ * chunks. The number of chunks is fixed, so the reader waits when it's ahead
+ * of the writer and memory use doesn't depend on the size of the archive.
+ */
+enum chunk_kind
+{
+    CHUNK_MEMBER,   ///< the header of the next member
+    CHUNK_DATA,     ///< a block of the current member
+    CHUNK_END,      ///< the end of the archive
+    CHUNK_ERROR,    ///< the archive can't be read, the message is in 'pathname'
+};
+
+struct chunk
+{
+    enum chunk_kind kind;
+    /* CHUNK_MEMBER, CHUNK_ERROR */
+    char *pathname;
+    mode_t type;
+    bool hardlink;
+    int64_t size;       ///< -1 if unknown
+    /* CHUNK_DATA */
+    int64_t offset;
+    size_t len;
+    char data[UPLOAD_READ_BLOCK];
+};
+
+struct pipeline
+{
+    const char *archive_path;
+    unsigned decompress_threads;
+    struct chunk *chunks;
+    GAsyncQueue *free_chunks;
+    GAsyncQueue *full_chunks;
+    volatile gint aborted;  ///< the writer gave up, the reader should stop
+};
+
+static struct chunk *reader_next_chunk(struct pipeline *p, enum chunk_kind kind)
+{
+    struct chunk *c = g_async_queue_pop(p->free_chunks);
+    c->kind = kind;
+    c->pathname = NULL;
+    return c;
+}
+
+static gpointer reader_run(gpointer data)
+{
+    struct pipeline *p = (struct pipeline *)data;
+    struct archive *a = archive_read_new();
+    archive_read_support_filter_all(a);
+    archive_read_support_format_tar(a);
+
+    if (p->decompress_threads > 1)
+    {
+        /* Codecs which can't decompress in several threads ignore it */
+        char threads[sizeof(unsigned)*3 + 1];
+        snprintf(threads, sizeof(threads), "%u", p->decompress_threads);
+        if (archive_read_set_filter_option(a, NULL, "threads", threads) < ARCHIVE_WARN)
+            log_debug("Can't decompress '%s' in %s threads", p->archive_path, threads);
+    }
+
+    uint64_t usec = 0;
+    uint64_t bytes = 0;
+    char *error = NULL;
+
+    gint64 start = g_get_monotonic_time();
+    int r = archive_read_open_filename(a, p->archive_path, UPLOAD_READ_BLOCK);
+    usec += g_get_monotonic_time() - start;
+    if (r != ARCHIVE_OK)
+    {
+        error = xasprintf(_("Can't open '%s': %s"), p->archive_path, archive_error_string(a));
+        goto finish;
+    }
+
+    while (!g_atomic_int_get(&p->aborted))
+    {
+        struct archive_entry *entry;
+        start = g_get_monotonic_time();
+        r = archive_read_next_header(a, &entry);
+        usec += g_get_monotonic_time() - start;
+        if (r == ARCHIVE_EOF)
+            break;
+        if (r != ARCHIVE_OK && r != ARCHIVE_WARN)
+            goto read_error;
+
+        struct chunk *c = reader_next_chunk(p, CHUNK_MEMBER);
+        const char *pathname = archive_entry_pathname(entry);
+        c->pathname = pathname ? xstrdup(pathname) : NULL;
+        c->type = archive_entry_filetype(entry);
+        c->hardlink = archive_entry_hardlink(entry) != NULL;
+        c->size = archive_entry_size_is_set(entry) ? archive_entry_size(entry) : -1;
+        g_async_queue_push(p->full_chunks, c);
+
+        /* The writer doesn't want the data of what it won't unpack */
+        if (c->type != AE_IFREG || c->hardlink)
+            continue;
+
+        while (!g_atomic_int_get(&p->aborted))
+        {
+            const void *buf;
+            size_t size;
+            int64_t offset;
+            start = g_get_monotonic_time();
+            r = archive_read_data_block(a, &buf, &size, &offset);
+            usec += g_get_monotonic_time() - start;
+            if (r == ARCHIVE_EOF)
+                break;
+            if (r != ARCHIVE_OK)
+                goto read_error;
+
+            bytes += size;
+            for (size_t done = 0; done < size; )
+            {
+                c = reader_next_chunk(p, CHUNK_DATA);
+                c->offset = offset + done;
+                c->len = MIN(size - done, sizeof(c->data));
+                memcpy(c->data, (const char *)buf + done, c->len);
+                g_async_queue_push(p->full_chunks, c);
+                done += c->len;
+            }
+        }
+    }
+    goto finish;
+
+ read_error:
+    error = xasprintf(_("Can't unpack '%s': %s"), p->archive_path, archive_error_string(a));
+
+ finish:
+    stats_add(&s_stats.decompress, 1, bytes, usec);
+    __sync_fetch_and_add(&s_stats.compressed_bytes, (uint64_t)archive_filter_bytes(a, -1));
+    archive_read_free(a);
+
+    struct chunk *c = reader_next_chunk(p, error ? CHUNK_ERROR : CHUNK_END);
+    c->pathname = error;
+    g_async_queue_push(p->full_chunks, c);
+    return NULL;
+}
+
+/*
+ * Validate and stage stages
+ *
+ * The writer checks the members as they come and writes the accepted ones
+ * to the staging directory.
+ */
+struct writer
+{
+    const struct abrt_upload_conf *conf;
+    int dir_fd;
+    int fd;                 ///< of the item being written, -1 if it's skipped
+    char *item;             ///< its path relative to the staging directory
+    int64_t size;           ///< its declared size or -1
+    bool is_time;           ///< the item is the time of a problem
+    char time[sizeof("18446744073709551615\n")];
+    size_t time_len;
+    uint64_t total;         ///< unpacked bytes of the archive
+    struct abrt_upload_stage_stats validate;
+    struct abrt_upload_stage_stats stage;
+};
+
+/* abrtd can't load a problem directory with a broken time */
+static bool time_is_valid(const char *time, size_t len)
+{
+    /* Longer than the buffer */
+    if (len > sizeof(((struct writer *)0)->time))
+        return false;
+
+    if (len > 0 && time[len - 1] == '\n')
+        --len;
+
+    for (size_t i = 0; i < len; ++i)
+        if (!isdigit((unsigned char)time[i]))
+            return false;
+
+    return len > 0;
+}
+
+static int writer_finish_item(struct writer *w)
+{
+    if (w->fd < 0)
+        return 0;
+
+    int r = 0;
+    gint64 start = g_get_monotonic_time();
+    if (w->is_time && !time_is_valid(w->time, w->time_len))
+    {
+        error_msg("'%s' is not a valid time", w->item);
+        r = -1;
+    }
+    w->validate.usec += g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    /* A hole at the end */
+    if (r == 0 && w->size >= 0 && ftruncate(w->fd, w->size) != 0)
+    {
+        perror_msg("Can't truncate '%s'", w->item);
+        r = -1;
+    }
+    close(w->fd);
+    w->fd = -1;
+    w->stage.usec += g_get_monotonic_time() - start;
+    ++w->stage.items;
+
+    free(w->item);
+    w->item = NULL;
+    return r;
+}
+
+static int writer_member(struct writer *w, const struct chunk *c)
+{
+    if (writer_finish_item(w) != 0)
+        return -1;
+
+    gint64 start = g_get_monotonic_time();
+    ++w->validate.items;
+
+    const char *pathname = c->pathname;
+    if (pathname == NULL)
+        return 0;
+
+    char *path = xstrdup(pathname);
+    char *components[2];
+    const int depth = split_member_path(path, components);
+
+    int r = 0;
+    if (depth == 0)
+        log_notice("Skipping '%s'", pathname);
+    else if (c->type == AE_IFDIR)
+    {
+        /* Problem directories can't have sub-directories */
+        if (depth == 1 && mkdirat(w->dir_fd, components[0], 0700) != 0 && errno != EEXIST)
+        {
+            perror_msg("Can't create '%s'", pathname);
+            r = -1;
+        }
+    }
+    else if (c->type != AE_IFREG || c->hardlink)
+        log_notice("Skipping '%s', not a regular file", pathname);
+    else if (c->size >= 0 && w->conf->max_size != 0 && w->total + c->size > w->conf->max_size)
+    {
+        error_msg("The unpacked archive is bigger than %llu bytes", (unsigned long long)w->conf->max_size);
+        r = -1;
+    }
+    else
+    {
+        if (depth == 2 && mkdirat(w->dir_fd, components[0], 0700) != 0 && errno != EEXIST)
+        {
+            perror_msg("Can't create '%s'", components[0]);
+            r = -1;
+        }
+        else
+        {
+            w->item = depth == 2 ? xasprintf("%s/%s", components[0], components[1]) : xstrdup(components[0]);
+            w->size = c->size;
+            w->is_time = strcmp(components[depth - 1], FILENAME_TIME) == 0;
+            w->time_len = 0;
+        }
+    }
+    free(path);
+    w->validate.usec += g_get_monotonic_time() - start;
+
+    if (w->item == NULL)
+        return r;
+
+    start = g_get_monotonic_time();
+    /* Only regular files and directories are created, so there are no
+     * links to follow */
+    w->fd = openat(w->dir_fd, w->item, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    w->stage.usec += g_get_monotonic_time() - start;
+    if (w->fd < 0)
+    {
+        perror_msg("Can't create '%s'", pathname);
+        free(w->item);
+        w->item = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int writer_data(struct writer *w, const struct chunk *c)
+{
+    if (w->fd < 0)
+        return 0;
+
+    gint64 start = g_get_monotonic_time();
+    w->total += c->len;
+    if (w->size >= 0 && c->offset + (int64_t)c->len > w->size)
+    {
+        error_msg("'%s' is longer than declared", w->item);
+        return -1;
+    }
+    if (w->conf->max_size != 0 && w->total > w->conf->max_size)
+    {
+        error_msg("The unpacked archive is bigger than %llu bytes", (unsigned long long)w->conf->max_size);
+        return -1;
+    }
+    if (w->is_time)
+    {
+        const size_t len = MIN(c->len, sizeof(w->time) - w->time_len);
+        memcpy(w->time + w->time_len, c->data, len);
+        w->time_len += len;
+        if (c->len > len)
+            w->time_len = sizeof(w->time) + 1; /* too long */
+    }
+    w->validate.bytes += c->len;
+    w->validate.usec += g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    /* Sparse members come in blocks with holes between them */
+    for (size_t written = 0; written < c->len; )
+    {
+        const ssize_t r = pwrite(w->fd, c->data + written, c->len - written, c->offset + written);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror_msg("Can't write '%s'", w->item);
+            return -1;
+        }
+        written += r;
+    }
+    w->stage.bytes += c->len;
+    w->stage.usec += g_get_monotonic_time() - start;
+
+    return 0;
+}
+
+static int unpack_archive(const char *archive_path, int dir_fd, const struct abrt_upload_conf *conf)
+{
+    struct pipeline p = {
+        .archive_path = archive_path,
+        .decompress_threads = 1,
+    };
+
+    struct stat st;
+    if (stat(archive_path, &st) == 0 && st.st_size >= UPLOAD_PARALLEL_DECOMPRESS_SIZE)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        p.decompress_threads = cpus > 1 ? cpus : 1;
+    }
+
+    p.chunks = xmalloc(UPLOAD_PIPELINE_CHUNKS * sizeof(p.chunks[0]));
+    p.free_chunks = g_async_queue_new();
+    p.full_chunks = g_async_queue_new();
+    for (unsigned i = 0; i < UPLOAD_PIPELINE_CHUNKS; ++i)
+        g_async_queue_push(p.free_chunks, &p.chunks[i]);
+
+    GThread *reader = g_thread_new("upload-reader", reader_run, &p);
+
+    struct writer w = {
+        .conf = conf,
+        .dir_fd = dir_fd,
+        .fd = -1,
+    };
+
+    int ret = 0;
+    for (;;)
+    {
+        struct chunk *c = g_async_queue_pop(p.full_chunks);
+        const enum chunk_kind kind = c->kind;
+        if (kind == CHUNK_ERROR)
+        {
+            error_msg("%s", c->pathname);
+            ret = -1;
+        }
+        else if (ret == 0 && kind == CHUNK_MEMBER)
+            ret = writer_member(&w, c);
+        else if (ret == 0 && kind == CHUNK_DATA)
+            ret = writer_data(&w, c);
+
+        /* The reader stops at the next block, the rest of the chunks
+         * only returns to the free queue */
+        if (ret != 0)
+            g_atomic_int_set(&p.aborted, 1);
+
+        free(c->pathname);
+        c->pathname = NULL;
+        g_async_queue_push(p.free_chunks, c);
+
+        if (kind == CHUNK_END || kind == CHUNK_ERROR)
+            break;
+    }
+
+    if (writer_finish_item(&w) != 0)
+        ret = -1;
+
+    g_thread_join(reader);
+    g_async_queue_unref(p.full_chunks);
+    g_async_queue_unref(p.free_chunks);
+    free(p.chunks);
+
+    stats_add(&s_stats.validate, w.validate.items, w.validate.bytes, w.validate.usec);
+    stats_add(&s_stats.stage, w.stage.items, w.stage.bytes, w.stage.usec);
+    return ret;
+}
+
+/* Gives the problem directory and its items to root and the abrt group and
+ * drops everything but regular files, the same as abrt-handle-upload */
+static int sanitize_problem_dir(const char *path, const struct abrt_upload_conf *conf)
+{
+    const int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir_fd < 0)
+    {
+        perror_msg("Can't open '%s'", path);
+        return -1;
+    }
+
+    if (fchown(dir_fd, 0, conf->fs_group) != 0 || fchmod(dir_fd, conf->dir_mode) != 0)
+    {
+        perror_msg("Can't change owner of '%s'", path);
+        close(dir_fd);
+        return -1;
+    }
+
+    DIR *dp = fdopendir(dup(dir_fd));
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", path);
+        close(dir_fd);
+        return -1;
+    }
+
+    int r = 0;
+    struct dirent *dent;
+    while (r == 0 && (dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        struct stat st;
+        if (fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            remove_tree_at(dir_fd, dent->d_name);
+        else if (!S_ISREG(st.st_mode))
+            unlinkat(dir_fd, dent->d_name, 0);
+        else if (fchownat(dir_fd, dent->d_name, 0, conf->fs_group, AT_SYMLINK_NOFOLLOW) != 0
+                 || fchmodat(dir_fd, dent->d_name, conf->item_mode, 0) != 0)
+        {
+            perror_msg("Can't change owner of '%s/%s'", path, dent->d_name);
+            r = -1;
+        }
+    }
+    closedir(dp);
+
+    if (r == 0)
+    {
+        /* Overwrite remote if it exists */
+        const int fd = openat(dir_fd, UPLOAD_ITEM_REMOTE, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, conf->item_mode);
+        if (fd < 0 || fchown(fd, 0, conf->fs_group) != 0 || full_write(fd, "1", 1) != 1)
+        {
+            perror_msg("Can't save '%s/%s'", path, UPLOAD_ITEM_REMOTE);
+            r = -1;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+
+    /* abrtd would increment count value and abrt-server refuses to process
+     * problem directories containing 'count' element when PrivateReports is on */
+    if (r == 0 && renameat(dir_fd, FILENAME_COUNT, dir_fd, UPLOAD_ITEM_REMOTE_COUNT) != 0 && errno != ENOENT)
+    {
+        perror_msg("Can't rename '%s/%s'", path, FILENAME_COUNT);
+        r = -1;
+    }
+
+    close(dir_fd);
+    return r;
+}
+
+static int publish_problem_dir(const char *src, const char *dst, const struct abrt_upload_conf *conf, GList **published)
+{
+    if (sanitize_problem_dir(src, conf) != 0)
+    {
+        error_msg("Removing uploaded dir '%s'", src);
+        remove_tree(src);
+        return -1;
+    }
+
+    /* The staging directory is in the dump location, abrtd never sees an
+     * incomplete directory */
+    if (rename(src, dst) != 0)
+    {
+        perror_msg("Can't move '%s' to '%s'", src, dst);
+        return -1;
+    }
+
+    log_notice("Created problem directory '%s'", dst);
+    notify_new_path(dst);
+    if (published)
+        *published = g_list_prepend(*published, xstrdup(dst));
+    return 0;
+}
+
+/* The archive can contain either plain dump files or one or more complete
+ * problem data directories */
+static int publish_problems(const char *tempdir, int dir_fd, const struct abrt_upload_conf *conf, GList **published)
+{
+    if ((faccessat(dir_fd, FILENAME_ANALYZER, F_OK, AT_SYMLINK_NOFOLLOW) == 0
+            || faccessat(dir_fd, FILENAME_TYPE, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+        && faccessat(dir_fd, FILENAME_TIME, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+        char *dst = concat_path_file(conf->dump_location, strrchr(tempdir, '/') + 1);
+        const int r = publish_problem_dir(tempdir, dst, conf, published);
+        free(dst);
+        return r == 0 ? 1 : -1;
+    }
+
+    DIR *dp = fdopendir(dup(dir_fd));
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", tempdir);
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        struct stat st;
+        if (dot_or_dotdot(dent->d_name)
+            || fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+            || !S_ISDIR(st.st_mode))
+            continue;
+
+        char *dst = concat_path_file(conf->dump_location, dent->d_name);
+        if (access(dst, F_OK) == 0)
+        {
+            char *unique = xasprintf("%s.%d.%u", dst, (int)getpid(), next_sequence());
+            free(dst);
+            dst = unique;
+        }
+
+        char *src = concat_path_file(tempdir, dent->d_name);
+        if (access(dst, F_OK) != 0 && publish_problem_dir(src, dst, conf, published) == 0)
+            ++count;
+        free(src);
+        free(dst);
+    }
+    closedir(dp);
+
+    return count;
+}
+
+/* Creates the staging directory, it stays in the dump location for the next
+ * archives */
+static char *create_staging_dir(const struct abrt_upload_conf *conf)
+{
+    char *staging = concat_path_file(conf->dump_location, ABRT_UPLOAD_STAGING_DIR_NAME);
+    if (mkdir(staging, 0700) != 0 && errno != EEXIST)
+    {
+        perror_msg(_("Can't create '%s' directory"), staging);
+        free(staging);
+        return NULL;
+    }
+
+    return staging;
+}
+
+int
+abrt_upload_archive_unpack(const char *archive_path, const struct abrt_upload_conf *conf, GList **published)
+{
+    char *staging = create_staging_dir(conf);
+    if (staging == NULL)
+    {
+        __sync_fetch_and_add(&s_stats.rejected, 1);
+        return -1;
+    }
+
+    char *working_dir = concat_path_file(staging, "abrt_handle_upload.XXXXXX");
+    free(staging);
+    if (mkdtemp(working_dir) == NULL)
+    {
+        perror_msg(_("Can't create working directory in '%s'"), conf->dump_location);
+        free(working_dir);
+        __sync_fetch_and_add(&s_stats.rejected, 1);
+        return -1;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    struct tm tm;
+    char date[sizeof("YYYY-MM-DD-hh:mm:ss") + 16];
+    strftime(date, sizeof(date), "%Y-%m-%d-%H:%M:%S", localtime_r(&tv.tv_sec, &tm));
+    char *tempdir = xasprintf("%s/remote.%s.%06ld.%d.%u", working_dir, date, (long)tv.tv_usec,
+            (int)getpid(), next_sequence());
+
+    int r = -1;
+    int dir_fd = -1;
+    if (mkdir(tempdir, 0700) != 0
+        || (dir_fd = open(tempdir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+    {
+        perror_msg(_("Can't create '%s' directory"), tempdir);
+        goto finish;
+    }
+
+    log(_("Unpacking '%s'"), archive_path);
+    if (unpack_archive(archive_path, dir_fd, conf) != 0)
+        goto finish;
+
+    const gint64 start = g_get_monotonic_time();
+    r = publish_problems(tempdir, dir_fd, conf, published);
+    stats_add(&s_stats.publish, r > 0 ? r : 0, 0, g_get_monotonic_time() - start);
+
+ finish:
+    if (r < 0)
+        __sync_fetch_and_add(&s_stats.rejected, 1);
+    if (dir_fd >= 0)
+        close(dir_fd);
+    remove_tree(working_dir);
+    free(tempdir);
+    free(working_dir);
+    return r;
+}
+
+static void get_stage_stats(struct abrt_upload_stage_stats *dst, struct abrt_upload_stage_stats *src)
+{
+    dst->items = __sync_fetch_and_add(&src->items, 0);
+    dst->bytes = __sync_fetch_and_add(&src->bytes, 0);
+    dst->usec = __sync_fetch_and_add(&src->usec, 0);
+}
+
+void
+abrt_upload_get_stats(struct abrt_upload_stats *stats)
+{
+    get_stage_stats(&stats->decompress, &s_stats.decompress);
+    get_stage_stats(&stats->validate, &s_stats.validate);
+    get_stage_stats(&stats->stage, &s_stats.stage);
+    get_stage_stats(&stats->publish, &s_stats.publish);
+    stats->compressed_bytes = __sync_fetch_and_add(&s_stats.compressed_bytes, 0);
+    stats->rejected = __sync_fetch_and_add(&s_stats.rejected, 0);
+}
+
+static void print_stage_stats(FILE *out, const char *name, const struct abrt_upload_stage_stats *stage)
+{
+    const double mib = stage->bytes / (1024.0 * 1024.0);
+    const double sec = stage->usec / 1000000.0;
+    fprintf(out, "%-10s %10llu items %10.1f MiB %9.3f s %9.1f MiB/s\n", name,
+            (unsigned long long)stage->items, mib, sec, sec > 0 ? mib / sec : 0.0);
+}
+
+void
+abrt_upload_print_stats(FILE *out)
+{
+    struct abrt_upload_stats stats;
+    abrt_upload_get_stats(&stats);
+
+    print_stage_stats(out, "decompress", &stats.decompress);
+    print_stage_stats(out, "validate", &stats.validate);
+    print_stage_stats(out, "stage", &stats.stage);
+    print_stage_stats(out, "publish", &stats.publish);
+    fprintf(out, "compressed %10.1f MiB, rejected %llu archives\n",
+            stats.compressed_bytes / (1024.0 * 1024.0), (unsigned long long)stats.rejected);
+}
@@ -0,0 +1,116 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef _ABRT_UPLOAD_ARCHIVE_H_
+#define _ABRT_UPLOAD_ARCHIVE_H_
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <glib.h>
+
+/*
+ * Unpacking of uploaded problem archives, the in-process equivalent of
+ * abrt-handle-upload.
+ *
+ * An archive contains either the items of a single problem directory or
+ * one or more complete problem directories. Only regular files are unpacked,
+ * links, devices and directories nested in problem directories are dropped.
+ *
+ * An archive passes through a pipeline of stages:
+ *   decompress - a reader thread decompresses the archive and splits it
+ *                to members
+ *   validate   - the members are checked as they come, an invalid archive
+ *                is rejected before it is unpacked completely
+ *   stage      - the items are written to a staging directory in the dump
+ *                location, hidden from abrtd
+ *   publish    - the complete problem directories are renamed to the dump
+ *                location and abrtd is notified about each of them
+ * Decompression of an archive runs in parallel with writing of its items.
+ * Large archives are decompressed in several threads if the codec can do it.
+ *
+ * The functions can be called from several threads at once.
+ */
+
+/* The staging directory in the dump location, abrtd ignores hidden names */
+#define ABRT_UPLOAD_STAGING_DIR_NAME ".upload"
+
+struct abrt_upload_conf
+{
+    const char *dump_location;
+    gid_t fs_group;                 ///< the group owning the problem directories
+    mode_t dir_mode;                ///< mode of the problem directories
+    mode_t item_mode;               ///< mode of their items
+    uint64_t max_size;              ///< of the unpacked data of an archive, 0 for no limit
+};
+
+/* Counters of a pipeline stage */
+struct abrt_upload_stage_stats
+{
+    uint64_t items;                 ///< archives, members, items or problem directories
+    uint64_t bytes;                 ///< unpacked data
+    uint64_t usec;                  ///< time spent in the stage
+};
+
+/* Counters of all archives processed by the process */
+struct abrt_upload_stats
+{
+    struct abrt_upload_stage_stats decompress;
+    struct abrt_upload_stage_stats validate;
+    struct abrt_upload_stage_stats stage;
+    struct abrt_upload_stage_stats publish;
+    uint64_t compressed_bytes;      ///< read from the archives
+    uint64_t rejected;              ///< archives which couldn't be unpacked
+};
+
+/*
+ * Checks the name of an uploaded file the same way abrt-handle-upload does.
+ *
+ * @returns true if the file looks like a problem archive
+ */
+bool
+abrt_upload_archive_name_is_valid(const char *name);
+
+/*
+ * Unpacks the archive and moves the problem directories found in it to
+ * the dump location.
+ *
+ * @param published If not NULL, the paths of the created problem directories
+ * are prepended to the list
+ *
+ * @returns the number of problem directories created or a negative number
+ * if the archive couldn't be unpacked
+ */
+int
+abrt_upload_archive_unpack(const char *archive_path, const struct abrt_upload_conf *conf, GList **published);
+
+/*
+ * Copies the counters of all stages, the copy isn't atomic as a whole.
+ */
+void
+abrt_upload_get_stats(struct abrt_upload_stats *stats);
+
+/*
+ * Prints the counters and the throughput of every stage to the file.
+ */
+void
+abrt_upload_print_stats(FILE *out);
+
+#endif /*_ABRT_UPLOAD_ARCHIVE_H_*/
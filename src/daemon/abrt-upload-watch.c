@@ -16,7 +16,10 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <grp.h>
+
 #include "abrt-inotify.h"
+#include "abrt-upload-archive.h"
 #include "abrt_glib.h"
 #include "libabrt.h"
 
@@ -25,42 +28,278 @@
 
 #define DEFAULT_COUNT_OF_WORKERS 10
 #define DEFAULT_CACHE_MIB_SIZE 4
+#define DEFAULT_QUEUE_DIRECTORY VAR_STATE"/upload-queue"
+#define DEFAULT_CATALOG_FILE VAR_STATE"/upload-catalog"
+/* Changes of the catalog are saved in batches, occurrences waiting for
+ * abrtd are retried at the same interval */
+#define CATALOG_SAVE_DELAY_SEC 2
 
 static int g_signal_pipe[2];
 
+/*
+ * Backlog of archives waiting for a worker
+ *
+ * Every detected archive gets a file in the queue directory named by its
+ * sequence number and containing the path of the archive. The file is
+ * removed when the archive has been processed, so the archives detected
+ * before a restart are processed after it. Nothing is dropped: when the
+ * in-memory part of the queue is full, the entries stay only on disk and
+ * are loaded when there is room for them.
+ */
+struct queue_entry
+{
+    unsigned long long seq;
+    char *path;
+};
+
 struct queue
 {
-    unsigned capacity;
-    GQueue q;
+    unsigned capacity;      ///< of the in-memory part
+    GQueue q;               ///< the oldest entries, the oldest at the tail
+    const char *directory;
+    unsigned length;        ///< of the whole queue
+    unsigned long long next_seq;
+    bool spilled;           ///< some entries are only on disk
+    unsigned long long spill_seq; ///< the first entry not loaded in memory
 };
 
+static void
+queue_entry_free(struct queue_entry *entry)
+{
+    if (entry == NULL)
+        return;
+
+    free(entry->path);
+    free(entry);
+}
+
+static char *
+queue_entry_file(const struct queue *queue, unsigned long long seq)
+{
+    return xasprintf("%s/%020llu", queue->directory, seq);
+}
+
+static bool
+queue_entry_file_seq(const char *name, unsigned long long *seq)
+{
+    if (strlen(name) != 20 || strspn(name, "0123456789") != 20)
+        return false;
+
+    *seq = strtoull(name, NULL, 10);
+    return true;
+}
+
+/* Removes the entry of a processed archive, can be called from any thread */
+static void
+queue_entry_done(const struct queue *queue, const struct queue_entry *entry)
+{
+    char *file = queue_entry_file(queue, entry->seq);
+    if (unlink(file) != 0 && errno != ENOENT)
+        perror_msg("Can't remove '%s'", file);
+    free(file);
+}
+
+static struct queue_entry *
+queue_entry_load(const struct queue *queue, unsigned long long seq)
+{
+    char *file = queue_entry_file(queue, seq);
+    char *path = xmalloc_open_read_close(file, /*maxsize:*/ NULL);
+    free(file);
+    if (path == NULL)
+        return NULL;
+
+    struct queue_entry *entry = xmalloc(sizeof(*entry));
+    entry->seq = seq;
+    entry->path = path;
+    return entry;
+}
+
 static int
-queue_push(struct queue *queue, char *value)
+compare_seq(gconstpointer a, gconstpointer b)
+{
+    const unsigned long long seq_a = *(const unsigned long long *)a;
+    const unsigned long long seq_b = *(const unsigned long long *)b;
+    return seq_a < seq_b ? -1 : seq_a > seq_b;
+}
+
+/* Returns the sorted sequence numbers of the entries from the first one */
+static GArray *
+queue_list(const struct queue *queue, unsigned long long first)
 {
-    if (g_queue_get_length(&queue->q) >= queue->capacity)
-        return 0;
+    GArray *seqs = g_array_new(FALSE, FALSE, sizeof(unsigned long long));
+
+    DIR *dp = opendir(queue->directory);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", queue->directory);
+        return seqs;
+    }
 
-    g_queue_push_head(&queue->q, value);
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        unsigned long long seq;
+        if (queue_entry_file_seq(dent->d_name, &seq) && seq >= first)
+            g_array_append_val(seqs, seq);
+    }
+    closedir(dp);
 
-    return 1;
+    g_array_sort(seqs, compare_seq);
+    return seqs;
 }
 
-static char *
+/* Moves the oldest entries kept only on disk to memory */
+static void
+queue_load(struct queue *queue)
+{
+    GArray *seqs = queue_list(queue, queue->spill_seq);
+
+    queue->spilled = false;
+    for (unsigned i = 0; i < seqs->len; ++i)
+    {
+        const unsigned long long seq = g_array_index(seqs, unsigned long long, i);
+        if (g_queue_get_length(&queue->q) >= queue->capacity)
+        {
+            queue->spilled = true;
+            queue->spill_seq = seq;
+            break;
+        }
+
+        struct queue_entry *entry = queue_entry_load(queue, seq);
+        if (entry)
+            g_queue_push_head(&queue->q, entry);
+    }
+
+    g_array_free(seqs, TRUE);
+}
+
+/* Creates the queue directory and finds the entries left by the last run */
+static void
+queue_open(struct queue *queue, const char *directory, unsigned capacity)
+{
+    g_queue_init(&queue->q);
+    queue->capacity = capacity;
+    queue->directory = directory;
+
+    if (g_mkdir_with_parents(directory, 0700) != 0)
+        perror_msg_and_die("Can't create '%s'", directory);
+
+    GArray *seqs = queue_list(queue, 0);
+    queue->length = seqs->len;
+    if (seqs->len > 0)
+    {
+        queue->next_seq = g_array_index(seqs, unsigned long long, seqs->len - 1) + 1;
+        queue->spilled = true;
+        queue->spill_seq = 0;
+        log_notice("%u archives left in the queue", queue->length);
+    }
+    g_array_free(seqs, TRUE);
+}
+
+/* Returns the paths of all queued archives */
+static GHashTable *
+queue_paths(struct queue *queue)
+{
+    GHashTable *paths = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+    GArray *seqs = queue_list(queue, 0);
+    for (unsigned i = 0; i < seqs->len; ++i)
+    {
+        struct queue_entry *entry = queue_entry_load(queue, g_array_index(seqs, unsigned long long, i));
+        if (entry == NULL)
+            continue;
+
+        g_hash_table_add(paths, entry->path);
+        entry->path = NULL;
+        queue_entry_free(entry);
+    }
+    g_array_free(seqs, TRUE);
+
+    return paths;
+}
+
+static void
+queue_push(struct queue *queue, const char *path)
+{
+    const unsigned long long seq = queue->next_seq++;
+
+    char *file = queue_entry_file(queue, seq);
+    char *tmp = xasprintf("%s.tmp", file);
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    const bool saved = fd >= 0
+        && full_write_str(fd, path) == strlen(path)
+        && fsync(fd) == 0
+        && close(fd) == 0
+        && rename(tmp, file) == 0;
+    if (!saved)
+    {
+        /* Still processed if nothing bad happens in the meantime */
+        perror_msg(_("Can't save '%s' to the queue"), path);
+        if (fd >= 0)
+            close(fd);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(file);
+
+    ++queue->length;
+
+    if (saved && (queue->spilled || g_queue_get_length(&queue->q) >= queue->capacity))
+    {
+        log_debug("Keeping '%s' only on disk", path);
+        if (!queue->spilled)
+        {
+            queue->spilled = true;
+            queue->spill_seq = seq;
+        }
+        return;
+    }
+
+    struct queue_entry *entry = xmalloc(sizeof(*entry));
+    entry->seq = seq;
+    entry->path = xstrdup(path);
+    g_queue_push_head(&queue->q, entry);
+}
+
+static struct queue_entry *
 queue_pop(struct queue *queue)
 {
+    if (g_queue_is_empty(&queue->q) && queue->spilled)
+        queue_load(queue);
+
     if (g_queue_is_empty(&queue->q))
         return NULL;
 
-    return (char *)g_queue_pop_tail(&queue->q);
+    --queue->length;
+    return (struct queue_entry *)g_queue_pop_tail(&queue->q);
+}
+
+static void
+queue_destroy(struct queue *queue)
+{
+    struct queue_entry *entry;
+    while ((entry = g_queue_pop_tail(&queue->q)) != NULL)
+        queue_entry_free(entry);
 }
 
 struct process
 {
     GMainLoop *main_loop;
     const char *upload_directory;
-    unsigned children;
-    unsigned max_children;
+    unsigned workers;
+    unsigned max_workers;
+    GThreadPool *pool;
+    struct abrt_upload_conf conf;
     struct queue queue;
+    struct abrt_upload_catalog *catalog;
+    guint catalog_source;
+};
+
+struct job
+{
+    struct process *proc;
+    struct queue_entry *entry;
+    GList *published;   ///< problem directories created from the archive
 };
 
 static void
@@ -70,76 +309,224 @@ process_quit(struct process *proc)
 }
 
 static void
-run_abrt_handle_upload(struct process *proc, const char *name)
+print_stats(struct process *proc)
 {
-    log_info("Processing file '%s' in directory '%s'", name, proc->upload_directory);
+    /* this is meant only for debugging, so not marking it as translatable */
+    fprintf(stderr, "%u archives to process, %u active workers\n", proc->queue.length, proc->workers);
+}
 
-    ++proc->children;
-    log_debug("Running workers: %d", proc->children);
+static gboolean
+catalog_save_cb(gpointer user_data)
+{
+    struct process *proc = (struct process *)user_data;
 
-    fflush(NULL); /* paranoia */
-    pid_t pid = fork();
-    if (pid < 0)
+    const unsigned pending = upload_catalog_flush_occurrences(proc->catalog);
+    upload_catalog_save(proc->catalog);
+
+    if (pending != 0)
     {
-        --proc->children;
-        perror_msg("fork");
-        return;
+        log_debug("%u problems with occurrences waiting for abrtd", pending);
+        return TRUE; /* try again later */
     }
 
-    if (pid == 0)
+    proc->catalog_source = 0;
+    return FALSE;
+}
+
+static void
+schedule_catalog_save(struct process *proc)
+{
+    if (proc->catalog_source == 0)
+        proc->catalog_source = g_timeout_add_seconds(CATALOG_SAVE_DELAY_SEC, catalog_save_cb, proc);
+}
+
+static void process_next_in_queue(struct process *proc);
+
+/* Runs in the main loop after a worker has finished */
+static gboolean
+job_done_cb(gpointer user_data)
+{
+    struct job *job = (struct job *)user_data;
+    struct process *proc = job->proc;
+
+    /* Manifests of the next occurrences are answered from the catalog */
+    for (GList *l = job->published; l; l = l->next)
+        upload_catalog_add_problem(proc->catalog, l->data);
+    if (job->published)
+        schedule_catalog_save(proc);
+
+    list_free_with_free(job->published);
+    queue_entry_free(job->entry);
+    free(job);
+
+    --proc->workers;
+    process_next_in_queue(proc);
+    print_stats(proc);
+
+    return FALSE; /* run only once */
+}
+
+/* Runs in a thread of the pool */
+static void
+job_run(gpointer data, gpointer user_data)
+{
+    struct job *job = (struct job *)data;
+    struct process *proc = job->proc;
+    const char *path = job->entry->path;
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    log_info("Processing file '%s' in directory '%s'", name, proc->upload_directory);
+
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        log_notice("'%s' is gone", path);
+    else if (abrt_upload_archive_name_is_valid(name))
     {
-        /* child */
-        xchdir(proc->upload_directory);
-        if (g_settings_delete_uploaded)
-            execlp("abrt-handle-upload", "abrt-handle-upload", "-d",
-                           g_settings_dump_location, proc->upload_directory, name, (char*)NULL);
-        else
-            execlp("abrt-handle-upload", "abrt-handle-upload",
-                           g_settings_dump_location, proc->upload_directory, name, (char*)NULL);
-        perror_msg_and_die("Can't execute '%s'", "abrt-handle-upload");
+        const int r = abrt_upload_archive_unpack(path, &proc->conf, &job->published);
+        if (r >= 0)
+            log(_("'%s' processed successfully"), name);
     }
+
+    /* Deleted even if it can't be unpacked, the same as abrt-handle-upload -d */
+    if (g_settings_delete_uploaded && unlink(path) != 0 && errno != ENOENT)
+        perror_msg("Can't delete '%s'", path);
+
+    queue_entry_done(&proc->queue, job->entry);
+
+    g_idle_add(job_done_cb, job);
 }
 
 static void
-handle_new_path(struct process *proc, char *name)
+process_next_in_queue(struct process *proc)
 {
-    log("Detected creation of file '%s' in upload directory '%s'", name, proc->upload_directory);
-
-    if (proc->children < proc->max_children)
+    while (proc->workers < proc->max_workers)
     {
-        run_abrt_handle_upload(proc, name);
-        free(name);
-        return;
+        struct queue_entry *entry = queue_pop(&proc->queue);
+        if (!entry)
+        {
+            log_debug("Deferred queue is empty. Running workers: %u", proc->workers);
+            return;
+        }
+
+        struct job *job = xzalloc(sizeof(*job));
+        job->proc = proc;
+        job->entry = entry;
+
+        ++proc->workers;
+        log_debug("Running workers: %u", proc->workers);
+
+        GError *error = NULL;
+        g_thread_pool_push(proc->pool, job, &error);
+        if (error)
+            error_msg_and_die("Can't start a worker: %s", error->message);
     }
+}
+
+/* Manifests are cheap to answer, they don't wait for a worker */
+static void
+handle_manifest(struct process *proc, const char *name)
+{
+    log_info("Answering manifest '%s'", name);
+
+    char *path = concat_path_file(proc->upload_directory, name);
+    const int r = upload_catalog_process_manifest(proc->catalog, path);
+    free(path);
+
+    if (r == UPLOAD_MANIFEST_DUPLICATE)
+        schedule_catalog_save(proc);
+}
 
-    log_debug("Pushing '%s' to deferred queue", name);
-    if (!queue_push(&proc->queue, name))
+static void
+handle_new_path(struct process *proc, const char *name)
+{
+    if (g_str_has_suffix(name, UPLOAD_MANIFEST_SUFFIX))
     {
-        error_msg(_("No free workers and full buffer. Omitting archive '%s'"), name);
-        free(name);
+        handle_manifest(proc, name);
         return;
     }
+
+    log("Detected creation of file '%s' in upload directory '%s'", name, proc->upload_directory);
+
+    char *path = concat_path_file(proc->upload_directory, name);
+    queue_push(&proc->queue, path);
+    free(path);
+
+    process_next_in_queue(proc);
 }
 
-static void
-print_stats(struct process *proc)
+static bool
+is_ignored_name(const char *name)
 {
-    /* this is meant only for debugging, so not marking it as translatable */
-    fprintf(stderr, "%i archives to process, %i active workers\n", g_queue_get_length(&proc->queue.q), proc->children);
+    /* Files being uploaded and the answers to manifests */
+    const char *ext = strrchr(name, '.');
+    return ext && (strcmp(ext + 1, "working") == 0
+                   || strcmp(ext + 1, "tmp") == 0
+                   || strcmp(ext, UPLOAD_RESPONSE_SUFFIX) == 0);
+}
+
+static bool
+timespec_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
 }
 
+/*
+ * Queues the archives uploaded while the service was not running.
+ *
+ * Processed archives are deleted if DeleteUploaded is on, so every archive
+ * found was missed. Otherwise, only the archives changed since the last
+ * change of the queue were missed. Answered manifests are always removed,
+ * so every manifest found is answered.
+ */
 static void
-process_next_in_queue(struct process *proc)
+rescan_upload_directory(struct process *proc, const struct timespec *since)
 {
-    char *name = queue_pop(&proc->queue);
-    if (!name)
+    DIR *dp = opendir(proc->upload_directory);
+    if (dp == NULL)
     {
-        log_debug("Deferred queue is empty. Running workers: %d", proc->children);
+        perror_msg("Can't open '%s'", proc->upload_directory);
         return;
     }
 
-    run_abrt_handle_upload(proc, name);
-    free(name);
+    GHashTable *queued = queue_paths(&proc->queue);
+    GList *missed = NULL;
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        struct stat st;
+        if (dent->d_name[0] == '.' || is_ignored_name(dent->d_name)
+            || fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+            || !S_ISREG(st.st_mode))
+            continue;
+
+        if (g_str_has_suffix(dent->d_name, UPLOAD_MANIFEST_SUFFIX))
+        {
+            handle_manifest(proc, dent->d_name);
+            continue;
+        }
+
+        if (!g_settings_delete_uploaded && (since == NULL || timespec_before(&st.st_ctim, since)))
+            continue;
+
+        char *path = concat_path_file(proc->upload_directory, dent->d_name);
+        if (g_hash_table_contains(queued, path))
+            free(path);
+        else
+            missed = g_list_prepend(missed, path);
+    }
+    closedir(dp);
+    g_hash_table_destroy(queued);
+
+    /* The directory order is random, the upload order is the best guess */
+    missed = g_list_sort(missed, (GCompareFunc)strcmp);
+    for (GList *l = missed; l; l = l->next)
+    {
+        log("Found missed file '%s'", (const char *)l->data);
+        queue_push(&proc->queue, l->data);
+    }
+    list_free_with_free(missed);
 }
 
 static void
@@ -182,21 +569,13 @@ handle_signal_pipe_cb(GIOChannel *gio, GIOCondition condition, gpointer user_dat
             if (signals[signo] == SIGUSR1)
             {
                 print_stats(proc);
+                abrt_upload_print_stats(stderr);
             }
-            else if (signals[signo] != SIGCHLD)
+            else
             {
                 process_quit(proc);
                 return FALSE; /* remove this event */
             }
-            else
-            {
-                while (safe_waitpid(-1, NULL, WNOHANG) > 0)
-                {
-                    --proc->children;
-                    process_next_in_queue(proc);
-                    print_stats(proc);
-                }
-            }
         }
     }
 
@@ -210,11 +589,10 @@ handle_inotify_cb(struct abrt_inotify_watch *watch, struct inotify_event *event,
      * or a file moved to upload dir? */
     if (!(event->mask & IN_ISDIR) && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
     {
-        const char *ext = strrchr(event->name, '.');
-        if (ext && strcmp(ext + 1, "working") == 0)
+        if (is_ignored_name(event->name))
             return;
 
-        handle_new_path((struct process *)user_data, xstrdup(event->name));
+        handle_new_path((struct process *)user_data, event->name);
     }
 }
 
@@ -255,13 +633,20 @@ main(int argc, char **argv)
     abrt_init(argv);
     /* Can't keep these strings/structs static: _() doesn't support that */
     const char *program_usage_string = _(
-        "& [-vs] [-w NUM] [-c MiB] [UPLOAD_DIRECTORY]\n"
+        "& [-vs] [-w NUM] [-c MiB] [-q DIR] [-C FILE] [UPLOAD_DIRECTORY]\n"
         "\n"
         "\nWatches UPLOAD_DIRECTORY and unpacks incoming archives into DumpLocation"
         "\nspecified in abrt.conf"
         "\n"
         "\nIf UPLOAD_DIRECTORY is not provided, uses a value of"
         "\nWatchCrashdumpArchiveDir option from abrt.conf"
+        "\n"
+        "\nThe archives waiting for a worker are queued in DIR and processed"
+        "\nafter a restart. Archives uploaded while the program was not running"
+        "\nare found at startup."
+        "\n"
+        "\nManifests (*"UPLOAD_MANIFEST_SUFFIX") of problems are answered from the catalog FILE:"
+        "\nduplicates are only counted, the archives of new problems are requested."
     );
     enum {
         OPT_v = 1 << 0,
@@ -269,10 +654,14 @@ main(int argc, char **argv)
         OPT_d = 1 << 2,
         OPT_w = 1 << 3,
         OPT_c = 1 << 4,
+        OPT_q = 1 << 5,
+        OPT_C = 1 << 6,
     };
 
     int concurrent_workers = DEFAULT_COUNT_OF_WORKERS;
     int cache_size_mib = DEFAULT_CACHE_MIB_SIZE;
+    char *queue_directory = (char *)DEFAULT_QUEUE_DIRECTORY;
+    char *catalog_file = (char *)DEFAULT_CATALOG_FILE;
 
     /* Keep enum above and order of options below in sync! */
     struct options program_options[] = {
@@ -281,6 +670,8 @@ main(int argc, char **argv)
         OPT_BOOL('d', NULL, NULL              , _("Daemize")),
         OPT_INTEGER('w', NULL, &concurrent_workers, _("Number of concurrent workers. Default is "STRINGIZE(DEFAULT_COUNT_OF_WORKERS))),
         OPT_INTEGER('c', NULL, &cache_size_mib, _("Maximal cache size in MiB. Default is "STRINGIZE(DEFAULT_CACHE_MIB_SIZE))),
+        OPT_STRING( 'q', NULL, &queue_directory, "DIR", _("Queue directory. Default is "DEFAULT_QUEUE_DIRECTORY)),
+        OPT_STRING( 'C', NULL, &catalog_file, "FILE", _("Catalog of problems for manifests. Default is "DEFAULT_CATALOG_FILE)),
         OPT_END()
     };
     unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
@@ -295,11 +686,7 @@ main(int argc, char **argv)
         error_msg_and_die("Too big cache size. Maximum is : %u MiB", UINT_MAX / (1024 * 1024 / FILENAME_MAX));
 
     struct process proc = {0};
-    proc.max_children = concurrent_workers;
-    /* By default it is about 1024 entries */
-    g_queue_init(&proc.queue.q);
-    proc.queue.capacity = cache_size_mib * (1024 * 1024 / FILENAME_MAX);
-    log_debug("Max queue size %u", proc.queue.capacity);
+    proc.max_workers = concurrent_workers;
 
     argv += optind;
     if (argv[0])
@@ -321,6 +708,16 @@ main(int argc, char **argv)
     if (!proc.upload_directory)
         error_msg_and_die("Neither UPLOAD_DIRECTORY nor WatchCrashdumpArchiveDir was specified");
 
+    proc.conf.dump_location = g_settings_dump_location;
+    proc.conf.max_size = (uint64_t)g_settings_nMaxCrashReportsSize * 1024 * 1024;
+    proc.conf.dir_mode = DEFAULT_DUMP_DIR_MODE | S_IXUSR | S_IXGRP;
+    proc.conf.item_mode = DEFAULT_DUMP_DIR_MODE;
+    struct group *gr = getgrnam("abrt");
+    if (gr)
+        proc.conf.fs_group = gr->gr_gid;
+    else
+        error_msg("Failed to get GID of 'abrt' (using 0 instead)");
+
     if (opts & OPT_d)
         daemonize();
 
@@ -330,6 +727,23 @@ main(int argc, char **argv)
         logmode = LOGMODE_JOURNAL;
     }
 
+    /* The last change of the queue is the last time anything was uploaded
+     * as far as we know */
+    struct stat queue_st;
+    const bool queue_exists = stat(queue_directory, &queue_st) == 0;
+
+    /* By default it is about 1024 entries */
+    queue_open(&proc.queue, queue_directory, cache_size_mib * (1024 * 1024 / FILENAME_MAX));
+    log_debug("Max queue size %u", proc.queue.capacity);
+
+    proc.catalog = upload_catalog_load(catalog_file, proc.conf.dump_location);
+    schedule_catalog_save(&proc);
+
+    GError *error = NULL;
+    proc.pool = g_thread_pool_new(job_run, NULL, concurrent_workers, /*exclusive*/FALSE, &error);
+    if (proc.pool == NULL)
+        error_msg_and_die("Can't create workers: %s", error->message);
+
     log_info("Creating glib main loop");
     proc.main_loop = g_main_loop_new(NULL, FALSE);
 
@@ -349,13 +763,15 @@ main(int argc, char **argv)
     signal(SIGUSR1, handle_signal);
     signal(SIGTERM, handle_signal);
     signal(SIGINT, handle_signal);
-    signal(SIGCHLD, handle_signal);
     GIOChannel *channel_signal = abrt_gio_channel_unix_new(g_signal_pipe[0]);
     guint channel_signal_source_id = g_io_add_watch(channel_signal,
                 G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
                 handle_signal_pipe_cb,
                 &proc);
 
+    rescan_upload_directory(&proc, queue_exists ? &queue_st.st_mtim : NULL);
+    process_next_in_queue(&proc);
+
     log_info("Starting glib main loop");
 
     g_main_loop_run(proc.main_loop);
@@ -364,7 +780,25 @@ main(int argc, char **argv)
 
     g_source_remove(channel_signal_source_id);
 
-    GError *error = NULL;
+    /* Let the workers finish the started archives, the rest stays queued */
+    g_thread_pool_free(proc.pool, /*immediate*/TRUE, /*wait*/TRUE);
+
+    /* The finished jobs are waiting in the main context, their published
+     * problems must get to the catalog before it is saved. No new jobs. */
+    proc.max_workers = 0;
+    while (g_main_context_iteration(NULL, /*may_block*/FALSE))
+        continue;
+    queue_destroy(&proc.queue);
+
+    if (proc.catalog_source != 0)
+        g_source_remove(proc.catalog_source);
+    upload_catalog_flush_occurrences(proc.catalog);
+    upload_catalog_save(proc.catalog);
+    upload_catalog_free(proc.catalog);
+
+    if (g_verbose > 0)
+        abrt_upload_print_stats(stderr);
+
     g_io_channel_shutdown(channel_signal, FALSE, &error);
     if (error)
     {
@@ -20,6 +20,8 @@
 # include <locale.h>
 #endif
 #include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <glib-unix.h>
 
 #include "abrt_glib.h"
@@ -46,6 +48,19 @@
 
 #define ABRTD_DBUS_NAME ABRT_DBUS_NAME".daemon"
 
+/* How often the trash is checked for problem directories deleted by other
+ * processes (e.g. abrt-dbus) */
+#define REAPER_PERIOD_SEC 30
+/* Deleting multi-GB cores at full speed would starve the other I/O */
+#define REAPER_MAX_BYTES_PER_SEC (64 * 1024 * 1024)
+/* How often old problems are moved to the cold storage */
+#define TIERING_PERIOD_SEC (10 * 60)
+
+/* glibc doesn't provide these */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
 /* Daemon initializes, then sits in glib main loop, waiting for events.
  * Events can be:
  * - inotify: something new appeared under /var/tmp/abrt or /var/spool/abrt-upload
@@ -62,6 +77,8 @@ static GMainLoop *s_main_loop;
 static GIOChannel *channel_socket = NULL;
 static guint channel_id_socket = 0;
 static int child_count = 0;
+static pid_t s_reaper_pid = 0;
+static pid_t s_tiering_pid = 0;
 
 /* Helpers */
 static guint add_watch_or_die(GIOChannel *channel, unsigned condition, GIOFunc func)
@@ -165,6 +182,121 @@ server_socket_finitio:
     return TRUE;
 }
 
+/* Forks a child which doesn't compete for I/O with the rest of the system.
+ * Returns the same as fork().
+ */
+static pid_t fork_low_priority_child(void)
+{
+    fflush(NULL); /* paranoia */
+    pid_t pid = fork();
+    if (pid < 0)
+        perror_msg("fork");
+    if (pid != 0)
+        return pid;
+
+    /* The signal pipe belongs to the parent */
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT,  SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        perror_msg("Can't set idle I/O priority");
+    if (setpriority(PRIO_PROCESS, 0, 19) != 0)
+        perror_msg("Can't lower priority");
+
+    return 0;
+}
+
+/* Deletes trashed problem directories and unreferenced blobs in a low priority
+ * child process */
+static void start_reaper(void)
+{
+    if (s_reaper_pid > 0)
+        return;
+
+    char *trash_dir = trash_location(g_settings_dump_location);
+
+    /* Don't fork if nothing has been trashed */
+    bool empty = true;
+    DIR *dp = opendir(trash_dir);
+    if (dp)
+    {
+        struct dirent *dent;
+        while (empty && (dent = readdir(dp)) != NULL)
+            empty = dot_or_dotdot(dent->d_name);
+        closedir(dp);
+    }
+
+    if (empty)
+    {
+        free(trash_dir);
+        return;
+    }
+
+    pid_t pid = fork_low_priority_child();
+    if (pid < 0)
+    {
+        free(trash_dir);
+        return;
+    }
+    if (pid == 0) /* child */
+    {
+        const int reaped = empty_trash(trash_dir, REAPER_MAX_BYTES_PER_SEC);
+        log_info("Deleted %d trashed problem directories", reaped);
+
+        /* Drop blobs of the deleted problems */
+        char *blob_dir = blob_store_location(g_settings_dump_location);
+        const int collected = blob_store_collect_garbage(blob_dir);
+        log_info("Removed %d unreferenced blobs", collected);
+        free(blob_dir);
+        _exit(0);
+    }
+
+    log_debug("Started reaper %d", (int)pid);
+    s_reaper_pid = pid;
+    free(trash_dir);
+}
+
+static gboolean reaper_timeout_cb(gpointer ptr_unused)
+{
+    start_reaper();
+    return TRUE; /* "please don't remove this event" */
+}
+
+/* Moves heavy payloads of old and reported problems to the cold storage */
+static void start_tiering(void)
+{
+    if (s_tiering_pid > 0 || g_settings_cold_storage_location == NULL)
+        return;
+
+    pid_t pid = fork_low_priority_child();
+    if (pid < 0)
+        return;
+    if (pid == 0) /* child */
+    {
+        const int moved = move_cold_problems(g_settings_dump_location,
+                g_settings_cold_storage_location,
+                g_settings_nColdStorageAge * 60UL * 60UL,
+                g_settings_cold_storage_reported);
+        log_info("Moved %d problems to cold storage", moved);
+
+        trim_cold_storage(g_settings_cold_storage_location, g_settings_dump_location,
+                g_settings_nMaxColdStorageSize * (double)(1024*1024));
+        _exit(0);
+    }
+
+    log_debug("Started tiering %d", (int)pid);
+    s_tiering_pid = pid;
+}
+
+static gboolean tiering_timeout_cb(gpointer ptr_unused)
+{
+    /* Pick up changes of the cold storage settings */
+    load_abrt_conf();
+    start_tiering();
+    return TRUE; /* "please don't remove this event" */
+}
+
 /* Signal pipe handler */
 static gboolean handle_signal_cb(GIOChannel *gio, GIOCondition condition, gpointer ptr_unused)
 {
@@ -179,10 +311,23 @@ static gboolean handle_signal_cb(GIOChannel *gio, GIOCondition condition, gpoint
             g_main_loop_quit(s_main_loop);
         else
         {
-            while (safe_waitpid(-1, NULL, WNOHANG) > 0)
+            pid_t pid;
+            while ((pid = safe_waitpid(-1, NULL, WNOHANG)) > 0)
             {
+                if (pid == s_reaper_pid)
+                {
+                    s_reaper_pid = 0;
+                    continue;
+                }
+                if (pid == s_tiering_pid)
+                {
+                    s_tiering_pid = 0;
+                    continue;
+                }
                 decrement_child_count();
             }
+            /* abrt-server may have trashed a duplicate problem */
+            start_reaper();
         }
     }
     start_idle_timeout();
@@ -363,8 +508,9 @@ static void mark_unprocessed_dump_dirs_not_reportable(const char *path)
     struct dirent *dent;
     while ((dent = readdir(dp)) != NULL)
     {
-        if (dot_or_dotdot(dent->d_name))
-            continue; /* skip "." and ".." */
+        /* skip ".", ".." and hidden entries like the trash */
+        if (dent->d_name[0] == '.')
+            continue;
 
         char *full_name = concat_path_file(path, dent->d_name);
 
@@ -496,6 +642,8 @@ int main(int argc, char** argv)
     guint channel_id_signal_event = 0;
     bool pidfile_created = false;
     struct abrt_inotify_watch *aiw = NULL;
+    guint reaper_timeout_id = 0;
+    guint tiering_timeout_id = 0;
     int ret = 1;
 
     /* Initialization */
@@ -564,6 +712,12 @@ int main(int argc, char** argv)
 
     guint name_id = 0;
 
+    /* Delete the problem directories trashed while we were not running and
+     * periodically those trashed by other processes. */
+    start_reaper();
+    reaper_timeout_id = g_timeout_add_seconds(REAPER_PERIOD_SEC, reaper_timeout_cb, NULL);
+    tiering_timeout_id = g_timeout_add_seconds(TIERING_PERIOD_SEC, tiering_timeout_cb, NULL);
+
     /* Mark the territory */
     log_notice("Creating pid file");
     if (create_pidfile() != 0)
@@ -617,6 +771,11 @@ int main(int argc, char** argv)
     if (name_id > 0)
         g_bus_unown_name (name_id);
 
+    if (reaper_timeout_id > 0)
+        g_source_remove(reaper_timeout_id);
+    if (tiering_timeout_id > 0)
+        g_source_remove(tiering_timeout_id);
+
     /* Error or INT/TERM. Clean up, in reverse order.
      * Take care to not undo things we did not do.
      */
@@ -275,6 +275,10 @@ static struct dump_dir *open_dump_directory(GDBusMethodInvocation *invocation,
         }
     }
 
+    /* Lock-free readers, see dd_snapshot_begin() */
+    if (dd_flags & DD_OPEN_FD_ONLY)
+        return dd;
+
     dd = dd_fdopendir(dd, dd_flags);
     if (dd == NULL)
     {
@@ -287,6 +291,53 @@ static struct dump_dir *open_dump_directory(GDBusMethodInvocation *invocation,
     return dd;
 }
 
+/*
+ * Turns a dump directory opened with DD_OPEN_FD_ONLY for lock-free reading
+ * to a regular locked one. Returns NULL and replies with D-Bus error on
+ * failure.
+ */
+static struct dump_dir *reopen_dump_directory_locked(GDBusMethodInvocation *invocation,
+    struct dump_dir *dd, int dd_flags)
+{
+    char *problem_dir = xstrdup(dd->dd_dirname);
+    dd = dd_fdopendir(dd, dd_flags);
+    if (dd == NULL)
+    {
+        log_notice("Can't open the problem '%s' with flags %x0", problem_dir, dd_flags);
+        g_dbus_method_invocation_return_dbus_error(invocation,
+                            "org.freedesktop.problems.Failure",
+                            _("Can't open the problem"));
+    }
+
+    free(problem_dir);
+    return dd;
+}
+
+/* GetInfo helper, returns NULL if none of the elements exists */
+static GVariantBuilder *load_elements(struct dump_dir *dd, GList *elements)
+{
+    GVariantBuilder *builder = NULL;
+    for (GList *l = elements; l; l = l->next)
+    {
+        const char *element_name = (const char*)l->data;
+        char *value = dd_load_text_decompress(dd, element_name, 0
+                                            | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE
+                                            | DD_FAIL_QUIETLY_ENOENT
+                                            | DD_FAIL_QUIETLY_EACCES);
+        log_notice("element '%s' %s", element_name, value ? "fetched" : "not found");
+        if (value)
+        {
+            if (!builder)
+                builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+
+            /* g_variant_builder_add makes a copy. No need to xstrdup here */
+            g_variant_builder_add(builder, "{ss}", element_name, value);
+            free(value);
+        }
+    }
+    return builder;
+}
+
 /*
  * Checks element's rights and does not open directory if element is protected.
  * Checks problem's rights and does not open directory if user hasn't got
@@ -306,6 +357,7 @@ static struct dump_dir *open_directory_for_modification_of_element(
     static const char *const protected_elements[] = {
         FILENAME_TIME,
         FILENAME_UID,
+        FILENAME_COLD_STORAGE,
         NULL,
     };
 
@@ -344,13 +396,13 @@ static int add_dirname_to_GList_if_matches(struct dump_dir *dd, void *arg)
 {
     struct field_and_time_range *me = arg;
 
-    char *field_data = dd_load_text(dd, me->element);
+    char *field_data = dd_snapshot_load_text(dd, me->element, 0);
     int brk = (strcmp(field_data, me->value) != 0);
     free(field_data);
     if (brk)
         return 0;
 
-    field_data = dd_load_text(dd, FILENAME_LAST_OCCURRENCE);
+    field_data = dd_snapshot_load_text(dd, FILENAME_LAST_OCCURRENCE, 0);
     long val = atol(field_data);
     free(field_data);
     if (val < me->timestamp_from || val > me->timestamp_to)
@@ -377,7 +429,7 @@ static GList *get_problem_dirs_for_element_in_time(uid_t uid,
         .timestamp_to = timestamp_to,
     };
 
-    for_each_problem_in_dir(g_settings_dump_location, uid, add_dirname_to_GList_if_matches, &me);
+    for_each_problem_snapshot_in_dir(g_settings_dump_location, uid, add_dirname_to_GList_if_matches, &me);
 
     return g_list_reverse(me.list);
 }
@@ -551,7 +603,7 @@ static void handle_method_call(GDBusConnection *connection,
         log_notice("problem_dir:'%s'", problem_dir);
 
         struct dump_dir *dd = open_dump_directory(invocation, caller, caller_uid,
-                problem_dir, DD_OPEN_READONLY | DD_FAIL_QUIETLY_EACCES , OPEN_AUTH_ASK);
+                problem_dir, DD_OPEN_FD_ONLY, OPEN_AUTH_ASK);
         if (!dd)
             return;
 
@@ -560,26 +612,28 @@ static void handle_method_call(GDBusConnection *connection,
         GList *elements = string_list_from_variant(array);
         g_variant_unref(array);
 
+        struct dd_snapshot snapshot;
+        bool lock_free = dd_snapshot_begin(dd, &snapshot) == 0;
+        if (!lock_free)
+            dd = reopen_dump_directory_locked(invocation, dd, DD_OPEN_READONLY | DD_FAIL_QUIETLY_EACCES);
+
         GVariantBuilder *builder = NULL;
-        for (GList *l = elements; l; l = l->next)
+        while (dd)
         {
-            const char *element_name = (const char*)l->data;
-            char *value = dd_load_text_ext(dd, element_name, 0
-                                                | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE
-                                                | DD_FAIL_QUIETLY_ENOENT
-                                                | DD_FAIL_QUIETLY_EACCES);
-            log_notice("element '%s' %s", element_name, value ? "fetched" : "not found");
-            if (value)
-            {
-                if (!builder)
-                    builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
-
-                /* g_variant_builder_add makes a copy. No need to xstrdup here */
-                g_variant_builder_add(builder, "{ss}", element_name, value);
-                free(value);
-            }
+            builder = load_elements(dd, elements);
+            if (!lock_free || dd_snapshot_validate(dd, &snapshot) == 0)
+                break;
+
+            /* A writer came in while we were reading */
+            if (builder)
+                g_variant_builder_unref(builder);
+            builder = NULL;
+            lock_free = false;
+            dd = reopen_dump_directory_locked(invocation, dd, DD_OPEN_READONLY | DD_FAIL_QUIETLY_EACCES);
         }
         list_free_with_free(elements);
+        if (!dd)
+            return;
         dd_close(dd);
         /* It is OK to call g_variant_new("(a{ss})", NULL) because */
         /* G_VARIANT_TYPE_TUPLE allows NULL value */
@@ -601,11 +655,31 @@ static void handle_method_call(GDBusConnection *connection,
         g_variant_get(parameters, "(&s)", &problem_id);
 
         struct dump_dir *dd = open_dump_directory(invocation, caller, caller_uid,
-                    problem_id, DD_OPEN_READONLY, OPEN_AUTH_ASK);
+                    problem_id, DD_OPEN_FD_ONLY, OPEN_AUTH_ASK);
         if (!dd)
             return;
 
-        problem_data_t *pd = create_problem_data_from_dump_dir(dd);
+        struct dd_snapshot snapshot;
+        bool lock_free = dd_snapshot_begin(dd, &snapshot) == 0;
+        if (!lock_free)
+            dd = reopen_dump_directory_locked(invocation, dd, DD_OPEN_READONLY);
+
+        problem_data_t *pd = NULL;
+        while (dd)
+        {
+            pd = create_problem_data_from_dump_dir(dd);
+            problem_data_decompress_items(pd, dd);
+            if (!lock_free || dd_snapshot_validate(dd, &snapshot) == 0)
+                break;
+
+            /* A writer came in while we were reading */
+            problem_data_free(pd);
+            pd = NULL;
+            lock_free = false;
+            dd = reopen_dump_directory_locked(invocation, dd, DD_OPEN_READONLY);
+        }
+        if (!dd)
+            return;
         dd_close(dd);
 
         GVariantBuilder *response_builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
@@ -779,7 +853,7 @@ static void handle_method_call(GDBusConnection *connection,
 
             if (dd)
             {
-                if (dd_delete(dd) != 0)
+                if (dd_trash(dd) != 0)
                 {
                     error_msg("Failed to delete problem directory '%s'", dir_name);
                     dd_close(dd);
@@ -17,56 +17,27 @@
 */
 #include "libabrt.h"
 
-struct oops_text {
-    unsigned panic_no;
-    unsigned part_no;
-    const char *filename;
-    char *text;
+struct merge_opts {
+    bool print;
+    GList *records;
 };
 
 static
-struct oops_text *parse_file(const char *filename)
+int merge_part(const struct abrt_pstore_part *part, const char *text, size_t len, void *arg)
 {
-    FILE *fp = fopen(filename, "r");
-    if (!fp)
-        return NULL;
+    struct merge_opts *mo = arg;
 
-    char buffer[16 * 1024];
-
-    struct oops_text *ot = NULL;
-
-    if (!fgets(buffer, sizeof(buffer), fp))
-        goto ret;
-    unsigned n1, n2;
-    int n = sscanf(buffer, "Panic#%u Part%u\n", &n1, &n2);
-    if (n != 2)
-        goto ret;
-
-    ot = xzalloc(sizeof(*ot));
-    ot->filename = filename;
-    ot->panic_no = n1;
-    ot->part_no = n2;
-
-    size_t sz = fread(buffer, 1, sizeof(buffer), fp);
-    ot->text = strndup(buffer, sz);
+    if (mo->print && fwrite(text, 1, len, stdout) != len)
+    {
+        perror_msg("Can't write merged oops");
+        return 1;
+    }
 
- ret:
-    fclose(fp);
-    return ot;
-}
+    /* Parts can be passed in several chunks */
+    if (!mo->records || mo->records->data != part->filename)
+        mo->records = g_list_prepend(mo->records, (gpointer)part->filename);
 
-static
-int compare_oops_texts(const void *a, const void *b)
-{
-    struct oops_text *aa = *(struct oops_text **)a;
-    struct oops_text *bb = *(struct oops_text **)b;
-    if (aa->panic_no < bb->panic_no)
-        return -1;
-    if (aa->panic_no > bb->panic_no)
-        return 1;
-    if (aa->part_no > bb->part_no)
-        return -1;
-    return (aa->part_no < bb->part_no);
+    return 0;
 }
 
 int main(int argc, char **argv)
@@ -102,47 +73,30 @@ int main(int argc, char **argv)
 
     export_abrt_envvars(0);
 
-    struct oops_text **v = xzalloc(sizeof(v[0]));
-    int i = 0;
-
-    while (*argv)
-    {
-        v[i] = parse_file(*argv);
-        if (v[i])
-        {
-            v = xrealloc(v, (++i + 1) * sizeof(v[0]));
-            v[i] = NULL;
-        }
-        argv++;
-    }
+    struct merge_opts mo = {
+        .print = (opts & OPT_o),
+        .records = NULL,
+    };
 
-    if (i == 0) /* nothing was found */
+    const unsigned count = argc - optind;
+    const int found = pstore_merge_files((const char *const *)argv + optind, count, merge_part, &mo);
+    if (found == 0) /* nothing was found */
         return 0;
 
-    qsort(v, i, sizeof(v[0]), compare_oops_texts);
-
-    if (opts & OPT_o)
-    {
-        struct oops_text **vv = v;
-        while (*vv)
-        {
-            struct oops_text *cur_oops = *vv;
-            fputs(cur_oops->text, stdout);
-            vv++;
-        }
-    }
+    if (mo.print && fflush(stdout) != 0)
+        perror_msg_and_die("Can't write merged oops");
 
     if (opts & OPT_d)
     {
-        struct oops_text **vv = v;
-        while (*vv)
+        for (GList *iter = mo.records; iter; iter = g_list_next(iter))
         {
-            struct oops_text *cur_oops = *vv;
-            if (unlink(cur_oops->filename) != 0)
-                perror_msg("Can't unlink '%s'", cur_oops->filename);
-            vv++;
+            const char *filename = iter->data;
+            if (unlink(filename) != 0)
+                perror_msg("Can't unlink '%s'", filename);
         }
     }
 
+    g_list_free(mo.records);
+
     return 0;
 }
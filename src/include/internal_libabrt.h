@@ -48,3 +48,49 @@ void libabrt_init(void);
     } \
     while (0)
 
+
+/* A cache of the problems in a dump location kept in a file, shared by the
+ * oops index and the upload catalog, see problem_cache.c */
+struct abrt_problem_cache;
+
+struct abrt_problem_cache_ops
+{
+    /* Names the cache in messages, e.g. "oops index" */
+    const char *what;
+    /* for_each_problem_snapshot_in_dir() callback adding a problem to the
+     * cache passed as arg while the cache is being rebuilt */
+    int (*add_problem)(struct dump_dir *dd, void *arg);
+    /* Adds an entry read from the file unless its problem directory is gone,
+     * see problem_cache_has_dir(). Returns -1 if the line is malformed. */
+    int (*read_entry)(struct abrt_problem_cache *cache, char *line, int dump_fd);
+    /* Writes an entry as a line of the file or nothing to leave it out */
+    void (*write_entry)(FILE *fp, const char *key, const void *entry);
+    GDestroyNotify free_entry;
+};
+
+struct abrt_problem_cache
+{
+    const struct abrt_problem_cache_ops *ops;
+    char *file;
+    char *dump_location;
+    /* key -> entry */
+    GHashTable *problems;
+    bool modified;
+};
+
+/* Loads the cache from the file or rebuilds it from the dump location */
+#define problem_cache_init abrt_problem_cache_init
+void problem_cache_init(struct abrt_problem_cache *cache,
+                const struct abrt_problem_cache_ops *ops,
+                const char *file,
+                const char *dump_location);
+#define problem_cache_destroy abrt_problem_cache_destroy
+void problem_cache_destroy(struct abrt_problem_cache *cache);
+
+/* Whether name is a problem directory in the dump location */
+#define problem_cache_has_dir abrt_problem_cache_has_dir
+bool problem_cache_has_dir(int dump_fd, const char *name);
+
+/* Atomically replaces the file, if the cache has been modified */
+#define problem_cache_save abrt_problem_cache_save
+int problem_cache_save(struct abrt_problem_cache *cache);
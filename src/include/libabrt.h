@@ -42,6 +42,12 @@ int low_free_space(unsigned setting_MaxCrashReportsSize, const char *dump_locati
 
 #define trim_problem_dirs abrt_trim_problem_dirs
 void trim_problem_dirs(const char *dirname, double cap_size, const char *exclude_path);
+/**
+ * Returns the length of dirname without trailing '/'s, but doesn't trim
+ * name "/" to ""
+ */
+#define trimmed_dir_name_len abrt_trimmed_dir_name_len
+unsigned trimmed_dir_name_len(const char *dirname);
 #define ensure_writable_dir_id abrt_ensure_writable_dir_uid_git
 void ensure_writable_dir_uid_gid(const char *dir, mode_t mode, uid_t uid, gid_t gid);
 #define ensure_writable_dir abrt_ensure_writable_dir
@@ -83,6 +89,24 @@ extern bool          g_settings_shortenedreporting;
 extern bool          g_settings_explorechroots;
 #define g_settings_debug_level abrt_g_settings_debug_level
 extern unsigned int  g_settings_debug_level;
+#define g_settings_nItemCompressionThreshold abrt_g_settings_nItemCompressionThreshold
+extern unsigned int  g_settings_nItemCompressionThreshold;
+#define g_settings_nItemDeduplicationThreshold abrt_g_settings_nItemDeduplicationThreshold
+extern unsigned int  g_settings_nItemDeduplicationThreshold;
+#define g_settings_cold_storage_location abrt_g_settings_cold_storage_location
+extern char *        g_settings_cold_storage_location;
+#define g_settings_nColdStorageAge abrt_g_settings_nColdStorageAge
+extern unsigned int  g_settings_nColdStorageAge;
+#define g_settings_cold_storage_reported abrt_g_settings_cold_storage_reported
+extern bool          g_settings_cold_storage_reported;
+#define g_settings_nMaxColdStorageSize abrt_g_settings_nMaxColdStorageSize
+extern unsigned int  g_settings_nMaxColdStorageSize;
+#define g_settings_replication_collector abrt_g_settings_replication_collector
+extern char *        g_settings_replication_collector;
+#define g_settings_nReplicationBandwidthLimit abrt_g_settings_nReplicationBandwidthLimit
+extern unsigned int  g_settings_nReplicationBandwidthLimit;
+#define g_settings_replication_allowed_peers abrt_g_settings_replication_allowed_peers
+extern GList *       g_settings_replication_allowed_peers;
 
 
 #define load_abrt_conf abrt_load_abrt_conf
@@ -119,6 +143,327 @@ int daemon_is_ok(void);
 #define notify_new_path abrt_notify_new_path
 void notify_new_path(const char *path);
 
+/* Compressed copies of problem items are stored next to the other items or
+ * in the cold storage under the original name with this suffix appended.
+ */
+#define ABRT_COMPRESSED_ITEM_SUFFIX ".zst"
+
+/**
+  @brief Compresses a memory buffer
+
+  @param out_size Size of the returned compressed data
+  @return Malloced compressed data or NULL on error
+*/
+char *abrt_compress_buffer(const char *data, size_t size, size_t *out_size);
+
+/**
+  @brief Decompresses a buffer created by abrt_compress_buffer()
+
+  The returned data are always terminated by '\0'.
+
+  @param out_size Size of the returned data without the terminator, can be NULL
+  @return Malloced decompressed data or NULL on error
+*/
+char *abrt_decompress_buffer(const char *data, size_t size, size_t *out_size);
+
+/**
+  @brief Compresses everything read from src_fd to dst_fd
+
+  Unlike abrt_compress_buffer(), the data are processed in small chunks.
+
+  @return 0 on success; otherwise non-0 value.
+*/
+int abrt_compress_fd(int src_fd, int dst_fd);
+
+/**
+  @brief Decompresses data created by abrt_compress_fd()
+
+  Blocks of zeros are not written, so dst_fd should be a regular file.
+
+  @return 0 on success; otherwise non-0 value.
+*/
+int abrt_decompress_fd(int src_fd, int dst_fd);
+
+/**
+  @brief Sets the dictionary used to compress problem items
+
+  The installed dictionary is used by default.
+
+  @param path The dictionary trained by 'zstd --train', NULL for the default,
+  an empty string for none
+*/
+#define set_item_compression_dictionary abrt_set_item_compression_dictionary
+void set_item_compression_dictionary(const char *path);
+
+/**
+  @brief Replaces large compressible text items by their compressed version
+
+  Only items which are not read by events after post-create are compressed,
+  the readers must use dd_load_text_decompress() or
+  problem_data_decompress_items().
+
+  @param dd A dump directory opened for writing
+  @param threshold Items smaller than this size in Bytes are left intact
+  @return Number of compressed items
+*/
+#define dd_compress_items abrt_dd_compress_items
+int dd_compress_items(struct dump_dir *dd, unsigned long threshold);
+
+/**
+  @brief The same as dd_load_text_ext() but falls back to the compressed
+  version of the item
+*/
+#define dd_load_text_decompress abrt_dd_load_text_decompress
+char *dd_load_text_decompress(struct dump_dir *dd, const char *name, unsigned flags);
+
+/**
+  @brief Replaces the compressed items of the problem data loaded from dd by
+  their text loaded by dd_load_text_decompress()
+*/
+#define problem_data_decompress_items abrt_problem_data_decompress_items
+void problem_data_decompress_items(problem_data_t *pd, struct dump_dir *dd);
+
+/**
+  @brief Returns the path of the blob store which belongs to the dump location
+
+  The store is a sibling of the dump location so that it is on the same file
+  system but is not mistaken for a problem directory.
+
+  @return Malloced string
+*/
+#define blob_store_location abrt_blob_store_location
+char *blob_store_location(const char *dump_location);
+
+/**
+  @brief Replaces items often shared among problems by reflinks of blobs
+
+  Blobs are keyed by the SHA-1 of their content. The items keep their own
+  owner and mode, only the data is shared. Nothing is changed on file systems
+  without reflinks.
+
+  @param dd A dump directory with sanitized mode and owner
+  @param blob_dir The blob store, created if it doesn't exist
+  @param threshold Items smaller than this size in Bytes are left intact
+  @return Number of items cloned from an already existing blob
+*/
+#define dd_deduplicate_items abrt_dd_deduplicate_items
+int dd_deduplicate_items(struct dump_dir *dd, const char *blob_dir, unsigned long threshold);
+
+/**
+  @brief Removes blobs which are no longer referenced by any problem
+
+  A blob is referenced while the file system reports its extents as shared.
+
+  @return Number of removed blobs
+*/
+#define blob_store_collect_garbage abrt_blob_store_collect_garbage
+int blob_store_collect_garbage(const char *blob_dir);
+
+/* Problem directories are moved to this sub-directory of their dump location
+ * and are deleted in background by abrtd.
+ */
+#define ABRT_TRASH_DIR_NAME ".trash"
+
+/**
+  @brief Returns the path of the trash of the dump location
+
+  @return Malloced string
+*/
+#define trash_location abrt_trash_location
+char *trash_location(const char *dump_location);
+
+/**
+  @brief Moves a locked dump directory to the trash
+
+  Falls back to dd_delete() if the directory can't be moved or is not in
+  g_settings_dump_location, nobody would empty any other trash. Like
+  dd_delete(), the dump directory is freed on success only.
+
+  @return 0 on success; otherwise non-0 value.
+*/
+#define dd_trash abrt_dd_trash
+int dd_trash(struct dump_dir *dd);
+
+/**
+  @brief The same as delete_dump_dir() but moves the directory to the trash
+*/
+#define trash_dump_dir abrt_trash_dump_dir
+int trash_dump_dir(const char *dirname);
+
+/**
+  @brief Deletes everything in the trash
+
+  Big files are truncated gradually to not stall the file system.
+
+  @param bytes_per_sec Upper limit of freed bytes per second, 0 means no limit
+  @return Number of deleted entries
+*/
+#define empty_trash abrt_empty_trash
+int empty_trash(const char *trash_dir, unsigned long bytes_per_sec);
+
+/* Path of the cold storage directory holding the heavy items of a problem */
+#define FILENAME_COLD_STORAGE "cold_storage"
+
+/**
+  @brief Moves heavy items (coredump, binary, vmcore) to the cold storage
+
+  The items are compressed to a sub-directory of cold_location named after
+  the problem directory.
+
+  @param dd A locked dump directory
+  @return Number of moved items or -1 on error
+*/
+#define dd_move_to_cold_storage abrt_dd_move_to_cold_storage
+int dd_move_to_cold_storage(struct dump_dir *dd, const char *cold_location);
+
+/**
+  @brief Restores the items moved by dd_move_to_cold_storage() and unpacks
+  the coredump kept compressed, see dd_unpack_coredump()
+
+  The items are restored only from the sub-directory of cold_location named
+  after the problem directory, FILENAME_COLD_STORAGE must refer to it.
+
+  @param dd A locked dump directory
+  @param cold_location ColdStorageLocation, NULL if not configured
+  @return Number of restored items or -1 on error
+*/
+#define dd_rehydrate_items abrt_dd_rehydrate_items
+int dd_rehydrate_items(struct dump_dir *dd, const char *cold_location);
+
+/**
+  @brief Returns the suffix of a coredump file compressed by systemd-coredump
+
+  Dumpers can keep such a coredump compressed in the problem directory as
+  FILENAME_COREDUMP with the suffix appended ("coredump.xz", "coredump.lz4"
+  or "coredump.zst"), dd_unpack_coredump() unpacks it.
+
+  @return The suffix or NULL if the format is not supported
+*/
+#define packed_coredump_suffix abrt_packed_coredump_suffix
+const char *packed_coredump_suffix(const char *path);
+
+/**
+  @brief Replaces a coredump kept compressed by its unpacked version
+
+  @param dd A locked dump directory
+  @return 1 if the coredump has been unpacked, 0 if there is nothing to unpack
+  or -1 on error
+*/
+#define dd_unpack_coredump abrt_dd_unpack_coredump
+int dd_unpack_coredump(struct dump_dir *dd);
+
+/**
+  @brief Unpacks a coredump kept compressed to a file outside the problem
+  directory, the problem directory is left intact
+
+  @param dd A dump directory
+  @param dst_path The unpacked coredump
+  @return 1 if the coredump has been unpacked, 0 if there is nothing to unpack
+  or -1 on error
+*/
+#define dd_unpack_coredump_to abrt_dd_unpack_coredump_to
+int dd_unpack_coredump_to(struct dump_dir *dd, const char *dst_path);
+
+/**
+  @brief Moves heavy items of old or reported problems to the cold storage
+
+  Problems which are locked or not completely processed are skipped.
+
+  @param age_sec Minimal time since the last occurrence, 0 means no limit
+  @param reported Move items of reported problems regardless of their age
+  @return Number of problems moved to the cold storage
+*/
+#define move_cold_problems abrt_move_cold_problems
+int move_cold_problems(const char *dump_location, const char *cold_location,
+        unsigned long age_sec, bool reported);
+
+/**
+  @brief Removes orphaned cold directories and trims the cold storage
+
+  @param cap_size Maximal size of the cold storage in Bytes, 0 means no limit
+*/
+#define trim_cold_storage abrt_trim_cold_storage
+void trim_cold_storage(const char *cold_location, const char *dump_location, double cap_size);
+
+/* Write a sequence of zstd frames readable by abrt_decompress_fd() */
+#define COPY_FILE_COMPRESS (1 << 0)
+
+/**
+  @brief Copies a huge file, continues an interrupted copy if possible
+
+  The file is cloned if the file system supports it, otherwise only the
+  data regions are copied and the copy is sparse. The progress is saved
+  next to dst_path, so a copy interrupted by a crash or a reboot continues
+  from the last checkpoint when the function is called again.
+
+  @param mode Mode of the created file
+  @param flags COPY_FILE_COMPRESS or 0
+  @return 0 on success; otherwise non-0 value.
+*/
+#define copy_file_resumable abrt_copy_file_resumable
+int copy_file_resumable(const char *src_path, const char *dst_path, mode_t mode, unsigned flags);
+
+/**
+  @brief Removes leftovers of an interrupted copy_file_resumable()
+*/
+#define copy_file_resumable_abort abrt_copy_file_resumable_abort
+void copy_file_resumable_abort(const char *dst_path);
+
+/* Lock-free reading of problem directories */
+struct dd_snapshot
+{
+    time_t since;
+};
+
+/**
+  @brief Checks whether a not locked dump directory can be read lock-free
+
+  @param dd A dump directory opened with DD_OPEN_FD_ONLY
+  @return false if the directory is locked or is not a problem directory
+*/
+#define dd_snapshot_is_valid_dir abrt_dd_snapshot_is_valid_dir
+bool dd_snapshot_is_valid_dir(struct dump_dir *dd);
+
+/**
+  @brief Starts reading of a dump directory without taking its lock
+
+  Succeeds only if the directory is not locked and nothing in it has been
+  modified for a few seconds. Items loaded after a successful call can be
+  trusted only if dd_snapshot_validate() succeeds too.
+
+  @param dd A dump directory opened with DD_OPEN_FD_ONLY
+  @return 0 on success, -1 if the directory must be locked for reading
+*/
+#define dd_snapshot_begin abrt_dd_snapshot_begin
+int dd_snapshot_begin(struct dump_dir *dd, struct dd_snapshot *snapshot);
+
+/**
+  @brief Checks that the directory has not been modified since dd_snapshot_begin()
+
+  @return 0 on success, -1 if the loaded items must be read again with lock
+*/
+#define dd_snapshot_validate abrt_dd_snapshot_validate
+int dd_snapshot_validate(struct dump_dir *dd, const struct dd_snapshot *snapshot);
+
+/**
+  @brief Loads a single item without taking the lock
+
+  Falls back to a locked read if the item is being modified. Accepts locked
+  dump directories too.
+
+  @param flags The same as for dd_load_text_ext()
+*/
+#define dd_snapshot_load_text abrt_dd_snapshot_load_text
+char *dd_snapshot_load_text(struct dump_dir *dd, const char *name, unsigned flags);
+
+/**
+  @brief Replaces the clock the quiescent period is measured by
+
+  Unit tests use it to avoid waiting. NULL restores time().
+*/
+#define dd_snapshot_set_clock abrt_dd_snapshot_set_clock
+void dd_snapshot_set_clock(time_t (*clock)(time_t *));
+
 /* Note: should be public since unit tests need to call it */
 #define koops_extract_version abrt_koops_extract_version
 char *koops_extract_version(const char *line);
@@ -130,6 +475,14 @@ char *kernel_tainted_long(const char *tainted_short);
 int koops_hash_str_ext(char hash_str[SHA1_RESULT_LEN*2 + 1], const char *oops_buf, int frame_count, int duphas_flags);
 #define koops_hash_str abrt_koops_hash_str
 int koops_hash_str(char hash_str[SHA1_RESULT_LEN*2 + 1], const char *oops_buf);
+/**
+ * Computes a cheap signature of an oops from its type and the first frames
+ * of the call trace. Repeats of an oops have the same signature.
+ *
+ * @return The number of frames used, 0 if the whole oops was hashed
+ */
+#define koops_signature_str abrt_koops_signature_str
+int koops_signature_str(char hash_str[SHA1_RESULT_LEN*2 + 1], const char *oops_buf);
 
 
 #define koops_line_skip_level abrt_koops_line_skip_level
@@ -145,10 +498,67 @@ struct abrt_koops_line_info {
     int level;
 };
 
+/*
+ * Incremental oops extractor
+ *
+ * Input can be fed in chunks of any size, state is carried over between
+ * the calls. Completed oopses are appended to oops_list as soon as their
+ * end is seen. The extractor keeps only the lines which can still be
+ * a part of an oops.
+ */
+struct abrt_koops_extractor;
+
+#define koops_extractor_new abrt_koops_extractor_new
+struct abrt_koops_extractor *koops_extractor_new(void);
+#define koops_extractor_free abrt_koops_extractor_free
+void koops_extractor_free(struct abrt_koops_extractor *ex);
+/* Feeds dmesg or syslog text, lines can be split between calls */
+#define koops_extractor_feed abrt_koops_extractor_feed
+void koops_extractor_feed(struct abrt_koops_extractor *ex, const char *buffer, size_t buflen, GList **oops_list);
+/* Feeds a single line stripped of the log level and jiffies */
+#define koops_extractor_feed_line abrt_koops_extractor_feed_line
+void koops_extractor_feed_line(struct abrt_koops_extractor *ex, const char *line, int level, GList **oops_list);
+/* Feeds a single not NUL terminated kernel message with the log level
+ * and jiffies, e.g. the MESSAGE field of a journal entry; the message
+ * is not modified and doesn't need to outlive the call */
+#define koops_extractor_feed_message abrt_koops_extractor_feed_message
+void koops_extractor_feed_message(struct abrt_koops_extractor *ex, const char *message, size_t len, GList **oops_list);
+/* Treats the input seen so far as complete, the extractor can be reused */
+#define koops_extractor_flush abrt_koops_extractor_flush
+void koops_extractor_flush(struct abrt_koops_extractor *ex, GList **oops_list);
+/* Is there an oops in progress or a line waiting for more input? Only then
+ * flushing can produce an oops */
+#define koops_extractor_has_pending abrt_koops_extractor_has_pending
+bool koops_extractor_has_pending(const struct abrt_koops_extractor *ex);
+
 #define koops_extract_oopses_from_lines abrt_koops_extract_oopses_from_lines
 void koops_extract_oopses_from_lines(GList **oops_list, const struct abrt_koops_line_info *lines_info, int lines_info_size);
 #define koops_extract_oopses abrt_koops_extract_oopses
 void koops_extract_oopses(GList **oops_list, char *buffer, size_t buflen);
+
+/* A record of a kernel log dump saved in pstore */
+struct abrt_pstore_part {
+    unsigned panic_no;
+    unsigned part_no;
+    const char *filename;
+};
+
+/* Text of a part without the header, a part can be passed in several
+ * chunks or as a single empty chunk; returning non-0 stops merging */
+typedef int (*pstore_part_callback)(const struct abrt_pstore_part *part, const char *text, size_t len, void *arg);
+
+/**
+ * Passes text of all pstore records found among the files to the callback,
+ * in the order of the kernel log. Records of any size are supported,
+ * compressed records (*.enc.z) are decompressed on the fly.
+ *
+ * @return The number of the files which are pstore records
+ */
+#define pstore_merge_files abrt_pstore_merge_files
+int pstore_merge_files(const char *const *filenames, unsigned count, pstore_part_callback callback, void *arg);
+/* Merges pstore records and extracts oopses from them */
+#define koops_extract_pstore_oopses abrt_koops_extract_pstore_oopses
+int koops_extract_pstore_oopses(GList **oops_list, const char *const *filenames, unsigned count);
 #define koops_suspicious_strings_list abrt_koops_suspicious_strings_list
 GList *koops_suspicious_strings_list(void);
 #define koops_print_suspicious_strings abrt_koops_print_suspicious_strings
@@ -162,6 +572,356 @@ void koops_print_suspicious_strings(void);
 #define koops_print_suspicious_strings_filtered abrt_koops_print_suspicious_strings_filtered
 void koops_print_suspicious_strings_filtered(const regex_t **filterout);
 
+/* Classes of kernel log lines, a line can belong to several classes */
+enum {
+    KOOPS_LINE_NONE             = 0,
+    /* Contains one of the suspicious strings */
+    KOOPS_LINE_START            = 1 << 0,
+    /* "Call Trace:" or the first frame of a call trace */
+    KOOPS_LINE_TRACE_START      = 1 << 1,
+    /* Does not end a call trace */
+    KOOPS_LINE_CONTINUATION     = 1 << 2,
+    /* "---[ end trace" */
+    KOOPS_LINE_END_TRACE        = 1 << 3,
+    /* The last line of an oops */
+    KOOPS_LINE_INSTRUCTION_DUMP = 1 << 4,
+};
+
+/**
+ * Classifies a kernel log line stripped of the log level and jiffies.
+ *
+ * All patterns are searched for in a single pass over the line.
+ *
+ * @return Bitwise OR of KOOPS_LINE_* values
+ */
+#define koops_classify_line abrt_koops_classify_line
+unsigned koops_classify_line(const char *line);
+
+/* Multi-pattern string matcher (Aho-Corasick automaton) */
+struct abrt_string_matcher;
+
+enum {
+    STRING_MATCHER_IGNORE_CASE = 1 << 0, /* ASCII letters only */
+};
+
+#define string_matcher_new abrt_string_matcher_new
+struct abrt_string_matcher *string_matcher_new(void);
+#define string_matcher_free abrt_string_matcher_free
+void string_matcher_free(struct abrt_string_matcher *m);
+
+/**
+ * Adds a pattern to a matcher which has not been compiled yet.
+ *
+ * @param value A non-zero value reported when the pattern is found, values
+ * of several patterns can be bit flags
+ */
+#define string_matcher_add abrt_string_matcher_add
+void string_matcher_add(struct abrt_string_matcher *m, const char *pattern, unsigned flags, unsigned value);
+
+/**
+ * Builds the automaton, must be called before scanning.
+ */
+#define string_matcher_compile abrt_string_matcher_compile
+void string_matcher_compile(struct abrt_string_matcher *m);
+
+/**
+ * @return Bitwise OR of the values of all patterns found in buf
+ */
+#define string_matcher_scan abrt_string_matcher_scan
+unsigned string_matcher_scan(const struct abrt_string_matcher *m, const char *buf, size_t len);
+
+/**
+ * Stops at the first found pattern.
+ */
+#define string_matcher_contains abrt_string_matcher_contains
+bool string_matcher_contains(const struct abrt_string_matcher *m, const char *buf, size_t len);
+
+/* Index of Kerneloops problems by duplicate hash, persisted in a file */
+struct abrt_koops_index;
+
+/**
+ * Loads the index of the dump location from the index file. If the file
+ * doesn't exist or belongs to another dump location, the index is built
+ * from the problems in the dump location.
+ */
+#define koops_index_load abrt_koops_index_load
+struct abrt_koops_index *koops_index_load(const char *index_file, const char *dump_location);
+#define koops_index_free abrt_koops_index_free
+void koops_index_free(struct abrt_koops_index *index);
+
+/**
+ * Adds a new problem directory of an oops with the hash.
+ */
+#define koops_index_add abrt_koops_index_add
+void koops_index_add(struct abrt_koops_index *index, const char *hash, const char *dirname);
+
+/**
+ * Adds occurrences to the count and updates the last occurrence of the
+ * problem with the hash.
+ *
+ * @return 0 if the problem has been updated, -1 if there is no such problem
+ */
+#define koops_index_record_occurrence abrt_koops_index_record_occurrence
+int koops_index_record_occurrence(struct abrt_koops_index *index, const char *hash, time_t t, unsigned long occurrences);
+
+/**
+ * Atomically replaces the index file, if the index has been modified.
+ *
+ * @return 0 on success, -1 on error
+ */
+#define koops_index_save abrt_koops_index_save
+int koops_index_save(struct abrt_koops_index *index);
+
+/* Kerneloops parsed when the problem is created, see koops_info.c */
+#define FILENAME_KOOPS_INFO "koops_info"
+
+struct abrt_koops_frame
+{
+    bool reliable;
+    char *function;
+    /* NULL for built-in functions */
+    char *module;
+};
+
+struct abrt_koops_info
+{
+    /* Kernel version, NULL if unknown */
+    char *kernel;
+    /* Short taint flags, NULL if not tainted */
+    char *tainted;
+    /* NULL if the oops can't be parsed */
+    char *reason;
+    /* Duplicate hashes of the first frames and of all frames, empty
+     * if the frames are not meaningful for hashing */
+    char hash[SHA1_RESULT_LEN*2 + 1];
+    char full_hash[SHA1_RESULT_LEN*2 + 1];
+    /* Names of the loaded modules */
+    GList *modules;
+    /* struct abrt_koops_frame of the call trace */
+    GList *frames;
+};
+
+/**
+ * Parses an oops as extracted from a kernel log, i.e. the kernel version
+ * on the first line followed by the backtrace.
+ */
+#define koops_info_parse abrt_koops_info_parse
+struct abrt_koops_info *koops_info_parse(const char *oops);
+#define koops_info_free abrt_koops_info_free
+void koops_info_free(struct abrt_koops_info *info);
+
+/**
+ * The hash abrt-action-analyze-oops saves as UUID of an oops.
+ *
+ * @return NULL if the oops has no usable duplicate hash
+ */
+#define koops_info_index_hash abrt_koops_info_index_hash
+const char *koops_info_index_hash(const struct abrt_koops_info *info);
+
+#define koops_info_to_str abrt_koops_info_to_str
+char *koops_info_to_str(const struct abrt_koops_info *info);
+/**
+ * @return NULL if the string is not in the known format
+ */
+#define koops_info_from_str abrt_koops_info_from_str
+struct abrt_koops_info *koops_info_from_str(const char *str);
+
+#define dd_save_koops_info abrt_dd_save_koops_info
+int dd_save_koops_info(struct dump_dir *dd, const struct abrt_koops_info *info);
+
+/**
+ * @return true if the problem has the parsed oops and the backtrace hasn't
+ * been changed since it was saved
+ */
+#define dd_koops_info_is_current abrt_dd_koops_info_is_current
+bool dd_koops_info_is_current(struct dump_dir *dd);
+
+/**
+ * Loads the parsed oops of the problem without taking the lock. Parses
+ * the backtrace of problems created by older versions and of problems whose
+ * backtrace has been changed, see dd_koops_info_is_current().
+ *
+ * @return NULL if the problem has no backtrace
+ */
+#define dd_load_koops_info abrt_dd_load_koops_info
+struct abrt_koops_info *dd_load_koops_info(struct dump_dir *dd);
+
+struct sr_stacktrace;
+/**
+ * Builds satyr stacktrace of the frames, e.g. for computing distances
+ * of backtraces, without parsing the backtrace.
+ *
+ * @return NULL if there are no frames
+ */
+#define koops_info_to_stacktrace abrt_koops_info_to_stacktrace
+struct sr_stacktrace *koops_info_to_stacktrace(const struct abrt_koops_info *info);
+
+/* Catalog of problems of an upload collector by fingerprint (type and UUID),
+ * see upload_catalog.c for the manifest protocol */
+#define UPLOAD_MANIFEST_SUFFIX ".manifest"
+#define UPLOAD_RESPONSE_SUFFIX ".response"
+#define UPLOAD_RESPONSE_PAYLOAD "payload"
+#define UPLOAD_RESPONSE_DUPLICATE "duplicate"
+
+enum {
+    UPLOAD_MANIFEST_ERROR = -1,
+    UPLOAD_MANIFEST_PAYLOAD,        ///< the node should upload the archive
+    UPLOAD_MANIFEST_DUPLICATE,      ///< the occurrences have been recorded
+};
+
+struct abrt_upload_catalog;
+
+/**
+ * Loads the catalog of the dump location from the catalog file. If the file
+ * doesn't exist or belongs to another dump location, the catalog is built
+ * from the problems in the dump location.
+ */
+#define upload_catalog_load abrt_upload_catalog_load
+struct abrt_upload_catalog *upload_catalog_load(const char *catalog_file, const char *dump_location);
+#define upload_catalog_free abrt_upload_catalog_free
+void upload_catalog_free(struct abrt_upload_catalog *catalog);
+
+/**
+ * Adds a problem directory, typically one unpacked from an uploaded archive.
+ *
+ * @return 0 on success, -1 if the problem has no fingerprint
+ */
+#define upload_catalog_add_problem abrt_upload_catalog_add_problem
+int upload_catalog_add_problem(struct abrt_upload_catalog *catalog, const char *dirname);
+
+/**
+ * Answers the manifest with a response file and removes the manifest.
+ * Occurrences of a known problem are recorded without the payload.
+ *
+ * @return UPLOAD_MANIFEST_PAYLOAD, UPLOAD_MANIFEST_DUPLICATE or
+ * UPLOAD_MANIFEST_ERROR if the manifest can't be answered
+ */
+#define upload_catalog_process_manifest abrt_upload_catalog_process_manifest
+int upload_catalog_process_manifest(struct abrt_upload_catalog *catalog, const char *manifest_path);
+
+/**
+ * Adds the recorded occurrences to the problems abrtd has processed since.
+ *
+ * @return The number of problems with occurrences still waiting
+ */
+#define upload_catalog_flush_occurrences abrt_upload_catalog_flush_occurrences
+unsigned upload_catalog_flush_occurrences(struct abrt_upload_catalog *catalog);
+
+/**
+ * Atomically replaces the catalog file, if the catalog has been modified.
+ *
+ * @return 0 on success, -1 on error
+ */
+#define upload_catalog_save abrt_upload_catalog_save
+int upload_catalog_save(struct abrt_upload_catalog *catalog);
+
+/**
+ * Atomically creates the manifest of the problem, the node side of the
+ * protocol.
+ *
+ * @param occurrences The number of occurrences the manifest stands for
+ * @return 0 on success, -1 on error
+ */
+#define upload_manifest_save abrt_upload_manifest_save
+int upload_manifest_save(struct dump_dir *dd, const char *manifest_path, unsigned long occurrences);
+
+/* Replication of problems from nodes to a collector over a stream socket,
+ * see replication.c for the protocol */
+#define REPLICATION_STAGING_DIR_NAME ".replica"
+/* Staged problems not completed by the node in time are removed (seconds) */
+#define REPLICATION_STAGING_TIMEOUT (24 * 60 * 60)
+/* Replicated problems are named <prefix><node>@<problem> on the collector */
+#define REPLICATION_PROBLEM_PREFIX "replica-"
+#define REPLICATION_NODE_NAME_MAX 64
+
+struct abrt_replication_sender;
+struct abrt_replication_receiver;
+
+/**
+ * Loads the state of replication of the dump location from the state file.
+ *
+ * @param node The name of the node on the collector
+ * @param bytes_per_sec The bandwidth cap, 0 for none
+ */
+#define replication_sender_new abrt_replication_sender_new
+struct abrt_replication_sender *replication_sender_new(const char *state_file, const char *dump_location,
+        const char *node, unsigned long bytes_per_sec);
+#define replication_sender_free abrt_replication_sender_free
+void replication_sender_free(struct abrt_replication_sender *sender);
+
+/**
+ * Finds new and changed problems in the dump location.
+ *
+ * @return The number of queued changes
+ */
+#define replication_sender_scan abrt_replication_sender_scan
+unsigned replication_sender_scan(struct abrt_replication_sender *sender);
+
+/**
+ * @return The number of changes not acknowledged by the collector
+ */
+#define replication_sender_pending abrt_replication_sender_pending
+unsigned replication_sender_pending(struct abrt_replication_sender *sender);
+
+/**
+ * Introduces the node to the collector on a new connection and learns
+ * where to continue.
+ *
+ * @return 0 on success, -1 if the connection is unusable
+ */
+#define replication_sender_resume abrt_replication_sender_resume
+int replication_sender_resume(struct abrt_replication_sender *sender, int fd);
+
+/**
+ * Sends the changes not acknowledged by the collector and waits for
+ * the acknowledgement.
+ *
+ * @return The number of sent changes, -1 if the connection is unusable
+ */
+#define replication_sender_send abrt_replication_sender_send
+int replication_sender_send(struct abrt_replication_sender *sender, int fd);
+
+/**
+ * Atomically replaces the state file, if the state has been modified.
+ *
+ * @return 0 on success, -1 on error
+ */
+#define replication_sender_save abrt_replication_sender_save
+int replication_sender_save(struct abrt_replication_sender *sender);
+
+/**
+ * @return true if the node name has only letters, digits, '.', '-' and '_'
+ */
+#define replication_node_name_is_valid abrt_replication_node_name_is_valid
+bool replication_node_name_is_valid(const char *node);
+
+struct abrt_replication_receiver_conf
+{
+    const char *dump_location;
+    gid_t fs_group;                 ///< the group owning the problem directories
+    mode_t dir_mode;                ///< mode of the problem directories
+    mode_t item_mode;               ///< mode of their items
+    unsigned long long max_size;    ///< of a problem directory, 0 for no limit
+};
+
+/**
+ * @param state_dir The directory with the last applied change of every node
+ */
+#define replication_receiver_new abrt_replication_receiver_new
+struct abrt_replication_receiver *replication_receiver_new(const char *state_dir,
+        const struct abrt_replication_receiver_conf *conf);
+#define replication_receiver_free abrt_replication_receiver_free
+void replication_receiver_free(struct abrt_replication_receiver *receiver);
+
+/**
+ * Applies the changes sent by a node over the connection until the node
+ * disconnects.
+ *
+ * @return 0 if the node has disconnected, -1 on error
+ */
+#define replication_receiver_serve abrt_replication_receiver_serve
+int replication_receiver_serve(struct abrt_replication_receiver *receiver, int fd);
+
 /* dbus client api */
 
 /**
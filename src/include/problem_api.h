@@ -45,6 +45,21 @@ int for_each_problem_in_dir(const char *path,
                         for_each_problem_in_dir_callback callback,
                         void *arg);
 
+/*
+ * Iterates over all dump directories placed in @path like
+ * @for_each_problem_in_dir but doesn't lock them.
+ *
+ * The dump directories passed to @callback are opened with DD_OPEN_FD_ONLY,
+ * @callback must read items via dd_snapshot_load_text(). Locked directories
+ * and directories modified in last few seconds are skipped.
+ *
+ * @returns 0 or the first non zero value returned from @callback
+ */
+int for_each_problem_snapshot_in_dir(const char *path,
+                        uid_t caller_uid,
+                        for_each_problem_in_dir_callback callback,
+                        void *arg);
+
 /* Retrieves the list of directories currently used as a problem storage
  * The result must be freed by caller
  * @returns List of strings representing the full path to dirs
@@ -29,6 +29,15 @@ char *        g_settings_autoreporting_event = NULL;
 bool          g_settings_shortenedreporting = 0;
 bool          g_settings_explorechroots = 0;
 unsigned int  g_settings_debug_level = 0;
+unsigned int  g_settings_nItemCompressionThreshold = 16;
+unsigned int  g_settings_nItemDeduplicationThreshold = 4;
+char *        g_settings_cold_storage_location = NULL;
+unsigned int  g_settings_nColdStorageAge = 24;
+bool          g_settings_cold_storage_reported = 1;
+unsigned int  g_settings_nMaxColdStorageSize = 0;
+char *        g_settings_replication_collector = NULL;
+unsigned int  g_settings_nReplicationBandwidthLimit = 0;
+GList *       g_settings_replication_allowed_peers = NULL;
 
 void free_abrt_conf_data()
 {
@@ -37,6 +46,15 @@ void free_abrt_conf_data()
 
     free(g_settings_dump_location);
     g_settings_dump_location = NULL;
+
+    free(g_settings_cold_storage_location);
+    g_settings_cold_storage_location = NULL;
+
+    free(g_settings_replication_collector);
+    g_settings_replication_collector = NULL;
+
+    list_free_with_free(g_settings_replication_allowed_peers);
+    g_settings_replication_allowed_peers = NULL;
 }
 
 static void ParseCommon(map_string_t *settings, const char *conf_filename)
@@ -130,6 +148,103 @@ static void ParseCommon(map_string_t *settings, const char *conf_filename)
         remove_map_string_item(settings, "DebugLevel");
     }
 
+    value = get_map_string_item_or_NULL(settings, "ItemCompressionThreshold");
+    if (value)
+    {
+        char *end;
+        errno = 0;
+        unsigned long ul = strtoul(value, &end, 10);
+        if (errno || end == value || *end != '\0' || ul > INT_MAX)
+            error_msg("Error parsing %s setting: '%s'", "ItemCompressionThreshold", value);
+        else
+            g_settings_nItemCompressionThreshold = ul;
+        remove_map_string_item(settings, "ItemCompressionThreshold");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ItemDeduplicationThreshold");
+    if (value)
+    {
+        char *end;
+        errno = 0;
+        unsigned long ul = strtoul(value, &end, 10);
+        if (errno || end == value || *end != '\0' || ul > INT_MAX)
+            error_msg("Error parsing %s setting: '%s'", "ItemDeduplicationThreshold", value);
+        else
+            g_settings_nItemDeduplicationThreshold = ul;
+        remove_map_string_item(settings, "ItemDeduplicationThreshold");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ColdStorageLocation");
+    if (value)
+    {
+        /* Empty value disables the cold storage */
+        if (value[0] != '\0')
+            g_settings_cold_storage_location = xstrdup(value);
+        remove_map_string_item(settings, "ColdStorageLocation");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ColdStorageAge");
+    if (value)
+    {
+        char *end;
+        errno = 0;
+        unsigned long ul = strtoul(value, &end, 10);
+        if (errno || end == value || *end != '\0' || ul > INT_MAX)
+            error_msg("Error parsing %s setting: '%s'", "ColdStorageAge", value);
+        else
+            g_settings_nColdStorageAge = ul;
+        remove_map_string_item(settings, "ColdStorageAge");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ColdStorageReported");
+    if (value)
+    {
+        g_settings_cold_storage_reported = string_to_bool(value);
+        remove_map_string_item(settings, "ColdStorageReported");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "MaxColdStorageSize");
+    if (value)
+    {
+        char *end;
+        errno = 0;
+        unsigned long ul = strtoul(value, &end, 10);
+        if (errno || end == value || *end != '\0' || ul > INT_MAX)
+            error_msg("Error parsing %s setting: '%s'", "MaxColdStorageSize", value);
+        else
+            g_settings_nMaxColdStorageSize = ul;
+        remove_map_string_item(settings, "MaxColdStorageSize");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ReplicationCollector");
+    if (value)
+    {
+        /* Empty value disables the replication */
+        if (value[0] != '\0')
+            g_settings_replication_collector = xstrdup(value);
+        remove_map_string_item(settings, "ReplicationCollector");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ReplicationBandwidthLimit");
+    if (value)
+    {
+        char *end;
+        errno = 0;
+        unsigned long ul = strtoul(value, &end, 10);
+        if (errno || end == value || *end != '\0' || ul > INT_MAX)
+            error_msg("Error parsing %s setting: '%s'", "ReplicationBandwidthLimit", value);
+        else
+            g_settings_nReplicationBandwidthLimit = ul;
+        remove_map_string_item(settings, "ReplicationBandwidthLimit");
+    }
+
+    value = get_map_string_item_or_NULL(settings, "ReplicationAllowedPeers");
+    if (value)
+    {
+        g_settings_replication_allowed_peers = parse_list(value);
+        remove_map_string_item(settings, "ReplicationAllowedPeers");
+    }
+
     GHashTableIter iter;
     const char *name;
     /*char *value; - already declared */
@@ -0,0 +1,352 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "internal_libabrt.h"
+
+/* The blob store is a flat directory of files named by the SHA-1 of their
+ * content. Problem directory items with the same content are reflinks
+ * (FICLONE) of the same blob: every item is a separate inode with its own
+ * owner and mode, only the data extents are shared by the file system.
+ * Changing the owner or mode of an item (e.g. ChownProblemDir) or rewriting
+ * it never touches the other problems.
+ *
+ * A blob whose extents are no longer shared is referenced by the store only
+ * and is removed by the garbage collector. On file systems without reflinks
+ * the items are left intact.
+ */
+
+#define BLOB_STORE_SUFFIX "-blobs"
+#define BLOB_TMP_NAME ".blob.tmp"
+/* Extents fetched by one FS_IOC_FIEMAP call */
+#define BLOB_FIEMAP_EXTENTS 32
+
+/* Items which are often identical across problems */
+static const char *const s_deduplicable_items[] = {
+    FILENAME_BINARY,
+    FILENAME_CMDLINE,
+    FILENAME_OS_RELEASE,
+    "proc_modules",
+    NULL
+};
+
+char *blob_store_location(const char *dump_location)
+{
+    return xasprintf("%.*s"BLOB_STORE_SUFFIX, (int)trimmed_dir_name_len(dump_location), dump_location);
+}
+
+static int hash_file(int fd, char hash_str[SHA1_RESULT_LEN*2 + 1])
+{
+    sha1_ctx_t sha1ctx;
+    sha1_begin(&sha1ctx);
+
+    char buf[64 * 1024];
+    ssize_t r;
+    while ((r = safe_read(fd, buf, sizeof(buf))) > 0)
+        sha1_hash(&sha1ctx, buf, r);
+
+    if (r < 0)
+        return -1;
+
+    unsigned char hash_bytes[SHA1_RESULT_LEN];
+    sha1_end(&sha1ctx, hash_bytes);
+    bin2hex(hash_str, (const char *)hash_bytes, SHA1_RESULT_LEN)[0] = '\0';
+    return 0;
+}
+
+/* Returns 1 if both files have the same content */
+static int same_content(const char *lhs, const char *rhs)
+{
+    int ret = 0;
+    int lfd = open(lhs, O_RDONLY | O_NOFOLLOW);
+    int rfd = open(rhs, O_RDONLY | O_NOFOLLOW);
+    if (lfd < 0 || rfd < 0)
+        goto finito;
+
+    char lbuf[32 * 1024];
+    char rbuf[sizeof(lbuf)];
+    while (1)
+    {
+        const ssize_t lr = full_read(lfd, lbuf, sizeof(lbuf));
+        const ssize_t rr = full_read(rfd, rbuf, sizeof(rbuf));
+        if (lr < 0 || lr != rr || memcmp(lbuf, rbuf, lr) != 0)
+            goto finito;
+
+        if (lr == 0)
+            break;
+    }
+    ret = 1;
+
+ finito:
+    if (lfd >= 0)
+        close(lfd);
+    if (rfd >= 0)
+        close(rfd);
+    return ret;
+}
+
+/* Replaces the data of dst_fd by a reflink of src_fd */
+static int clone_fd(int dst_fd, int src_fd)
+{
+#ifdef FICLONE
+    return ioctl(dst_fd, FICLONE, src_fd);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+/* Makes a new blob of the item, the blob is a private copy of the store */
+static void store_blob(int item_fd, const char *item_path, const char *blob_path)
+{
+    char *tmp_path = xasprintf("%s.XXXXXX", blob_path);
+    const int fd = mkstemp(tmp_path);
+    if (fd < 0)
+    {
+        perror_msg("Can't create '%s'", tmp_path);
+        goto finito;
+    }
+
+    if (clone_fd(fd, item_fd) != 0)
+    {
+        if (errno != EOPNOTSUPP && errno != EXDEV && errno != EINVAL)
+            perror_msg("Can't clone '%s' to '%s'", item_path, tmp_path);
+        else
+            log_debug("Can't clone '%s': %s", item_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        goto finito;
+    }
+    close(fd);
+
+    /* A concurrent writer stores the same content under the same name */
+    if (rename(tmp_path, blob_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_path, blob_path);
+        unlink(tmp_path);
+        goto finito;
+    }
+
+    log_debug("New blob '%s' for '%s'", blob_path, item_path);
+
+ finito:
+    free(tmp_path);
+}
+
+/* Returns 1 if the item has been cloned from a blob */
+static int deduplicate_item(struct dump_dir *dd, const char *blob_dir, const char *item, unsigned long threshold)
+{
+    int ret = 0;
+    char *item_path = concat_path_file(dd->dd_dirname, item);
+    char *tmp_path = NULL;
+    char *blob_path = NULL;
+    int blob_fd = -1;
+
+    const int fd = open(item_path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        goto finito;
+
+    struct stat item_st;
+    if (fstat(fd, &item_st) != 0 || !S_ISREG(item_st.st_mode)
+        || (unsigned long)item_st.st_size < threshold)
+    {
+        close(fd);
+        goto finito;
+    }
+
+    char hash_str[SHA1_RESULT_LEN*2 + 1];
+    if (hash_file(fd, hash_str) != 0)
+    {
+        perror_msg("Can't read '%s'", item_path);
+        close(fd);
+        goto finito;
+    }
+
+    blob_path = concat_path_file(blob_dir, hash_str);
+    blob_fd = open(blob_path, O_RDONLY | O_NOFOLLOW);
+    if (blob_fd < 0)
+    {
+        /* The first occurrence becomes the blob */
+        if (errno == ENOENT)
+            store_blob(fd, item_path, blob_path);
+        else
+            perror_msg("Can't open blob '%s'", blob_path);
+        close(fd);
+        goto finito;
+    }
+    close(fd);
+
+    /* SHA-1 is not collision free */
+    if (!same_content(item_path, blob_path))
+    {
+        log_notice("Hash collision between '%s' and '%s'", item_path, blob_path);
+        goto finito;
+    }
+
+    tmp_path = concat_path_file(dd->dd_dirname, BLOB_TMP_NAME);
+    unlink(tmp_path);
+    const int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, item_st.st_mode & 07777);
+    if (tmp_fd < 0)
+    {
+        perror_msg("Can't create '%s'", tmp_path);
+        goto finito;
+    }
+
+    /* The clone is a new inode, it must look like the item it replaces */
+    if (clone_fd(tmp_fd, blob_fd) != 0
+        || fchown(tmp_fd, item_st.st_uid, item_st.st_gid) != 0
+        || fchmod(tmp_fd, item_st.st_mode & 07777) != 0)
+    {
+        if (errno != EOPNOTSUPP && errno != EXDEV && errno != EINVAL)
+            perror_msg("Can't clone '%s' to '%s'", blob_path, tmp_path);
+        close(tmp_fd);
+        unlink(tmp_path);
+        goto finito;
+    }
+    close(tmp_fd);
+
+    /* Atomically replace the item, readers see either copy */
+    if (rename(tmp_path, item_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_path, item_path);
+        unlink(tmp_path);
+        goto finito;
+    }
+
+    log_info("Cloned '%s' from blob '%s'", item_path, blob_path);
+    ret = 1;
+
+ finito:
+    if (blob_fd >= 0)
+        close(blob_fd);
+    free(tmp_path);
+    free(blob_path);
+    free(item_path);
+    return ret;
+}
+
+int dd_deduplicate_items(struct dump_dir *dd, const char *blob_dir, unsigned long threshold)
+{
+    if (mkdir(blob_dir, 0700) != 0 && errno != EEXIST)
+    {
+        perror_msg("Can't create blob store '%s'", blob_dir);
+        return 0;
+    }
+
+    int cloned = 0;
+    for (const char *const *item = s_deduplicable_items; *item; ++item)
+        cloned += deduplicate_item(dd, blob_dir, *item, threshold);
+
+    return cloned;
+}
+
+/* Returns 1 if any extent of the file is shared with another file, 0 if
+ * none is and -1 if the file system can't tell.
+ */
+static int has_shared_extents(int fd)
+{
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extents[BLOB_FIEMAP_EXTENTS];
+    } buf;
+
+    __u64 start = 0;
+    while (1)
+    {
+        memset(&buf, 0, sizeof(buf));
+        buf.map.fm_start = start;
+        buf.map.fm_length = FIEMAP_MAX_OFFSET - start;
+        buf.map.fm_flags = FIEMAP_FLAG_SYNC;
+        buf.map.fm_extent_count = BLOB_FIEMAP_EXTENTS;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, &buf.map) != 0)
+            return -1;
+
+        if (buf.map.fm_mapped_extents == 0)
+            return 0;
+
+        for (unsigned i = 0; i < buf.map.fm_mapped_extents; ++i)
+        {
+            const struct fiemap_extent *ext = &buf.map.fm_extents[i];
+            if (ext->fe_flags & FIEMAP_EXTENT_SHARED)
+                return 1;
+
+            if (ext->fe_flags & FIEMAP_EXTENT_LAST)
+                return 0;
+        }
+
+        const struct fiemap_extent *last = &buf.map.fm_extents[buf.map.fm_mapped_extents - 1];
+        start = last->fe_logical + last->fe_length;
+    }
+}
+
+/* Blobs are named by the SHA-1 of their content, anything else is e.g.
+ * a blob being stored */
+static bool is_blob_name(const char *name)
+{
+    return strlen(name) == SHA1_RESULT_LEN*2 && strspn(name, "0123456789abcdef") == SHA1_RESULT_LEN*2;
+}
+
+int blob_store_collect_garbage(const char *blob_dir)
+{
+    DIR *dp = opendir(blob_dir);
+    if (dp == NULL)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open blob store '%s'", blob_dir);
+        return 0;
+    }
+
+    int removed = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (!is_blob_name(dent->d_name))
+            continue;
+
+        const int fd = openat(dirfd(dp), dent->d_name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+        if (fd < 0)
+            continue;
+
+        struct stat st;
+        const int shared = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? has_shared_extents(fd) : 1;
+        close(fd);
+
+        /* Referenced by a problem or unknown */
+        if (shared != 0)
+        {
+            if (shared < 0)
+                log_debug("Can't map extents of blob '%s': %s", dent->d_name, strerror(errno));
+            continue;
+        }
+
+        if (unlinkat(dirfd(dp), dent->d_name, 0) != 0)
+        {
+            perror_msg("Can't remove blob '%s/%s'", blob_dir, dent->d_name);
+            continue;
+        }
+
+        log_debug("Removed unreferenced blob '%s'", dent->d_name);
+        ++removed;
+    }
+    closedir(dp);
+
+    return removed;
+}
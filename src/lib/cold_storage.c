@@ -0,0 +1,522 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+#include "problem_api.h"
+
+/* Layout of the cold storage:
+ *   <ColdStorageLocation>/<problem directory name>/<item>.zst
+ *
+ * The problem directory keeps the item FILENAME_COLD_STORAGE with the path
+ * of its cold directory. The path is always computed from the problem name,
+ * the item must match it. The item is saved before the payloads are removed
+ * and removed after the payloads are restored, so a crash in between leaves
+ * either both copies or a cold directory with no reference; the latter is
+ * removed by trim_cold_storage().
+ *
+ * The compressed files inherit owner and mode of the original items, hence
+ * the users who can read the payloads in the problem directory can read them
+ * in the cold storage too.
+ */
+
+#define COLD_DIR_MODE 0751
+#define COLD_TMP_SUFFIX ".tmp"
+
+/* Heavy items which are useful only for gdb and the retrace server */
+static const char *const s_cold_items[] = {
+    FILENAME_COREDUMP,
+    FILENAME_BINARY,
+    FILENAME_VMCORE,
+    NULL
+};
+
+static const char *dd_basename(struct dump_dir *dd)
+{
+    const char *base = strrchr(dd->dd_dirname, '/');
+    return base ? base + 1 : dd->dd_dirname;
+}
+
+static int remove_cold_dir(const char *cold_dir)
+{
+    DIR *dp = opendir(cold_dir);
+    if (dp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        if (unlinkat(dirfd(dp), dent->d_name, 0) != 0 && errno != ENOENT)
+            perror_msg("Can't remove '%s/%s'", cold_dir, dent->d_name);
+    }
+    closedir(dp);
+
+    if (rmdir(cold_dir) != 0 && errno != ENOENT)
+    {
+        perror_msg("Can't remove '%s'", cold_dir);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Compresses src_path to dst_path atomically */
+static int freeze_file(const char *src_path, const char *dst_path, off_t *size)
+{
+    const int src_fd = open(src_path, O_RDONLY | O_NOFOLLOW);
+    if (src_fd < 0)
+        return -1;
+
+    int ret = -1;
+    char *tmp_path = xasprintf("%s"COLD_TMP_SUFFIX, dst_path);
+    int dst_fd = -1;
+
+    struct stat st;
+    if (fstat(src_fd, &st) != 0 || !S_ISREG(st.st_mode))
+        goto finito;
+
+    dst_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    if (dst_fd < 0)
+    {
+        perror_msg("Can't create '%s'", tmp_path);
+        goto finito;
+    }
+
+    if (abrt_compress_fd(src_fd, dst_fd) != 0)
+        goto finito;
+
+    /* The original is going to be removed */
+    if (fsync(dst_fd) != 0
+        || fchown(dst_fd, st.st_uid, st.st_gid) != 0
+        || fchmod(dst_fd, st.st_mode & 07777) != 0)
+    {
+        perror_msg("Can't finalize '%s'", tmp_path);
+        goto finito;
+    }
+
+    if (rename(tmp_path, dst_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_path, dst_path);
+        goto finito;
+    }
+
+    *size = st.st_size;
+    ret = 0;
+
+ finito:
+    if (dst_fd >= 0)
+        close(dst_fd);
+    if (ret != 0)
+        unlink(tmp_path);
+    free(tmp_path);
+    close(src_fd);
+    return ret;
+}
+
+/* Decompresses src_path to dst_path atomically */
+static int thaw_file(const char *src_path, const char *dst_path)
+{
+    const int src_fd = open(src_path, O_RDONLY | O_NOFOLLOW);
+    if (src_fd < 0)
+    {
+        perror_msg("Can't open '%s'", src_path);
+        return -1;
+    }
+
+    int ret = -1;
+    char *tmp_path = xasprintf("%s"COLD_TMP_SUFFIX, dst_path);
+
+    struct stat st;
+    const int dst_fd = fstat(src_fd, &st) != 0 ? -1
+            : open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, st.st_mode & 07777);
+    if (dst_fd < 0)
+    {
+        perror_msg("Can't create '%s'", tmp_path);
+        goto finito;
+    }
+
+    if (abrt_decompress_fd(src_fd, dst_fd) != 0)
+        goto finito;
+
+    /* Fails if the problem directory has been chowned to a user, which is
+     * fine: the user owns all items then. */
+    if (fchown(dst_fd, st.st_uid, st.st_gid) != 0)
+        log_debug("Can't change owner of '%s'", tmp_path);
+
+    if (rename(tmp_path, dst_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_path, dst_path);
+        goto finito;
+    }
+
+    ret = 0;
+
+ finito:
+    if (dst_fd >= 0)
+        close(dst_fd);
+    if (ret != 0)
+        unlink(tmp_path);
+    free(tmp_path);
+    close(src_fd);
+    return ret;
+}
+
+int dd_move_to_cold_storage(struct dump_dir *dd, const char *cold_location)
+{
+    if (dd_exist(dd, FILENAME_COLD_STORAGE))
+        return 0;
+
+    if (mkdir(cold_location, COLD_DIR_MODE) != 0 && errno != EEXIST)
+    {
+        perror_msg("Can't create cold storage '%s'", cold_location);
+        return -1;
+    }
+
+    char *cold_dir = concat_path_file(cold_location, dd_basename(dd));
+    if (mkdir(cold_dir, COLD_DIR_MODE) != 0 && errno != EEXIST)
+    {
+        perror_msg("Can't create '%s'", cold_dir);
+        free(cold_dir);
+        return -1;
+    }
+
+    GList *frozen = NULL;
+    off_t frozen_size = 0;
+    for (const char *const *item = s_cold_items; *item; ++item)
+    {
+        if (!dd_exist(dd, *item))
+            continue;
+
+        char *src_path = concat_path_file(dd->dd_dirname, *item);
+        char *dst_path = xasprintf("%s/%s"ABRT_COMPRESSED_ITEM_SUFFIX, cold_dir, *item);
+
+        off_t size = 0;
+        if (freeze_file(src_path, dst_path, &size) == 0)
+        {
+            frozen = g_list_prepend(frozen, (gpointer)*item);
+            frozen_size += size;
+        }
+
+        free(dst_path);
+        free(src_path);
+    }
+
+    if (frozen == NULL)
+    {
+        remove_cold_dir(cold_dir);
+        free(cold_dir);
+        return 0;
+    }
+
+    /* Remember where the payloads are before removing them */
+    dd_save_text(dd, FILENAME_COLD_STORAGE, cold_dir);
+
+    int moved = 0;
+    for (GList *l = frozen; l; l = l->next)
+    {
+        if (dd_delete_item(dd, (const char *)l->data) == 0)
+            ++moved;
+    }
+
+    log_info("Moved %d items (%llu bytes) of '%s' to '%s'", moved,
+            (unsigned long long)frozen_size, dd->dd_dirname, cold_dir);
+
+    g_list_free(frozen);
+    free(cold_dir);
+    return moved;
+}
+
+/* Formats of coredumps compressed by systemd-coredump, the zstd ones are
+ * readable by abrt_decompress_fd() and libreport knows the others */
+static const char *const s_packed_coredump_suffixes[] = {
+    ABRT_COMPRESSED_ITEM_SUFFIX,
+    ".xz",
+    ".lz4",
+    NULL
+};
+
+const char *packed_coredump_suffix(const char *path)
+{
+    const size_t len = strlen(path);
+    for (const char *const *sfx = s_packed_coredump_suffixes; *sfx; ++sfx)
+    {
+        const size_t sfx_len = strlen(*sfx);
+        if (len > sfx_len && strcmp(path + len - sfx_len, *sfx) == 0)
+            return *sfx;
+    }
+
+    return NULL;
+}
+
+int dd_unpack_coredump_to(struct dump_dir *dd, const char *dst_path)
+{
+    for (const char *const *sfx = s_packed_coredump_suffixes; *sfx; ++sfx)
+    {
+        char *src_path = xasprintf("%s/"FILENAME_COREDUMP"%s", dd->dd_dirname, *sfx);
+        if (access(src_path, F_OK) != 0)
+        {
+            free(src_path);
+            continue;
+        }
+
+        const int r = strcmp(*sfx, ABRT_COMPRESSED_ITEM_SUFFIX) == 0
+                ? thaw_file(src_path, dst_path)
+                : decompress_file(src_path, dst_path, 0600);
+        if (r != 0)
+            error_msg("Can't unpack '%s'", src_path);
+
+        free(src_path);
+        return r == 0 ? 1 : -1;
+    }
+
+    return 0;
+}
+
+int dd_unpack_coredump(struct dump_dir *dd)
+{
+    for (const char *const *sfx = s_packed_coredump_suffixes; *sfx; ++sfx)
+    {
+        char *packed = xasprintf(FILENAME_COREDUMP"%s", *sfx);
+        if (!dd_exist(dd, packed))
+        {
+            free(packed);
+            continue;
+        }
+
+        char *src_path = concat_path_file(dd->dd_dirname, packed);
+        int r;
+        if (strcmp(*sfx, ABRT_COMPRESSED_ITEM_SUFFIX) == 0)
+        {
+            char *dst_path = concat_path_file(dd->dd_dirname, FILENAME_COREDUMP);
+            r = thaw_file(src_path, dst_path);
+            free(dst_path);
+        }
+        else
+            r = dd_copy_file_unpack(dd, FILENAME_COREDUMP, src_path) < 0 ? -1 : 0;
+
+        if (r == 0)
+        {
+            log_info("Unpacked '%s' in '%s'", packed, dd->dd_dirname);
+            dd_delete_item(dd, packed);
+        }
+        else
+            error_msg("Can't unpack '%s'", src_path);
+
+        free(src_path);
+        free(packed);
+        return r == 0 ? 1 : -1;
+    }
+
+    return 0;
+}
+
+int dd_rehydrate_items(struct dump_dir *dd, const char *cold_location)
+{
+    const int unpacked = dd_unpack_coredump(dd);
+    if (unpacked < 0)
+        return -1;
+
+    char *reference = dd_load_text_ext(dd, FILENAME_COLD_STORAGE,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    if (reference == NULL)
+        return unpacked;
+
+    /* The item is only a marker, the owner of the problem could point it
+     * anywhere and the cold directory gets removed */
+    char *cold_dir = cold_location ? concat_path_file(cold_location, dd_basename(dd)) : NULL;
+    if (cold_dir == NULL || strcmp(reference, cold_dir) != 0)
+    {
+        error_msg("'%s' of '%s' doesn't refer to the cold storage", FILENAME_COLD_STORAGE, dd->dd_dirname);
+        free(reference);
+        free(cold_dir);
+        return -1;
+    }
+    free(reference);
+
+    DIR *dp = opendir(cold_dir);
+    if (dp == NULL)
+    {
+        const int err = errno;
+        perror_msg("Payload of '%s' is lost, can't open '%s'", dd->dd_dirname, cold_dir);
+        if (err == ENOENT)
+            dd_delete_item(dd, FILENAME_COLD_STORAGE);
+        free(cold_dir);
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        const size_t len = strlen(dent->d_name);
+        const size_t sfx_len = strlen(ABRT_COMPRESSED_ITEM_SUFFIX);
+        if (len <= sfx_len || strcmp(dent->d_name + len - sfx_len, ABRT_COMPRESSED_ITEM_SUFFIX) != 0)
+            continue;
+
+        char *item = xstrndup(dent->d_name, len - sfx_len);
+        if (!str_is_correct_filename(item))
+        {
+            error_msg("Invalid item name '%s' in '%s'", item, cold_dir);
+            free(item);
+            continue;
+        }
+
+        char *src_path = concat_path_file(cold_dir, dent->d_name);
+        char *dst_path = concat_path_file(dd->dd_dirname, item);
+        if (thaw_file(src_path, dst_path) == 0)
+        {
+            log_info("Restored '%s' from '%s'", item, cold_dir);
+            ++ret;
+        }
+        else
+            ret = -1;
+
+        free(dst_path);
+        free(src_path);
+        free(item);
+
+        if (ret < 0)
+            break;
+    }
+    closedir(dp);
+
+    if (ret >= 0)
+    {
+        dd_delete_item(dd, FILENAME_COLD_STORAGE);
+        /* Might fail for unprivileged users, trim_cold_storage() will remove
+         * the directory later */
+        remove_cold_dir(cold_dir);
+        ret += unpacked;
+    }
+
+    free(cold_dir);
+    return ret;
+}
+
+static time_t last_occurrence(struct dump_dir *dd)
+{
+    const int flags = DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE;
+    char *value = dd_load_text_ext(dd, FILENAME_LAST_OCCURRENCE, flags);
+    if (value == NULL)
+        value = dd_load_text_ext(dd, FILENAME_TIME, flags);
+    if (value == NULL)
+        return 0;
+
+    const time_t t = strtoul(value, NULL, 10);
+    free(value);
+    return t;
+}
+
+int move_cold_problems(const char *dump_location, const char *cold_location,
+        unsigned long age_sec, bool reported)
+{
+    DIR *dp = opendir(dump_location);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open directory '%s'", dump_location);
+        return 0;
+    }
+
+    const time_t now = time(NULL);
+    int moved = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        /* skip ".", ".." and hidden entries like the trash */
+        if (dent->d_name[0] == '.')
+            continue;
+
+        char *full_name = concat_path_file(dump_location, dent->d_name);
+        struct dump_dir *dd = dd_opendir(full_name, DD_DONT_WAIT_FOR_LOCK
+                                                  | DD_FAIL_QUIETLY_ENOENT
+                                                  | DD_FAIL_QUIETLY_EACCES);
+        free(full_name);
+        if (dd == NULL)
+            continue;
+
+        /* Leave alone problems which are being processed */
+        if (problem_dump_dir_is_complete(dd) && !dd_exist(dd, FILENAME_COLD_STORAGE))
+        {
+            const bool old = age_sec > 0 && now - last_occurrence(dd) >= (time_t)age_sec;
+            if (old || (reported && dd_exist(dd, FILENAME_REPORTED_TO)))
+                moved += dd_move_to_cold_storage(dd, cold_location) > 0;
+        }
+
+        dd_close(dd);
+    }
+    closedir(dp);
+
+    return moved;
+}
+
+void trim_cold_storage(const char *cold_location, const char *dump_location, double cap_size)
+{
+    DIR *dp = opendir(cold_location);
+    if (dp == NULL)
+        return;
+
+    /* Remove payloads of deleted and rehydrated problems */
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dent->d_name[0] == '.')
+            continue;
+
+        char *problem_dir = concat_path_file(dump_location, dent->d_name);
+        char *reference = concat_path_file(problem_dir, FILENAME_COLD_STORAGE);
+        struct stat st;
+        if (lstat(reference, &st) != 0 && errno == ENOENT)
+        {
+            char *cold_dir = concat_path_file(cold_location, dent->d_name);
+            log_info("Removing orphaned cold storage '%s'", cold_dir);
+            remove_cold_dir(cold_dir);
+            free(cold_dir);
+        }
+        free(reference);
+        free(problem_dir);
+    }
+    closedir(dp);
+
+    if (cap_size <= 0)
+        return;
+
+    int count = 20;
+    while (--count >= 0)
+    {
+        char *worst_basename = NULL;
+        const double cur_size = get_dirsize_find_largest_dir(cold_location, &worst_basename, NULL);
+        if (cur_size <= cap_size || !worst_basename)
+        {
+            log_info("cold size:%.0f cap_size:%.0f, no (more) trimming", cur_size, cap_size);
+            free(worst_basename);
+            break;
+        }
+
+        /* The problem keeps its metadata, rehydration will report the loss */
+        log("%s is %.0f bytes (more than %.0fMiB), deleting '%s'",
+                cold_location, cur_size, cap_size / (1024*1024), worst_basename);
+        char *cold_dir = concat_path_file(cold_location, worst_basename);
+        free(worst_basename);
+        const int removed = remove_cold_dir(cold_dir);
+        free(cold_dir);
+        if (removed != 0)
+            break;
+    }
+}
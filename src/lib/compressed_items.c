@@ -0,0 +1,434 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <zstd.h>
+
+#include "internal_libabrt.h"
+
+/* zstd level 3 is the library default: fast enough to run in abrtd and
+ * still squeezes coredumps and vmcores several times.
+ */
+#define ITEM_COMPRESSION_LEVEL 3
+
+/* Refuse to inflate a buffer bigger than this, large data are processed by
+ * the streaming functions.
+ */
+#define ITEM_MAX_DECOMPRESSED_SIZE (256 * 1024 * 1024)
+
+/* 'zstd --train' creates 110 KiB dictionaries by default */
+#define ITEM_MAX_DICTIONARY_SIZE (1024 * 1024)
+
+/* Text items which are large, repetitive and not read by any event after
+ * post-create. 'backtrace' and 'dso_list' are deliberately missing: event
+ * rules and reporters read them directly from the dump directory.
+ * 'proc_modules' is deduplicated into the blob store, the hard link to the
+ * shared copy is smaller than any compressed one.
+ */
+static const char *const s_compressible_items[] = {
+    FILENAME_MAPS,
+    FILENAME_ENVIRON,
+    "var_log_messages",
+    NULL
+};
+
+/* The dictionary trained on these items, see 'make items-dict'. It is
+ * optional, frames record the ID of the dictionary they were compressed with,
+ * so a missing or replaced dictionary is detected at decompression time.
+ */
+static char *s_dictionary_path;
+static bool s_dictionary_loaded;
+static ZSTD_CDict *s_cdict;
+static ZSTD_DDict *s_ddict;
+
+void set_item_compression_dictionary(const char *path)
+{
+    ZSTD_freeCDict(s_cdict);
+    s_cdict = NULL;
+    ZSTD_freeDDict(s_ddict);
+    s_ddict = NULL;
+
+    free(s_dictionary_path);
+    s_dictionary_path = path ? xstrdup(path) : NULL;
+    s_dictionary_loaded = false;
+}
+
+static void load_dictionary(void)
+{
+    if (s_dictionary_loaded)
+        return;
+
+    s_dictionary_loaded = true;
+
+    const char *const path = s_dictionary_path ? s_dictionary_path : ITEM_COMPRESSION_DICTIONARY;
+    if (path[0] == '\0')
+        return;
+
+    size_t size = ITEM_MAX_DICTIONARY_SIZE;
+    char *dict = xmalloc_open_read_close(path, &size);
+    if (dict == NULL)
+    {
+        log_notice("Compressing items without dictionary, can't read '%s'", path);
+        return;
+    }
+
+    if (ZSTD_getDictID_fromDict(dict, size) == 0)
+    {
+        error_msg("'%s' is not a zstd dictionary", path);
+        free(dict);
+        return;
+    }
+
+    s_cdict = ZSTD_createCDict(dict, size, ITEM_COMPRESSION_LEVEL);
+    s_ddict = ZSTD_createDDict(dict, size);
+    free(dict);
+
+    if (s_cdict == NULL || s_ddict == NULL)
+        die_out_of_memory();
+
+    log_debug("Using item compression dictionary '%s' (ID %u, %zu bytes)",
+            path, ZSTD_getDictID_fromDDict(s_ddict), size);
+}
+
+char *abrt_compress_buffer(const char *data, size_t size, size_t *out_size)
+{
+    const size_t bound = ZSTD_compressBound(size);
+    char *out = xmalloc(bound);
+
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+        die_out_of_memory();
+
+    load_dictionary();
+
+    const size_t r = s_cdict != NULL
+        ? ZSTD_compress_usingCDict(cctx, out, bound, data, size, s_cdict)
+        : ZSTD_compressCCtx(cctx, out, bound, data, size, ITEM_COMPRESSION_LEVEL);
+
+    ZSTD_freeCCtx(cctx);
+
+    if (ZSTD_isError(r))
+    {
+        error_msg("Failed to compress data: %s", ZSTD_getErrorName(r));
+        free(out);
+        return NULL;
+    }
+
+    *out_size = r;
+    return out;
+}
+
+char *abrt_decompress_buffer(const char *data, size_t size, size_t *out_size)
+{
+    const unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR)
+    {
+        error_msg("Compressed data are not a zstd frame");
+        return NULL;
+    }
+
+    /* We always write frames with the content size */
+    if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size > ITEM_MAX_DECOMPRESSED_SIZE)
+    {
+        error_msg("Compressed data have unknown or insane size");
+        return NULL;
+    }
+
+    /* +1 for the terminating '\0', the callers may treat the data as a text */
+    char *out = xmalloc(content_size + 1);
+
+    const unsigned dict_id = ZSTD_getDictID_fromFrame(data, size);
+    if (dict_id != 0)
+    {
+        load_dictionary();
+        if (s_ddict == NULL || ZSTD_getDictID_fromDDict(s_ddict) != dict_id)
+        {
+            error_msg("Compressed data need the dictionary with ID %u", dict_id);
+            free(out);
+            return NULL;
+        }
+    }
+
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL)
+        die_out_of_memory();
+
+    const size_t r = dict_id != 0
+        ? ZSTD_decompress_usingDDict(dctx, out, content_size, data, size, s_ddict)
+        : ZSTD_decompressDCtx(dctx, out, content_size, data, size);
+
+    ZSTD_freeDCtx(dctx);
+
+    if (ZSTD_isError(r))
+    {
+        error_msg("Failed to decompress data: %s", ZSTD_getErrorName(r));
+        free(out);
+        return NULL;
+    }
+
+    out[r] = '\0';
+    if (out_size)
+        *out_size = r;
+    return out;
+}
+
+static char *load_compressed_item(struct dump_dir *dd, const char *packed_name)
+{
+    char *path = concat_path_file(dd->dd_dirname, packed_name);
+    size_t size = ITEM_MAX_DECOMPRESSED_SIZE;
+    char *packed = xmalloc_open_read_close(path, &size);
+    free(path);
+    if (packed == NULL)
+        return NULL;
+
+    char *data = abrt_decompress_buffer(packed, size, NULL);
+    free(packed);
+    return data;
+}
+
+int dd_compress_items(struct dump_dir *dd, unsigned long threshold)
+{
+    int compressed = 0;
+
+    for (const char *const *item = s_compressible_items; *item; ++item)
+    {
+        const long item_size = dd_get_item_size(dd, *item);
+        if (item_size <= 0 || (unsigned long)item_size < threshold)
+            continue;
+
+        /* Byte exact copy, dd_load_text() would rewrite the text */
+        char *path = concat_path_file(dd->dd_dirname, *item);
+        size_t size = item_size;
+        char *data = xmalloc_open_read_close(path, &size);
+        free(path);
+        if (data == NULL)
+            continue;
+
+        size_t packed_size = 0;
+        char *packed = abrt_compress_buffer(data, size, &packed_size);
+        free(data);
+
+        /* Not worth it */
+        if (packed == NULL || packed_size >= size)
+        {
+            free(packed);
+            continue;
+        }
+
+        char *packed_name = xasprintf("%s"ABRT_COMPRESSED_ITEM_SUFFIX, *item);
+        dd_save_binary(dd, packed_name, packed, packed_size);
+        free(packed);
+
+        if (dd_delete_item(dd, *item) != 0)
+        {
+            error_msg("Can't remove '%s' replaced by '%s'", *item, packed_name);
+            dd_delete_item(dd, packed_name);
+        }
+        else
+        {
+            log_info("Compressed '%s' %zu -> %zu bytes", *item, size, packed_size);
+            ++compressed;
+        }
+
+        free(packed_name);
+    }
+
+    return compressed;
+}
+
+static bool is_compressible_item(const char *name)
+{
+    for (const char *const *item = s_compressible_items; *item; ++item)
+        if (strcmp(*item, name) == 0)
+            return true;
+
+    return false;
+}
+
+char *dd_load_text_decompress(struct dump_dir *dd, const char *name, unsigned flags)
+{
+    if (!is_compressible_item(name) || dd_exist(dd, name))
+        return dd_load_text_ext(dd, name, flags);
+
+    char *packed_name = xasprintf("%s"ABRT_COMPRESSED_ITEM_SUFFIX, name);
+    char *data = dd_exist(dd, packed_name) ? load_compressed_item(dd, packed_name) : NULL;
+    free(packed_name);
+
+    if (data != NULL)
+        return data;
+
+    /* Let libreport handle the failure in the way the caller asked for */
+    return dd_load_text_ext(dd, name, flags);
+}
+
+void problem_data_decompress_items(problem_data_t *pd, struct dump_dir *dd)
+{
+    for (const char *const *item = s_compressible_items; *item; ++item)
+    {
+        char *packed_name = xasprintf("%s"ABRT_COMPRESSED_ITEM_SUFFIX, *item);
+        if (problem_data_get_item_or_NULL(pd, packed_name) != NULL
+            && problem_data_get_item_or_NULL(pd, *item) == NULL)
+        {
+            char *data = dd_load_text_decompress(dd, *item, DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE
+                                                            | DD_FAIL_QUIETLY_ENOENT);
+            if (data != NULL)
+            {
+                problem_data_add_text_noteditable(pd, *item, data);
+                g_hash_table_remove(pd, packed_name);
+                free(data);
+            }
+        }
+        free(packed_name);
+    }
+}
+
+/* Streaming variants for payloads which don't fit into memory */
+int abrt_compress_fd(int src_fd, int dst_fd)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+        die_out_of_memory();
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ITEM_COMPRESSION_LEVEL);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+    const size_t in_size = ZSTD_CStreamInSize();
+    const size_t out_size = ZSTD_CStreamOutSize();
+    char *in_buf = xmalloc(in_size);
+    char *out_buf = xmalloc(out_size);
+
+    int ret = -1;
+    while (1)
+    {
+        const ssize_t r = full_read(src_fd, in_buf, in_size);
+        if (r < 0)
+        {
+            perror_msg("Can't read data to compress");
+            goto finito;
+        }
+
+        const ZSTD_EndDirective mode = (size_t)r < in_size ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = { in_buf, r, 0 };
+        size_t remaining;
+        do
+        {
+            ZSTD_outBuffer output = { out_buf, out_size, 0 };
+            remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining))
+            {
+                error_msg("Failed to compress data: %s", ZSTD_getErrorName(remaining));
+                goto finito;
+            }
+
+            if ((size_t)full_write(dst_fd, out_buf, output.pos) != output.pos)
+            {
+                perror_msg("Can't write compressed data");
+                goto finito;
+            }
+        }
+        while (mode == ZSTD_e_end ? remaining != 0 : input.pos != input.size);
+
+        if (mode == ZSTD_e_end)
+            break;
+    }
+    ret = 0;
+
+ finito:
+    free(out_buf);
+    free(in_buf);
+    ZSTD_freeCCtx(cctx);
+    return ret;
+}
+
+/* Returns 1 if the buffer contains only zeros */
+static int is_hole(const char *buf, size_t size)
+{
+    return size > 0 && buf[0] == '\0' && memcmp(buf, buf + 1, size - 1) == 0;
+}
+
+int abrt_decompress_fd(int src_fd, int dst_fd)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL)
+        die_out_of_memory();
+
+    const size_t in_size = ZSTD_DStreamInSize();
+    const size_t out_size = ZSTD_DStreamOutSize();
+    char *in_buf = xmalloc(in_size);
+    char *out_buf = xmalloc(out_size);
+
+    int ret = -1;
+    off_t written = 0;
+    size_t last = 0;
+    ssize_t r;
+    while ((r = full_read(src_fd, in_buf, in_size)) > 0)
+    {
+        ZSTD_inBuffer input = { in_buf, r, 0 };
+        while (input.pos < input.size)
+        {
+            ZSTD_outBuffer output = { out_buf, out_size, 0 };
+            last = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(last))
+            {
+                error_msg("Failed to decompress data: %s", ZSTD_getErrorName(last));
+                goto finito;
+            }
+
+            /* Keep sparse files (coredumps, vmcores) sparse */
+            if (is_hole(out_buf, output.pos))
+            {
+                if (lseek(dst_fd, output.pos, SEEK_CUR) < 0)
+                {
+                    perror_msg("Can't seek in decompressed data");
+                    goto finito;
+                }
+            }
+            else if ((size_t)full_write(dst_fd, out_buf, output.pos) != output.pos)
+            {
+                perror_msg("Can't write decompressed data");
+                goto finito;
+            }
+            written += output.pos;
+        }
+    }
+
+    if (r < 0)
+    {
+        perror_msg("Can't read compressed data");
+        goto finito;
+    }
+
+    if (last != 0)
+    {
+        error_msg("Compressed data are truncated");
+        goto finito;
+    }
+
+    /* A trailing hole must be materialized */
+    if (ftruncate(dst_fd, written) != 0)
+    {
+        perror_msg("Can't resize decompressed data");
+        goto finito;
+    }
+    ret = 0;
+
+ finito:
+    free(out_buf);
+    free(in_buf);
+    ZSTD_freeDCtx(dctx);
+    return ret;
+}
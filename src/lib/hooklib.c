@@ -41,6 +41,72 @@ int low_free_space(unsigned setting_MaxCrashReportsSize, const char *dump_locati
     return 0;
 }
 
+unsigned trimmed_dir_name_len(const char *dirname)
+{
+    unsigned len = strlen(dirname);
+    while (len > 1 && dirname[len-1] == '/')
+        len--;
+    return len;
+}
+
+/* The same as get_dirsize_find_largest_dir() but hidden directories are
+ * never picked. They are not problems: the trash, the staging directories of
+ * uploads and replication. Their size is still counted.
+ */
+static double get_dirsize_find_largest_problem(const char *dirname, char **worst_dir, const char *excluded)
+{
+    DIR *dp = opendir(dirname);
+    if (dp == NULL)
+        return 0;
+
+    const time_t now = time(NULL);
+    double size = 0;
+    double maxsz = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        struct stat st;
+        char *path = concat_path_file(dirname, dent->d_name);
+        if (lstat(path, &st) != 0)
+        {
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode))
+        {
+            double sz = get_dirsize(path);
+            size += sz;
+
+            if (dent->d_name[0] != '.' && (!excluded || strcmp(excluded, dent->d_name) != 0))
+            {
+                /* The same weight as libreport uses: kbytes * age in minutes */
+                sz /= 1024;
+                const long age = (now - st.st_mtime) / 60;
+                if (age > 0)
+                    sz *= age;
+
+                if (sz > maxsz)
+                {
+                    maxsz = sz;
+                    free(*worst_dir);
+                    *worst_dir = xstrdup(dent->d_name);
+                }
+            }
+        }
+        else if (S_ISREG(st.st_mode))
+            size += st.st_size;
+
+        free(path);
+    }
+    closedir(dp);
+
+    return size;
+}
+
 /* rhbz#539551: "abrt going crazy when crashing process is respawned".
  * Check total size of problem dirs, if it overflows,
  * delete oldest/biggest dirs.
@@ -50,10 +116,7 @@ void trim_problem_dirs(const char *dirname, double cap_size, const char *exclude
     const char *excluded_basename = NULL;
     if (exclude_path)
     {
-        unsigned len_dirname = strlen(dirname);
-        /* Trim trailing '/'s, but dont trim name "/" to "" */
-        while (len_dirname > 1 && dirname[len_dirname-1] == '/')
-            len_dirname--;
+        const unsigned len_dirname = trimmed_dir_name_len(dirname);
         if (strncmp(dirname, exclude_path, len_dirname) == 0
          && exclude_path[len_dirname] == '/'
         ) {
@@ -63,12 +126,16 @@ void trim_problem_dirs(const char *dirname, double cap_size, const char *exclude
     }
     log_debug("excluded_basename:'%s'", excluded_basename);
 
+    char *trash_dir = trash_location(dirname);
+
     int count = 20;
     while (--count >= 0)
     {
         /* We exclude our own dir from candidates for deletion (3rd param): */
         char *worst_basename = NULL;
-        double cur_size = get_dirsize_find_largest_dir(dirname, &worst_basename, excluded_basename);
+        double cur_size = get_dirsize_find_largest_problem(dirname, &worst_basename, excluded_basename);
+        /* Trashed directories are already on their way out */
+        cur_size -= get_dirsize(trash_dir);
         if (cur_size <= cap_size || !worst_basename)
         {
             log_info("cur_size:%.0f cap_size:%.0f, no (more) trimming", cur_size, cap_size);
@@ -79,9 +146,11 @@ void trim_problem_dirs(const char *dirname, double cap_size, const char *exclude
                 dirname, cur_size, cap_size / (1024*1024), worst_basename);
         char *d = concat_path_file(dirname, worst_basename);
         free(worst_basename);
-        delete_dump_dir(d);
+        trash_dump_dir(d);
         free(d);
     }
+
+    free(trash_dir);
 }
 
 /**
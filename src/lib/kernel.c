@@ -150,6 +150,141 @@ static const char *const s_koops_suspicious_strings[] = {
     NULL
 };
 
+/* Patterns classifying a kernel log line, see koops_classify_line() */
+enum {
+    /* Parts of the " [<.......>] function+0xFF/0xAA" pattern */
+    KOOPS_MARK_ADDRESS_END = 1 << 16,
+    KOOPS_MARK_OFFSET      = 1 << 17,
+    KOOPS_MARK_SIZE        = 1 << 18,
+    /* Candidate of an ARM register like "r7:df912310" */
+    KOOPS_MARK_ARM_REG     = 1 << 19,
+    KOOPS_MARKS            = KOOPS_MARK_ADDRESS_END | KOOPS_MARK_OFFSET
+                           | KOOPS_MARK_SIZE | KOOPS_MARK_ARM_REG,
+};
+
+static const struct {
+    const char *str;
+    unsigned flags;
+    unsigned value;
+} s_koops_line_patterns[] = {
+    { "Call Trace:",                STRING_MATCHER_IGNORE_CASE, KOOPS_LINE_TRACE_START },
+    /* Fatal MCE's have a few lines of useful information between
+     * first "Machine check exception:" line and the final "Kernel panic"
+     * line. Such oops, of course, is only detectable in kdumps (tested)
+     * or possibly pstore-saved logs (I did not try this yet).
+     * In order to capture all these lines, we treat final line
+     * as "backtrace" (which is admittedly a hack):
+     */
+    { "Kernel panic - not syncing", 0, KOOPS_LINE_TRACE_START },
+    { "---[ end trace",             0, KOOPS_LINE_END_TRACE },
+    { "Instruction dump:",          0, KOOPS_LINE_INSTRUCTION_DUMP },
+    /* Lines which do not break a call trace */
+    { "] [",                        0, KOOPS_LINE_CONTINUATION },
+    { "--- Exception",              0, KOOPS_LINE_CONTINUATION },
+    { "LR =",                       0, KOOPS_LINE_CONTINUATION },
+    { "<#DF>",                      0, KOOPS_LINE_CONTINUATION },
+    { "<IRQ>",                      0, KOOPS_LINE_CONTINUATION },
+    { "<EOI>",                      0, KOOPS_LINE_CONTINUATION },
+    { "<NMI>",                      0, KOOPS_LINE_CONTINUATION },
+    { "<<EOE>>",                    0, KOOPS_LINE_CONTINUATION },
+    { "Comm:",                      0, KOOPS_LINE_CONTINUATION },
+    { "Hardware name:",             0, KOOPS_LINE_CONTINUATION },
+    { "Backtrace:",                 0, KOOPS_LINE_CONTINUATION },
+    { ">]",                         0, KOOPS_MARK_ADDRESS_END },
+    { "+0x",                        0, KOOPS_MARK_OFFSET },
+    { "/0x",                        0, KOOPS_MARK_SIZE },
+    { "r0", 0, KOOPS_MARK_ARM_REG }, { "r1", 0, KOOPS_MARK_ARM_REG },
+    { "r2", 0, KOOPS_MARK_ARM_REG }, { "r3", 0, KOOPS_MARK_ARM_REG },
+    { "r4", 0, KOOPS_MARK_ARM_REG }, { "r5", 0, KOOPS_MARK_ARM_REG },
+    { "r6", 0, KOOPS_MARK_ARM_REG }, { "r7", 0, KOOPS_MARK_ARM_REG },
+    { "r8", 0, KOOPS_MARK_ARM_REG }, { "r9", 0, KOOPS_MARK_ARM_REG },
+};
+
+/* All patterns are searched for in a single pass over the line. The matcher
+ * lives as long as the process. */
+static struct abrt_string_matcher *s_koops_matcher;
+
+static const struct abrt_string_matcher *koops_line_matcher(void)
+{
+    if (s_koops_matcher != NULL)
+        return s_koops_matcher;
+
+    s_koops_matcher = string_matcher_new();
+    for (const char *const *str = s_koops_suspicious_strings; *str; ++str)
+        string_matcher_add(s_koops_matcher, *str, 0, KOOPS_LINE_START);
+
+    for (unsigned i = 0; i < ARRAY_SIZE(s_koops_line_patterns); ++i)
+        string_matcher_add(s_koops_matcher, s_koops_line_patterns[i].str,
+                s_koops_line_patterns[i].flags, s_koops_line_patterns[i].value);
+
+    string_matcher_compile(s_koops_matcher);
+    return s_koops_matcher;
+}
+
+/* Equivalent of regex "r[[:digit:]]{1,}:[a-f[:digit:]]{8}", e.g. r7:df912310 */
+static bool has_arm_register(const char *line)
+{
+    for (const char *r = strchr(line, 'r'); r != NULL; r = strchr(r + 1, 'r'))
+    {
+        const char *c = r + 1;
+        if (!isdigit((unsigned char)*c))
+            continue;
+
+        while (isdigit((unsigned char)*c))
+            ++c;
+
+        if (*c++ != ':')
+            continue;
+
+        int hex = 0;
+        while (hex < 8 && (isdigit((unsigned char)c[hex]) || (c[hex] >= 'a' && c[hex] <= 'f')))
+            ++hex;
+
+        if (hex == 8)
+            return true;
+    }
+
+    return false;
+}
+
+unsigned koops_classify_line(const char *line)
+{
+    while (*line == ' ')
+        line++;
+
+    unsigned cls = string_matcher_scan(koops_line_matcher(), line, strlen(line));
+
+    /* a call trace starts with "Call Trace:" or with the " [<.......>] function+0xFF/0xAA" pattern */
+    if ((cls & (KOOPS_MARK_ADDRESS_END | KOOPS_MARK_OFFSET | KOOPS_MARK_SIZE))
+            == (KOOPS_MARK_ADDRESS_END | KOOPS_MARK_OFFSET | KOOPS_MARK_SIZE)
+        && strnlen(line, 9) > 8
+        && (  (line[0] == '(' && line[1] == '[' && line[2] == '<')
+           || (line[0] == '[' && line[1] == '<')))
+    {
+        cls |= KOOPS_LINE_TRACE_START;
+    }
+
+    /* line needs to start with " [" or have "] [" if it is still a call trace */
+    /* example: "[<ffffffffa006c156>] radeon_get_ring_head+0x16/0x41 [radeon]" */
+    /* example s390: "([<ffffffffa006c156>] 0xdeadbeaf)" */
+    if (!(cls & KOOPS_LINE_CONTINUATION)
+        && (   line[0] == '['
+            || (line[0] == '(' && line[1] == '[')
+            || strncmp(line, "Code: ", 6) == 0
+            || strncmp(line, "RIP ", 4) == 0
+            || strncmp(line, "RSP ", 4) == 0
+            /* s390 Call Trace ends with 'Last Breaking-Event-Address:'
+             * which is followed by a single frame */
+            || strncmp(line, "Last Breaking-Event-Address:", strlen("Last Breaking-Event-Address:")) == 0
+            /* ARM dumps registers intertwined with the backtrace */
+            || ((cls & KOOPS_MARK_ARM_REG) && has_arm_register(line))))
+    {
+        cls |= KOOPS_LINE_CONTINUATION;
+    }
+
+    return cls & ~KOOPS_MARKS;
+}
+
 void koops_print_suspicious_strings(void)
 {
     koops_print_suspicious_strings_filtered(NULL);
@@ -237,287 +372,477 @@ int koops_line_skip_level(const char **c)
     return linelevel;
 }
 
-void koops_extract_oopses(GList **oops_list, char *buffer, size_t buflen)
+/* Lines after an oops start searched for the end marker */
+#define KOOPS_END_TRACE_LOOKAHEAD 50
+/* Longer oopses are dropped */
+#define KOOPS_MAX_OOPS_LINES 80
+/* Oopses without a backtrace are recorded after this many lines */
+#define KOOPS_MAX_NO_TRACE_LINES 40
+/* Longer lines are split, so that a broken input cannot eat all memory */
+#define KOOPS_MAX_LINE_LEN (64 * 1024)
+/* Number of unused lines to drop at once */
+#define KOOPS_DISCARD_BATCH 64
+
+/* The extractor keeps only the lines which can still become a part of an oops:
+ * the lines of the oops being extracted plus the look ahead window, i.e.
+ * the memory is bounded regardless of the input size. Indexes are relative
+ * to the first kept line.
+ *
+ * The kept lines are stored one after another in a bump allocated arena.
+ * Discarding lines from the front moves the rest to the beginning of the
+ * arena, so once the arena grows large enough, no more allocations happen.
+ */
+struct line_arena
 {
-    char *c;
-    int linecount = 0;
-    int lines_info_size = 0;
-    struct abrt_koops_line_info *lines_info = NULL;
+    char *buf;
+    size_t used;
+    size_t size;
+};
 
-    /* Split buffer into lines */
+struct abrt_koops_extractor
+{
+    struct abrt_koops_line_info *lines;
+    unsigned *classes;
+    int count;
+    int capacity;
+
+    struct line_arena arena;
+    /* NUL terminated copy of the line being fed */
+    char *scratch;
+    size_t scratch_size;
+
+    /* The next line to analyze */
+    int next;
+    int oopsstart;
+    int inbacktrace;
+    char prevlevel;
+
+    /* Incomplete last line of text input */
+    char *partial;
+    size_t partial_len;
+    size_t partial_size;
+};
 
-    if (buflen != 0)
-            buffer[buflen - 1] = '\n';  /* the buffer usually ends with \n, but let's make sure */
-    c = buffer;
-    while (c < buffer + buflen)
-    {
-        char linelevel;
-        char *c9;
-        char *colon;
-
-        linecount++;
-        c9 = (char*)memchr(c, '\n', buffer + buflen - c); /* a \n will always be found */
-        assert(c9);
-        *c9 = '\0'; /* turn the \n into a string termination */
-        if (c9 == c)
-            goto next_line;
-
-        /* Is it a syslog file (/var/log/messages or similar)?
-         * Even though _usually_ it looks like "Nov 19 12:34:38 localhost kernel: xxx",
-         * some users run syslog in non-C locale:
-         * "2010-02-22T09:24:08.156534-08:00 gnu-4 gnome-session[2048]: blah blah"
-         *  ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ !!!
-         * We detect it by checking for N:NN:NN pattern in first 15 chars
-         * (and this still is not good enough... false positive: "pci 0000:15:00.0: PME# disabled")
-         */
-        colon = strchr(c, ':');
-        if (colon && colon > c && colon < c + 15
-         && isdigit(colon[-1]) /* N:... */
-         && isdigit(colon[1]) /* ...N:NN:... */
-         && isdigit(colon[2])
-         && colon[3] == ':'
-         && isdigit(colon[4]) /* ...N:NN:NN... */
-         && isdigit(colon[5])
-        ) {
-            /* It's syslog file, not a bare dmesg */
-
-            /* Skip non-kernel lines */
-            char *kernel_str = strstr(c, "kernel: ");
-            if (!kernel_str)
-            {
-                /* if we see our own marker:
-                 * "hostname abrt: Kerneloops: Reported 1 kernel oopses to Abrt"
-                 * we know we submitted everything upto here already */
-                if (strstr(c, "kernel oopses to Abrt"))
-                {
-                    log_debug("Found our marker at line %d", linecount);
-                    free(lines_info);
-                    lines_info = NULL;
-                    lines_info_size = 0;
-                    list_free_with_free(*oops_list);
-                    *oops_list = NULL;
-                }
-                goto next_line;
-            }
-            c = kernel_str + sizeof("kernel: ")-1;
-        }
+struct abrt_koops_extractor *koops_extractor_new(void)
+{
+    struct abrt_koops_extractor *ex = xzalloc(sizeof(*ex));
+    ex->oopsstart = -1;
+    return ex;
+}
 
-        /* store and remove kernel log level */
-        linelevel = koops_line_skip_level((const char **)&c);
-        koops_line_skip_jiffies((const char **)&c);
+/* Points the kept lines to a new copy of the arena */
+static void extractor_rebase_lines(struct abrt_koops_extractor *ex, char *old_buf, char *new_buf)
+{
+    for (int l = 0; l < ex->count; ++l)
+        if (ex->lines[l].ptr)
+            ex->lines[l].ptr = new_buf + (ex->lines[l].ptr - old_buf);
+}
 
-        if ((lines_info_size & 0xfff) == 0)
+static char *extractor_store_line(struct abrt_koops_extractor *ex, const char *line, size_t len)
+{
+    struct line_arena *a = &ex->arena;
+    if (a->used + len + 1 > a->size)
+    {
+        const size_t size = MAX(a->size * 2, a->used + len + 1);
+        char *buf = xmalloc(size);
+        if (a->used > 0)
         {
-            lines_info = xrealloc(lines_info, (lines_info_size + 0x1000) * sizeof(lines_info[0]));
+            memcpy(buf, a->buf, a->used);
+            extractor_rebase_lines(ex, a->buf, buf);
         }
-        lines_info[lines_info_size].ptr = c;
-        lines_info[lines_info_size].level = linelevel;
-        lines_info_size++;
-next_line:
-        c = c9 + 1;
+        free(a->buf);
+        a->buf = buf;
+        a->size = size;
     }
 
-    koops_extract_oopses_from_lines(oops_list, lines_info, lines_info_size);
-    free(lines_info);
+    char *ptr = a->buf + a->used;
+    memcpy(ptr, line, len);
+    ptr[len] = '\0';
+    a->used += len + 1;
+    return ptr;
 }
 
-void koops_extract_oopses_from_lines(GList **oops_list, const struct abrt_koops_line_info *lines_info, int lines_info_size)
+static void extractor_discard_lines(struct abrt_koops_extractor *ex, int count)
 {
-    /* Analyze lines */
+    if (count <= 0)
+        return;
 
-    int i;
-    char prevlevel = 0;
-    int oopsstart = -1;
-    int inbacktrace = 0;
-    regex_t arm_regex;
-    int arm_regex_rc = 0;
+    /* The lines are stored in the order they were fed */
+    const char *first_kept = NULL;
+    for (int l = count; l < ex->count && first_kept == NULL; ++l)
+        first_kept = ex->lines[l].ptr;
+
+    struct line_arena *a = &ex->arena;
+    if (first_kept == NULL)
+        a->used = 0;
+    else
+    {
+        const size_t offset = first_kept - a->buf;
+        a->used -= offset;
+        memmove(a->buf, first_kept, a->used);
+        for (int l = count; l < ex->count; ++l)
+            if (ex->lines[l].ptr)
+                ex->lines[l].ptr -= offset;
+    }
+
+    ex->count -= count;
+    memmove(ex->lines, ex->lines + count, ex->count * sizeof(ex->lines[0]));
+    memmove(ex->classes, ex->classes + count, ex->count * sizeof(ex->classes[0]));
+
+    ex->next -= count;
+    if (ex->oopsstart >= 0)
+        ex->oopsstart -= count;
+}
+
+static void extractor_reset(struct abrt_koops_extractor *ex)
+{
+    extractor_discard_lines(ex, ex->count);
+    ex->next = 0;
+    ex->oopsstart = -1;
+    ex->inbacktrace = 0;
+    ex->prevlevel = 0;
+}
+
+void koops_extractor_free(struct abrt_koops_extractor *ex)
+{
+    if (ex == NULL)
+        return;
+
+    extractor_reset(ex);
+    free(ex->lines);
+    free(ex->classes);
+    free(ex->arena.buf);
+    free(ex->scratch);
+    free(ex->partial);
+    free(ex);
+}
+
+/* Analyzes a single line. Returns false if the line cannot be analyzed
+ * before more lines are available. */
+static bool extractor_step(struct abrt_koops_extractor *ex, GList **oops_list, bool flush)
+{
+    const struct abrt_koops_line_info *lines_info = ex->lines;
+    const int lines_info_size = ex->count;
+    int i = ex->next;
 
-    /* ARM backtrace regex, match a string similar to r7:df912310 */
-    arm_regex_rc = regcomp(&arm_regex, "r[[:digit:]]{1,}:[a-f[:digit:]]{8}", REG_EXTENDED | REG_NOSUB);
+    char *curline = lines_info[i].ptr;
+    const unsigned curclass = ex->classes[i];
 
-    i = 0;
-    while (i < lines_info_size)
+    if (curline == NULL)
     {
-        char *curline = lines_info[i].ptr;
+        ex->next = i + 1;
+        return true;
+    }
 
-        if (curline == NULL)
-        {
-            i++;
-            continue;
-        }
-        while (*curline == ' ')
-            curline++;
+    if (ex->oopsstart < 0 && (curclass & KOOPS_LINE_START)
+        && !flush && i + KOOPS_END_TRACE_LOOKAHEAD > lines_info_size)
+    {
+        /* The end marker can be in lines we haven't seen yet, unless
+         * it has already come and the oops can be emitted right now */
+        int i2 = i + 1;
+        while (i2 < lines_info_size && !(ex->classes[i2] & KOOPS_LINE_END_TRACE))
+            i2++;
+
+        if (i2 == lines_info_size)
+            return false;
+    }
 
-        if (oopsstart < 0)
+    while (*curline == ' ')
+        curline++;
+
+    if (ex->oopsstart < 0)
+    {
+        /* Find start-of-oops markers */
+        if (curclass & KOOPS_LINE_START)
+            ex->oopsstart = i;
+
+        if (ex->oopsstart >= 0)
         {
-            /* Find start-of-oops markers */
-            for (const char *const *str = s_koops_suspicious_strings; *str; ++str)
+            /* debug information */
+            log_debug("Found oops at line %d: '%s'", ex->oopsstart, lines_info[ex->oopsstart].ptr);
+            /* try to find the end marker */
+            int i2 = i + 1;
+            while (i2 < lines_info_size && i2 < (i + KOOPS_END_TRACE_LOOKAHEAD))
             {
-                if (strstr(curline, *str))
+                if (ex->classes[i2] & KOOPS_LINE_END_TRACE)
                 {
-                    oopsstart = i;
+                    ex->inbacktrace = 1;
+                    i = i2;
                     break;
                 }
+                i2++;
             }
+        }
+    }
 
-            if (oopsstart >= 0)
-            {
-                /* debug information */
-                log_debug("Found oops at line %d: '%s'", oopsstart, lines_info[oopsstart].ptr);
-                /* try to find the end marker */
-                int i2 = i + 1;
-                while (i2 < lines_info_size && i2 < (i+50))
-                {
-                    if (strstr(lines_info[i2].ptr, "---[ end trace"))
-                    {
-                        inbacktrace = 1;
-                        i = i2;
-                        break;
-                    }
-                    i2++;
-                }
-            }
+    /* Are we entering a call trace part? */
+    /* a call trace starts with "Call Trace:" or with the " [<.......>] function+0xFF/0xAA" pattern */
+    if (ex->oopsstart >= 0 && !ex->inbacktrace)
+    {
+        if (curclass & KOOPS_LINE_TRACE_START)
+            ex->inbacktrace = 1;
+    }
+
+    /* Are we at the end of an oops? */
+    else if (ex->oopsstart >= 0 && ex->inbacktrace)
+    {
+        int oopsend = INT_MAX;
+
+        if (!(curclass & KOOPS_LINE_CONTINUATION))
+        {
+            oopsend = i-1; /* not a call trace line */
         }
+        /* oops lines are always more than 8 chars long */
+        else if (strnlen(curline, 8) < 8)
+            oopsend = i-1;
+        /* single oopses are of the same loglevel */
+        else if (lines_info[i].level != ex->prevlevel)
+            oopsend = i-1;
+        else if (curclass & KOOPS_LINE_INSTRUCTION_DUMP)
+            oopsend = i;
+        /* kernel end-of-oops marker (not including marker itself) */
+        else if (curclass & KOOPS_LINE_END_TRACE)
+            oopsend = i-1;
+        /* if a new oops starts, this one has ended */
+        else if (curclass & KOOPS_LINE_START)
+            oopsend = i-1;
+
+        if (oopsend <= i)
+        {
+            log_debug("End of oops at line %d (%d): '%s'", oopsend, i, lines_info[oopsend].ptr);
+            record_oops(oops_list, lines_info, ex->oopsstart, oopsend);
+            ex->oopsstart = -1;
+            ex->inbacktrace = 0;
+        }
+    }
 
-        /* Are we entering a call trace part? */
-        /* a call trace starts with "Call Trace:" or with the " [<.......>] function+0xFF/0xAA" pattern */
-        if (oopsstart >= 0 && !inbacktrace)
+    ex->prevlevel = lines_info[i].level;
+    ex->next = ++i;
+
+    if (ex->oopsstart >= 0)
+    {
+        /* Do we have a suspiciously long oops? Cancel it.
+         * Bumped from 60 to 80 (see examples/oops_recursive_locking1.test)
+         */
+        if (i - ex->oopsstart > KOOPS_MAX_OOPS_LINES)
         {
-            if (strcasestr(curline, "Call Trace:")) /* yes, it must be case-insensitive */
-                inbacktrace = 1;
-            else
-            /* Fatal MCE's have a few lines of useful information between
-             * first "Machine check exception:" line and the final "Kernel panic"
-             * line. Such oops, of course, is only detectable in kdumps (tested)
-             * or possibly pstore-saved logs (I did not try this yet).
-             * In order to capture all these lines, we treat final line
-             * as "backtrace" (which is admittedly a hack):
+            ex->inbacktrace = 0;
+            ex->oopsstart = -1;
+            log_debug("Dropped oops, too long");
+        }
+        else if (!ex->inbacktrace && i - ex->oopsstart > KOOPS_MAX_NO_TRACE_LINES)
+        {
+            /* Used to drop oopses w/o backtraces, but some of them
+             * (MCEs, for example) don't have backtrace yet we still want to file them.
              */
-            if (strstr(curline, "Kernel panic - not syncing"))
-                inbacktrace = 1;
-            else
-            if (strnlen(curline, 9) > 8
-             && (  (curline[0] == '(' && curline[1] == '[' && curline[2] == '<')
-                || (curline[0] == '[' && curline[1] == '<'))
-             && strstr(curline, ">]")
-             && strstr(curline, "+0x")
-             && strstr(curline, "/0x")
-            ) {
-                inbacktrace = 1;
-            }
+            log_debug("One-line oops at line %d: '%s'", ex->oopsstart, lines_info[ex->oopsstart].ptr);
+            record_oops(oops_list, lines_info, ex->oopsstart, ex->oopsstart);
+            /*inbacktrace = 0; - already is */
+            ex->oopsstart = -1;
         }
+    }
 
-        /* Are we at the end of an oops? */
-        else if (oopsstart >= 0 && inbacktrace)
-        {
-            int oopsend = INT_MAX;
-
-            /* line needs to start with " [" or have "] [" if it is still a call trace */
-            /* example: "[<ffffffffa006c156>] radeon_get_ring_head+0x16/0x41 [radeon]" */
-            /* example s390: "([<ffffffffa006c156>] 0xdeadbeaf)" */
-            if ((curline[0] != '[' && (curline[0] != '(' || curline[1] != '['))
-             && !strstr(curline, "] [")
-             && !strstr(curline, "--- Exception")
-             && !strstr(curline, "LR =")
-             && !strstr(curline, "<#DF>")
-             && !strstr(curline, "<IRQ>")
-             && !strstr(curline, "<EOI>")
-             && !strstr(curline, "<NMI>")
-             && !strstr(curline, "<<EOE>>")
-             && !strstr(curline, "Comm:")
-             && !strstr(curline, "Hardware name:")
-             && !strstr(curline, "Backtrace:")
-             && strncmp(curline, "Code: ", 6) != 0
-             && strncmp(curline, "RIP ", 4) != 0
-             && strncmp(curline, "RSP ", 4) != 0
-             /* s390 Call Trace ends with 'Last Breaking-Event-Address:'
-              * which is followed by a single frame */
-             && strncmp(curline, "Last Breaking-Event-Address:", strlen("Last Breaking-Event-Address:")) != 0
-             /* ARM dumps registers intertwined with the backtrace */
-             && (arm_regex_rc == 0 ? regexec(&arm_regex, curline, 0, NULL, 0) == REG_NOMATCH : 1)
-            ) {
-                oopsend = i-1; /* not a call trace line */
-            }
-            /* oops lines are always more than 8 chars long */
-            else if (strnlen(curline, 8) < 8)
-                oopsend = i-1;
-            /* single oopses are of the same loglevel */
-            else if (lines_info[i].level != prevlevel)
-                oopsend = i-1;
-            else if (strstr(curline, "Instruction dump:"))
-                oopsend = i;
-            /* kernel end-of-oops marker (not including marker itself) */
-            else if (strstr(curline, "---[ end trace"))
-                oopsend = i-1;
-            else
-            {
-                /* if a new oops starts, this one has ended */
-                for (const char *const *str = s_koops_suspicious_strings; *str; ++str)
-                {
-                    if (strstr(curline, *str))
-                    {
-                        oopsend = i-1;
-                        break;
-                    }
-                }
-            }
+    return true;
+}
+
+static void extractor_run(struct abrt_koops_extractor *ex, GList **oops_list, bool flush)
+{
+    while (ex->next < ex->count && extractor_step(ex, oops_list, flush))
+        ;
+
+    /* Forget the lines which cannot be a part of an oops anymore,
+     * in batches to amortize moving of the kept lines */
+    const int unused = ex->oopsstart >= 0 ? ex->oopsstart : ex->next;
+    if (unused >= KOOPS_DISCARD_BATCH)
+        extractor_discard_lines(ex, unused);
+}
+
+void koops_extractor_feed_line(struct abrt_koops_extractor *ex, const char *line, int level, GList **oops_list)
+{
+    const unsigned cls = line ? koops_classify_line(line) : KOOPS_LINE_NONE;
+
+    /* Fast path for the vast majority of lines: no oops in progress and
+     * nothing waiting for look ahead, the line doesn't have to be kept */
+    if (ex->oopsstart < 0 && ex->next == ex->count && !(cls & KOOPS_LINE_START))
+    {
+        if (line)
+            ex->prevlevel = level;
+        return;
+    }
 
-            if (oopsend <= i)
+    if (ex->count == ex->capacity)
+    {
+        ex->capacity = ex->capacity ? ex->capacity * 2 : 64;
+        ex->lines = xrealloc(ex->lines, ex->capacity * sizeof(ex->lines[0]));
+        ex->classes = xrealloc(ex->classes, ex->capacity * sizeof(ex->classes[0]));
+    }
+
+    ex->lines[ex->count].ptr = line ? extractor_store_line(ex, line, strlen(line)) : NULL;
+    ex->lines[ex->count].level = level;
+    ex->classes[ex->count] = cls;
+    ex->count++;
+
+    extractor_run(ex, oops_list, /*flush*/false);
+}
+
+void koops_extractor_feed_message(struct abrt_koops_extractor *ex, const char *message, size_t len, GList **oops_list)
+{
+    /* A reused copy, the classifier needs NUL terminated strings */
+    if (len + 1 > ex->scratch_size)
+    {
+        ex->scratch_size = MAX(len + 1, ex->scratch_size * 2);
+        free(ex->scratch);
+        ex->scratch = xmalloc(ex->scratch_size);
+    }
+    memcpy(ex->scratch, message, len);
+    ex->scratch[len] = '\0';
+
+    const char *line = ex->scratch;
+    const int level = koops_line_skip_level(&line);
+    koops_line_skip_jiffies(&line);
+
+    koops_extractor_feed_line(ex, line, level, oops_list);
+}
+
+/* Handles a single NUL terminated line of dmesg or syslog */
+static void extractor_feed_log_line(struct abrt_koops_extractor *ex, char *c, GList **oops_list)
+{
+    if (*c == '\0')
+        return;
+
+    /* Is it a syslog file (/var/log/messages or similar)?
+     * Even though _usually_ it looks like "Nov 19 12:34:38 localhost kernel: xxx",
+     * some users run syslog in non-C locale:
+     * "2010-02-22T09:24:08.156534-08:00 gnu-4 gnome-session[2048]: blah blah"
+     *  ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ !!!
+     * We detect it by checking for N:NN:NN pattern in first 15 chars
+     * (and this still is not good enough... false positive: "pci 0000:15:00.0: PME# disabled")
+     */
+    char *colon = strchr(c, ':');
+    if (colon && colon > c && colon < c + 15
+     && isdigit(colon[-1]) /* N:... */
+     && isdigit(colon[1]) /* ...N:NN:... */
+     && isdigit(colon[2])
+     && colon[3] == ':'
+     && isdigit(colon[4]) /* ...N:NN:NN... */
+     && isdigit(colon[5])
+    ) {
+        /* It's syslog file, not a bare dmesg */
+
+        /* Skip non-kernel lines */
+        char *kernel_str = strstr(c, "kernel: ");
+        if (!kernel_str)
+        {
+            /* if we see our own marker:
+             * "hostname abrt: Kerneloops: Reported 1 kernel oopses to Abrt"
+             * we know we submitted everything upto here already */
+            if (strstr(c, "kernel oopses to Abrt"))
             {
-                log_debug("End of oops at line %d (%d): '%s'", oopsend, i, lines_info[oopsend].ptr);
-                record_oops(oops_list, lines_info, oopsstart, oopsend);
-                oopsstart = -1;
-                inbacktrace = 0;
+                log_debug("Found our marker");
+                extractor_reset(ex);
+                list_free_with_free(*oops_list);
+                *oops_list = NULL;
             }
+            return;
         }
+        c = kernel_str + sizeof("kernel: ")-1;
+    }
 
-        prevlevel = lines_info[i].level;
-        i++;
+    /* store and remove kernel log level */
+    const int linelevel = koops_line_skip_level((const char **)&c);
+    koops_line_skip_jiffies((const char **)&c);
 
-        if (oopsstart >= 0)
+    koops_extractor_feed_line(ex, c, (char)linelevel, oops_list);
+}
+
+void koops_extractor_feed(struct abrt_koops_extractor *ex, const char *buffer, size_t buflen, GList **oops_list)
+{
+    const char *const end = buffer + buflen;
+    while (buffer < end)
+    {
+        const char *eol = memchr(buffer, '\n', end - buffer);
+        size_t len = (eol ? eol : end) - buffer;
+
+        /* Lines are split to chunks of bounded length */
+        if (ex->partial_len + len > KOOPS_MAX_LINE_LEN)
         {
-            /* Do we have a suspiciously long oops? Cancel it.
-             * Bumped from 60 to 80 (see examples/oops_recursive_locking1.test)
-             */
-            if (i - oopsstart > 80)
-            {
-                inbacktrace = 0;
-                oopsstart = -1;
-                log_debug("Dropped oops, too long");
-                continue;
-            }
-            if (!inbacktrace && i - oopsstart > 40)
-            {
-                /* Used to drop oopses w/o backtraces, but some of them
-                 * (MCEs, for example) don't have backtrace yet we still want to file them.
-                 */
-                log_debug("One-line oops at line %d: '%s'", oopsstart, lines_info[oopsstart].ptr);
-                record_oops(oops_list, lines_info, oopsstart, oopsstart);
-                /*inbacktrace = 0; - already is */
-                oopsstart = -1;
-                continue;
-            }
+            len = KOOPS_MAX_LINE_LEN - ex->partial_len;
+            eol = buffer + len;
+        }
+
+        if (ex->partial_len + len + 1 > ex->partial_size)
+        {
+            ex->partial_size = ex->partial_len + len + 1;
+            ex->partial = xrealloc(ex->partial, ex->partial_size);
         }
-    } /* while (i < lines_info_size) */
+        memcpy(ex->partial + ex->partial_len, buffer, len);
+        ex->partial_len += len;
+        ex->partial[ex->partial_len] = '\0';
 
-    regfree(&arm_regex);
+        if (eol == NULL)
+            break; /* wait for the rest of the line */
+
+        extractor_feed_log_line(ex, ex->partial, oops_list);
+        ex->partial_len = 0;
+        buffer = (*eol == '\n') ? eol + 1 : eol;
+    }
+}
+
+bool koops_extractor_has_pending(const struct abrt_koops_extractor *ex)
+{
+    return ex->oopsstart >= 0 || ex->next < ex->count || ex->partial_len > 0;
+}
+
+void koops_extractor_flush(struct abrt_koops_extractor *ex, GList **oops_list)
+{
+    if (ex->partial_len > 0)
+    {
+        extractor_feed_log_line(ex, ex->partial, oops_list);
+        ex->partial_len = 0;
+    }
+
+    extractor_run(ex, oops_list, /*flush*/true);
 
     /* process last oops if we have one */
-    if (oopsstart >= 0)
+    if (ex->oopsstart >= 0)
     {
-        if (inbacktrace)
+        const struct abrt_koops_line_info *lines_info = ex->lines;
+        if (ex->inbacktrace)
         {
-            int oopsend = i-1;
+            int oopsend = ex->next - 1;
             log_debug("End of oops at line %d (end of file): '%s'", oopsend, lines_info[oopsend].ptr);
-            record_oops(oops_list, lines_info, oopsstart, oopsend);
+            record_oops(oops_list, lines_info, ex->oopsstart, oopsend);
         }
         else
         {
-            log_debug("One-line oops at line %d: '%s'", oopsstart, lines_info[oopsstart].ptr);
-            record_oops(oops_list, lines_info, oopsstart, oopsstart);
+            log_debug("One-line oops at line %d: '%s'", ex->oopsstart, lines_info[ex->oopsstart].ptr);
+            record_oops(oops_list, lines_info, ex->oopsstart, ex->oopsstart);
         }
     }
+
+    extractor_reset(ex);
 }
+
+void koops_extract_oopses(GList **oops_list, char *buffer, size_t buflen)
+{
+    if (buflen != 0)
+            buffer[buflen - 1] = '\n';  /* the buffer usually ends with \n, but let's make sure */
+
+    struct abrt_koops_extractor *ex = koops_extractor_new();
+    koops_extractor_feed(ex, buffer, buflen, oops_list);
+    koops_extractor_flush(ex, oops_list);
+    koops_extractor_free(ex);
+}
+
+void koops_extract_oopses_from_lines(GList **oops_list, const struct abrt_koops_line_info *lines_info, int lines_info_size)
+{
+    struct abrt_koops_extractor *ex = koops_extractor_new();
+    for (int i = 0; i < lines_info_size; ++i)
+        koops_extractor_feed_line(ex, lines_info[i].ptr, lines_info[i].level, oops_list);
+    koops_extractor_flush(ex, oops_list);
+    koops_extractor_free(ex);
+}
+
 int koops_hash_str_ext(char result[SHA1_RESULT_LEN*2 + 1], const char *oops_buf, int frame_count, int duphash_flags)
 {
     char *hash_str = NULL, *error = NULL;
@@ -576,6 +901,60 @@ int koops_hash_str(char result[SHA1_RESULT_LEN*2 + 1], const char *oops_buf)
     return koops_hash_str_ext(result, oops_buf, frame_count, duphash_flags);
 }
 
+/* The same number of frames koops_hash_str() uses */
+#define KOOPS_SIGNATURE_FRAMES 6
+
+static bool is_symbol_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+int koops_signature_str(char result[SHA1_RESULT_LEN*2 + 1], const char *oops_buf)
+{
+    sha1_ctx_t sha1ctx;
+    sha1_begin(&sha1ctx);
+
+    /* The oops type, e.g. "BUG" or "general protection fault" */
+    const char *eol = strchrnul(oops_buf, '\n');
+    const char *colon = memchr(oops_buf, ':', eol - oops_buf);
+    sha1_hash(&sha1ctx, oops_buf, (colon ? colon : eol) - oops_buf);
+
+    /* Function names of frames "[<ffffffff8108cfd4>] ? symbol+0x5f/0x80",
+     * without parsing the whole oops by satyr */
+    int frames = 0;
+    for (const char *line = eol; *line && frames < KOOPS_SIGNATURE_FRAMES; line = eol)
+    {
+        ++line;
+        eol = strchrnul(line, '\n');
+
+        const char *offset = memmem(line, eol - line, "+0x", 3);
+        if (offset == NULL)
+            continue;
+
+        const char *symbol = offset;
+        while (symbol > line && is_symbol_char(symbol[-1]))
+            --symbol;
+
+        /* Unreliable frames are left out of duphashes too */
+        if (symbol == offset || (symbol - line >= 2 && symbol[-2] == '?' && symbol[-1] == ' '))
+            continue;
+
+        sha1_hash(&sha1ctx, "\n", 1);
+        sha1_hash(&sha1ctx, symbol, offset - symbol);
+        ++frames;
+    }
+
+    /* Oopses without a call trace are unique */
+    if (frames == 0)
+        sha1_hash(&sha1ctx, oops_buf, strlen(oops_buf));
+
+    unsigned char hash_bytes[SHA1_RESULT_LEN];
+    sha1_end(&sha1ctx, hash_bytes);
+    bin2hex(result, (const char *)hash_bytes, SHA1_RESULT_LEN)[0] = '\0';
+
+    return frames;
+}
+
 char *koops_extract_version(const char *linepointer)
 {
     if (strstr(linepointer, "Pid")
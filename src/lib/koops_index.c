@@ -0,0 +1,200 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+#include "problem_api.h"
+
+/* Index of Kerneloops problems by their duplicate hash.
+ *
+ * The oops dumpers look up every extracted oops in the index and only bump
+ * the occurrence counter of the already existing problem instead of
+ * creating a new problem directory, which post-create would find to be
+ * a duplicate and delete anyway.
+ *
+ * The index file is a text file:
+ *   <dump location>
+ *   <hash> <problem directory name>
+ *   ...
+ * It is only a cache, see problem_cache.c for how it is kept up to date.
+ */
+
+#define KOOPS_TYPE "Kerneloops"
+
+struct abrt_koops_index
+{
+    /* hash -> problem directory name */
+    struct abrt_problem_cache cache;
+};
+
+static int add_problem_cb(struct dump_dir *dd, void *arg)
+{
+    struct abrt_problem_cache *cache = arg;
+
+    char *type = dd_snapshot_load_text(dd, FILENAME_TYPE,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    if (type == NULL || strcmp(type, KOOPS_TYPE) != 0)
+    {
+        free(type);
+        return 0;
+    }
+    free(type);
+
+    char *uuid = dd_snapshot_load_text(dd, FILENAME_UUID,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    if (uuid == NULL || uuid[0] == '\0')
+    {
+        free(uuid);
+        return 0;
+    }
+
+    const char *name = strrchr(dd->dd_dirname, '/');
+    name = name ? name + 1 : dd->dd_dirname;
+
+    /* There should be only one problem per hash, keep the first one */
+    if (g_hash_table_lookup(cache->problems, uuid) == NULL)
+        g_hash_table_insert(cache->problems, uuid, xstrdup(name));
+    else
+        free(uuid);
+
+    return 0;
+}
+
+static int read_entry(struct abrt_problem_cache *cache, char *line, int dump_fd)
+{
+    char *name = strchr(line, ' ');
+    if (name == NULL || name == line)
+        return -1;
+    *name++ = '\0';
+
+    /* Forget deleted problems, so the index doesn't grow forever */
+    if (problem_cache_has_dir(dump_fd, name))
+        g_hash_table_replace(cache->problems, xstrdup(line), xstrdup(name));
+    else
+        cache->modified = true;
+
+    return 0;
+}
+
+static void write_entry(FILE *fp, const char *hash, const void *name)
+{
+    fprintf(fp, "%s %s\n", hash, (const char *)name);
+}
+
+static const struct abrt_problem_cache_ops koops_index_ops = {
+    .what = "oops index",
+    .add_problem = add_problem_cb,
+    .read_entry = read_entry,
+    .write_entry = write_entry,
+    .free_entry = free,
+};
+
+struct abrt_koops_index *koops_index_load(const char *index_file, const char *dump_location)
+{
+    struct abrt_koops_index *index = xzalloc(sizeof(*index));
+    problem_cache_init(&index->cache, &koops_index_ops, index_file, dump_location);
+    return index;
+}
+
+void koops_index_free(struct abrt_koops_index *index)
+{
+    if (index == NULL)
+        return;
+
+    problem_cache_destroy(&index->cache);
+    free(index);
+}
+
+void koops_index_add(struct abrt_koops_index *index, const char *hash, const char *dirname)
+{
+    const char *name = strrchr(dirname, '/');
+    name = name ? name + 1 : dirname;
+
+    g_hash_table_replace(index->cache.problems, xstrdup(hash), xstrdup(name));
+    index->cache.modified = true;
+}
+
+static void koops_index_forget(struct abrt_koops_index *index, const char *hash)
+{
+    g_hash_table_remove(index->cache.problems, hash);
+    index->cache.modified = true;
+}
+
+int koops_index_record_occurrence(struct abrt_koops_index *index, const char *hash, time_t t, unsigned long occurrences)
+{
+    const char *name = g_hash_table_lookup(index->cache.problems, hash);
+    if (name == NULL)
+        return -1;
+
+    char *path = concat_path_file(index->cache.dump_location, name);
+    struct dump_dir *dd = dd_opendir(path, DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES);
+    if (dd == NULL)
+    {
+        log_notice("Oops index refers to a missing problem '%s'", path);
+        free(path);
+        koops_index_forget(index, hash);
+        return -1;
+    }
+
+    /* The directory may have been replaced or post-create hasn't run yet
+     * (then the problem was added by us and has no UUID) */
+    char *type = dd_load_text_ext(dd, FILENAME_TYPE,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    char *uuid = dd_load_text_ext(dd, FILENAME_UUID,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    const bool same = type != NULL && strcmp(type, KOOPS_TYPE) == 0
+                      && (uuid == NULL || strcmp(uuid, hash) == 0);
+    free(uuid);
+    free(type);
+    if (!same)
+    {
+        log_notice("Problem '%s' is not the indexed oops", path);
+        dd_close(dd);
+        free(path);
+        koops_index_forget(index, hash);
+        return -1;
+    }
+
+    char *count_str = dd_load_text_ext(dd, FILENAME_COUNT, DD_FAIL_QUIETLY_ENOENT);
+    unsigned long count = strtoul(count_str, NULL, 10);
+    free(count_str);
+
+    /* abrtd sets the count of new problems to 1 in post-create and leaves
+     * it alone if it is already set */
+    if (count == 0)
+        count = 1;
+    count += occurrences;
+
+    char new_count_str[sizeof(long)*3 + 2];
+    sprintf(new_count_str, "%lu", count);
+    dd_save_text(dd, FILENAME_COUNT, new_count_str);
+
+    char last_ocr[sizeof(long)*3 + 2];
+    sprintf(last_ocr, "%lu", (unsigned long)t);
+    dd_save_text(dd, FILENAME_LAST_OCCURRENCE, last_ocr);
+
+    dd_close(dd);
+
+    log_info("Oops is a duplicate of '%s', occurrence %lu", path, count);
+    free(path);
+    return 0;
+}
+
+int koops_index_save(struct abrt_koops_index *index)
+{
+    return problem_cache_save(&index->cache);
+}
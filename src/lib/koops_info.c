@@ -0,0 +1,379 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <satyr/stacktrace.h>
+#include <satyr/thread.h>
+#include <satyr/koops/stacktrace.h>
+#include <satyr/koops/frame.h>
+
+#include "internal_libabrt.h"
+
+/* Kerneloops parsed once.
+ *
+ * Parsing an oops by satyr is the most expensive part of its processing and
+ * every consumer used to parse the backtrace again: the dumper to find
+ * duplicates, abrt-action-analyze-oops to compute UUID and DUPHASH, the
+ * post-create deduplication for every compared problem. The dumper parses
+ * the oops when it creates the problem directory and saves the results in
+ * the 'koops_info' item:
+ *
+ *   format 1
+ *   kernel <version>
+ *   tainted <short taint flags>
+ *   reason <one line description>
+ *   hash <duplicate hash of the first 6 frames>
+ *   full_hash <duplicate hash of all frames>
+ *   module <name>
+ *   ...
+ *   frame <reliable 0/1> <function> [<module>]
+ *   ...
+ *
+ * Frames are the frames of the crash thread. Missing lines mean
+ * the value is not available. Problems created by older versions don't have
+ * the item, loading falls back to parsing the backtrace.
+ */
+
+#define KOOPS_INFO_FORMAT 1
+/* The same as koops_hash_str() */
+#define KOOPS_INFO_HASH_FRAMES 6
+#define KOOPS_INFO_HASH_FLAGS (SR_DUPHASH_NONORMALIZE|SR_DUPHASH_KOOPS_COMPAT)
+
+static void thread_hash(char result[SHA1_RESULT_LEN*2 + 1], struct sr_thread *thread, int frame_count, int duphash_flags)
+{
+    if (g_verbose >= 3)
+    {
+        char *hash_str = sr_thread_get_duphash(thread, frame_count, NULL,
+                                               duphash_flags|SR_DUPHASH_NOHASH);
+        if (hash_str)
+            log("Generating duphash: '%s'", hash_str);
+        else
+            log("Nothing useful for duphash");
+
+        free(hash_str);
+    }
+
+    result[0] = '\0';
+    char *hash_str = sr_thread_get_duphash(thread, frame_count, NULL, duphash_flags);
+    if (hash_str)
+    {
+        strncpy(result, hash_str, SHA1_RESULT_LEN*2);
+        result[SHA1_RESULT_LEN*2] = '\0';
+        free(hash_str);
+    }
+}
+
+static struct abrt_koops_frame *koops_frame_new(bool reliable, const char *function, const char *module)
+{
+    struct abrt_koops_frame *frame = xmalloc(sizeof(*frame));
+    frame->reliable = reliable;
+    frame->function = xstrdup(function);
+    frame->module = module && module[0] ? xstrdup(module) : NULL;
+    return frame;
+}
+
+static void koops_frame_free(struct abrt_koops_frame *frame)
+{
+    if (frame == NULL)
+        return;
+
+    free(frame->function);
+    free(frame->module);
+    free(frame);
+}
+
+static struct abrt_koops_info *koops_info_new(void)
+{
+    return xzalloc(sizeof(struct abrt_koops_info));
+}
+
+void koops_info_free(struct abrt_koops_info *info)
+{
+    if (info == NULL)
+        return;
+
+    free(info->kernel);
+    free(info->tainted);
+    free(info->reason);
+    list_free_with_free(info->modules);
+    g_list_free_full(info->frames, (GDestroyNotify)koops_frame_free);
+    free(info);
+}
+
+struct abrt_koops_info *koops_info_parse(const char *oops)
+{
+    struct abrt_koops_info *info = koops_info_new();
+
+    /* The first line is the kernel version */
+    const char *backtrace = strchrnul(oops, '\n');
+    if (backtrace != oops)
+        info->kernel = xstrndup(oops, backtrace - oops);
+    if (*backtrace)
+        ++backtrace;
+
+    info->tainted = kernel_tainted_short(backtrace);
+
+    char *error = NULL;
+    struct sr_stacktrace *stacktrace = sr_stacktrace_parse(SR_REPORT_KERNELOOPS, backtrace, &error);
+    if (stacktrace == NULL)
+    {
+        log_debug("Failed to parse koops: %s", error);
+        free(error);
+        return info;
+    }
+
+    info->reason = sr_stacktrace_get_reason(stacktrace);
+    /* The item is line oriented */
+    for (char *c = info->reason; c && *c; ++c)
+        if (*c == '\n')
+            *c = ' ';
+
+    const struct sr_koops_stacktrace *koops = (const struct sr_koops_stacktrace *)stacktrace;
+    for (char **module = koops->modules; module && *module; ++module)
+        info->modules = g_list_prepend(info->modules, xstrdup(*module));
+    info->modules = g_list_reverse(info->modules);
+
+    /* A kernel oops is a single thread */
+    struct sr_thread *thread = sr_stacktrace_find_crash_thread(stacktrace);
+    if (thread)
+    {
+        thread_hash(info->hash, thread, KOOPS_INFO_HASH_FRAMES, KOOPS_INFO_HASH_FLAGS);
+        thread_hash(info->full_hash, thread, /*no frame count limit*/-1, /*every frame*/0);
+
+        for (const struct sr_koops_frame *f = koops->frames; f; f = f->next)
+        {
+            if (f->function_name == NULL || strpbrk(f->function_name, " \n") != NULL)
+                continue;
+
+            info->frames = g_list_prepend(info->frames,
+                    koops_frame_new(f->reliable, f->function_name, f->module_name));
+        }
+        info->frames = g_list_reverse(info->frames);
+    }
+    else
+        log_debug("Failed to find crash thread");
+
+    sr_stacktrace_free(stacktrace);
+    return info;
+}
+
+const char *koops_info_index_hash(const struct abrt_koops_info *info)
+{
+    /* The same hash abrt-action-analyze-oops saves as UUID */
+    if (info->hash[0])
+        return info->hash;
+    if (info->full_hash[0])
+        return info->full_hash;
+    return NULL;
+}
+
+char *koops_info_to_str(const struct abrt_koops_info *info)
+{
+    struct strbuf *buf = strbuf_new();
+    strbuf_append_strf(buf, "format %d\n", KOOPS_INFO_FORMAT);
+    if (info->kernel)
+        strbuf_append_strf(buf, "kernel %s\n", info->kernel);
+    if (info->tainted)
+        strbuf_append_strf(buf, "tainted %s\n", info->tainted);
+    if (info->reason)
+        strbuf_append_strf(buf, "reason %s\n", info->reason);
+    if (info->hash[0])
+        strbuf_append_strf(buf, "hash %s\n", info->hash);
+    if (info->full_hash[0])
+        strbuf_append_strf(buf, "full_hash %s\n", info->full_hash);
+
+    for (GList *l = info->modules; l; l = l->next)
+        strbuf_append_strf(buf, "module %s\n", (const char *)l->data);
+
+    for (GList *l = info->frames; l; l = l->next)
+    {
+        const struct abrt_koops_frame *frame = l->data;
+        strbuf_append_strf(buf, "frame %d %s%s%s\n", frame->reliable, frame->function,
+                frame->module ? " " : "", frame->module ? frame->module : "");
+    }
+
+    return strbuf_free_nobuf(buf);
+}
+
+static void copy_hash(char result[SHA1_RESULT_LEN*2 + 1], const char *value)
+{
+    if (strlen(value) != SHA1_RESULT_LEN*2)
+        return;
+
+    strcpy(result, value);
+}
+
+struct abrt_koops_info *koops_info_from_str(const char *str)
+{
+    struct abrt_koops_info *info = koops_info_new();
+
+    bool format_ok = false;
+    const char *eol;
+    for (const char *line = str; *line; line = *eol ? eol + 1 : eol)
+    {
+        eol = strchrnul(line, '\n');
+        const char *space = memchr(line, ' ', eol - line);
+        if (space == NULL)
+            continue;
+
+        const size_t key_len = space - line;
+        char *value = xstrndup(space + 1, eol - space - 1);
+#define KEY_IS(key) (key_len == strlen(key) && strncmp(line, key, key_len) == 0)
+        if (KEY_IS("format"))
+            format_ok = atoi(value) == KOOPS_INFO_FORMAT;
+        else if (KEY_IS("kernel"))
+        {
+            free(info->kernel);
+            info->kernel = value;
+            value = NULL;
+        }
+        else if (KEY_IS("tainted"))
+        {
+            free(info->tainted);
+            info->tainted = value;
+            value = NULL;
+        }
+        else if (KEY_IS("reason"))
+        {
+            free(info->reason);
+            info->reason = value;
+            value = NULL;
+        }
+        else if (KEY_IS("hash"))
+            copy_hash(info->hash, value);
+        else if (KEY_IS("full_hash"))
+            copy_hash(info->full_hash, value);
+        else if (KEY_IS("module"))
+        {
+            info->modules = g_list_prepend(info->modules, value);
+            value = NULL;
+        }
+        else if (KEY_IS("frame") && (value[0] == '0' || value[0] == '1') && value[1] == ' ' && value[2])
+        {
+            char *function = value + 2;
+            char *module = strchr(function, ' ');
+            if (module)
+                *module++ = '\0';
+
+            info->frames = g_list_prepend(info->frames,
+                    koops_frame_new(value[0] == '1', function, module));
+        }
+#undef KEY_IS
+        free(value);
+    }
+
+    if (!format_ok)
+    {
+        koops_info_free(info);
+        return NULL;
+    }
+
+    info->modules = g_list_reverse(info->modules);
+    info->frames = g_list_reverse(info->frames);
+    return info;
+}
+
+int dd_save_koops_info(struct dump_dir *dd, const struct abrt_koops_info *info)
+{
+    char *str = koops_info_to_str(info);
+    dd_save_text(dd, FILENAME_KOOPS_INFO, str);
+    free(str);
+    return 0;
+}
+
+bool dd_koops_info_is_current(struct dump_dir *dd)
+{
+    struct stat info_st;
+    if (fstatat(dd->dd_fd, FILENAME_KOOPS_INFO, &info_st, AT_SYMLINK_NOFOLLOW) != 0
+        || !S_ISREG(info_st.st_mode))
+        return false;
+
+    /* Nothing to parse instead */
+    struct stat bt_st;
+    if (fstatat(dd->dd_fd, FILENAME_BACKTRACE, &bt_st, AT_SYMLINK_NOFOLLOW) != 0)
+        return true;
+
+    /* Saved together with the backtrace by the dumper, so within the same
+     * tick of the clock or later */
+    return info_st.st_mtim.tv_sec > bt_st.st_mtim.tv_sec
+           || (info_st.st_mtim.tv_sec == bt_st.st_mtim.tv_sec
+               && info_st.st_mtim.tv_nsec >= bt_st.st_mtim.tv_nsec);
+}
+
+struct abrt_koops_info *dd_load_koops_info(struct dump_dir *dd)
+{
+    char *str = NULL;
+    if (dd_koops_info_is_current(dd))
+        str = dd_snapshot_load_text(dd, FILENAME_KOOPS_INFO,
+                DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    else if (dd_exist(dd, FILENAME_KOOPS_INFO))
+        log_notice("'%s/%s' is older than '%s', parsing the backtrace",
+                dd->dd_dirname, FILENAME_KOOPS_INFO, FILENAME_BACKTRACE);
+
+    if (str)
+    {
+        struct abrt_koops_info *info = koops_info_from_str(str);
+        free(str);
+        if (info)
+            return info;
+
+        log_notice("'%s/%s' has unknown format, parsing the backtrace", dd->dd_dirname, FILENAME_KOOPS_INFO);
+    }
+
+    /* Created by an older version or the backtrace has been changed */
+    char *backtrace = dd_snapshot_load_text(dd, FILENAME_BACKTRACE,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    if (backtrace == NULL)
+        return NULL;
+
+    char *kernel = dd_snapshot_load_text(dd, FILENAME_KERNEL,
+            DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE);
+    char *oops = xasprintf("%s\n%s", kernel ? kernel : "", backtrace);
+    free(kernel);
+    free(backtrace);
+
+    struct abrt_koops_info *info = koops_info_parse(oops);
+    free(oops);
+    return info;
+}
+
+struct sr_stacktrace *koops_info_to_stacktrace(const struct abrt_koops_info *info)
+{
+    if (info->frames == NULL)
+        return NULL;
+
+    struct sr_koops_stacktrace *stacktrace = sr_koops_stacktrace_new();
+    if (info->kernel)
+        stacktrace->version = xstrdup(info->kernel);
+
+    struct sr_koops_frame **tail = &stacktrace->frames;
+    for (GList *l = info->frames; l; l = l->next)
+    {
+        const struct abrt_koops_frame *frame = l->data;
+
+        struct sr_koops_frame *f = sr_koops_frame_new();
+        f->reliable = frame->reliable;
+        f->function_name = xstrdup(frame->function);
+        if (frame->module)
+            f->module_name = xstrdup(frame->module);
+
+        *tail = f;
+        tail = &f->next;
+    }
+
+    return (struct sr_stacktrace *)stacktrace;
+}
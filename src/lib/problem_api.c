@@ -21,14 +21,11 @@
 #include <sys/time.h>
 #include "problem_api.h"
 
-/*
- * Goes through all problems and for problems accessible by caller_uid
- * calls callback. If callback returns non-0, returns that value.
- */
-int for_each_problem_in_dir(const char *path,
+static int iterate_problems_in_dir(const char *path,
                         uid_t caller_uid,
                         int (*callback)(struct dump_dir *dd, void *arg),
-                        void *arg)
+                        void *arg,
+                        bool snapshot)
 {
     DIR *dp = opendir(path);
     if (!dp)
@@ -42,8 +39,9 @@ int for_each_problem_in_dir(const char *path,
     struct dirent *dent;
     while ((dent = readdir(dp)) != NULL)
     {
-        if (dot_or_dotdot(dent->d_name))
-            continue; /* skip "." and ".." */
+        /* skip ".", ".." and hidden entries like the trash */
+        if (dent->d_name[0] == '.')
+            continue;
 
         char *full_name = concat_path_file(path, dent->d_name);
 
@@ -58,17 +56,27 @@ int for_each_problem_in_dir(const char *path,
 
         if (caller_uid == -1 || dd_accessible_by_uid(dd, caller_uid))
         {
-            /* Silently ignore *any* errors, not only EACCES.
-             * We saw "lock file is locked by process PID" error
-             * when we raced with wizard.
-             */
-            int sv_logmode = logmode;
-            /* Silently ignore errors only in the silent log level. */
-            logmode = g_verbose == 0 ? 0: sv_logmode;
-            dd = dd_fdopendir(dd, DD_OPEN_READONLY | DD_DONT_WAIT_FOR_LOCK);
-            logmode = sv_logmode;
-            if (dd)
-                brk = callback ? callback(dd, arg) : 0;
+            if (snapshot)
+            {
+                /* Directories being created or modified right now are
+                 * skipped the same way as the locked ones below */
+                if (dd_snapshot_is_valid_dir(dd))
+                    brk = callback ? callback(dd, arg) : 0;
+            }
+            else
+            {
+                /* Silently ignore *any* errors, not only EACCES.
+                 * We saw "lock file is locked by process PID" error
+                 * when we raced with wizard.
+                 */
+                int sv_logmode = logmode;
+                /* Silently ignore errors only in the silent log level. */
+                logmode = g_verbose == 0 ? 0: sv_logmode;
+                dd = dd_fdopendir(dd, DD_OPEN_READONLY | DD_DONT_WAIT_FOR_LOCK);
+                logmode = sv_logmode;
+                if (dd)
+                    brk = callback ? callback(dd, arg) : 0;
+            }
         }
 
         if (dd)
@@ -83,6 +91,29 @@ int for_each_problem_in_dir(const char *path,
     return brk;
 }
 
+/*
+ * Goes through all problems and for problems accessible by caller_uid
+ * calls callback. If callback returns non-0, returns that value.
+ */
+int for_each_problem_in_dir(const char *path,
+                        uid_t caller_uid,
+                        int (*callback)(struct dump_dir *dd, void *arg),
+                        void *arg)
+{
+    return iterate_problems_in_dir(path, caller_uid, callback, arg, /*snapshot*/false);
+}
+
+/*
+ * The same as for_each_problem_in_dir() but the problems are not locked.
+ */
+int for_each_problem_snapshot_in_dir(const char *path,
+                        uid_t caller_uid,
+                        int (*callback)(struct dump_dir *dd, void *arg),
+                        void *arg)
+{
+    return iterate_problems_in_dir(path, caller_uid, callback, arg, /*snapshot*/true);
+}
+
 /* get_problem_dirs_for_uid and its helpers */
 
 static int add_dirname_to_GList(struct dump_dir *dd, void *arg)
@@ -102,7 +133,7 @@ static int add_dirname_to_GList(struct dump_dir *dd, void *arg)
 GList *get_problem_dirs_for_uid(uid_t uid, const char *dump_location)
 {
     GList *list = NULL;
-    for_each_problem_in_dir(dump_location, uid, add_dirname_to_GList, &list);
+    for_each_problem_snapshot_in_dir(dump_location, uid, add_dirname_to_GList, &list);
     /*
      * Why reverse?
      * Because N*prepend+reverse is faster than N*append
@@ -134,7 +165,7 @@ GList *get_problem_dirs_not_accessible_by_uid(uid_t uid, const char *dump_locati
         .list = NULL,
     };
 
-    for_each_problem_in_dir(dump_location, /*disable default uid check*/-1, add_dirname_to_GList_if_not_accessible, &args);
+    for_each_problem_snapshot_in_dir(dump_location, /*disable default uid check*/-1, add_dirname_to_GList_if_not_accessible, &args);
     return g_list_reverse(args.list);
 }
 
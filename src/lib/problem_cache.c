@@ -0,0 +1,157 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+#include "problem_api.h"
+
+/* A cache of the problems in a dump location, persisted in a text file:
+ *   <dump location>
+ *   <entry>
+ *   ...
+ * The format of the entries is up to the user of the cache. The file is
+ * replaced atomically, so concurrent users can lose an update but never
+ * see a broken file. Entries are verified against the problem directories
+ * before use and the cache is rebuilt from the dump location if the file is
+ * missing or belongs to another location.
+ */
+
+static void problem_cache_rebuild(struct abrt_problem_cache *cache)
+{
+    log_notice("Rebuilding %s of '%s'", cache->ops->what, cache->dump_location);
+
+    g_hash_table_remove_all(cache->problems);
+    for_each_problem_snapshot_in_dir(cache->dump_location, /*any uid*/-1, cache->ops->add_problem, cache);
+    cache->modified = true;
+}
+
+/* Returns -1 if the file can't be used */
+static int problem_cache_read(struct abrt_problem_cache *cache)
+{
+    FILE *fp = fopen(cache->file, "r");
+    if (fp == NULL)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", cache->file);
+        return -1;
+    }
+
+    int ret = -1;
+    char *line = xmalloc_fgetline(fp);
+    if (line == NULL || strcmp(line, cache->dump_location) != 0)
+    {
+        log_notice("'%s' is not the %s of '%s'", cache->file, cache->ops->what, cache->dump_location);
+        goto finito;
+    }
+
+    const int dump_fd = open(cache->dump_location, O_RDONLY | O_DIRECTORY);
+    if (dump_fd < 0)
+        goto finito;
+
+    while (free(line), (line = xmalloc_fgetline(fp)) != NULL)
+    {
+        if (cache->ops->read_entry(cache, line, dump_fd) != 0)
+            log_notice("Ignoring malformed line in '%s'", cache->file);
+    }
+    close(dump_fd);
+    ret = 0;
+
+ finito:
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+void problem_cache_init(struct abrt_problem_cache *cache,
+                const struct abrt_problem_cache_ops *ops,
+                const char *file,
+                const char *dump_location)
+{
+    cache->ops = ops;
+    cache->file = xstrdup(file);
+    cache->dump_location = xstrndup(dump_location, trimmed_dir_name_len(dump_location));
+    cache->problems = g_hash_table_new_full(g_str_hash, g_str_equal, free, ops->free_entry);
+    cache->modified = false;
+
+    if (problem_cache_read(cache) != 0)
+        problem_cache_rebuild(cache);
+
+    log_debug("The %s of '%s' contains %u problems",
+            ops->what, cache->dump_location, g_hash_table_size(cache->problems));
+}
+
+void problem_cache_destroy(struct abrt_problem_cache *cache)
+{
+    g_hash_table_destroy(cache->problems);
+    free(cache->dump_location);
+    free(cache->file);
+}
+
+bool problem_cache_has_dir(int dump_fd, const char *name)
+{
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL)
+        return false;
+
+    struct stat st;
+    return fstatat(dump_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+int problem_cache_save(struct abrt_problem_cache *cache)
+{
+    if (!cache->modified)
+        return 0;
+
+    char *tmp_file = xasprintf("%s.tmp", cache->file);
+    FILE *fp = fopen(tmp_file, "w");
+    if (fp == NULL)
+    {
+        perror_msg("Can't create '%s'", tmp_file);
+        free(tmp_file);
+        return -1;
+    }
+
+    fprintf(fp, "%s\n", cache->dump_location);
+
+    GHashTableIter iter;
+    gpointer key, entry;
+    g_hash_table_iter_init(&iter, cache->problems);
+    while (g_hash_table_iter_next(&iter, &key, &entry))
+        cache->ops->write_entry(fp, key, entry);
+
+    /* The cache must survive a crash, don't rename an empty file */
+    int ret = 0;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || ferror(fp))
+    {
+        perror_msg("Can't write '%s'", tmp_file);
+        ret = -1;
+    }
+    fclose(fp);
+
+    if (ret == 0 && rename(tmp_file, cache->file) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_file, cache->file);
+        ret = -1;
+    }
+
+    if (ret != 0)
+        unlink(tmp_file);
+    else
+        cache->modified = false;
+
+    free(tmp_file);
+    return ret;
+}
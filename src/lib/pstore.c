@@ -0,0 +1,349 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "internal_libabrt.h"
+
+/* Kernel log dumps saved in pstore are split into records of the size
+ * of the backend's buffer:
+ *   Panic#1 Part1
+ *   <the last part of kernel log>
+ * The parts are numbered from the end of the log, the reason ("Panic",
+ * "Oops", ...) depends on the kernel version. If the kernel failed to
+ * decompress a record, the record is exposed as is in a file with the
+ * suffix ".enc.z" (deflate with or without zlib header).
+ *
+ * Only the headers are read in advance, the records are mapped and passed
+ * to the consumer one by one in the order of the log.
+ */
+
+#define PSTORE_COMPRESSED_SUFFIX ".enc.z"
+/* "Emergency#4294967295 Part4294967295" */
+#define PSTORE_MAX_HEADER_LEN 64
+#define PSTORE_INFLATE_CHUNK (64 * 1024)
+
+struct pstore_record
+{
+    struct abrt_pstore_part part;
+    bool compressed;
+};
+
+static bool is_compressed(const char *filename)
+{
+    const size_t len = strlen(filename);
+    const size_t suffix_len = strlen(PSTORE_COMPRESSED_SUFFIX);
+    return len > suffix_len && strcmp(filename + len - suffix_len, PSTORE_COMPRESSED_SUFFIX) == 0;
+}
+
+/* Returns the length of the header line including '\n' or 0 */
+static size_t parse_header(const char *data, size_t size, struct abrt_pstore_part *part)
+{
+    const char *eol = memchr(data, '\n', MIN(size, PSTORE_MAX_HEADER_LEN));
+    if (eol == NULL)
+        return 0;
+
+    char header[PSTORE_MAX_HEADER_LEN + 1];
+    memcpy(header, data, eol - data);
+    header[eol - data] = '\0';
+
+    unsigned panic_no, part_no;
+    if (sscanf(header, "%*[A-Za-z]#%u Part%u", &panic_no, &part_no) != 2)
+        return 0;
+
+    part->panic_no = panic_no;
+    part->part_no = part_no;
+    return eol - data + 1;
+}
+
+typedef int (*inflate_sink)(const char *buf, size_t len, void *arg);
+
+/* Returns 0 at the end of input, 1 if the sink stopped it, -1 on error.
+ * Truncated input is not an error, pstore backends may cut records. */
+static int pstore_inflate(const char *data, size_t size, inflate_sink sink, void *arg)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    int window_bits = -MAX_WBITS; /* raw deflate */
+    if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+        window_bits = MAX_WBITS + 16; /* gzip */
+    else if (size >= 2 && (bytes[0] & 0x0f) == Z_DEFLATED && ((bytes[0] << 8) | bytes[1]) % 31 == 0)
+        window_bits = MAX_WBITS; /* zlib */
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, window_bits) != Z_OK)
+        return -1;
+
+    char *out = xmalloc(PSTORE_INFLATE_CHUNK);
+    int ret = 0;
+    int r = Z_OK;
+    while (r != Z_STREAM_END)
+    {
+        if (zs.avail_in == 0)
+        {
+            if (size == 0)
+                break;
+
+            zs.next_in = (Bytef *)bytes;
+            zs.avail_in = MIN(size, (size_t)UINT_MAX);
+            bytes += zs.avail_in;
+            size -= zs.avail_in;
+        }
+
+        zs.next_out = (Bytef *)out;
+        zs.avail_out = PSTORE_INFLATE_CHUNK;
+        r = inflate(&zs, Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+        {
+            log_notice("Can't decompress pstore record: %s", zs.msg ? zs.msg : "unknown error");
+            ret = -1;
+            break;
+        }
+
+        const size_t have = PSTORE_INFLATE_CHUNK - zs.avail_out;
+        if (have > 0 && sink(out, have, arg) != 0)
+        {
+            ret = 1;
+            break;
+        }
+
+        /* No progress */
+        if (r == Z_BUF_ERROR && size == 0)
+            break;
+    }
+
+    free(out);
+    inflateEnd(&zs);
+    return ret;
+}
+
+struct header_sink
+{
+    char buf[PSTORE_MAX_HEADER_LEN];
+    size_t len;
+};
+
+static int collect_header(const char *buf, size_t len, void *arg)
+{
+    struct header_sink *hs = arg;
+    const size_t n = MIN(len, sizeof(hs->buf) - hs->len);
+    memcpy(hs->buf + hs->len, buf, n);
+    hs->len += n;
+    return memchr(hs->buf, '\n', hs->len) != NULL || hs->len == sizeof(hs->buf);
+}
+
+struct part_sink
+{
+    const struct abrt_pstore_part *part;
+    pstore_part_callback callback;
+    void *arg;
+    /* The header line hasn't been skipped yet */
+    bool in_header;
+    bool fed;
+};
+
+static int feed_part(const char *buf, size_t len, void *arg)
+{
+    struct part_sink *ps = arg;
+    if (ps->in_header)
+    {
+        const char *eol = memchr(buf, '\n', len);
+        if (eol == NULL)
+            return 0;
+
+        ps->in_header = false;
+        len -= eol + 1 - buf;
+        buf = eol + 1;
+        if (len == 0)
+            return 0;
+    }
+
+    ps->fed = true;
+    return ps->callback(ps->part, buf, len, ps->arg);
+}
+
+/* Returns NULL for empty or not regular files */
+static char *map_file(const char *filename, size_t *size)
+{
+    const int fd = open(filename, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", filename);
+        return NULL;
+    }
+
+    char *data = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            perror_msg("Can't map '%s'", filename);
+            data = NULL;
+        }
+        else
+        {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            *size = st.st_size;
+        }
+    }
+    close(fd);
+
+    return data;
+}
+
+static bool read_record_header(const char *filename, struct pstore_record *record)
+{
+    size_t size;
+    char *data = map_file(filename, &size);
+    if (data == NULL)
+        return false;
+
+    record->part.filename = filename;
+    record->compressed = is_compressed(filename);
+
+    size_t header_len;
+    if (record->compressed)
+    {
+        struct header_sink hs = { .len = 0 };
+        pstore_inflate(data, size, collect_header, &hs);
+        header_len = parse_header(hs.buf, hs.len, &record->part);
+    }
+    else
+        header_len = parse_header(data, size, &record->part);
+
+    munmap(data, size);
+
+    if (header_len == 0)
+        log_info("'%s' is not a pstore record", filename);
+
+    return header_len != 0;
+}
+
+/* Panics in ascending order, parts in descending order */
+static int compare_records(const void *a, const void *b)
+{
+    const struct pstore_record *aa = a;
+    const struct pstore_record *bb = b;
+    if (aa->part.panic_no != bb->part.panic_no)
+        return aa->part.panic_no < bb->part.panic_no ? -1 : 1;
+    if (aa->part.part_no != bb->part.part_no)
+        return aa->part.part_no > bb->part.part_no ? -1 : 1;
+    return 0;
+}
+
+static int feed_record(const struct pstore_record *record, pstore_part_callback callback, void *arg)
+{
+    size_t size;
+    char *data = map_file(record->part.filename, &size);
+    if (data == NULL)
+        return 0;
+
+    struct part_sink ps = {
+        .part = &record->part,
+        .callback = callback,
+        .arg = arg,
+        .in_header = true,
+    };
+
+    int r = 0;
+    if (record->compressed)
+        r = pstore_inflate(data, size, feed_part, &ps) == 1;
+    else
+        r = feed_part(data, size, &ps);
+
+    /* Let the consumer know about records without text too */
+    if (r == 0 && !ps.fed)
+        r = callback(&record->part, "", 0, arg);
+
+    munmap(data, size);
+    return r;
+}
+
+int pstore_merge_files(const char *const *filenames, unsigned count, pstore_part_callback callback, void *arg)
+{
+    struct pstore_record *records = NULL;
+    unsigned records_count = 0;
+    unsigned records_size = 0;
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (records_count == records_size)
+        {
+            records_size = records_size ? records_size * 2 : 32;
+            records = xrealloc(records, records_size * sizeof(records[0]));
+        }
+
+        if (read_record_header(filenames[i], &records[records_count]))
+            ++records_count;
+    }
+
+    qsort(records, records_count, sizeof(records[0]), compare_records);
+
+    for (unsigned i = 0; i < records_count; ++i)
+    {
+        log_debug("Merging '%s' (panic %u, part %u)", records[i].part.filename,
+                records[i].part.panic_no, records[i].part.part_no);
+
+        if (feed_record(&records[i], callback, arg) != 0)
+            break;
+    }
+
+    free(records);
+    return records_count;
+}
+
+struct pstore_extraction
+{
+    struct abrt_koops_extractor *extractor;
+    GList **oops_list;
+    unsigned panic_no;
+    bool started;
+};
+
+static int extract_part(const struct abrt_pstore_part *part, const char *text, size_t len, void *arg)
+{
+    struct pstore_extraction *pe = arg;
+
+    /* Every dump is a separate log, don't glue them together */
+    if (pe->started && pe->panic_no != part->panic_no)
+        koops_extractor_flush(pe->extractor, pe->oops_list);
+
+    pe->started = true;
+    pe->panic_no = part->panic_no;
+    koops_extractor_feed(pe->extractor, text, len, pe->oops_list);
+    return 0;
+}
+
+int koops_extract_pstore_oopses(GList **oops_list, const char *const *filenames, unsigned count)
+{
+    struct pstore_extraction pe = {
+        .extractor = koops_extractor_new(),
+        .oops_list = oops_list,
+    };
+
+    const int records = pstore_merge_files(filenames, count, extract_part, &pe);
+
+    koops_extractor_flush(pe.extractor, oops_list);
+    koops_extractor_free(pe.extractor);
+
+    return records;
+}
@@ -0,0 +1,1322 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+
+/* Replication of problems from nodes to a collector.
+ *
+ * The node (sender) scans its dump location and numbers every change with
+ * a sequence number: a changed item of a problem, a changed occurrence
+ * counter and the completion of a new problem. The collector (receiver)
+ * remembers the last sequence number it has applied for every node.
+ *
+ * The protocol is line based, item data follow their header:
+ *   node:      HELLO <node>
+ *   collector: RESUME <last applied sequence number>
+ *   node:      ITEM <seq> <problem> <item> <size>\n<size bytes>
+ *              COUNT <seq> <problem> <count> <last occurrence>
+ *              DONE <seq> <problem>
+ *              ...
+ *              SYNC
+ *   collector: ACK <last applied sequence number>
+ *
+ * Only the changed items are sent and a duplicate occurrence, which changes
+ * only the counter of an existing problem, is sent as a COUNT. The records
+ * carry the current state, not differences, so applying a record twice
+ * doesn't matter. After a reconnection, the node sends again everything
+ * after the sequence number the collector has acknowledged.
+ *
+ * The collector assembles a new problem in a hidden staging directory in
+ * its dump location and moves it to the dump location on DONE, named
+ * replica-<node>@<problem>. The counter of the node is saved as remote_count,
+ * like abrt-handle-upload does. The collector doesn't trust the nodes: it
+ * drops the items granting access or naming local paths, gives the problems
+ * its own owner and mode and rejects problems bigger than MaxCrashReportsSize.
+ *
+ * The collector remembers the problems it has seen DONE, so the changes of
+ * a problem whose replica has been deleted on the collector are ignored
+ * instead of staging the problem again. Staged problems which are never
+ * completed, e.g. deleted on the node before DONE, are removed after
+ * REPLICATION_STAGING_TIMEOUT.
+ */
+
+#define REPLICATION_READ_BLOCK (64 * 1024)
+#define REPLICATION_ITEM_REMOTE "remote"
+#define REPLICATION_ITEM_REMOTE_COUNT "remote_count"
+/* The node of a replicated problem, identifies the collector's problems */
+#define REPLICATION_ITEM_NODE "replica_node"
+
+/*
+ * Sender
+ */
+
+struct replicated_item
+{
+    off_t size;
+    long long mtime;            ///< nanoseconds
+    unsigned long long seq;     ///< the change sending this version, 0 for counters
+};
+
+struct replicated_problem
+{
+    long long dir_mtime;
+    long long count_mtime;
+    unsigned long long count_seq;
+    unsigned long long done_seq;
+    bool complete;              ///< DONE has been queued
+    bool seen;
+    /* item name -> struct replicated_item */
+    GHashTable *items;
+};
+
+struct abrt_replication_sender
+{
+    char *state_file;
+    char *dump_location;
+    char *node;
+    /* problem name -> struct replicated_problem */
+    GHashTable *problems;
+    unsigned long long next_seq;
+    unsigned long long acked_seq;
+    bool modified;
+    bool fresh;                 ///< numbered without a state file
+
+    unsigned long bytes_per_sec;
+    gint64 last_refill;         ///< monotonic usec
+    double allowance;           ///< bytes which can be sent now
+};
+
+enum record_kind
+{
+    RECORD_ITEM,
+    RECORD_COUNT,
+    RECORD_DONE,
+};
+
+struct record
+{
+    unsigned long long seq;
+    enum record_kind kind;
+    const char *problem;
+    const char *item;
+};
+
+static long long mtime_nsec(const struct stat *st)
+{
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static bool is_counter_item(const char *name)
+{
+    return strcmp(name, FILENAME_COUNT) == 0 || strcmp(name, FILENAME_LAST_OCCURRENCE) == 0;
+}
+
+static void replicated_problem_free(gpointer data)
+{
+    struct replicated_problem *p = data;
+    g_hash_table_destroy(p->items);
+    free(p);
+}
+
+static struct replicated_problem *replicated_problem_new(void)
+{
+    struct replicated_problem *p = xzalloc(sizeof(*p));
+    p->items = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    return p;
+}
+
+/* Returns -1 if the file can't be used */
+static int sender_read_state(struct abrt_replication_sender *sender)
+{
+    FILE *fp = fopen(sender->state_file, "r");
+    if (fp == NULL)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", sender->state_file);
+        return -1;
+    }
+
+    int ret = -1;
+    char *line = xmalloc_fgetline(fp);
+    if (line == NULL || strcmp(line, sender->dump_location) != 0)
+    {
+        log_notice("'%s' is not a replication state of '%s'", sender->state_file, sender->dump_location);
+        goto finito;
+    }
+
+    while (free(line), (line = xmalloc_fgetline(fp)) != NULL)
+    {
+        char problem[strlen(line) + 1];
+        char item[strlen(line) + 1];
+        unsigned long long a, b, c, d;
+        int complete;
+        long long size, mtime;
+
+        if (sscanf(line, "next %llu %llu", &a, &b) == 2)
+        {
+            sender->next_seq = a;
+            sender->acked_seq = b;
+        }
+        else if (sscanf(line, "problem %s %llu %llu %llu %llu %d", problem, &a, &b, &c, &d, &complete) == 6)
+        {
+            struct replicated_problem *p = replicated_problem_new();
+            p->dir_mtime = a;
+            p->count_mtime = b;
+            p->count_seq = c;
+            p->done_seq = d;
+            p->complete = complete;
+            g_hash_table_replace(sender->problems, xstrdup(problem), p);
+        }
+        else if (sscanf(line, "item %s %s %lld %lld %llu", problem, item, &size, &mtime, &a) == 5)
+        {
+            struct replicated_problem *p = g_hash_table_lookup(sender->problems, problem);
+            if (p == NULL)
+                continue;
+
+            struct replicated_item *it = xzalloc(sizeof(*it));
+            it->size = size;
+            it->mtime = mtime;
+            it->seq = a;
+            g_hash_table_replace(p->items, xstrdup(item), it);
+        }
+        else
+            log_notice("Ignoring malformed line in '%s'", sender->state_file);
+    }
+    ret = 0;
+
+ finito:
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+struct abrt_replication_sender *replication_sender_new(const char *state_file, const char *dump_location,
+        const char *node, unsigned long bytes_per_sec)
+{
+    struct abrt_replication_sender *sender = xzalloc(sizeof(*sender));
+    sender->state_file = xstrdup(state_file);
+
+    sender->dump_location = xstrndup(dump_location, trimmed_dir_name_len(dump_location));
+    sender->node = xstrdup(node);
+    sender->problems = g_hash_table_new_full(g_str_hash, g_str_equal, free, replicated_problem_free);
+    sender->next_seq = 1;
+    sender->bytes_per_sec = bytes_per_sec;
+    sender->last_refill = g_get_monotonic_time();
+
+    /* Everything is sent again, numbered after the changes the collector
+     * has applied, see replication_sender_resume() */
+    if (sender_read_state(sender) != 0)
+    {
+        sender->fresh = true;
+        sender->modified = true;
+    }
+
+    return sender;
+}
+
+void replication_sender_free(struct abrt_replication_sender *sender)
+{
+    if (sender == NULL)
+        return;
+
+    g_hash_table_destroy(sender->problems);
+    free(sender->node);
+    free(sender->dump_location);
+    free(sender->state_file);
+    free(sender);
+}
+
+/* Queues the changed items of the problem */
+static unsigned scan_problem(struct abrt_replication_sender *sender, const char *name,
+        struct replicated_problem *p, int dir_fd)
+{
+    DIR *dp = fdopendir(dir_fd);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s/%s'", sender->dump_location, name);
+        close(dir_fd);
+        return 0;
+    }
+
+    unsigned queued = 0;
+    bool counters_changed = false;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        struct stat st;
+        /* Hidden names are the lock and temporary files */
+        if (dent->d_name[0] == '.'
+            || fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+            || !S_ISREG(st.st_mode))
+            continue;
+
+        struct replicated_item *it = g_hash_table_lookup(p->items, dent->d_name);
+        if (it != NULL && it->size == st.st_size && it->mtime == mtime_nsec(&st))
+            continue;
+
+        if (it == NULL)
+        {
+            it = xzalloc(sizeof(*it));
+            g_hash_table_insert(p->items, xstrdup(dent->d_name), it);
+        }
+        it->size = st.st_size;
+        it->mtime = mtime_nsec(&st);
+
+        if (is_counter_item(dent->d_name))
+            counters_changed = true;
+        else
+        {
+            it->seq = sender->next_seq++;
+            ++queued;
+        }
+    }
+    closedir(dp);
+
+    /* A duplicate occurrence changes only the counters */
+    if (counters_changed || !p->complete)
+    {
+        p->count_seq = sender->next_seq++;
+        ++queued;
+    }
+
+    if (!p->complete)
+    {
+        p->done_seq = sender->next_seq++;
+        p->complete = true;
+        ++queued;
+    }
+
+    sender->modified = true;
+    return queued;
+}
+
+unsigned replication_sender_scan(struct abrt_replication_sender *sender)
+{
+    DIR *dp = opendir(sender->dump_location);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", sender->dump_location);
+        return 0;
+    }
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, sender->problems);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        ((struct replicated_problem *)value)->seen = false;
+
+    unsigned queued = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        /* skip ".", ".." and hidden entries like the trash */
+        if (dent->d_name[0] == '.')
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode))
+            continue;
+
+        const int dir_fd = openat(dirfd(dp), dent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir_fd < 0)
+            continue;
+
+        /* abrtd saves count after post-create, a problem without it is
+         * incomplete or being deleted as a duplicate */
+        struct stat count_st;
+        if (fstatat(dir_fd, FILENAME_COUNT, &count_st, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            close(dir_fd);
+            continue;
+        }
+
+        struct replicated_problem *p = g_hash_table_lookup(sender->problems, dent->d_name);
+        if (p == NULL)
+        {
+            p = replicated_problem_new();
+            g_hash_table_insert(sender->problems, xstrdup(dent->d_name), p);
+        }
+        p->seen = true;
+
+        /* Counters may be rewritten in place, which doesn't change the
+         * directory */
+        if (p->dir_mtime == mtime_nsec(&st) && p->count_mtime == mtime_nsec(&count_st))
+        {
+            close(dir_fd);
+            continue;
+        }
+        p->dir_mtime = mtime_nsec(&st);
+        p->count_mtime = mtime_nsec(&count_st);
+
+        queued += scan_problem(sender, dent->d_name, p, dir_fd);
+    }
+    closedir(dp);
+
+    /* Deleted problems stay on the collector */
+    g_hash_table_iter_init(&iter, sender->problems);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        if (!((struct replicated_problem *)value)->seen)
+        {
+            g_hash_table_iter_remove(&iter);
+            sender->modified = true;
+        }
+    }
+
+    if (queued != 0)
+        log_info("Queued %u changes for replication", queued);
+
+    return queued;
+}
+
+static gint record_cmp(gconstpointer a, gconstpointer b)
+{
+    const struct record *ra = a, *rb = b;
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+/* The records not acknowledged by the collector, in order */
+static GArray *pending_records(struct abrt_replication_sender *sender)
+{
+    GArray *records = g_array_new(FALSE, FALSE, sizeof(struct record));
+    const unsigned long long acked = sender->acked_seq;
+
+    GHashTableIter iter;
+    gpointer problem, value;
+    g_hash_table_iter_init(&iter, sender->problems);
+    while (g_hash_table_iter_next(&iter, &problem, &value))
+    {
+        struct replicated_problem *p = value;
+
+        GHashTableIter item_iter;
+        gpointer item, item_value;
+        g_hash_table_iter_init(&item_iter, p->items);
+        while (g_hash_table_iter_next(&item_iter, &item, &item_value))
+        {
+            const struct replicated_item *it = item_value;
+            if (it->seq > acked)
+            {
+                struct record r = { it->seq, RECORD_ITEM, problem, item };
+                g_array_append_val(records, r);
+            }
+        }
+
+        if (p->count_seq > acked)
+        {
+            struct record r = { p->count_seq, RECORD_COUNT, problem, NULL };
+            g_array_append_val(records, r);
+        }
+
+        if (p->done_seq > acked)
+        {
+            struct record r = { p->done_seq, RECORD_DONE, problem, NULL };
+            g_array_append_val(records, r);
+        }
+    }
+
+    g_array_sort(records, record_cmp);
+    return records;
+}
+
+unsigned replication_sender_pending(struct abrt_replication_sender *sender)
+{
+    GArray *records = pending_records(sender);
+    const unsigned count = records->len;
+    g_array_free(records, TRUE);
+    return count;
+}
+
+/* Writes the buffer, no faster than the bandwidth cap */
+static int limited_write(struct abrt_replication_sender *sender, int fd, const void *buf, size_t len)
+{
+    while (len > 0)
+    {
+        size_t chunk = len;
+        if (sender->bytes_per_sec != 0)
+        {
+            const gint64 now = g_get_monotonic_time();
+            sender->allowance += (now - sender->last_refill) * (double)sender->bytes_per_sec / 1000000;
+            sender->last_refill = now;
+            /* Up to one second of a burst */
+            if (sender->allowance > sender->bytes_per_sec)
+                sender->allowance = sender->bytes_per_sec;
+
+            if (sender->allowance < 1)
+            {
+                const double wait = (1 - sender->allowance) * 1000000 / sender->bytes_per_sec;
+                usleep(wait < 1000 ? 1000 : (useconds_t)wait);
+                continue;
+            }
+
+            if (chunk > sender->allowance)
+                chunk = sender->allowance;
+            sender->allowance -= chunk;
+        }
+
+        const ssize_t r = full_write(fd, buf, chunk);
+        if (r < 0 || (size_t)r != chunk)
+        {
+            perror_msg("Can't send replication data");
+            return -1;
+        }
+        buf = (const char *)buf + chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int write_line(struct abrt_replication_sender *sender, int fd, const char *fmt, ...)
+{
+    va_list p;
+    va_start(p, fmt);
+    char *line = xvasprintf(fmt, p);
+    va_end(p);
+
+    const int r = limited_write(sender, fd, line, strlen(line));
+    free(line);
+    return r;
+}
+
+/* Reads a response line from the collector, the responses are short */
+static char *read_line(int fd)
+{
+    char line[256];
+    size_t len = 0;
+    while (len < sizeof(line) - 1)
+    {
+        const ssize_t r = safe_read(fd, line + len, 1);
+        if (r <= 0)
+        {
+            if (r < 0)
+                perror_msg("Can't read replication response");
+            else
+                error_msg("The collector has closed the connection");
+            return NULL;
+        }
+        if (line[len] == '\n')
+        {
+            line[len] = '\0';
+            return xstrdup(line);
+        }
+        ++len;
+    }
+
+    error_msg("Too long replication response");
+    return NULL;
+}
+
+static int send_item(struct abrt_replication_sender *sender, int fd, const struct record *r)
+{
+    char *path = xasprintf("%s/%s/%s", sender->dump_location, r->problem, r->item);
+    const int item_fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (item_fd < 0 || fstat(item_fd, &st) != 0)
+    {
+        /* Removed meanwhile, the collector keeps the old version */
+        log_notice("Can't replicate '%s'", path);
+        if (item_fd >= 0)
+            close(item_fd);
+        free(path);
+        return 0;
+    }
+
+    int ret = write_line(sender, fd, "ITEM %llu %s %s %lld\n", r->seq, r->problem, r->item, (long long)st.st_size);
+
+    char *buf = xmalloc(REPLICATION_READ_BLOCK);
+    for (off_t left = st.st_size; ret == 0 && left > 0; )
+    {
+        ssize_t len = safe_read(item_fd, buf, MIN((off_t)REPLICATION_READ_BLOCK, left));
+        if (len <= 0)
+        {
+            /* Shrunk meanwhile, the next scan sends the new version */
+            len = MIN((off_t)REPLICATION_READ_BLOCK, left);
+            memset(buf, 0, len);
+        }
+        ret = limited_write(sender, fd, buf, len);
+        left -= len;
+    }
+    free(buf);
+
+    close(item_fd);
+    free(path);
+    return ret;
+}
+
+static int send_count(struct abrt_replication_sender *sender, int fd, const struct record *r)
+{
+    char *path = concat_path_file(sender->dump_location, r->problem);
+    struct dump_dir *dd = dd_opendir(path, DD_OPEN_READONLY | DD_FAIL_QUIETLY_ENOENT);
+    free(path);
+    if (dd == NULL)
+        return 0;
+
+    char *count = dd_load_text_ext(dd, FILENAME_COUNT, DD_FAIL_QUIETLY_ENOENT);
+    char *last_ocr = dd_load_text_ext(dd, FILENAME_LAST_OCCURRENCE, DD_FAIL_QUIETLY_ENOENT);
+    if (last_ocr[0] == '\0')
+    {
+        free(last_ocr);
+        last_ocr = dd_load_text_ext(dd, FILENAME_TIME, DD_FAIL_QUIETLY_ENOENT);
+    }
+    dd_close(dd);
+
+    const int ret = write_line(sender, fd, "COUNT %llu %s %lu %lu\n", r->seq, r->problem,
+            strtoul(count, NULL, 10), strtoul(last_ocr, NULL, 10));
+    free(last_ocr);
+    free(count);
+    return ret;
+}
+
+static int parse_ack(const char *keyword, int fd, unsigned long long *seq)
+{
+    char *line = read_line(fd);
+    if (line == NULL)
+        return -1;
+
+    const size_t len = strlen(keyword);
+    char *end = NULL;
+    if (strncmp(line, keyword, len) == 0 && line[len] == ' ')
+        *seq = strtoull(line + len + 1, &end, 10);
+
+    const int ret = end != NULL && end != line + len + 1 && *end == '\0' ? 0 : -1;
+    if (ret != 0)
+        error_msg("Unexpected replication response '%s'", line);
+    free(line);
+    return ret;
+}
+
+static void renumber(struct abrt_replication_sender *sender, unsigned long long shift)
+{
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, sender->problems);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        struct replicated_problem *p = value;
+        p->count_seq += p->count_seq ? shift : 0;
+        p->done_seq += p->done_seq ? shift : 0;
+
+        GHashTableIter item_iter;
+        gpointer item_value;
+        g_hash_table_iter_init(&item_iter, p->items);
+        while (g_hash_table_iter_next(&item_iter, NULL, &item_value))
+        {
+            struct replicated_item *it = item_value;
+            it->seq += it->seq ? shift : 0;
+        }
+    }
+
+    sender->next_seq += shift;
+    sender->modified = true;
+}
+
+int replication_sender_resume(struct abrt_replication_sender *sender, int fd)
+{
+    unsigned long long seq;
+    if (write_line(sender, fd, "HELLO %s\n", sender->node) != 0 || parse_ack("RESUME", fd, &seq) != 0)
+        return -1;
+
+    /* The node has lost its state, the collector would take the new
+     * changes for the already applied ones */
+    if (seq != 0 && (sender->fresh || seq >= sender->next_seq))
+    {
+        log_notice("Renumbering replication changes after %llu", seq);
+        renumber(sender, seq);
+    }
+    sender->fresh = false;
+
+    /* A collector which has lost its state gets everything again */
+    if (seq != sender->acked_seq)
+    {
+        log_notice("Resuming replication after %llu", seq);
+        sender->acked_seq = seq;
+        sender->modified = true;
+    }
+
+    return 0;
+}
+
+int replication_sender_send(struct abrt_replication_sender *sender, int fd)
+{
+    GArray *records = pending_records(sender);
+    const unsigned count = records->len;
+
+    int ret = 0;
+    for (unsigned i = 0; ret == 0 && i < records->len; ++i)
+    {
+        const struct record *r = &g_array_index(records, struct record, i);
+        switch (r->kind)
+        {
+            case RECORD_ITEM:
+                ret = send_item(sender, fd, r);
+                break;
+            case RECORD_COUNT:
+                ret = send_count(sender, fd, r);
+                break;
+            case RECORD_DONE:
+                ret = write_line(sender, fd, "DONE %llu %s\n", r->seq, r->problem);
+                break;
+        }
+    }
+    g_array_free(records, TRUE);
+
+    unsigned long long seq;
+    if (ret != 0 || write_line(sender, fd, "SYNC\n") != 0 || parse_ack("ACK", fd, &seq) != 0)
+        return -1;
+
+    if (seq != sender->acked_seq)
+    {
+        sender->acked_seq = seq;
+        sender->modified = true;
+    }
+
+    log_info("Replicated %u changes, acknowledged %llu", count, seq);
+    return count;
+}
+
+int replication_sender_save(struct abrt_replication_sender *sender)
+{
+    if (!sender->modified)
+        return 0;
+
+    char *tmp_file = xasprintf("%s.tmp", sender->state_file);
+    FILE *fp = fopen(tmp_file, "w");
+    if (fp == NULL)
+    {
+        perror_msg("Can't create '%s'", tmp_file);
+        free(tmp_file);
+        return -1;
+    }
+
+    fprintf(fp, "%s\n", sender->dump_location);
+    fprintf(fp, "next %llu %llu\n", sender->next_seq, sender->acked_seq);
+
+    GHashTableIter iter;
+    gpointer problem, value;
+    g_hash_table_iter_init(&iter, sender->problems);
+    while (g_hash_table_iter_next(&iter, &problem, &value))
+    {
+        struct replicated_problem *p = value;
+        fprintf(fp, "problem %s %lld %lld %llu %llu %d\n", (const char *)problem,
+                p->dir_mtime, p->count_mtime, p->count_seq, p->done_seq, p->complete);
+
+        GHashTableIter item_iter;
+        gpointer item, item_value;
+        g_hash_table_iter_init(&item_iter, p->items);
+        while (g_hash_table_iter_next(&item_iter, &item, &item_value))
+        {
+            const struct replicated_item *it = item_value;
+            fprintf(fp, "item %s %s %lld %lld %llu\n", (const char *)problem, (const char *)item,
+                    (long long)it->size, it->mtime, it->seq);
+        }
+    }
+
+    /* The state must survive a crash, don't rename an empty file */
+    int ret = 0;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || ferror(fp))
+    {
+        perror_msg("Can't write '%s'", tmp_file);
+        ret = -1;
+    }
+    fclose(fp);
+
+    if (ret == 0 && rename(tmp_file, sender->state_file) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_file, sender->state_file);
+        ret = -1;
+    }
+
+    if (ret != 0)
+        unlink(tmp_file);
+    else
+        sender->modified = false;
+
+    free(tmp_file);
+    return ret;
+}
+
+/*
+ * Receiver
+ */
+
+/* Marks a staged problem whose items have been dropped */
+#define REPLICATION_REJECTED ".rejected"
+/* The directory of the markers of completed problems in the state directory,
+ * node names can't start with '.' */
+#define REPLICATION_DONE_DIR_NAME ".done"
+
+/* Items which the collector must not take from a node: the owner of the
+ * problem gets access to it, cold_storage is a path root acts on and the rest
+ * is maintained by the collector itself */
+static const char *const s_dropped_items[] = {
+    FILENAME_UID,
+    FILENAME_COLD_STORAGE,
+    FILENAME_COUNT,
+    FILENAME_LAST_OCCURRENCE,
+    REPLICATION_ITEM_REMOTE,
+    REPLICATION_ITEM_REMOTE_COUNT,
+    REPLICATION_ITEM_NODE,
+    NULL
+};
+
+struct abrt_replication_receiver
+{
+    char *state_dir;
+    struct abrt_replication_receiver_conf conf;
+};
+
+struct abrt_replication_receiver *replication_receiver_new(const char *state_dir,
+        const struct abrt_replication_receiver_conf *conf)
+{
+    struct abrt_replication_receiver *receiver = xzalloc(sizeof(*receiver));
+    receiver->state_dir = xstrdup(state_dir);
+    receiver->conf = *conf;
+    receiver->conf.dump_location = xstrdup(conf->dump_location);
+    return receiver;
+}
+
+void replication_receiver_free(struct abrt_replication_receiver *receiver)
+{
+    if (receiver == NULL)
+        return;
+
+    free((char *)receiver->conf.dump_location);
+    free(receiver->state_dir);
+    free(receiver);
+}
+
+bool replication_node_name_is_valid(const char *node)
+{
+    const size_t len = strlen(node);
+    return len > 0 && len <= REPLICATION_NODE_NAME_MAX && node[0] != '.' && node[0] != '-'
+        && strspn(node, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_") == len;
+}
+
+static bool item_is_accepted(const char *item)
+{
+    /* Hidden names are the lock and temporary files */
+    if (item[0] == '.' || !str_is_correct_filename(item))
+        return false;
+
+    for (const char *const *dropped = s_dropped_items; *dropped; ++dropped)
+    {
+        if (strcmp(item, *dropped) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+static unsigned long long receiver_load_seq(struct abrt_replication_receiver *receiver, const char *node)
+{
+    char *path = concat_path_file(receiver->state_dir, node);
+    char *value = xmalloc_open_read_close(path, NULL);
+    free(path);
+
+    const unsigned long long seq = value ? strtoull(value, NULL, 10) : 0;
+    free(value);
+    return seq;
+}
+
+static int receiver_save_seq(struct abrt_replication_receiver *receiver, const char *node, unsigned long long seq)
+{
+    char *path = concat_path_file(receiver->state_dir, node);
+    char *tmp_path = xasprintf("%s.tmp", path);
+
+    /* Acknowledged data must not be requested again after a crash */
+    int ret = -1;
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+        perror_msg("Can't create '%s'", tmp_path);
+    else
+    {
+        char buf[sizeof(long long)*3 + 2];
+        const size_t len = sprintf(buf, "%llu\n", seq);
+        if (full_write(fd, buf, len) != len || fsync(fd) != 0)
+            perror_msg("Can't write '%s'", tmp_path);
+        else if (rename(tmp_path, path) != 0)
+            perror_msg("Can't rename '%s' to '%s'", tmp_path, path);
+        else
+            ret = 0;
+        close(fd);
+
+        if (ret != 0)
+            unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(path);
+    return ret;
+}
+
+/* Returns the path of the marker saying that DONE of the problem has been applied */
+static char *receiver_done_marker(struct abrt_replication_receiver *receiver, const char *node,
+        const char *problem)
+{
+    return xasprintf("%s/"REPLICATION_DONE_DIR_NAME"/%s@%s", receiver->state_dir, node, problem);
+}
+
+static bool receiver_is_done(struct abrt_replication_receiver *receiver, const char *node,
+        const char *problem)
+{
+    char *marker = receiver_done_marker(receiver, node, problem);
+    struct stat st;
+    const bool done = lstat(marker, &st) == 0;
+    free(marker);
+    return done;
+}
+
+static void receiver_mark_done(struct abrt_replication_receiver *receiver, const char *node,
+        const char *problem)
+{
+    char *done_dir = concat_path_file(receiver->state_dir, REPLICATION_DONE_DIR_NAME);
+    if (mkdir(done_dir, 0700) != 0 && errno != EEXIST)
+        perror_msg("Can't create '%s'", done_dir);
+    free(done_dir);
+
+    char *marker = receiver_done_marker(receiver, node, problem);
+    const int fd = open(marker, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+        perror_msg("Can't create '%s'", marker);
+    else
+        close(fd);
+    free(marker);
+}
+
+/* Returns the directory of the problem on the collector, the published one if
+ * it exists, and whether it is published. Node names can't contain '@', so
+ * the names of replicated problems are unique and, thanks to the prefix,
+ * differ from the names of local problems.
+ *
+ * Returns NULL if the published directory is not a replica of the node. */
+static char *receiver_problem_dir(struct abrt_replication_receiver *receiver, const char *node,
+        const char *problem, bool *published)
+{
+    char *name = xasprintf(REPLICATION_PROBLEM_PREFIX"%s@%s", node, problem);
+    char *path = concat_path_file(receiver->conf.dump_location, name);
+
+    struct stat st;
+    *published = lstat(path, &st) == 0;
+    if (*published)
+    {
+        char *marker = concat_path_file(path, REPLICATION_ITEM_NODE);
+        char *owner = S_ISDIR(st.st_mode) ? xmalloc_open_read_close(marker, NULL) : NULL;
+        free(marker);
+        if (owner == NULL || strcmp(owner, node) != 0)
+        {
+            error_msg("'%s' is not a replica of node '%s'", path, node);
+            free(path);
+            path = NULL;
+        }
+        free(owner);
+    }
+    else
+    {
+        free(path);
+        path = xasprintf("%s/"REPLICATION_STAGING_DIR_NAME"/%s", receiver->conf.dump_location, name);
+    }
+
+    free(name);
+    return path;
+}
+
+/* Creates the item with the owner and mode of the collector's items */
+static int receiver_create_item(struct abrt_replication_receiver *receiver, const char *path)
+{
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, receiver->conf.item_mode);
+    if (fd < 0)
+        perror_msg("Can't create '%s'", path);
+    else if (fchown(fd, (uid_t)-1, receiver->conf.fs_group) != 0 || fchmod(fd, receiver->conf.item_mode) != 0)
+    {
+        perror_msg("Can't change owner of '%s'", path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+static void save_text_at(struct abrt_replication_receiver *receiver, const char *dir,
+        const char *name, const char *value)
+{
+    char *path = concat_path_file(dir, name);
+    char *tmp_path = xasprintf("%s/.%s.tmp", dir, name);
+    const int fd = receiver_create_item(receiver, tmp_path);
+    if (fd >= 0)
+    {
+        if (full_write(fd, value, strlen(value)) != strlen(value) || rename(tmp_path, path) != 0)
+        {
+            perror_msg("Can't save '%s'", path);
+            unlink(tmp_path);
+        }
+        close(fd);
+    }
+    free(tmp_path);
+    free(path);
+}
+
+static int skip_bytes(FILE *in, long long size)
+{
+    char buf[4096];
+    while (size > 0)
+    {
+        const size_t len = fread(buf, 1, MIN((long long)sizeof(buf), size), in);
+        if (len == 0)
+            return -1;
+        size -= len;
+    }
+    return 0;
+}
+
+static bool is_rejected(const char *dir)
+{
+    char *marker = concat_path_file(dir, REPLICATION_REJECTED);
+    struct stat st;
+    const bool rejected = lstat(marker, &st) == 0;
+    free(marker);
+    return rejected;
+}
+
+/* Staged problems contain only the files written by the collector */
+static void clear_staged_problem(const char *dir)
+{
+    DIR *dp = opendir(dir);
+    if (dp == NULL)
+        return;
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (!dot_or_dotdot(dent->d_name))
+            unlinkat(dirfd(dp), dent->d_name, 0);
+    }
+    closedir(dp);
+}
+
+/* Drops the items of a staged problem, it won't be published */
+static void reject_staged_problem(const char *dir)
+{
+    clear_staged_problem(dir);
+
+    char *marker = concat_path_file(dir, REPLICATION_REJECTED);
+    const int fd = open(marker, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        close(fd);
+    free(marker);
+}
+
+static int receive_item(struct abrt_replication_receiver *receiver, FILE *in, const char *node,
+        const char *problem, const char *item, long long size)
+{
+    bool published;
+    char *dir = receiver_problem_dir(receiver, node, problem, &published);
+    if (dir == NULL)
+        return skip_bytes(in, size);
+
+    if (!published && receiver_is_done(receiver, node, problem))
+    {
+        /* The replica has been deleted on the collector */
+        log_info("Ignoring '%s' of deleted problem '%s'", item, dir);
+        free(dir);
+        return skip_bytes(in, size);
+    }
+
+    if (!published)
+    {
+        char *staging = concat_path_file(receiver->conf.dump_location, REPLICATION_STAGING_DIR_NAME);
+        if (mkdir(staging, 0700) != 0 && errno != EEXIST)
+            perror_msg("Can't create '%s'", staging);
+        free(staging);
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+            perror_msg("Can't create '%s'", dir);
+    }
+
+    if (!item_is_accepted(item) || (!published && is_rejected(dir)))
+    {
+        log_info("Dropping '%s' of '%s'", item, dir);
+        free(dir);
+        return skip_bytes(in, size);
+    }
+
+    char *path = concat_path_file(dir, item);
+    if (receiver->conf.max_size != 0)
+    {
+        struct stat st;
+        const double old_size = lstat(path, &st) == 0 ? st.st_size : 0;
+        if (get_dirsize(dir) - old_size + size > receiver->conf.max_size)
+        {
+            error_msg("'%s' would be bigger than %llu bytes, dropping '%s'", dir,
+                    (unsigned long long)receiver->conf.max_size, item);
+            if (!published)
+                reject_staged_problem(dir);
+            free(path);
+            free(dir);
+            return skip_bytes(in, size);
+        }
+    }
+
+    struct dump_dir *dd = published ? dd_opendir(dir, /*flags*/0) : NULL;
+    char *tmp_path = xasprintf("%s/.%s.tmp", dir, item);
+    int fd = published && dd == NULL ? -1 : receiver_create_item(receiver, tmp_path);
+
+    /* The data must be read even if they can't be saved */
+    int ret = 0;
+    char *buf = xmalloc(REPLICATION_READ_BLOCK);
+    while (size > 0)
+    {
+        const size_t len = fread(buf, 1, MIN((long long)REPLICATION_READ_BLOCK, size), in);
+        if (len == 0)
+        {
+            ret = -1;
+            break;
+        }
+        if (fd >= 0 && full_write(fd, buf, len) != len)
+        {
+            perror_msg("Can't write '%s'", tmp_path);
+            close(fd);
+            unlink(tmp_path);
+            fd = -1;
+        }
+        size -= len;
+    }
+    free(buf);
+
+    if (fd >= 0)
+    {
+        close(fd);
+        if (ret != 0 || rename(tmp_path, path) != 0)
+            unlink(tmp_path);
+    }
+
+    dd_close(dd);
+    free(tmp_path);
+    free(path);
+    free(dir);
+    return ret;
+}
+
+static void receive_count(struct abrt_replication_receiver *receiver, const char *node,
+        const char *problem, unsigned long count, unsigned long last_ocr)
+{
+    bool published;
+    char *dir = receiver_problem_dir(receiver, node, problem, &published);
+    if (dir == NULL)
+        return;
+
+    struct stat st;
+    if (!published && (stat(dir, &st) != 0 || is_rejected(dir)))
+    {
+        /* Deleted on the collector, e.g. as a duplicate of another problem */
+        log_notice("Ignoring counter of unknown problem '%s'", dir);
+        free(dir);
+        return;
+    }
+
+    struct dump_dir *dd = published ? dd_opendir(dir, /*flags*/0) : NULL;
+    if (!published || dd != NULL)
+    {
+        char value[sizeof(long)*3 + 2];
+        sprintf(value, "%lu", count);
+        save_text_at(receiver, dir, REPLICATION_ITEM_REMOTE_COUNT, value);
+        sprintf(value, "%lu", last_ocr);
+        save_text_at(receiver, dir, FILENAME_LAST_OCCURRENCE, value);
+    }
+
+    dd_close(dd);
+    free(dir);
+}
+
+static void receive_done(struct abrt_replication_receiver *receiver, const char *node, const char *problem)
+{
+    bool published;
+    char *dir = receiver_problem_dir(receiver, node, problem, &published);
+    if (dir == NULL)
+        return;
+
+    /* Whatever happens to the replica, it is not staged again */
+    receiver_mark_done(receiver, node, problem);
+    if (published)
+    {
+        free(dir);
+        return;
+    }
+
+    /* The same check as abrt-handle-upload does */
+    char *type = concat_path_file(dir, FILENAME_TYPE);
+    char *time = concat_path_file(dir, FILENAME_TIME);
+    struct stat st;
+    const bool complete = !is_rejected(dir) && lstat(type, &st) == 0 && lstat(time, &st) == 0;
+    free(time);
+    free(type);
+
+    if (!complete)
+    {
+        error_msg("Removing incomplete replica '%s'", dir);
+        clear_staged_problem(dir);
+        if (rmdir(dir) != 0)
+            perror_msg("Can't remove '%s'", dir);
+        free(dir);
+        return;
+    }
+
+    char *name = xasprintf(REPLICATION_PROBLEM_PREFIX"%s@%s", node, problem);
+    char *dst = concat_path_file(receiver->conf.dump_location, name);
+    free(name);
+
+    save_text_at(receiver, dir, REPLICATION_ITEM_REMOTE, "1");
+    save_text_at(receiver, dir, REPLICATION_ITEM_NODE, node);
+    if (chown(dir, (uid_t)-1, receiver->conf.fs_group) != 0
+        || chmod(dir, receiver->conf.dir_mode) != 0
+        || rename(dir, dst) != 0)
+        perror_msg("Can't move '%s' to '%s'", dir, dst);
+    else
+    {
+        log_notice("Created problem directory '%s'", dst);
+        notify_new_path(dst);
+    }
+
+    free(dst);
+    free(dir);
+}
+
+/* Removes the staged problems which haven't changed for the timeout */
+static void receiver_reap_staging(struct abrt_replication_receiver *receiver)
+{
+    char *staging = concat_path_file(receiver->conf.dump_location, REPLICATION_STAGING_DIR_NAME);
+    DIR *dp = opendir(staging);
+    if (dp == NULL)
+    {
+        free(staging);
+        return;
+    }
+
+    const time_t deadline = time(NULL) - REPLICATION_STAGING_TIMEOUT;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        struct stat st;
+        if (dot_or_dotdot(dent->d_name)
+            || fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0
+            || !S_ISDIR(st.st_mode) || st.st_mtime > deadline)
+            continue;
+
+        char *dir = concat_path_file(staging, dent->d_name);
+        log_notice("Removing stale replica '%s'", dir);
+        clear_staged_problem(dir);
+        if (rmdir(dir) != 0)
+            perror_msg("Can't remove '%s'", dir);
+        free(dir);
+    }
+
+    closedir(dp);
+    free(staging);
+}
+
+int replication_receiver_serve(struct abrt_replication_receiver *receiver, int fd)
+{
+    FILE *in = fdopen(dup(fd), "r");
+    if (in == NULL)
+    {
+        perror_msg("Can't read replication data");
+        return -1;
+    }
+
+    int ret = -1;
+    char *node = NULL;
+    char *line = xmalloc_fgetline(in);
+    if (line == NULL || strncmp(line, "HELLO ", strlen("HELLO ")) != 0
+        || !replication_node_name_is_valid(line + strlen("HELLO ")))
+    {
+        error_msg("Invalid replication greeting");
+        goto finito;
+    }
+    node = xstrdup(line + strlen("HELLO "));
+
+    receiver_reap_staging(receiver);
+
+    unsigned long long last_seq = receiver_load_seq(receiver, node);
+    char response[sizeof("RESUME ") + sizeof(long long)*3 + 2];
+    sprintf(response, "RESUME %llu\n", last_seq);
+    if (full_write_str(fd, response) < 0)
+        goto finito;
+
+    log_info("Replicating node '%s' after %llu", node, last_seq);
+
+    while (free(line), (line = xmalloc_fgetline(in)) != NULL)
+    {
+        char problem[strlen(line) + 1];
+        char item[strlen(line) + 1];
+        unsigned long long seq;
+        unsigned long count, last_ocr;
+        long long size;
+
+        if (strcmp(line, "SYNC") == 0)
+        {
+            if (receiver_save_seq(receiver, node, last_seq) != 0)
+                goto finito;
+            sprintf(response, "ACK %llu\n", last_seq);
+            if (full_write_str(fd, response) < 0)
+                goto finito;
+        }
+        else if (sscanf(line, "ITEM %llu %s %s %lld", &seq, problem, item, &size) == 4
+                 && problem[0] != '.' && str_is_correct_filename(problem)
+                 && str_is_correct_filename(item) && size >= 0)
+        {
+            /* Sent again after a reconnection */
+            if (seq <= last_seq)
+            {
+                if (skip_bytes(in, size) != 0)
+                    goto finito;
+                continue;
+            }
+            if (receive_item(receiver, in, node, problem, item, size) != 0)
+                goto finito;
+            last_seq = seq;
+        }
+        else if (sscanf(line, "COUNT %llu %s %lu %lu", &seq, problem, &count, &last_ocr) == 4
+                 && problem[0] != '.' && str_is_correct_filename(problem))
+        {
+            if (seq <= last_seq)
+                continue;
+            receive_count(receiver, node, problem, count, last_ocr);
+            last_seq = seq;
+        }
+        else if (sscanf(line, "DONE %llu %s", &seq, problem) == 2
+                 && problem[0] != '.' && str_is_correct_filename(problem))
+        {
+            if (seq <= last_seq)
+                continue;
+            receive_done(receiver, node, problem);
+            last_seq = seq;
+        }
+        else
+        {
+            error_msg("Invalid replication record '%s'", line);
+            goto finito;
+        }
+    }
+
+    /* Disconnected, the applied records are not requested again */
+    ret = receiver_save_seq(receiver, node, last_seq);
+
+ finito:
+    free(line);
+    free(node);
+    fclose(in);
+    return ret;
+}
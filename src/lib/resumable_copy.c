@@ -0,0 +1,444 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <zstd.h>
+
+#include "internal_libabrt.h"
+
+/* Copying of huge files (vmcores) which survives a reboot in the middle.
+ *
+ * The data are written to '<dst>.part' and the progress is recorded in
+ * '<dst>.progress':
+ *   <src size> <src mtime> <src inode> <flags> <src offset> <dst offset>
+ * The progress file is replaced atomically after the data written so far
+ * have been synced, so the part file is never shorter than the recorded
+ * offset. A copy is resumed only if the source hasn't changed.
+ *
+ * The cheapest available method wins:
+ * 1. a reflink, if the files are on the same file system,
+ * 2. copy_file_range() of the data regions (holes are skipped),
+ * 3. read() and write() skipping blocks of zeros.
+ * Compressed copies are a sequence of independent zstd frames, one per
+ * chunk, so a copy can be resumed at any frame boundary and the result is
+ * readable by abrt_decompress_fd().
+ */
+
+#define COPY_PART_SUFFIX ".part"
+#define COPY_PROGRESS_SUFFIX ".progress"
+#define COPY_CHUNK_SIZE (4 * 1024 * 1024)
+#define COPY_CHECKPOINT_SIZE (256 * 1024 * 1024)
+#define COPY_BLOCK_SIZE 4096
+#define COPY_COMPRESSION_LEVEL 3
+
+struct copy_progress
+{
+    off_t src_size;
+    time_t src_mtime;
+    ino_t src_ino;
+    unsigned flags;
+    off_t src_offset;
+    off_t dst_offset;
+};
+
+struct copy_job
+{
+    const char *src_path;
+    const char *dst_path;
+    char *part_path;
+    char *progress_path;
+    int src_fd;
+    int dst_fd;
+    struct copy_progress progress;
+    off_t checkpoint;
+    /* Cleared once copy_file_range() fails */
+    bool use_copy_range;
+    char *buf;
+    char *packed;
+    size_t packed_size;
+    ZSTD_CCtx *cctx;
+};
+
+static int load_progress(const char *path, struct copy_progress *progress)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    unsigned long long size, offset, dst_offset, ino;
+    long long mtime;
+    const int r = fscanf(fp, "%llu %lld %llu %u %llu %llu", &size, &mtime, &ino,
+            &progress->flags, &offset, &dst_offset);
+    fclose(fp);
+
+    if (r != 6)
+    {
+        log_notice("Ignoring malformed progress file '%s'", path);
+        return -1;
+    }
+
+    progress->src_size = size;
+    progress->src_mtime = mtime;
+    progress->src_ino = ino;
+    progress->src_offset = offset;
+    progress->dst_offset = dst_offset;
+    return 0;
+}
+
+static int save_progress(struct copy_job *job)
+{
+    /* The recorded data must be on the disk before the record */
+    if (fdatasync(job->dst_fd) != 0)
+    {
+        perror_msg("Can't sync '%s'", job->part_path);
+        return -1;
+    }
+
+    char *tmp_path = xasprintf("%s.tmp", job->progress_path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL)
+    {
+        perror_msg("Can't create '%s'", tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    const struct copy_progress *p = &job->progress;
+    fprintf(fp, "%llu %lld %llu %u %llu %llu\n",
+            (unsigned long long)p->src_size, (long long)p->src_mtime,
+            (unsigned long long)p->src_ino, p->flags,
+            (unsigned long long)p->src_offset, (unsigned long long)p->dst_offset);
+
+    int ret = 0;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || ferror(fp))
+    {
+        perror_msg("Can't write '%s'", tmp_path);
+        ret = -1;
+    }
+    fclose(fp);
+
+    if (ret == 0 && rename(tmp_path, job->progress_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_path, job->progress_path);
+        ret = -1;
+    }
+
+    if (ret != 0)
+        unlink(tmp_path);
+    else
+        job->checkpoint = p->src_offset;
+
+    free(tmp_path);
+    return ret;
+}
+
+/* Returns 0 if the part file can be continued */
+static int resume_copy(struct copy_job *job, const struct stat *src_st)
+{
+    struct copy_progress saved;
+    if (load_progress(job->progress_path, &saved) != 0)
+        return -1;
+
+    struct stat part_st;
+    if (saved.src_size != src_st->st_size
+        || saved.src_mtime != src_st->st_mtime
+        || saved.src_ino != src_st->st_ino
+        || saved.flags != job->progress.flags
+        || saved.src_offset > saved.src_size
+        || fstat(job->dst_fd, &part_st) != 0
+        || part_st.st_size < saved.dst_offset)
+    {
+        log_notice("Can't resume copy of '%s', starting over", job->src_path);
+        return -1;
+    }
+
+    /* Throw away the data written after the last checkpoint */
+    if (ftruncate(job->dst_fd, saved.dst_offset) != 0)
+    {
+        perror_msg("Can't truncate '%s'", job->part_path);
+        return -1;
+    }
+
+    job->progress = saved;
+    job->checkpoint = saved.src_offset;
+    log_info("Resuming copy of '%s' at %llu bytes", job->src_path,
+            (unsigned long long)saved.src_offset);
+    return 0;
+}
+
+static int clone_file(struct copy_job *job)
+{
+#ifdef FICLONE
+    if (ioctl(job->dst_fd, FICLONE, job->src_fd) == 0)
+    {
+        log_info("Cloned '%s' to '%s'", job->src_path, job->dst_path);
+        return 0;
+    }
+    log_debug("Can't clone '%s': %s", job->src_path, strerror(errno));
+#endif
+    return -1;
+}
+
+/* Copies the region [offset, end) of the source to the same offset */
+static int copy_region(struct copy_job *job, off_t offset, off_t end)
+{
+    while (offset < end && job->use_copy_range)
+    {
+        loff_t in_off = offset, out_off = offset;
+        const ssize_t r = copy_file_range(job->src_fd, &in_off, job->dst_fd, &out_off, end - offset, 0);
+        if (r > 0)
+        {
+            offset += r;
+            continue;
+        }
+
+        if (r == 0)
+            /* The source has been truncated */
+            return -1;
+
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+        {
+            perror_msg("Can't copy '%s'", job->src_path);
+            return -1;
+        }
+
+        log_debug("copy_file_range() is not usable: %s", strerror(errno));
+        job->use_copy_range = false;
+    }
+
+    while (offset < end)
+    {
+        const size_t len = MIN(end - offset, COPY_CHUNK_SIZE);
+        const ssize_t r = pread(job->src_fd, job->buf, len, offset);
+        if (r <= 0)
+        {
+            if (r < 0)
+                perror_msg("Can't read '%s'", job->src_path);
+            return -1;
+        }
+
+        /* Leave blocks of zeros as holes */
+        for (ssize_t pos = 0; pos < r; pos += COPY_BLOCK_SIZE)
+        {
+            const char *block = job->buf + pos;
+            const size_t block_len = MIN(r - pos, COPY_BLOCK_SIZE);
+            if (block[0] == '\0' && memcmp(block, block + 1, block_len - 1) == 0)
+                continue;
+
+            if (pwrite(job->dst_fd, block, block_len, offset + pos) != (ssize_t)block_len)
+            {
+                perror_msg("Can't write '%s'", job->part_path);
+                return -1;
+            }
+        }
+        offset += r;
+    }
+
+    return 0;
+}
+
+static int copy_sparse(struct copy_job *job)
+{
+    struct copy_progress *p = &job->progress;
+    while (p->src_offset < p->src_size)
+    {
+        off_t data = lseek(job->src_fd, p->src_offset, SEEK_DATA);
+        if (data < 0 && errno == ENXIO)
+            /* The rest is a hole */
+            data = p->src_size;
+        else if (data < 0)
+            data = p->src_offset;
+
+        off_t hole = data < p->src_size ? lseek(job->src_fd, data, SEEK_HOLE) : p->src_size;
+        if (hole < 0 || hole > p->src_size)
+            hole = p->src_size;
+
+        /* Don't go too far between checkpoints */
+        const off_t end = MIN(hole, job->checkpoint + COPY_CHECKPOINT_SIZE);
+        if (data < end && copy_region(job, data, end) != 0)
+            return -1;
+
+        p->src_offset = p->dst_offset = MAX(end, data);
+        if (p->src_offset - job->checkpoint >= COPY_CHECKPOINT_SIZE && save_progress(job) != 0)
+            return -1;
+    }
+
+    /* A trailing hole must be materialized */
+    if (ftruncate(job->dst_fd, p->src_size) != 0)
+    {
+        perror_msg("Can't resize '%s'", job->part_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int copy_compressed(struct copy_job *job)
+{
+    struct copy_progress *p = &job->progress;
+    while (p->src_offset < p->src_size)
+    {
+        const size_t len = MIN(p->src_size - p->src_offset, COPY_CHUNK_SIZE);
+        const ssize_t r = pread(job->src_fd, job->buf, len, p->src_offset);
+        if (r <= 0)
+        {
+            if (r < 0)
+                perror_msg("Can't read '%s'", job->src_path);
+            return -1;
+        }
+
+        const size_t packed_len = ZSTD_compress2(job->cctx, job->packed, job->packed_size, job->buf, r);
+        if (ZSTD_isError(packed_len))
+        {
+            error_msg("Failed to compress data: %s", ZSTD_getErrorName(packed_len));
+            return -1;
+        }
+
+        if (pwrite(job->dst_fd, job->packed, packed_len, p->dst_offset) != (ssize_t)packed_len)
+        {
+            perror_msg("Can't write '%s'", job->part_path);
+            return -1;
+        }
+
+        p->src_offset += r;
+        p->dst_offset += packed_len;
+        if (p->src_offset - job->checkpoint >= COPY_CHECKPOINT_SIZE && save_progress(job) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int copy_file_resumable(const char *src_path, const char *dst_path, mode_t mode, unsigned flags)
+{
+    struct copy_job job = {
+        .src_path = src_path,
+        .dst_path = dst_path,
+        .part_path = xasprintf("%s"COPY_PART_SUFFIX, dst_path),
+        .progress_path = xasprintf("%s"COPY_PROGRESS_SUFFIX, dst_path),
+        .src_fd = open(src_path, O_RDONLY | O_NOFOLLOW),
+        .dst_fd = -1,
+        .use_copy_range = true,
+    };
+
+    int ret = -1;
+    struct stat src_st;
+    if (job.src_fd < 0 || fstat(job.src_fd, &src_st) != 0)
+    {
+        perror_msg("Can't open '%s'", src_path);
+        goto finito;
+    }
+
+    if (!S_ISREG(src_st.st_mode))
+    {
+        error_msg("'%s' is not a regular file", src_path);
+        goto finito;
+    }
+
+    job.dst_fd = open(job.part_path, O_WRONLY | O_CREAT | O_NOFOLLOW, mode);
+    struct stat dst_st;
+    if (job.dst_fd < 0 || fchmod(job.dst_fd, mode) != 0 || fstat(job.dst_fd, &dst_st) != 0)
+    {
+        perror_msg("Can't create '%s'", job.part_path);
+        goto finito;
+    }
+
+    job.progress.src_size = src_st.st_size;
+    job.progress.src_mtime = src_st.st_mtime;
+    job.progress.src_ino = src_st.st_ino;
+    job.progress.flags = flags;
+
+    const bool compress = flags & COPY_FILE_COMPRESS;
+    if (resume_copy(&job, &src_st) != 0)
+    {
+        if (ftruncate(job.dst_fd, 0) != 0)
+        {
+            perror_msg("Can't truncate '%s'", job.part_path);
+            goto finito;
+        }
+
+        if (!compress && src_st.st_dev == dst_st.st_dev && clone_file(&job) == 0)
+        {
+            job.progress.src_offset = job.progress.dst_offset = src_st.st_size;
+            goto done;
+        }
+    }
+
+    job.buf = xmalloc(COPY_CHUNK_SIZE);
+    if (compress)
+    {
+        job.cctx = ZSTD_createCCtx();
+        if (job.cctx == NULL)
+            die_out_of_memory();
+        ZSTD_CCtx_setParameter(job.cctx, ZSTD_c_compressionLevel, COPY_COMPRESSION_LEVEL);
+        ZSTD_CCtx_setParameter(job.cctx, ZSTD_c_checksumFlag, 1);
+        job.packed_size = ZSTD_compressBound(COPY_CHUNK_SIZE);
+        job.packed = xmalloc(job.packed_size);
+    }
+
+    if ((compress ? copy_compressed(&job) : copy_sparse(&job)) != 0)
+    {
+        /* Keep the part file, the copy can continue from the checkpoint */
+        error_msg("Copying '%s' interrupted at %llu bytes", src_path,
+                (unsigned long long)job.checkpoint);
+        goto finito;
+    }
+
+ done:
+    if (fsync(job.dst_fd) != 0)
+    {
+        perror_msg("Can't sync '%s'", job.part_path);
+        goto finito;
+    }
+
+    if (rename(job.part_path, dst_path) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", job.part_path, dst_path);
+        goto finito;
+    }
+    unlink(job.progress_path);
+
+    log_info("Copied '%s' to '%s' (%llu -> %llu bytes)", src_path, dst_path,
+            (unsigned long long)job.progress.src_offset,
+            (unsigned long long)job.progress.dst_offset);
+    ret = 0;
+
+ finito:
+    ZSTD_freeCCtx(job.cctx);
+    free(job.packed);
+    free(job.buf);
+    if (job.dst_fd >= 0)
+        close(job.dst_fd);
+    if (job.src_fd >= 0)
+        close(job.src_fd);
+    free(job.progress_path);
+    free(job.part_path);
+    return ret;
+}
+
+void copy_file_resumable_abort(const char *dst_path)
+{
+    char *path = xasprintf("%s"COPY_PART_SUFFIX, dst_path);
+    unlink(path);
+    free(path);
+
+    path = xasprintf("%s"COPY_PROGRESS_SUFFIX, dst_path);
+    unlink(path);
+    free(path);
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+
+/* Lock-free reads of problem directories.
+ *
+ * Taking the dump directory lock creates and removes the '.lock' symlink,
+ * i.e. every reader writes to the file system. Instead, readers open the
+ * directory with DD_OPEN_FD_ONLY and use the time stamps maintained by the
+ * kernel as a generation counter:
+ *
+ * 1. Before reading, the directory must not be locked and neither the
+ *    directory nor the read items may have been modified during the last
+ *    SNAPSHOT_QUIESCENT_SEC seconds.
+ * 2. After reading, the same conditions must still hold.
+ *
+ * Any modification after 1. sets the modification or change time to the
+ * current time, so 2. fails. Creating, removing and replacing items (that's
+ * how libreport writes them) changes the directory, writing in place (event
+ * scripts) changes the item itself. The quiescent period makes the protocol
+ * immune to coarse-grained time stamps.
+ *
+ * When validation fails, the reader falls back to a regular locked read.
+ */
+
+#define SNAPSHOT_QUIESCENT_SEC 2
+#define LOCK_FILE_NAME ".lock"
+
+static time_t (*s_clock)(time_t *) = time;
+
+void dd_snapshot_set_clock(time_t (*clock)(time_t *))
+{
+    s_clock = clock ? clock : time;
+}
+
+static bool stat_is_quiescent(const struct stat *st, time_t since)
+{
+    return st->st_mtime < since && st->st_ctime < since;
+}
+
+static bool dir_is_quiescent(int dir_fd, time_t since)
+{
+    struct stat st;
+    if (fstatat(dir_fd, LOCK_FILE_NAME, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        return false;
+
+    return fstat(dir_fd, &st) == 0 && stat_is_quiescent(&st, since);
+}
+
+/* Checks the directory and all its items */
+static bool dd_is_quiescent(struct dump_dir *dd, time_t since)
+{
+    if (!dir_is_quiescent(dd->dd_fd, since))
+        return false;
+
+    /* fdopendir() takes over the descriptor */
+    const int fd = dup(dd->dd_fd);
+    if (fd < 0)
+        return false;
+
+    DIR *dp = fdopendir(fd);
+    if (dp == NULL)
+    {
+        close(fd);
+        return false;
+    }
+
+    bool quiescent = true;
+    struct dirent *dent;
+    while (quiescent && (dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        struct stat st;
+        quiescent = fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                    && stat_is_quiescent(&st, since);
+    }
+    closedir(dp);
+
+    return quiescent;
+}
+
+bool dd_snapshot_is_valid_dir(struct dump_dir *dd)
+{
+    struct stat st;
+    if (fstatat(dd->dd_fd, LOCK_FILE_NAME, &st, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+        log_debug("'%s' is locked", dd->dd_dirname);
+        return false;
+    }
+
+    /* dd_fdopendir() refuses directories without the time item too */
+    if (fstatat(dd->dd_fd, FILENAME_TIME, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+    {
+        log_debug("'%s' is not a problem directory", dd->dd_dirname);
+        return false;
+    }
+
+    return true;
+}
+
+int dd_snapshot_begin(struct dump_dir *dd, struct dd_snapshot *snapshot)
+{
+    snapshot->since = s_clock(NULL) - SNAPSHOT_QUIESCENT_SEC;
+    return dd_is_quiescent(dd, snapshot->since) ? 0 : -1;
+}
+
+int dd_snapshot_validate(struct dump_dir *dd, const struct dd_snapshot *snapshot)
+{
+    return dd_is_quiescent(dd, snapshot->since) ? 0 : -1;
+}
+
+static bool item_is_quiescent(struct dump_dir *dd, const char *name, time_t since, struct stat *st)
+{
+    if (!dir_is_quiescent(dd->dd_fd, since))
+        return false;
+
+    if (fstatat(dd->dd_fd, name, st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        /* A missing item is a valid result */
+        memset(st, 0, sizeof(*st));
+        return errno == ENOENT;
+    }
+
+    return stat_is_quiescent(st, since);
+}
+
+char *dd_snapshot_load_text(struct dump_dir *dd, const char *name, unsigned flags)
+{
+    /* Nothing to gain */
+    if (dd->locked)
+        return dd_load_text_ext(dd, name, flags);
+
+    const time_t since = s_clock(NULL) - SNAPSHOT_QUIESCENT_SEC;
+    struct stat before;
+    if (item_is_quiescent(dd, name, since, &before))
+    {
+        char *value = dd_load_text_ext(dd, name, flags);
+
+        struct stat after;
+        if (item_is_quiescent(dd, name, since, &after)
+            && before.st_ino == after.st_ino
+            && before.st_size == after.st_size)
+            return value;
+
+        free(value);
+    }
+
+    log_debug("'%s/%s' is being modified, falling back to locked read", dd->dd_dirname, name);
+
+    struct dump_dir *locked = dd_opendir(dd->dd_dirname, DD_OPEN_READONLY | DD_FAIL_QUIETLY_EACCES);
+    if (locked == NULL)
+        return (flags & DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE) ? NULL : xstrdup("");
+
+    char *value = dd_load_text_ext(locked, name, flags);
+    dd_close(locked);
+    return value;
+}
@@ -0,0 +1,255 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+
+/* Aho-Corasick automaton searching for all patterns in a single pass.
+ *
+ * The automaton is a complete DFA: every state has a transition for every
+ * input symbol, so the scan loop is one table look up per input byte.
+ * To keep the table small, input bytes are mapped to classes first - all
+ * bytes which do not occur in any pattern share the class 0 - and ASCII
+ * letters are folded to lower case. Case sensitive patterns are verified
+ * with memcmp() when the automaton reports them, which happens rarely.
+ */
+
+#define MATCHER_ROOT 0
+
+struct matcher_pattern
+{
+    char *str;
+    unsigned len;
+    unsigned flags;
+    unsigned value;
+    /* Next pattern ending in the same state or -1 */
+    int next;
+};
+
+struct abrt_string_matcher
+{
+    struct matcher_pattern *patterns;
+    unsigned pattern_count;
+    /* Values of empty patterns, they match everything */
+    unsigned empty_value;
+
+    bool compiled;
+    unsigned char byte_class[256];
+    unsigned class_count;
+    unsigned state_count;
+    /* state_count * class_count transitions */
+    unsigned *delta;
+    /* First pattern ending in the state or -1 */
+    int *term;
+    /* The longest proper suffix state with a pattern or -1 */
+    int *dict;
+    /* The state itself or its dict, if any pattern ends in the state */
+    int *output;
+};
+
+static unsigned char fold_case(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+struct abrt_string_matcher *string_matcher_new(void)
+{
+    return xzalloc(sizeof(struct abrt_string_matcher));
+}
+
+void string_matcher_free(struct abrt_string_matcher *m)
+{
+    if (m == NULL)
+        return;
+
+    for (unsigned i = 0; i < m->pattern_count; ++i)
+        free(m->patterns[i].str);
+
+    free(m->patterns);
+    free(m->delta);
+    free(m->term);
+    free(m->dict);
+    free(m->output);
+    free(m);
+}
+
+void string_matcher_add(struct abrt_string_matcher *m, const char *pattern, unsigned flags, unsigned value)
+{
+    if (m->compiled)
+        error_msg_and_die("Can't add '%s' to a compiled string matcher", pattern);
+
+    if (pattern[0] == '\0')
+    {
+        m->empty_value |= value;
+        return;
+    }
+
+    if ((m->pattern_count & 0x1f) == 0)
+        m->patterns = xrealloc(m->patterns, (m->pattern_count + 0x20) * sizeof(m->patterns[0]));
+
+    struct matcher_pattern *p = &m->patterns[m->pattern_count++];
+    p->str = xstrdup(pattern);
+    p->len = strlen(pattern);
+    p->flags = flags;
+    p->value = value;
+    p->next = -1;
+}
+
+void string_matcher_compile(struct abrt_string_matcher *m)
+{
+    if (m->compiled)
+        return;
+
+    /* Byte classes */
+    unsigned max_states = 1;
+    m->class_count = 1;
+    memset(m->byte_class, 0, sizeof(m->byte_class));
+    for (unsigned i = 0; i < m->pattern_count; ++i)
+    {
+        max_states += m->patterns[i].len;
+        for (const char *c = m->patterns[i].str; *c; ++c)
+        {
+            const unsigned char f = fold_case(*c);
+            if (m->byte_class[f] == 0)
+                m->byte_class[f] = m->class_count++;
+        }
+    }
+    for (unsigned b = 'A'; b <= 'Z'; ++b)
+        m->byte_class[b] = m->byte_class[fold_case(b)];
+
+    const unsigned cc = m->class_count;
+    m->delta = xzalloc(max_states * cc * sizeof(m->delta[0]));
+    m->term = xmalloc(max_states * sizeof(m->term[0]));
+    m->dict = xmalloc(max_states * sizeof(m->dict[0]));
+    m->output = xmalloc(max_states * sizeof(m->output[0]));
+    for (unsigned s = 0; s < max_states; ++s)
+        m->term[s] = m->dict[s] = m->output[s] = -1;
+
+    /* Trie */
+    m->state_count = 1;
+    for (unsigned i = 0; i < m->pattern_count; ++i)
+    {
+        unsigned state = MATCHER_ROOT;
+        for (const char *c = m->patterns[i].str; *c; ++c)
+        {
+            unsigned *next = &m->delta[state * cc + m->byte_class[(unsigned char)*c]];
+            if (*next == MATCHER_ROOT)
+                *next = m->state_count++;
+            state = *next;
+        }
+        m->patterns[i].next = m->term[state];
+        m->term[state] = i;
+    }
+
+    /* Failure function folded into transitions, in breadth first order,
+     * so the failure state of every state is complete before it is used */
+    unsigned *fail = xzalloc(m->state_count * sizeof(fail[0]));
+    unsigned *queue = xmalloc(m->state_count * sizeof(queue[0]));
+    unsigned head = 0, tail = 0;
+
+    for (unsigned c = 0; c < cc; ++c)
+    {
+        const unsigned child = m->delta[MATCHER_ROOT * cc + c];
+        if (child != MATCHER_ROOT)
+            queue[tail++] = child;
+    }
+
+    while (head < tail)
+    {
+        const unsigned state = queue[head++];
+
+        if (m->term[fail[state]] >= 0)
+            m->dict[state] = fail[state];
+        else
+            m->dict[state] = m->dict[fail[state]];
+
+        m->output[state] = m->term[state] >= 0 ? (int)state : m->dict[state];
+
+        for (unsigned c = 0; c < cc; ++c)
+        {
+            unsigned *next = &m->delta[state * cc + c];
+            if (*next != MATCHER_ROOT)
+            {
+                fail[*next] = m->delta[fail[state] * cc + c];
+                queue[tail++] = *next;
+            }
+            else
+                *next = m->delta[fail[state] * cc + c];
+        }
+    }
+
+    free(queue);
+    free(fail);
+
+    log_debug("String matcher: %u patterns, %u states, %u byte classes",
+            m->pattern_count, m->state_count, cc);
+
+    m->compiled = true;
+}
+
+/* Returns values of patterns ending at 'end' */
+static unsigned report(const struct abrt_string_matcher *m, int state, const char *end)
+{
+    unsigned value = 0;
+    for (; state >= 0; state = m->dict[state])
+    {
+        for (int i = m->term[state]; i >= 0; i = m->patterns[i].next)
+        {
+            const struct matcher_pattern *p = &m->patterns[i];
+            /* The automaton has already matched the folded pattern */
+            if ((p->flags & STRING_MATCHER_IGNORE_CASE)
+                || memcmp(end + 1 - p->len, p->str, p->len) == 0)
+                value |= p->value;
+        }
+    }
+    return value;
+}
+
+static unsigned scan(const struct abrt_string_matcher *m, const char *buf, size_t len, bool first)
+{
+    if (!m->compiled)
+        error_msg_and_die("String matcher is not compiled");
+
+    unsigned value = m->empty_value;
+    if (first && value)
+        return value;
+
+    const unsigned cc = m->class_count;
+    unsigned state = MATCHER_ROOT;
+    for (const char *c = buf; c < buf + len; ++c)
+    {
+        state = m->delta[state * cc + m->byte_class[(unsigned char)*c]];
+        if (m->output[state] >= 0)
+        {
+            value |= report(m, m->output[state], c);
+            if (first && value)
+                break;
+        }
+    }
+
+    return value;
+}
+
+unsigned string_matcher_scan(const struct abrt_string_matcher *m, const char *buf, size_t len)
+{
+    return scan(m, buf, len, /*first*/false);
+}
+
+bool string_matcher_contains(const struct abrt_string_matcher *m, const char *buf, size_t len)
+{
+    return scan(m, buf, len, /*first*/true) != 0;
+}
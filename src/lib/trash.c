@@ -0,0 +1,240 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+
+/* Large files are truncated in steps of this size, so that the file system
+ * never has to free too many extents at once.
+ */
+#define REAP_TRUNCATE_STEP (16 * 1024 * 1024)
+
+/* Don't bother sleeping for less than 1/10s worth of data */
+#define REAP_SLEEP_DIVISOR 10
+
+char *trash_location(const char *dump_location)
+{
+    return concat_path_file(dump_location, ABRT_TRASH_DIR_NAME);
+}
+
+/* Only abrtd empties the trash and only the one of the dump location */
+static bool is_dump_location(const char *dirname)
+{
+    if (g_settings_dump_location == NULL)
+        return false;
+
+    const unsigned len = trimmed_dir_name_len(g_settings_dump_location);
+    return strlen(dirname) == len && strncmp(dirname, g_settings_dump_location, len) == 0;
+}
+
+int dd_trash(struct dump_dir *dd)
+{
+    char *dirname = xstrndup(dd->dd_dirname, trimmed_dir_name_len(dd->dd_dirname));
+
+    char *base = strrchr(dirname, '/');
+    if (base == NULL || base == dirname)
+    {
+        free(dirname);
+        return dd_delete(dd);
+    }
+    *base++ = '\0';
+
+    if (!is_dump_location(dirname))
+    {
+        log_debug("'%s' is not the dump location, deleting '%s'", dirname, base);
+        free(dirname);
+        return dd_delete(dd);
+    }
+
+    char *trash_dir = trash_location(dirname);
+    char *trash_path = NULL;
+    if (mkdir(trash_dir, 0700) != 0 && errno != EEXIST)
+    {
+        perror_msg("Can't create '%s'", trash_dir);
+        goto delete;
+    }
+
+    /* The same problem name can be trashed several times before the reaper
+     * gets to it (e.g. a dump directory re-created by a hook) */
+    trash_path = concat_path_file(trash_dir, base);
+    struct stat st;
+    for (unsigned i = 1; lstat(trash_path, &st) == 0; ++i)
+    {
+        free(trash_path);
+        trash_path = xasprintf("%s/%s.%u", trash_dir, base, i);
+    }
+
+    if (dd_rename(dd, trash_path) != 0)
+    {
+        error_msg("Can't move '%s' to trash", dd->dd_dirname);
+        goto delete;
+    }
+
+    log_info("Moved '%s/%s' to '%s'", dirname, base, trash_path);
+    dd_close(dd);
+
+    free(trash_path);
+    free(trash_dir);
+    free(dirname);
+    return 0;
+
+ delete:
+    free(trash_path);
+    free(trash_dir);
+    free(dirname);
+    return dd_delete(dd);
+}
+
+int trash_dump_dir(const char *dirname)
+{
+    struct dump_dir *dd = dd_opendir(dirname, /*flags:*/ 0);
+    if (!dd)
+        return -1;
+
+    if (dd_trash(dd) != 0)
+    {
+        dd_close(dd);
+        return -1;
+    }
+
+    return 0;
+}
+
+struct reaper
+{
+    unsigned long bytes_per_sec;
+    unsigned long long debt;
+};
+
+static void reaper_throttle(struct reaper *r, unsigned long long bytes)
+{
+    if (r->bytes_per_sec == 0)
+        return;
+
+    r->debt += bytes;
+    if (r->debt < r->bytes_per_sec / REAP_SLEEP_DIVISOR)
+        return;
+
+    usleep(r->debt * 1000000ULL / r->bytes_per_sec);
+    r->debt = 0;
+}
+
+static void reap_file(struct reaper *r, int dir_fd, const char *name)
+{
+    const int fd = openat(dir_fd, name, O_WRONLY | O_NOFOLLOW | O_NONBLOCK);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1)
+    {
+        /* Truncating hard linked files doesn't free any space */
+        off_t size = st.st_size;
+        while (size > REAP_TRUNCATE_STEP)
+        {
+            size -= REAP_TRUNCATE_STEP;
+            if (ftruncate(fd, size) != 0)
+                break;
+
+            reaper_throttle(r, REAP_TRUNCATE_STEP);
+        }
+        reaper_throttle(r, size);
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (unlinkat(dir_fd, name, 0) != 0 && errno != ENOENT)
+        perror_msg("Can't remove '%s'", name);
+}
+
+static int reap_dir(struct reaper *r, int parent_fd, const char *name)
+{
+    const int dir_fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (dir_fd < 0)
+    {
+        perror_msg("Can't open '%s'", name);
+        return -1;
+    }
+
+    DIR *dp = fdopendir(dir_fd);
+    if (dp == NULL)
+    {
+        close(dir_fd);
+        return -1;
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        struct stat st;
+        if (fstatat(dir_fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            reap_dir(r, dir_fd, dent->d_name);
+        else
+            reap_file(r, dir_fd, dent->d_name);
+    }
+    closedir(dp);
+
+    if (unlinkat(parent_fd, name, AT_REMOVEDIR) != 0)
+    {
+        perror_msg("Can't remove '%s'", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+int empty_trash(const char *trash_dir, unsigned long bytes_per_sec)
+{
+    DIR *dp = opendir(trash_dir);
+    if (dp == NULL)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", trash_dir);
+        return 0;
+    }
+
+    struct reaper r = { .bytes_per_sec = bytes_per_sec, .debt = 0 };
+
+    int reaped = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (dot_or_dotdot(dent->d_name))
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (reap_dir(&r, dirfd(dp), dent->d_name) != 0)
+                continue;
+        }
+        else
+            reap_file(&r, dirfd(dp), dent->d_name);
+
+        log_debug("Reaped '%s/%s'", trash_dir, dent->d_name);
+        ++reaped;
+    }
+    closedir(dp);
+
+    return reaped;
+}
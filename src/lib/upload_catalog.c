@@ -0,0 +1,509 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "internal_libabrt.h"
+#include "problem_api.h"
+
+/* Catalog of problems of a collector by their fingerprints.
+ *
+ * Before uploading an archive, a node drops a manifest with the fingerprint
+ * of the problem, i.e. its type and UUID, to the upload directory:
+ *   type CCpp
+ *   uuid 0123abcd...
+ *   time 1490000000
+ *   count 1
+ * where count is the number of occurrences the manifest stands for.
+ *
+ * The collector answers with a response file next to the manifest containing
+ * either "payload", the node should upload the archive, or
+ * "duplicate [<problem directory name>]", the collector has only recorded
+ * the occurrences and the archive is not needed. The name is missing if
+ * another node is uploading the payload of the problem.
+ *
+ * Occurrences of a problem which hasn't been processed by abrtd yet, or whose
+ * payload is still being uploaded, are kept in the catalog and added to the
+ * problem once it is complete.
+ *
+ * The catalog file is a text file:
+ *   <dump location>
+ *   <fingerprint> <problem directory name> <pending occurrences> <last occurrence>
+ *   ...
+ * It is only a cache, see problem_cache.c for how it is kept up to date.
+ * Problems awaiting their payloads are not saved, the nodes are asked for
+ * the payload again after a restart.
+ */
+
+/* A node which hasn't uploaded the payload in this time is considered gone
+ * and the next node is asked for it */
+#define UPLOAD_PAYLOAD_TIMEOUT_SEC (60 * 60)
+
+struct catalog_entry
+{
+    /* NULL while the payload is being uploaded */
+    char *dirname;
+    /* when the payload was requested */
+    time_t requested;
+    /* occurrences not added to the problem yet */
+    unsigned long pending;
+    time_t last_occurrence;
+};
+
+struct abrt_upload_catalog
+{
+    /* fingerprint -> struct catalog_entry */
+    struct abrt_problem_cache cache;
+};
+
+static void catalog_entry_free(gpointer data)
+{
+    struct catalog_entry *entry = data;
+    free(entry->dirname);
+    free(entry);
+}
+
+static struct catalog_entry *catalog_entry_new(const char *dirname)
+{
+    struct catalog_entry *entry = xzalloc(sizeof(*entry));
+    entry->dirname = xstrdup(dirname);
+    return entry;
+}
+
+static char *fingerprint(const char *type, const char *uuid)
+{
+    if (type == NULL || type[0] == '\0' || uuid == NULL || uuid[0] == '\0'
+        || strpbrk(type, " \n:") != NULL || strpbrk(uuid, " \n") != NULL)
+        return NULL;
+
+    return xasprintf("%s:%s", type, uuid);
+}
+
+/* Returns the fingerprint of the problem or NULL if it has none */
+static char *problem_fingerprint(struct dump_dir *dd)
+{
+    const int flags = DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE;
+    char *type = dd_snapshot_load_text(dd, FILENAME_TYPE, flags);
+    char *uuid = dd_snapshot_load_text(dd, FILENAME_UUID, flags);
+    char *fp = fingerprint(type, uuid);
+    free(uuid);
+    free(type);
+    return fp;
+}
+
+static const char *base_name(const char *dirname)
+{
+    const char *name = strrchr(dirname, '/');
+    return name ? name + 1 : dirname;
+}
+
+static int add_problem_cb(struct dump_dir *dd, void *arg)
+{
+    struct abrt_problem_cache *cache = arg;
+
+    char *fp = problem_fingerprint(dd);
+    if (fp == NULL)
+        return 0;
+
+    /* There should be only one problem per fingerprint, keep the first one */
+    if (g_hash_table_lookup(cache->problems, fp) == NULL)
+        g_hash_table_insert(cache->problems, fp, catalog_entry_new(base_name(dd->dd_dirname)));
+    else
+        free(fp);
+
+    return 0;
+}
+
+static int read_entry(struct abrt_problem_cache *cache, char *line, int dump_fd)
+{
+    char fp[strlen(line) + 1];
+    char name[strlen(line) + 1];
+    unsigned long pending, last;
+    if (sscanf(line, "%s %s %lu %lu", fp, name, &pending, &last) != 4)
+        return -1;
+
+    /* Forget deleted problems, so the catalog doesn't grow forever */
+    if (!problem_cache_has_dir(dump_fd, name))
+    {
+        if (pending != 0)
+            log_warning("Dropping %lu occurrences of deleted problem '%s'", pending, name);
+        cache->modified = true;
+        return 0;
+    }
+
+    struct catalog_entry *entry = catalog_entry_new(name);
+    entry->pending = pending;
+    entry->last_occurrence = last;
+    g_hash_table_replace(cache->problems, xstrdup(fp), entry);
+    return 0;
+}
+
+static void write_entry(FILE *fp, const char *fp_str, const void *value)
+{
+    const struct catalog_entry *entry = value;
+    if (entry->dirname != NULL)
+        fprintf(fp, "%s %s %lu %lu\n", fp_str, entry->dirname,
+                entry->pending, (unsigned long)entry->last_occurrence);
+}
+
+static const struct abrt_problem_cache_ops upload_catalog_ops = {
+    .what = "upload catalog",
+    .add_problem = add_problem_cb,
+    .read_entry = read_entry,
+    .write_entry = write_entry,
+    .free_entry = catalog_entry_free,
+};
+
+struct abrt_upload_catalog *upload_catalog_load(const char *catalog_file, const char *dump_location)
+{
+    struct abrt_upload_catalog *catalog = xzalloc(sizeof(*catalog));
+    problem_cache_init(&catalog->cache, &upload_catalog_ops, catalog_file, dump_location);
+    return catalog;
+}
+
+void upload_catalog_free(struct abrt_upload_catalog *catalog)
+{
+    if (catalog == NULL)
+        return;
+
+    problem_cache_destroy(&catalog->cache);
+    free(catalog);
+}
+
+/* Adds the pending occurrences to the problem.
+ *
+ * Returns 1 if they have been added, 0 if the problem isn't complete yet
+ * and -1 if the problem is gone or isn't the catalogued one.
+ */
+static int flush_occurrences(struct abrt_upload_catalog *catalog, const char *fp, struct catalog_entry *entry)
+{
+    char *path = concat_path_file(catalog->cache.dump_location, entry->dirname);
+    struct dump_dir *dd = dd_opendir(path, DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES);
+    if (dd == NULL)
+    {
+        log_notice("Upload catalog refers to a missing problem '%s'", path);
+        free(path);
+        return -1;
+    }
+
+    int ret = -1;
+    char *dd_fp = problem_fingerprint(dd);
+    if (dd_fp == NULL || strcmp(dd_fp, fp) != 0)
+    {
+        log_notice("Problem '%s' is not the catalogued one", path);
+        goto finito;
+    }
+
+    /* abrtd would take the problem with 'count' for a processed one */
+    char *count_str = dd_load_text_ext(dd, FILENAME_COUNT, DD_FAIL_QUIETLY_ENOENT);
+    unsigned long count = strtoul(count_str, NULL, 10);
+    free(count_str);
+    if (count == 0)
+    {
+        ret = 0;
+        goto finito;
+    }
+
+    if (entry->pending != 0)
+    {
+        count += entry->pending;
+
+        char new_count_str[sizeof(long)*3 + 2];
+        sprintf(new_count_str, "%lu", count);
+        dd_save_text(dd, FILENAME_COUNT, new_count_str);
+
+        char last_ocr[sizeof(long)*3 + 2];
+        sprintf(last_ocr, "%lu", (unsigned long)entry->last_occurrence);
+        dd_save_text(dd, FILENAME_LAST_OCCURRENCE, last_ocr);
+
+        log_info("Added %lu occurrences to '%s', occurrence %lu", entry->pending, path, count);
+        entry->pending = 0;
+        catalog->cache.modified = true;
+    }
+    ret = 1;
+
+ finito:
+    free(dd_fp);
+    dd_close(dd);
+    free(path);
+    return ret;
+}
+
+int upload_catalog_add_problem(struct abrt_upload_catalog *catalog, const char *dirname)
+{
+    struct dump_dir *dd = dd_opendir(dirname, DD_OPEN_READONLY | DD_FAIL_QUIETLY_ENOENT);
+    if (dd == NULL)
+        return -1;
+
+    char *fp = problem_fingerprint(dd);
+    dd_close(dd);
+    if (fp == NULL)
+    {
+        log_info("Problem '%s' has no fingerprint", dirname);
+        return -1;
+    }
+
+    struct catalog_entry *entry = g_hash_table_lookup(catalog->cache.problems, fp);
+    if (entry == NULL)
+        g_hash_table_insert(catalog->cache.problems, fp, catalog_entry_new(base_name(dirname)));
+    else
+    {
+        /* The awaited payload has come */
+        if (entry->dirname == NULL)
+            entry->dirname = xstrdup(base_name(dirname));
+        /* Otherwise post-create deletes the new one as a duplicate */
+        free(fp);
+    }
+
+    catalog->cache.modified = true;
+    return 0;
+}
+
+unsigned upload_catalog_flush_occurrences(struct abrt_upload_catalog *catalog)
+{
+    unsigned pending = 0;
+
+    GHashTableIter iter;
+    gpointer fp, value;
+    g_hash_table_iter_init(&iter, catalog->cache.problems);
+    while (g_hash_table_iter_next(&iter, &fp, &value))
+    {
+        struct catalog_entry *entry = value;
+        if (entry->pending == 0)
+            continue;
+
+        if (entry->dirname == NULL)
+        {
+            ++pending;
+            continue;
+        }
+
+        const int r = flush_occurrences(catalog, fp, entry);
+        if (r == 0)
+            ++pending;
+        else if (r < 0)
+        {
+            log_warning("Dropping %lu occurrences of '%s'", entry->pending, entry->dirname);
+            g_hash_table_iter_remove(&iter);
+            catalog->cache.modified = true;
+        }
+    }
+
+    return pending;
+}
+
+/* Manifests are small, anything bigger is not a manifest */
+#define UPLOAD_MANIFEST_MAX_SIZE (4 * 1024)
+
+static int save_response(const char *manifest_path, const char *response)
+{
+    const size_t len = strlen(manifest_path) - strlen(UPLOAD_MANIFEST_SUFFIX);
+    char *response_path = xasprintf("%.*s"UPLOAD_RESPONSE_SUFFIX, (int)len, manifest_path);
+    char *tmp_path = xasprintf("%s.tmp", response_path);
+
+    /* The node waits for the file, it must never see a partial response */
+    int ret = -1;
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0)
+        perror_msg("Can't create '%s'", tmp_path);
+    else
+    {
+        const size_t response_len = strlen(response);
+        if (full_write(fd, response, response_len) != response_len || full_write(fd, "\n", 1) != 1)
+            perror_msg("Can't write '%s'", tmp_path);
+        else if (rename(tmp_path, response_path) != 0)
+            perror_msg("Can't rename '%s' to '%s'", tmp_path, response_path);
+        else
+            ret = 0;
+        close(fd);
+
+        if (ret != 0)
+            unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(response_path);
+    return ret;
+}
+
+static int answer_manifest(const char *manifest_path, int result, const char *dirname)
+{
+    /* The problem directory isn't known while the payload is being uploaded */
+    char *response = result == UPLOAD_MANIFEST_PAYLOAD ? xstrdup(UPLOAD_RESPONSE_PAYLOAD)
+                     : dirname == NULL ? xstrdup(UPLOAD_RESPONSE_DUPLICATE)
+                     : xasprintf(UPLOAD_RESPONSE_DUPLICATE" %s", dirname);
+    const int r = save_response(manifest_path, response);
+    free(response);
+
+    if (r != 0)
+        return UPLOAD_MANIFEST_ERROR;
+
+    if (unlink(manifest_path) != 0 && errno != ENOENT)
+        perror_msg("Can't remove '%s'", manifest_path);
+
+    return result;
+}
+
+int upload_catalog_process_manifest(struct abrt_upload_catalog *catalog, const char *manifest_path)
+{
+    if (!g_str_has_suffix(manifest_path, UPLOAD_MANIFEST_SUFFIX))
+    {
+        error_msg("'%s' is not a manifest", manifest_path);
+        return UPLOAD_MANIFEST_ERROR;
+    }
+
+    size_t size = UPLOAD_MANIFEST_MAX_SIZE;
+    char *manifest = xmalloc_open_read_close(manifest_path, &size);
+    if (manifest == NULL)
+        return UPLOAD_MANIFEST_ERROR;
+
+    char *type = NULL, *uuid = NULL;
+    unsigned long occurrences = 1;
+    time_t t = time(NULL);
+    char *saveptr = NULL;
+    for (char *line = strtok_r(manifest, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr))
+    {
+        char *value = strchr(line, ' ');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+
+        if (strcmp(line, FILENAME_TYPE) == 0)
+            type = value;
+        else if (strcmp(line, FILENAME_UUID) == 0)
+            uuid = value;
+        else if (strcmp(line, FILENAME_TIME) == 0)
+            t = strtoul(value, NULL, 10);
+        else if (strcmp(line, FILENAME_COUNT) == 0)
+            occurrences = strtoul(value, NULL, 10);
+    }
+
+    char *fp = fingerprint(type, uuid);
+    free(manifest);
+
+    /* Can't deduplicate, the collector needs the whole problem */
+    if (fp == NULL)
+    {
+        log_info("Manifest '%s' has no fingerprint", manifest_path);
+        return answer_manifest(manifest_path, UPLOAD_MANIFEST_PAYLOAD, NULL);
+    }
+
+    if (occurrences == 0)
+        occurrences = 1;
+
+    struct catalog_entry *entry = g_hash_table_lookup(catalog->cache.problems, fp);
+    if (entry != NULL && entry->dirname != NULL)
+    {
+        entry->pending += occurrences;
+        if (t > entry->last_occurrence)
+            entry->last_occurrence = t;
+        catalog->cache.modified = true;
+
+        /* Checks the problem is still there */
+        if (flush_occurrences(catalog, fp, entry) < 0)
+        {
+            g_hash_table_remove(catalog->cache.problems, fp);
+            entry = NULL;
+        }
+    }
+
+    int result = UPLOAD_MANIFEST_DUPLICATE;
+    const char *dirname = NULL;
+    if (entry == NULL)
+    {
+        entry = xzalloc(sizeof(*entry));
+        entry->requested = time(NULL);
+        entry->last_occurrence = t;
+        g_hash_table_replace(catalog->cache.problems, xstrdup(fp), entry);
+        result = UPLOAD_MANIFEST_PAYLOAD;
+    }
+    else if (entry->dirname == NULL)
+    {
+        /* Another node is uploading the payload */
+        if (entry->requested + UPLOAD_PAYLOAD_TIMEOUT_SEC < time(NULL))
+        {
+            log_notice("Payload of '%s' hasn't come, asking again", fp);
+            entry->requested = time(NULL);
+            result = UPLOAD_MANIFEST_PAYLOAD;
+        }
+        else
+        {
+            entry->pending += occurrences;
+            if (t > entry->last_occurrence)
+                entry->last_occurrence = t;
+        }
+    }
+    else
+        dirname = entry->dirname;
+
+    log_info("Manifest '%s' of '%s': %s", manifest_path, fp,
+            result == UPLOAD_MANIFEST_PAYLOAD ? "payload needed" : "duplicate");
+    free(fp);
+
+    return answer_manifest(manifest_path, result, dirname);
+}
+
+int upload_catalog_save(struct abrt_upload_catalog *catalog)
+{
+    return problem_cache_save(&catalog->cache);
+}
+
+int upload_manifest_save(struct dump_dir *dd, const char *manifest_path, unsigned long occurrences)
+{
+    const int flags = DD_FAIL_QUIETLY_ENOENT | DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE;
+    char *type = dd_load_text_ext(dd, FILENAME_TYPE, flags);
+    char *uuid = dd_load_text_ext(dd, FILENAME_UUID, flags);
+    char *last_ocr = dd_load_text_ext(dd, FILENAME_LAST_OCCURRENCE, flags);
+    if (last_ocr == NULL)
+        last_ocr = dd_load_text_ext(dd, FILENAME_TIME, flags);
+
+    struct strbuf *manifest = strbuf_new();
+    if (type)
+        strbuf_append_strf(manifest, FILENAME_TYPE" %s\n", type);
+    if (uuid)
+        strbuf_append_strf(manifest, FILENAME_UUID" %s\n", uuid);
+    if (last_ocr)
+        strbuf_append_strf(manifest, FILENAME_TIME" %s\n", last_ocr);
+    strbuf_append_strf(manifest, FILENAME_COUNT" %lu\n", occurrences);
+
+    free(last_ocr);
+    free(uuid);
+    free(type);
+
+    /* The collector reacts to the rename, it must never see a partial manifest */
+    char *tmp_path = xasprintf("%s.tmp", manifest_path);
+    int ret = -1;
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0)
+        perror_msg("Can't create '%s'", tmp_path);
+    else
+    {
+        if (full_write(fd, manifest->buf, manifest->len) != manifest->len)
+            perror_msg("Can't write '%s'", tmp_path);
+        else if (rename(tmp_path, manifest_path) != 0)
+            perror_msg("Can't rename '%s' to '%s'", tmp_path, manifest_path);
+        else
+            ret = 0;
+        close(fd);
+
+        if (ret != 0)
+            unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    strbuf_free(manifest);
+    return ret;
+}
@@ -59,9 +59,18 @@ int main(int argc, char **argv)
     map_string_t *settings = new_map_string();
     load_abrt_plugin_conf_file("oops.conf", settings);
 
-    char *oops = dd_load_text(dd, FILENAME_BACKTRACE);
-    char hash_str[SHA1_RESULT_LEN*2 + 1];
-    int bad = koops_hash_str(hash_str, oops);
+    /* Parsed by the dumper */
+    struct abrt_koops_info *info = dd_load_koops_info(dd);
+    if (!info)
+        error_msg_and_die("Can't load '%s' from '%s'", FILENAME_BACKTRACE, dump_dir_name);
+
+    /* Problems created by older versions don't have it and it is stale if
+     * the backtrace has been changed, the hashes must match the backtrace */
+    if (!dd_koops_info_is_current(dd))
+        dd_save_koops_info(dd, info);
+
+    const char *hash_str = info->hash;
+    int bad = hash_str[0] == '\0';
     if (bad)
     {
         error_msg("Can't find a meaningful backtrace for hashing in '%s'", dump_dir_name);
@@ -83,26 +92,24 @@ int main(int argc, char **argv)
               "can contact kernel maintainers via e-mail.")
             );
 
-            /* Try to generate the hash once more with no limits. */
+            /* Use the hash with no limits. */
             /* We need UUID file for the local duplicates look-up and DUPHASH */
             /* file is also useful because user can force ABRT to report */
             /* the oops into a bug tracking system (Bugzilla). */
-            bad = koops_hash_str_ext(hash_str, oops,
-                    /* use no frame count limit */-1,
-                    /* use every frame in stacktrace */0);
+            hash_str = info->full_hash;
+            bad = hash_str[0] == '\0';
 
             /* If even this attempt fails, we can drop the oops without any hesitation. */
         }
     }
 
-    free(oops);
-
     if (!bad)
     {
         dd_save_text(dd, FILENAME_UUID, hash_str);
         dd_save_text(dd, FILENAME_DUPHASH, hash_str);
     }
 
+    koops_info_free(info);
     dd_close(dd);
 
     free_map_string(settings);
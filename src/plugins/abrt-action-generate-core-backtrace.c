@@ -21,6 +21,92 @@
 
 #include "libabrt.h"
 
+/* A coredump kept compressed by abrt-dump-journal-core stays compressed in
+ * the problem directory until an analyze_* event rehydrates it. The unwinder
+ * gets a temporary copy of the problem directory with the coredump unpacked.
+ *
+ * Returns the copy, NULL if there is no compressed coredump or on error.
+ */
+static char *unpack_to_scratch_dir(const char *dump_dir_name, bool *failed)
+{
+    *failed = false;
+
+    struct dump_dir *dd = dd_opendir(dump_dir_name, DD_OPEN_READONLY);
+    if (!dd)
+    {
+        *failed = true;
+        return NULL;
+    }
+
+    char *scratch = NULL;
+    if (dd_exist(dd, FILENAME_COREDUMP))
+        goto finito;
+
+    scratch = xstrdup(LARGE_DATA_TMP_DIR"/abrt-core-backtrace-XXXXXX");
+    if (mkdtemp(scratch) == NULL)
+    {
+        perror_msg("Can't create '%s'", scratch);
+        goto fail;
+    }
+
+    /* Everything except the coredump, the items are small */
+    dd_init_next_file(dd);
+    char *short_name, *full_name;
+    while (dd_get_next_file(dd, &short_name, &full_name))
+    {
+        if (strncmp(short_name, FILENAME_COREDUMP, strlen(FILENAME_COREDUMP)) != 0)
+        {
+            char *dst_path = concat_path_file(scratch, short_name);
+            if (copy_file(full_name, dst_path, 0600) < 0)
+                log_info("Can't copy '%s'", full_name);
+            free(dst_path);
+        }
+        free(short_name);
+        free(full_name);
+    }
+
+    char *coredump = concat_path_file(scratch, FILENAME_COREDUMP);
+    const int unpacked = dd_unpack_coredump_to(dd, coredump);
+    free(coredump);
+    if (unpacked > 0)
+        goto finito;
+
+    delete_dump_dir(scratch);
+    free(scratch);
+    scratch = NULL;
+    if (unpacked == 0)
+        goto finito;
+
+ fail:
+    free(scratch);
+    scratch = NULL;
+    *failed = true;
+
+ finito:
+    dd_close(dd);
+    return scratch;
+}
+
+/* Moves the result from the scratch directory to the problem directory */
+static int save_core_backtrace(const char *scratch, const char *dump_dir_name)
+{
+    char *path = concat_path_file(scratch, FILENAME_CORE_BACKTRACE);
+    char *core_backtrace = xmalloc_open_read_close(path, /*maxsize:*/ NULL);
+    free(path);
+    if (!core_backtrace)
+        return 1;
+
+    struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
+    if (dd)
+    {
+        dd_save_text(dd, FILENAME_CORE_BACKTRACE, core_backtrace);
+        dd_close(dd);
+    }
+    free(core_backtrace);
+
+    return dd ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
     /* I18n */
@@ -63,26 +149,35 @@ int main(int argc, char **argv)
     /* Let user know what's going on */
     log_notice(_("Generating core_backtrace"));
 
+    bool failed;
+    char *scratch = unpack_to_scratch_dir(dump_dir_name, &failed);
+    if (failed)
+        return 1;
+
+    const char *core_dir_name = scratch ? scratch : dump_dir_name;
+
     char *error_message = NULL;
     bool success;
 
 #ifdef ENABLE_NATIVE_UNWINDER
 
-    success = sr_abrt_create_core_stacktrace(dump_dir_name, !raw_fingerprints,
+    success = sr_abrt_create_core_stacktrace(core_dir_name, !raw_fingerprints,
                                              &error_message);
 #else /* ENABLE_NATIVE_UNWINDER */
 
     /* The value 240 was taken from abrt-action-generate-backtrace.c. */
     int exec_timeout_sec = 240;
 
-    char *gdb_output = get_backtrace(dump_dir_name, exec_timeout_sec, NULL);
+    char *gdb_output = get_backtrace(core_dir_name, exec_timeout_sec, NULL);
     if (!gdb_output)
     {
         log(_("Error: GDB did not return any data"));
+        if (scratch)
+            delete_dump_dir(scratch);
         return 1;
     }
 
-    success = sr_abrt_create_core_stacktrace_from_gdb(dump_dir_name,
+    success = sr_abrt_create_core_stacktrace_from_gdb(core_dir_name,
                                                       gdb_output,
                                                       !raw_fingerprints,
                                                       &error_message);
@@ -90,12 +185,21 @@ int main(int argc, char **argv)
 
 #endif /* ENABLE_NATIVE_UNWINDER */
 
+    int ret = 0;
     if (!success)
     {
         log(_("Error: %s"), error_message);
         free(error_message);
-        return 1;
+        ret = 1;
+    }
+    else if (scratch)
+        ret = save_core_backtrace(scratch, dump_dir_name);
+
+    if (scratch)
+    {
+        delete_dump_dir(scratch);
+        free(scratch);
     }
 
-    return 0;
+    return ret;
 }
@@ -0,0 +1,325 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "libabrt.h"
+#include "oops-utils.h"
+
+#define VMCORE_DMESG "vmcore-dmesg.txt"
+#define VMCORE_DMESG_MAX_SIZE (64 * 1024 * 1024)
+#define COLD_DIR_MODE 0751
+
+/* Copying a multi-GB vmcore takes minutes, the oops of the crashed kernel
+ * is published right away as a Kerneloops problem next to the vmcore one */
+static void publish_oops(const char *problem_dir, char *oops, const struct abrt_koops_info *info)
+{
+    char *dir = xstrdup(problem_dir);
+    char *name = strrchr(dir, '/');
+    if (name)
+        *name++ = '\0';
+    char *path = name ? xasprintf("%s/oops-%s", dir, name) : xasprintf("oops-%s", dir);
+    free(dir);
+
+    /* Published by an interrupted run */
+    struct stat st;
+    if (lstat(path, &st) == 0)
+    {
+        log_info("'%s' already exists", path);
+        free(path);
+        return;
+    }
+
+    struct dump_dir *dd = dd_create(path, /*fs owner*/0, DEFAULT_DUMP_DIR_MODE);
+    if (!dd)
+    {
+        error_msg("Unable to create problem directory '%s'", path);
+        free(path);
+        return;
+    }
+
+    dd_create_basic_files(dd, /*no uid*/(uid_t)-1L, NULL);
+    abrt_oops_save_data_in_dump_dir(dd, oops, /*no proc modules*/NULL, info);
+    dd_save_text(dd, FILENAME_ABRT_VERSION, VERSION);
+    dd_save_text(dd, FILENAME_ANALYZER, "abrt-oops");
+    dd_save_text(dd, FILENAME_TYPE, "Kerneloops");
+    dd_close(dd);
+
+    notify_new_path(path);
+    log_notice("Published the oops of '%s' as '%s'", problem_dir, path);
+    free(path);
+}
+
+/* Extracts the oops up front, so the problem directory is complete
+ * as soon as it is renamed and post-create doesn't need to scan the log.
+ * Returns the duplicate hash of the oops or NULL */
+static char *save_dmesg_oops(struct dump_dir *dd, const char *problem_dir)
+{
+    char *path = concat_path_file(dd->dd_dirname, VMCORE_DMESG);
+    size_t size = VMCORE_DMESG_MAX_SIZE;
+    char *dmesg = xmalloc_open_read_close(path, &size);
+    free(path);
+    if (dmesg == NULL)
+        return NULL;
+
+    GList *oops_list = NULL;
+    struct abrt_koops_extractor *extractor = koops_extractor_new();
+    koops_extractor_feed(extractor, dmesg, size, &oops_list);
+    koops_extractor_flush(extractor, &oops_list);
+    koops_extractor_free(extractor);
+    free(dmesg);
+
+    char *hash = NULL;
+    if (oops_list != NULL)
+    {
+        /* The same oops abrt-dump-oops -u would pick */
+        char *oops = oops_list->data;
+        struct abrt_koops_info *info = koops_info_parse(oops);
+        const char *hash_str = koops_info_index_hash(info);
+        if (hash_str)
+            hash = xstrdup(hash_str);
+
+        abrt_oops_save_data_in_dump_dir(dd, oops, /*no proc modules*/NULL, info);
+        publish_oops(problem_dir, oops, info);
+        koops_info_free(info);
+    }
+    list_free_with_free(oops_list);
+
+    return hash;
+}
+
+/* Unique ID of vmcores without a usable oops. Only the whole vmcore
+ * identifies it, vmcores of different crashes share their headers. */
+static char *hash_vmcore(const char *vmcore_path)
+{
+    const int fd = open(vmcore_path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror_msg("Can't open '%s'", vmcore_path);
+        return NULL;
+    }
+
+    sha1_ctx_t sha1ctx;
+    sha1_begin(&sha1ctx);
+
+    char buf[64 * 1024];
+    ssize_t r;
+    while ((r = safe_read(fd, buf, sizeof(buf))) > 0)
+        sha1_hash(&sha1ctx, buf, r);
+    close(fd);
+
+    if (r < 0)
+    {
+        perror_msg("Can't read '%s'", vmcore_path);
+        return NULL;
+    }
+
+    char hash_bytes[SHA1_RESULT_LEN];
+    sha1_end(&sha1ctx, hash_bytes);
+
+    char hash_str[SHA1_RESULT_LEN*2 + 1];
+    bin2hex(hash_str, hash_bytes, SHA1_RESULT_LEN)[0] = '\0';
+    return xstrdup(hash_str);
+}
+
+/* Copies everything but vmcore, the small files come first */
+static int copy_small_files(struct dump_dir *dd, const char *kdump_dir)
+{
+    DIR *dp = opendir(kdump_dir);
+    if (dp == NULL)
+    {
+        perror_msg("Can't open '%s'", kdump_dir);
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dp)) != NULL)
+    {
+        if (strcmp(dent->d_name, FILENAME_VMCORE) == 0 || !str_is_correct_filename(dent->d_name))
+            continue;
+
+        /* Skip sub-directories, abrt ignores them in its processing anyway */
+        struct stat st;
+        if (fstatat(dirfd(dp), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        char *path = concat_path_file(kdump_dir, dent->d_name);
+        if (dd_copy_file(dd, dent->d_name, path) < 0)
+        {
+            error_msg("Can't copy '%s' to '%s'", path, dd->dd_dirname);
+            ret = -1;
+        }
+        free(path);
+    }
+    closedir(dp);
+
+    return ret;
+}
+
+static int copy_vmcore(struct dump_dir *dd, const char *vmcore_path, const char *problem_dir, bool compress)
+{
+    if (compress && (g_settings_cold_storage_location == NULL || g_settings_cold_storage_location[0] == '\0'))
+    {
+        log_notice("ColdStorageLocation is not set, not compressing '%s'", vmcore_path);
+        compress = false;
+    }
+
+    if (!compress)
+    {
+        char *dst_path = concat_path_file(dd->dd_dirname, FILENAME_VMCORE);
+        const int r = copy_file_resumable(vmcore_path, dst_path, dd->mode, 0);
+        free(dst_path);
+        return r;
+    }
+
+    /* The layout of the cold storage, the events needing vmcore run
+     * abrt-action-rehydrate */
+    const char *name = strrchr(problem_dir, '/');
+    name = name ? name + 1 : problem_dir;
+    char *cold_dir = concat_path_file(g_settings_cold_storage_location, name);
+    if ((mkdir(g_settings_cold_storage_location, COLD_DIR_MODE) != 0 && errno != EEXIST)
+        || (mkdir(cold_dir, COLD_DIR_MODE) != 0 && errno != EEXIST))
+    {
+        perror_msg("Can't create '%s'", cold_dir);
+        free(cold_dir);
+        return -1;
+    }
+
+    char *dst_path = xasprintf("%s/%s"ABRT_COMPRESSED_ITEM_SUFFIX, cold_dir, FILENAME_VMCORE);
+    const int r = copy_file_resumable(vmcore_path, dst_path, dd->mode, COPY_FILE_COMPRESS);
+    if (r == 0)
+        dd_save_text(dd, FILENAME_COLD_STORAGE, cold_dir);
+
+    free(dst_path);
+    free(cold_dir);
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    /* I18n */
+    setlocale(LC_ALL, "");
+#if ENABLE_NLS
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+#endif
+
+    abrt_init(argv);
+
+    /* Can't keep these strings/structs static: _() doesn't support that */
+    const char *program_usage_string = _(
+        "& [-vz] KDUMP_DIR PROBLEM_DIR\n"
+        "\n"
+        "Copies vmcore directory KDUMP_DIR created by kdump to problem directory\n"
+        "PROBLEM_DIR. An interrupted copy continues where it stopped."
+    );
+    enum {
+        OPT_v = 1 << 0,
+        OPT_z = 1 << 1,
+    };
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_BOOL('z', NULL, NULL, _("Compress vmcore to the cold storage")),
+        OPT_END()
+    };
+    unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
+
+    export_abrt_envvars(0);
+
+    argv += optind;
+    if (!argv[0] || !argv[1] || argv[2])
+        show_usage_and_die(program_usage_string, program_options);
+
+    const char *kdump_dir = argv[0];
+    const char *problem_dir = argv[1];
+
+    load_abrt_conf();
+
+    /* Did we already copy it last time we booted? */
+    struct stat st;
+    if (lstat(problem_dir, &st) == 0)
+    {
+        log_info("'%s' already exists", problem_dir);
+        return 0;
+    }
+
+    char *vmcore_path = concat_path_file(kdump_dir, FILENAME_VMCORE);
+    if (stat(vmcore_path, &st) != 0 || !S_ISREG(st.st_mode))
+        error_msg_and_die("VMCore dir '%s' doesn't contain 'vmcore' file", kdump_dir);
+
+    /* The .new suffix makes sure abrtd doesn't try to process partially
+     * copied directory */
+    char *new_dir = xasprintf("%s.new", problem_dir);
+    struct dump_dir *dd = NULL;
+    if (lstat(new_dir, &st) == 0)
+    {
+        log_notice("Continuing to copy '%s' to '%s'", kdump_dir, new_dir);
+        dd = dd_opendir(new_dir, /*flags:*/ 0);
+    }
+    else
+    {
+        dd = dd_create(new_dir, /*uid:*/ 0, DEFAULT_DUMP_DIR_MODE);
+        if (dd)
+        {
+            dd_create_basic_files(dd, /*uid:*/ 0, NULL);
+            dd_save_text(dd, FILENAME_ANALYZER, "abrt-vmcore");
+            dd_save_text(dd, FILENAME_TYPE, "vmcore");
+            dd_save_text(dd, FILENAME_COMPONENT, "kernel");
+        }
+    }
+    if (!dd)
+        error_msg_and_die("Unable to create problem directory '%s'", new_dir);
+
+    if (copy_small_files(dd, kdump_dir) != 0)
+        goto interrupted;
+
+    if (!dd_exist(dd, FILENAME_UUID))
+    {
+        char *hash = save_dmesg_oops(dd, problem_dir);
+        if (hash == NULL)
+            hash = hash_vmcore(vmcore_path);
+        if (hash == NULL)
+            goto interrupted;
+
+        dd_save_text(dd, FILENAME_UUID, hash);
+        free(hash);
+    }
+
+    if (copy_vmcore(dd, vmcore_path, problem_dir, opts & OPT_z) != 0)
+        goto interrupted;
+
+    /* Get rid of the .new suffix */
+    if (dd_rename(dd, problem_dir) != 0)
+    {
+        error_msg("Unable to rename '%s' to '%s'", new_dir, problem_dir);
+        goto interrupted;
+    }
+
+    dd_close(dd);
+    free(new_dir);
+    free(vmcore_path);
+    return 0;
+
+ interrupted:
+    /* Keep the directory, the next run continues the copy */
+    dd_close(dd);
+    error_msg("Copying '%s' to '%s' is not finished", kdump_dir, new_dir);
+    free(new_dir);
+    free(vmcore_path);
+    return 1;
+}
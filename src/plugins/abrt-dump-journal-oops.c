@@ -18,98 +18,80 @@
 
 #define ABRT_JOURNAL_WATCH_STATE_FILE VAR_STATE"/abrt-dump-journal-oops.state"
 
-/* Limit number of buffered lines */
-#define ABRT_JOURNAL_MAX_READ_LINES (1024 * 1024)
-
 #define ABRT_JOURNAL_KOOPS_ANALYZER "abrt-journal-koops"
 
 /*
  * Koops extractor
  */
 
-static GList* abrt_journal_extract_kernel_oops(abrt_journal_t *journal)
+static GList* abrt_journal_extract_kernel_oops(abrt_journal_t *journal, struct abrt_koops_extractor *extractor)
 {
-    size_t lines_info_count = 0;
-    size_t lines_info_size = 32;
-    struct abrt_koops_line_info *lines_info = xmalloc(lines_info_size * sizeof(lines_info[0]));
+    GList *oops_list = NULL;
+    size_t lines_count = 0;
 
+    /* The extractor keeps only the lines of the oops being extracted, so
+     * there is no need to limit the number of read lines. The messages are
+     * read directly from the journal's memory without copying. */
     do
     {
-        char *line = abrt_journal_get_log_line(journal);
-        if (line == NULL)
+        const char *message;
+        size_t message_len;
+        if (abrt_journal_get_field(journal, "MESSAGE", (const void **)&message, &message_len) < 0)
             error_msg_and_die(_("Cannot read journal data."));
 
-        if (lines_info_count == lines_info_size)
-        {
-            lines_info_size *= 2;
-            lines_info = xrealloc(lines_info, lines_info_size * sizeof(lines_info[0]));
-        }
-
-        char *orig_line = line;
-        lines_info[lines_info_count].level = koops_line_skip_level((const char **)&line);
-        koops_line_skip_jiffies((const char **)&line);
-
-        memmove(orig_line, line, strlen(line) + 1);
+        koops_extractor_feed_message(extractor, message, message_len, &oops_list);
 
-        lines_info[lines_info_count].ptr = orig_line;
-
-        ++lines_info_count;
+        ++lines_count;
     }
-    while (lines_info_count < ABRT_JOURNAL_MAX_READ_LINES
-            && abrt_journal_next(journal) > 0);
-
-    GList *oops_list = NULL;
-    koops_extract_oopses_from_lines(&oops_list, lines_info, lines_info_count);
+    while (abrt_journal_next(journal) > 0);
 
-    log_debug("Extracted: %d oopses", g_list_length(oops_list));
+    /* The end of available data ends the last oops */
+    koops_extractor_flush(extractor, &oops_list);
 
-    for (size_t i = 0; i < lines_info_count; ++i)
-        free(lines_info[i].ptr);
-
-    free(lines_info);
+    log_debug("Extracted: %d oopses from %zu lines", g_list_length(oops_list), lines_count);
 
     return oops_list;
 }
 
 /*
- * An adatapter of abrt_journal_extract_kernel_oops for abrt_journal_watch_callback
+ * Feeds the oops stream with the watched messages
  */
 struct watch_journald_settings
 {
-    const char *dump_location;
-    int oops_utils_flags;
+    struct abrt_oops_stream stream;
+    bool unsaved;               ///< messages fed since saving the position
 };
 
-static void abrt_journal_watch_extract_kernel_oops(abrt_journal_watch_t *watch, void *data)
+static void abrt_journal_watch_feed_kernel_oops(abrt_journal_watch_t *watch, void *data)
 {
-    const struct watch_journald_settings *conf = (const struct watch_journald_settings *)data;
-
-    abrt_journal_t *journal = abrt_journal_watch_get_journal(watch);
+    struct watch_journald_settings *conf = (struct watch_journald_settings *)data;
 
-    /* Give systemd-journal one second to suck in all kernel's strings */
-    if (abrt_oops_signaled_sleep(1) > 0)
-    {
-        abrt_journal_watch_stop(watch);
-        return;
-    }
+    const char *message;
+    size_t message_len;
+    if (abrt_journal_get_field(abrt_journal_watch_get_journal(watch), "MESSAGE", (const void **)&message, &message_len) < 0)
+        error_msg_and_die(_("Cannot read journal data."));
 
-    GList *oopses = abrt_journal_extract_kernel_oops(journal);
-    abrt_oops_process_list(oopses, conf->dump_location,
-                           ABRT_JOURNAL_KOOPS_ANALYZER, conf->oops_utils_flags);
+    abrt_oops_stream_feed(&conf->stream, message, message_len);
+    conf->unsaved = true;
+}
 
-    g_list_free_full(oopses, (GDestroyNotify)free);
+static int abrt_journal_watch_idle_kernel_oops(abrt_journal_watch_t *watch, void *data)
+{
+    struct watch_journald_settings *conf = (struct watch_journald_settings *)data;
 
-    /* Skip stuff which appeared while processing oops as it is not necessary */
-    /* to catch all consecutive oopses (anyway such oopses are almost */
-    /* certainly duplicates of the already extracted ones) */
-    abrt_journal_seek_tail(journal);
+    const int timeout = abrt_oops_stream_idle(&conf->stream);
+    if (timeout >= 0)
+        return timeout;
 
-    /* In case of disaster, lets make sure we won't read the journal messages */
-    /* again. */
-    abrt_journal_save_current_position(journal, ABRT_JOURNAL_WATCH_STATE_FILE);
+    /* All read messages have been processed, in case of disaster, lets make
+     * sure we won't read them again. */
+    if (conf->unsaved)
+    {
+        abrt_journal_save_current_position(abrt_journal_watch_get_journal(watch), ABRT_JOURNAL_WATCH_STATE_FILE);
+        conf->unsaved = false;
+    }
 
-    if (g_abrt_oops_sleep_woke_up_on_signal > 0)
-        abrt_journal_watch_stop(watch);
+    return -1;
 }
 
 /*
@@ -118,56 +100,26 @@ static void abrt_journal_watch_extract_kernel_oops(abrt_journal_watch_t *watch,
 
 static void watch_journald(abrt_journal_t *journal, const char *dump_location, int flags)
 {
-    GList *koops_strings = koops_suspicious_strings_list();
-
-    char *oops_string_filter_regex = abrt_oops_string_filter_regex();
-    if (oops_string_filter_regex)
-    {
-        regex_t filter_re;
-        if (regcomp(&filter_re, oops_string_filter_regex, REG_NOSUB) != 0)
-            perror_msg_and_die(_("Failed to compile regex"));
-
-        GList *iter = koops_strings;
-        while(iter != NULL)
-        {
-            GList *next = g_list_next(iter);
-
-            const int reti = regexec(&filter_re, (const char *)iter->data, 0, NULL, 0);
-            if (reti == 0)
-                koops_strings = g_list_delete_link(koops_strings, iter);
-            else if (reti != REG_NOMATCH)
-            {
-                char msgbuf[100];
-                regerror(reti, &filter_re, msgbuf, sizeof(msgbuf));
-                error_msg_and_die("Regex match failed: %s", msgbuf);
-            }
-
-            iter = next;
-        }
-
-        regfree(&filter_re);
-        free(oops_string_filter_regex);
-    }
-
-    struct watch_journald_settings watch_conf = {
-        .dump_location = dump_location,
-        .oops_utils_flags = flags,
-    };
-
-    struct abrt_journal_watch_notify_strings notify_strings_conf = {
-        .decorated_cb = abrt_journal_watch_extract_kernel_oops,
-        .decorated_cb_data = &watch_conf,
-        .strings = koops_strings,
-    };
+    struct watch_journald_settings watch_conf = { .unsaved = false };
+    abrt_oops_stream_init(&watch_conf.stream, dump_location, ABRT_JOURNAL_KOOPS_ANALYZER, flags);
 
     abrt_journal_watch_t *watch = NULL;
-    if (abrt_journal_watch_new(&watch, journal, abrt_journal_watch_notify_strings, &notify_strings_conf) < 0)
+    if (abrt_journal_watch_new(&watch, journal, abrt_journal_watch_feed_kernel_oops, &watch_conf) < 0)
         error_msg_and_die(_("Failed to initialize systemd-journal watch"));
 
+    abrt_journal_watch_set_idle_callback(watch, abrt_journal_watch_idle_kernel_oops);
+
     abrt_journal_watch_run_sync(watch);
     abrt_journal_watch_free(watch);
 
-    g_list_free(koops_strings);
+    /* Don't lose an oops interrupted by the end of the watch and don't
+     * create it again after restart */
+    abrt_oops_stream_flush(&watch_conf.stream);
+    if (watch_conf.unsaved)
+        abrt_journal_save_current_position(journal, ABRT_JOURNAL_WATCH_STATE_FILE);
+    abrt_oops_stream_destroy(&watch_conf.stream);
+
+    abrt_oops_flush_throttled(dump_location);
 }
 
 int main(int argc, char *argv[])
@@ -224,7 +176,7 @@ int main(int argc, char *argv[])
         OPT_STRING('d', NULL, &dump_location, "DIR", _("Create new problem directory in DIR for every oops found")),
         OPT_BOOL(  'D', NULL, NULL, _("Same as -d DumpLocation, DumpLocation is specified in abrt.conf")),
         OPT_BOOL(  'x', NULL, NULL, _("Make the problem directory world readable")),
-        OPT_BOOL(  't', NULL, NULL, _("Throttle problem directory creation to 1 per second")),
+        OPT_BOOL(  't', NULL, NULL, _("Rate limit repeating oopses")),
         OPT_STRING('c', NULL, &cursor, "CURSOR", _("Start reading systemd-journal from the CURSOR position")),
         OPT_BOOL(  'e', NULL, NULL, _("Start reading systemd-journal from the end")),
         OPT_BOOL(  'f', NULL, NULL, _("Follow systemd-journal from the last seen position (if available)")),
@@ -312,10 +264,13 @@ int main(int argc, char *argv[])
          * to a next message.*/
         abrt_journal_next(journal);
 
-        GList *oopses = abrt_journal_extract_kernel_oops(journal);
+        struct abrt_koops_extractor *extractor = koops_extractor_new();
+        GList *oopses = abrt_journal_extract_kernel_oops(journal, extractor);
+        koops_extractor_free(extractor);
         const int errors = abrt_oops_process_list(oopses, dump_location,
                                                   ABRT_JOURNAL_KOOPS_ANALYZER, oops_utils_flags);
         g_list_free_full(oopses, (GDestroyNotify)free);
+        abrt_oops_flush_throttled(dump_location);
 
         return errors;
     }
@@ -19,28 +19,6 @@
 #define XORG_CONF "xorg.conf"
 #define XORG_CONF_PATH "/etc/abrt/plugins/"XORG_CONF
 
-static void
-abrt_xorg_process_list_of_crashes(GList *crashes, const char *dump_location, int flags)
-{
-    if (crashes == NULL)
-        return;
-
-    GList *list;
-    for (list = crashes; list != NULL; list = list->next)
-    {
-        xorg_crash_info_create_dump_dir(list->data, dump_location, (flags & ABRT_XORG_WORLD_READABLE));
-
-        if (flags & ABRT_XORG_PRINT_STDOUT)
-            xorg_crash_info_print_crash(list->data);
-
-        if (flags & ABRT_XORG_THROTTLE_CREATION)
-            if (abrt_xorg_signaled_sleep(1) > 0)
-                break;
-    }
-
-    return;
-}
-
 static GList *abrt_journal_extract_xorg_crashes(abrt_journal_t *journal)
 {
     GList *crash_info_list = NULL;
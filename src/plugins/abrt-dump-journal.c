@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2017  ABRT team
+ * Copyright (C) 2017  RedHat Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include "libabrt.h"
+#include "abrt-journal.h"
+#include "journal-core-utils.h"
+#include "oops-utils.h"
+#include "xorg-utils.h"
+
+/* The same positions as abrt-dump-journal-{core,oops,xorg}, so the services
+ * can be replaced by this one without processing the journal again */
+#define ABRT_JOURNAL_CORE_STATE_FILE VAR_STATE"/abrt-dump-journal-core.state"
+#define ABRT_JOURNAL_OOPS_STATE_FILE VAR_STATE"/abrt-dump-journal-oops.state"
+#define ABRT_JOURNAL_XORG_STATE_FILE VAR_STATE"/abrt-dump-journal-xorg.state"
+
+#define ABRT_JOURNAL_KOOPS_ANALYZER "abrt-journal-koops"
+#define XORG_CONF "xorg.conf"
+
+/*
+ * Coredumps
+ */
+
+static void core_handler_entry(abrt_journal_t *journal, void *data)
+{
+    abrt_journal_watch_core(journal, (const abrt_watch_core_conf_t *)data);
+}
+
+/*
+ * Kernel oopses
+ */
+
+static void oops_handler_entry(abrt_journal_t *journal, void *data)
+{
+    const char *message;
+    size_t message_len;
+    if (abrt_journal_get_field(journal, "MESSAGE", (const void **)&message, &message_len) < 0)
+        error_msg_and_die(_("Cannot read journal data."));
+
+    abrt_oops_stream_feed((struct abrt_oops_stream *)data, message, message_len);
+}
+
+static int oops_handler_idle(abrt_journal_t *journal, void *data)
+{
+    return abrt_oops_stream_idle((struct abrt_oops_stream *)data);
+}
+
+/* The last oops must not wait for the next start */
+static void oops_handler_flush(abrt_journal_t *journal, void *data)
+{
+    abrt_oops_stream_flush((struct abrt_oops_stream *)data);
+}
+
+/*
+ * Xorg crashes
+ */
+
+static void xorg_handler_entry(abrt_journal_t *journal, void *data)
+{
+    char *line = abrt_journal_get_log_line(journal);
+    if (line == NULL)
+        error_msg_and_die(_("Cannot read journal data."));
+
+    abrt_xorg_stream_feed_line((struct abrt_xorg_stream *)data, line);
+}
+
+static int xorg_handler_idle(abrt_journal_t *journal, void *data)
+{
+    return abrt_xorg_stream_idle((struct abrt_xorg_stream *)data);
+}
+
+static GList *load_xorg_journal_filter(void)
+{
+    const char *const env_journal_filter = getenv("ABRT_DUMP_JOURNAL_XORG_DEBUG_FILTER");
+    if (env_journal_filter != NULL)
+        return g_list_append(NULL, xstrdup(env_journal_filter));
+
+    map_string_t *settings = new_map_string();
+    log_notice("Loading settings from '%s'", XORG_CONF);
+    load_abrt_plugin_conf_file(XORG_CONF, settings);
+    GList *filter = parse_list(get_map_string_item_or_NULL(settings, "JournalFilters"));
+    free_map_string(settings);
+
+    return filter;
+}
+
+static abrt_journal_handler_t *add_handler(abrt_journal_t *journal, const char *name, GList *filter,
+        abrt_journal_handler_entry_callback entry_callback,
+        abrt_journal_handler_idle_callback idle_callback,
+        void *data, const char *state_file)
+{
+    abrt_journal_handler_t *handler = abrt_journal_add_handler(journal, name, filter,
+            entry_callback, idle_callback, data);
+    if (handler == NULL)
+        error_msg_and_die(_("Failed to initialize systemd-journal handler '%s'"), name);
+
+    abrt_journal_handler_set_state_file(handler, state_file);
+    return handler;
+}
+
+int main(int argc, char *argv[])
+{
+    /* I18n */
+    setlocale(LC_ALL, "");
+#if ENABLE_NLS
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+#endif
+
+    abrt_init(argv);
+
+    /* Can't keep these strings/structs static: _() doesn't support that */
+    const char *program_usage_string = _(
+        "& [-vsxte] [-T INT] [-m INT] [-d DIR]/[-D] [-a]/[-J PATH] [-H HANDLER]...\n"
+        "\n"
+        "Follows systemd-journal and creates problems from coredumps (core),\n"
+        "kernel oopses (oops) and Xorg crashes (xorg) in a single process\n"
+        "\n"
+        "Every handler continues from its own last seen position, the positions\n"
+        "are shared with abrt-dump-journal-core, abrt-dump-journal-oops and\n"
+        "abrt-dump-journal-xorg.\n"
+    );
+    enum {
+        OPT_v = 1 << 0,
+        OPT_s = 1 << 1,
+        OPT_d = 1 << 2,
+        OPT_D = 1 << 3,
+        OPT_x = 1 << 4,
+        OPT_t = 1 << 5,
+        OPT_T = 1 << 6,
+        OPT_e = 1 << 7,
+        OPT_a = 1 << 8,
+        OPT_J = 1 << 9,
+        OPT_H = 1 << 10,
+        OPT_m = 1 << 11,
+    };
+
+    char *dump_location = NULL;
+    char *journal_dir = NULL;
+    int core_throttle = 0;
+    int core_throttle_capacity = 0;
+    GList *handler_names = NULL;
+
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_BOOL(  's', NULL, NULL, _("Log to syslog")),
+        OPT_STRING('d', NULL, &dump_location, "DIR", _("Create new problem directory in DIR for every crash found")),
+        OPT_BOOL(  'D', NULL, NULL, _("Same as -d DumpLocation, DumpLocation is specified in abrt.conf")),
+        OPT_BOOL(  'x', NULL, NULL, _("Make the oops and Xorg problem directories world readable")),
+        OPT_BOOL(  't', NULL, NULL, _("Rate limit repeating oopses and Xorg crashes")),
+        OPT_INTEGER('T', NULL, &core_throttle, _("Throttle coredumps of an executable to 1 per INT second")),
+        OPT_BOOL(  'e', NULL, NULL, _("Handlers without the last seen position start at the end")),
+        OPT_BOOL(  'a', NULL, NULL, _("Read journal files from all machines")),
+        OPT_STRING('J', NULL, &journal_dir,  "PATH", _("Read all journal files from directory at PATH")),
+        OPT_LIST(  'H', NULL, &handler_names, "HANDLER", _("Enable only HANDLER (core, oops, xorg; may be given many times)")),
+        OPT_INTEGER('m', NULL, &core_throttle_capacity, _("Remember the last coredumps of INT executables for throttling")),
+        OPT_END()
+    };
+    unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
+
+    export_abrt_envvars(0);
+
+    msg_prefix = g_progname;
+    if ((opts & OPT_s) || getenv("ABRT_SYSLOG"))
+        logmode = LOGMODE_JOURNAL;
+
+    load_abrt_conf();
+
+    if (opts & OPT_D)
+    {
+        if (opts & OPT_d)
+            show_usage_and_die(program_usage_string, program_options);
+        dump_location = g_settings_dump_location;
+    }
+
+    bool use_core = handler_names == NULL, use_oops = handler_names == NULL, use_xorg = handler_names == NULL;
+    for (GList *l = handler_names; l != NULL; l = l->next)
+    {
+        if (strcmp(l->data, "core") == 0)
+            use_core = true;
+        else if (strcmp(l->data, "oops") == 0)
+            use_oops = true;
+        else if (strcmp(l->data, "xorg") == 0)
+            use_xorg = true;
+        else
+            error_msg_and_die(_("Unknown handler '%s'"), (const char *)l->data);
+    }
+    g_list_free(handler_names);
+
+    abrt_journal_t *journal = NULL;
+    if ((opts & OPT_J))
+    {
+        log_debug("Using journal files from directory '%s'", journal_dir);
+
+        if (abrt_journal_open_directory(&journal, journal_dir))
+            error_msg_and_die(_("Cannot initialize systemd-journal in directory '%s'"), journal_dir);
+    }
+    else
+    {
+        if (((opts & OPT_a) ? abrt_journal_new_merged : abrt_journal_new)(&journal))
+            error_msg_and_die(_("Cannot open systemd-journal"));
+    }
+
+    abrt_watch_core_conf_t core_conf = {
+        .awc_dump_location = dump_location,
+        .awc_throttle = core_throttle,
+        .awc_throttle_capacity = core_throttle_capacity > 0 ? core_throttle_capacity : 0,
+    };
+    if (use_core)
+    {
+        const char *const env_journal_filter = getenv("ABRT_DUMP_JOURNAL_CORE_DEBUG_FILTER");
+        GList *filter = g_list_append(NULL,
+                (env_journal_filter ? (gpointer)env_journal_filter : (gpointer)"SYSLOG_IDENTIFIER=systemd-coredump"));
+        add_handler(journal, "core", filter, core_handler_entry, NULL, &core_conf,
+                ABRT_JOURNAL_CORE_STATE_FILE);
+        g_list_free(filter);
+    }
+
+    int oops_utils_flags = 0;
+    if ((opts & OPT_x))
+        oops_utils_flags |= ABRT_OOPS_WORLD_READABLE;
+    if ((opts & OPT_t))
+        oops_utils_flags |= ABRT_OOPS_THROTTLE_CREATION;
+
+    struct abrt_oops_stream oops_stream;
+    if (use_oops)
+    {
+        abrt_oops_stream_init(&oops_stream, dump_location, ABRT_JOURNAL_KOOPS_ANALYZER, oops_utils_flags);
+
+        const char *const env_journal_filter = getenv("ABRT_DUMP_JOURNAL_OOPS_DEBUG_FILTER");
+        GList *filter = g_list_append(NULL,
+                (env_journal_filter ? (gpointer)env_journal_filter : (gpointer)"SYSLOG_IDENTIFIER=kernel"));
+        abrt_journal_handler_t *handler = add_handler(journal, "oops", filter,
+                oops_handler_entry, oops_handler_idle, &oops_stream, ABRT_JOURNAL_OOPS_STATE_FILE);
+        abrt_journal_handler_set_flush_callback(handler, oops_handler_flush);
+        g_list_free(filter);
+    }
+
+    int xorg_utils_flags = 0;
+    if ((opts & OPT_x))
+        xorg_utils_flags |= ABRT_XORG_WORLD_READABLE;
+    if ((opts & OPT_t))
+        xorg_utils_flags |= ABRT_XORG_THROTTLE_CREATION;
+
+    struct abrt_xorg_stream xorg_stream;
+    if (use_xorg)
+    {
+        abrt_xorg_stream_init(&xorg_stream, dump_location, xorg_utils_flags);
+
+        GList *filter = load_xorg_journal_filter();
+        if (filter == NULL)
+            error_msg_and_die(_("Journal filter must be stored in /etc/abrt/plugins/xorg.conf file"));
+
+        add_handler(journal, "xorg", filter, xorg_handler_entry, xorg_handler_idle, &xorg_stream,
+                ABRT_JOURNAL_XORG_STATE_FILE);
+        g_list_free_full(filter, free);
+    }
+
+    const int r = abrt_journal_run_handlers(journal, (opts & OPT_e) ? ABRT_JOURNAL_HANDLERS_START_AT_END : 0);
+
+    if (use_oops)
+    {
+        abrt_oops_stream_destroy(&oops_stream);
+        abrt_oops_flush_throttled(dump_location);
+    }
+
+    if (use_xorg)
+        abrt_xorg_stream_destroy(&xorg_stream);
+
+    if (use_core)
+    {
+        abrt_journal_core_throttle_free();
+        abrt_journal_core_log_stats();
+    }
+
+    abrt_journal_free(journal);
+    free_abrt_conf_data();
+
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
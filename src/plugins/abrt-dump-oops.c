@@ -48,15 +48,19 @@ static void scan_syslog_file(GList **oops_list, int fd)
     sz += READ_AHEAD;
     char *buffer = xzalloc(sz);
 
+    /* Oopses can straddle chunk boundaries, the extractor carries
+     * incomplete lines and oopses over to the next chunk */
+    struct abrt_koops_extractor *extractor = koops_extractor_new();
     for (;;)
     {
         int r = full_read(fd, buffer, sz-1);
         if (r <= 0)
             break;
         log_debug("Read %u bytes", r);
-        koops_extract_oopses(oops_list, buffer, r);
-//TODO: rewind to last newline?
+        koops_extractor_feed(extractor, buffer, r, oops_list);
     }
+    koops_extractor_flush(extractor, oops_list);
+    koops_extractor_free(extractor);
 
     free(buffer);
 }
@@ -75,8 +79,9 @@ int main(int argc, char **argv)
     /* Can't keep these strings/structs static: _() doesn't support that */
     const char *program_usage_string = _(
         "& [-vusoxm] [-d DIR]/[-D] [FILE]\n"
+        "or: & [-vsoxt] [-d DIR]/[-D] -P FILE...\n"
         "\n"
-        "Extract oops from FILE (or standard input)"
+        "Extract oops from FILE (or standard input) or from pstore records"
     );
     enum {
         OPT_v = 1 << 0,
@@ -88,6 +93,7 @@ int main(int argc, char **argv)
         OPT_x = 1 << 6,
         OPT_t = 1 << 7,
         OPT_m = 1 << 8,
+        OPT_P = 1 << 9,
     };
     char *problem_dir = NULL;
     char *dump_location = NULL;
@@ -103,8 +109,9 @@ int main(int argc, char **argv)
         OPT_BOOL(  'D', NULL, NULL, _("Same as -d DumpLocation, DumpLocation is specified in abrt.conf")),
         OPT_STRING('u', NULL, &problem_dir, "PROBLEM", _("Save the extracted information in PROBLEM")),
         OPT_BOOL(  'x', NULL, NULL, _("Make the problem directory world readable")),
-        OPT_BOOL(  't', NULL, NULL, _("Throttle problem directory creation to 1 per second")),
+        OPT_BOOL(  't', NULL, NULL, _("Rate limit repeating oopses")),
         OPT_BOOL(  'm', NULL, NULL, _("Print search string(s) to stdout and exit")),
+        OPT_BOOL(  'P', NULL, NULL, _("Merge pstore records in FILEs and extract oopses from them")),
         OPT_END()
     };
     unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
@@ -160,11 +167,24 @@ int main(int argc, char **argv)
         oops_utils_flags |= ABRT_OOPS_PRINT_STDOUT;
 
     argv += optind;
-    if (argv[0])
-        xmove_fd(xopen(argv[0], O_RDONLY), STDIN_FILENO);
-
     GList *oops_list = NULL;
-    scan_syslog_file(&oops_list, STDIN_FILENO);
+    if (opts & OPT_P)
+    {
+        if (opts & OPT_u)
+            show_usage_and_die(program_usage_string, program_options);
+
+        /* The records are merged on the fly, no need for a temporary file */
+        const int records = koops_extract_pstore_oopses(&oops_list,
+                (const char *const *)argv, argc - optind);
+        log_notice("Found %d pstore records", records);
+    }
+    else
+    {
+        if (argv[0])
+            xmove_fd(xopen(argv[0], O_RDONLY), STDIN_FILENO);
+
+        scan_syslog_file(&oops_list, STDIN_FILENO);
+    }
 
     unsigned errors = 0;
     if (opts & OPT_u)
@@ -188,15 +208,18 @@ int main(int argc, char **argv)
                     struct dump_dir *dd = dd_opendir(problem_dir, /*open for writing*/0);
                     if (dd)
                     {
-                        abrt_oops_save_data_in_dump_dir(dd, (char *)oops_list->data, /*no proc modules*/NULL);
+                        abrt_oops_save_data_in_dump_dir(dd, (char *)oops_list->data, /*no proc modules*/NULL, /*parse*/NULL);
                         dd_close(dd);
                     }
                 }
         }
     }
     else
+    {
         errors = abrt_oops_process_list(oops_list, dump_location,
                                         ABRT_DUMP_OOPS_ANALYZER, oops_utils_flags);
+        abrt_oops_flush_throttled(dump_location);
+    }
 
     list_free_with_free(oops_list);
     //oops_list = NULL;
@@ -19,6 +19,53 @@
 #include "libabrt.h"
 #include "xorg-utils.h"
 
+/* The position file holds "<inode> <size>" of the already scanned log,
+ * a different inode or a smaller file means the log was rotated */
+static off_t load_position(const char *pos_file, const struct stat *log_st)
+{
+    char *line = xmalloc_fopen_fgetline_fclose(pos_file);
+    if (line == NULL)
+        return 0;
+
+    unsigned long long ino = 0, size = 0;
+    off_t start = 0;
+    if (sscanf(line, "%llu %llu", &ino, &size) == 2
+        && ino == (unsigned long long)log_st->st_ino
+        && size <= (unsigned long long)log_st->st_size)
+        start = size;
+
+    free(line);
+    return start;
+}
+
+static void save_position(const char *pos_file, const struct stat *log_st, off_t size)
+{
+    char *tmp = xasprintf("%s.new", pos_file);
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        perror_msg("Can't open '%s'", tmp);
+        free(tmp);
+        return;
+    }
+
+    fprintf(fp, "%llu %llu\n", (unsigned long long)log_st->st_ino, (unsigned long long)size);
+    if (fclose(fp) != 0 || rename(tmp, pos_file) != 0)
+    {
+        perror_msg("Can't save position to '%s'", pos_file);
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+static void handle_crash(struct xorg_crash_info *crash_info, bool print, const char *dump_location, bool world_readable)
+{
+    if (print)
+        xorg_crash_info_print_crash(crash_info);
+    if (dump_location)
+        xorg_crash_info_create_dump_dir(crash_info, dump_location, world_readable);
+}
+
 int main(int argc, char **argv)
 {
     /* I18n */
@@ -32,9 +79,12 @@ int main(int argc, char **argv)
 
     /* Can't keep these strings/structs static: _() doesn't support that */
     const char *program_usage_string = _(
-        "& [-vsoxm] [-d DIR]/[-D] [FILE]\n"
+        "& [-vsoxm] [-d DIR]/[-D] [-p POSFILE] [FILE]\n"
         "\n"
-        "Extract Xorg crash from FILE (or standard input)"
+        "Extract Xorg crash from FILE (or standard input)\n"
+        "\n"
+        "Regular files are searched backwards from the end for the last crash,\n"
+        "other inputs are read forward and every crash is extracted."
     );
     enum {
         OPT_v = 1 << 0,
@@ -44,8 +94,10 @@ int main(int argc, char **argv)
         OPT_D = 1 << 4,
         OPT_x = 1 << 5,
         OPT_m = 1 << 6,
+        OPT_p = 1 << 7,
     };
     char *dump_location = NULL;
+    const char *pos_file = NULL;
     /* Keep OPT_z enums and order of options below in sync! */
     struct options program_options[] = {
         OPT__VERBOSE(&g_verbose),
@@ -55,6 +107,7 @@ int main(int argc, char **argv)
         OPT_BOOL(  'D', NULL, NULL, _("Same as -d DumpLocation, DumpLocation is specified in abrt.conf")),
         OPT_BOOL(  'x', NULL, NULL, _("Make the problem directory world readable")),
         OPT_BOOL(  'm', NULL, NULL, _("Print search string(s) to stdout and exit")),
+        OPT_STRING('p', NULL, &pos_file, "POSFILE", _("Search only the part of FILE added since the last run, remember the position in POSFILE")),
         OPT_END()
     };
     unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
@@ -87,6 +140,26 @@ int main(int argc, char **argv)
     if (argv[0])
         xmove_fd(xopen(argv[0], O_RDONLY), STDIN_FILENO);
 
+    /* Xorg log of a long running server can be huge, but the crash
+     * is at its end */
+    struct stat st;
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        const off_t start = pos_file ? load_position(pos_file, &st) : 0;
+        off_t size = 0;
+        struct xorg_crash_info *crash_info = xorg_crash_info_find_last_in_fd(STDIN_FILENO, start, &size);
+        if (crash_info)
+        {
+            handle_crash(crash_info, opts & OPT_o, dump_location, opts & OPT_x);
+            xorg_crash_info_free(crash_info);
+        }
+
+        if (pos_file)
+            save_position(pos_file, &st, size);
+
+        return 0;
+    }
+
     int bt_count = 0;
     char *line = NULL;
     while ((line = xmalloc_fgetline(stdin)) != NULL)
@@ -97,11 +170,9 @@ int main(int argc, char **argv)
             struct xorg_crash_info *crash_info = process_xorg_bt(&xorg_get_next_line_from_fd, stdin);
             if (crash_info)
             {
-                if (opts & OPT_o)
-                    xorg_crash_info_print_crash(crash_info);
-                if (opts & (OPT_d|OPT_D))
-                    if (bt_count++ <= ABRT_OOPS_MAX_DUMPED_COUNT)
-                        xorg_crash_info_create_dump_dir(crash_info, dump_location, (opts & OPT_x));
+                handle_crash(crash_info, opts & OPT_o,
+                        bt_count++ <= ABRT_OOPS_MAX_DUMPED_COUNT ? dump_location : NULL,
+                        opts & OPT_x);
                 xorg_crash_info_free(crash_info);
             }
             else
@@ -35,8 +35,13 @@
 struct abrt_journal
 {
     sd_journal *j;
+
+    GList *handlers;                ///< abrt_journal_handler_t
+    struct abrt_journal_watch *handlers_watch;
 };
 
+static void abrt_journal_handler_free(abrt_journal_handler_t *handler);
+
 static int abrt_journal_new_flags(abrt_journal_t **journal, int flags)
 {
     sd_journal *j;
@@ -86,6 +91,9 @@ int abrt_journal_open_directory(abrt_journal_t **journal, const char *directory)
 
 void abrt_journal_free(abrt_journal_t *journal)
 {
+    g_list_free_full(journal->handlers, (GDestroyNotify)abrt_journal_handler_free);
+    journal->handlers = NULL;
+
     sd_journal_close(journal->j);
     journal->j = (void *)0xDEADBEAF;
 
@@ -263,6 +271,44 @@ int abrt_journal_next(abrt_journal_t *journal)
     return r;
 }
 
+/* Replaces the state file atomically, so a crash leaves either the old or the
+ * new position, never an empty or partially written file */
+static int abrt_journal_save_cursor(const char *cursor, const char *file_name)
+{
+    char *tmp_name = xasprintf("%s.new", file_name);
+    int state_fd = open(tmp_name,
+            O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+            ABRT_JOURNAL_WATCH_STATE_FILE_MODE);
+
+    if (state_fd < 0)
+    {
+        perror_msg(_("Cannot save journal watch's position: open('%s')"), tmp_name);
+        free(tmp_name);
+        return -1;
+    }
+
+    if (full_write_str(state_fd, cursor) < 0 || fdatasync(state_fd) != 0)
+    {
+        perror_msg(_("Cannot save journal watch's position: write('%s')"), tmp_name);
+        close(state_fd);
+        unlink(tmp_name);
+        free(tmp_name);
+        return -1;
+    }
+    close(state_fd);
+
+    if (rename(tmp_name, file_name) != 0)
+    {
+        perror_msg(_("Cannot save journal watch's position: rename('%s')"), file_name);
+        unlink(tmp_name);
+        free(tmp_name);
+        return -1;
+    }
+
+    free(tmp_name);
+    return 0;
+}
+
 int abrt_journal_save_current_position(abrt_journal_t *journal, const char *file_name)
 {
     char *crsr = NULL;
@@ -275,24 +321,12 @@ int abrt_journal_save_current_position(abrt_journal_t *journal, const char *file
         return r;
     }
 
-    int state_fd = open(file_name,
-            O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
-            ABRT_JOURNAL_WATCH_STATE_FILE_MODE);
-
-    if (state_fd < 0)
-    {
-        perror_msg(_("Cannot save journal watch's position: open('%s')"), file_name);
-        return -1;
-    }
-
-    full_write_str(state_fd, crsr);
-    close(state_fd);
-
+    const int ret = abrt_journal_save_cursor(crsr, file_name);
     free(crsr);
-    return 0;
+    return ret;
 }
 
-int abrt_journal_restore_position(abrt_journal_t *journal, const char *file_name)
+static int abrt_journal_load_cursor(const char *file_name, char **cursor)
 {
     struct stat buf;
     if (lstat(file_name, &buf) < 0)
@@ -333,13 +367,26 @@ int abrt_journal_restore_position(abrt_journal_t *journal, const char *file_name
     {
         error_msg(_("Cannot restore journal watch's position: cannot read entire file '%s'"), file_name);
         close(state_fd);
+        free(crsr);
         return -errno;
     }
 
     crsr[sz] = '\0';
     close(state_fd);
 
-    const int r = abrt_journal_set_cursor(journal, crsr);
+    *cursor = crsr;
+    return 0;
+}
+
+int abrt_journal_restore_position(abrt_journal_t *journal, const char *file_name)
+{
+    char *crsr = NULL;
+    int r = abrt_journal_load_cursor(file_name, &crsr);
+    if (r < 0)
+        return r;
+
+    r = abrt_journal_set_cursor(journal, crsr);
+    free(crsr);
     if (r < 0)
     {
         /* abrt_journal_set_cursor() prints error message in verbose mode */
@@ -347,7 +394,6 @@ int abrt_journal_restore_position(abrt_journal_t *journal, const char *file_name
         return r;
     }
 
-    free(crsr);
     return 0;
 }
 
@@ -375,6 +421,17 @@ struct abrt_journal_watch
 
     abrt_journal_watch_callback callback;
     void *callback_data;
+
+    /* Batched mode */
+    abrt_journal_watch_batch_callback batch_callback;
+    char **batch;                   ///< cursors of the collected entries
+    unsigned batch_count;
+    const char *state_file;
+    unsigned commit_interval;
+    char *pending_cursor;           ///< processed but not saved yet
+    time_t last_commit;
+
+    abrt_journal_watch_idle_callback idle_callback;
 };
 
 int abrt_journal_watch_new(abrt_journal_watch_t **watch, abrt_journal_t *journal, abrt_journal_watch_callback callback, void *callback_data)
@@ -389,8 +446,30 @@ int abrt_journal_watch_new(abrt_journal_watch_t **watch, abrt_journal_t *journal
     return 0;
 }
 
+int abrt_journal_watch_new_batched(abrt_journal_watch_t **watch, abrt_journal_t *journal,
+        abrt_journal_watch_batch_callback callback, void *callback_data,
+        const char *state_file, unsigned commit_interval)
+{
+    assert(callback != NULL || !"ABRT watch needs valid callback ptr");
+
+    *watch = xzalloc(sizeof(**watch));
+    (*watch)->j = journal;
+    (*watch)->batch_callback = callback;
+    (*watch)->callback_data = callback_data;
+    (*watch)->batch = xmalloc(ABRT_JOURNAL_WATCH_BATCH_MAX * sizeof(char *));
+    (*watch)->state_file = state_file;
+    (*watch)->commit_interval = commit_interval;
+
+    return 0;
+}
+
 void abrt_journal_watch_free(abrt_journal_watch_t *watch)
 {
+    for (unsigned i = 0; i < watch->batch_count; ++i)
+        free(watch->batch[i]);
+    free(watch->batch);
+    free(watch->pending_cursor);
+
     watch->j = (void *)0xDEADBEAF;
     free(watch);
 }
@@ -400,6 +479,75 @@ abrt_journal_t *abrt_journal_watch_get_journal(abrt_journal_watch_t *watch)
     return watch->j;
 }
 
+void abrt_journal_watch_set_idle_callback(abrt_journal_watch_t *watch, abrt_journal_watch_idle_callback callback)
+{
+    watch->idle_callback = callback;
+}
+
+/* Saves the position of the last processed entry. Entries processed after
+ * the last commit are processed again after a crash, but no entry is ever
+ * skipped. */
+static void abrt_journal_watch_commit(abrt_journal_watch_t *watch, bool force)
+{
+    if (watch->pending_cursor == NULL || watch->state_file == NULL)
+        return;
+
+    const time_t now = time(NULL);
+    if (!force && now >= watch->last_commit && now - watch->last_commit < watch->commit_interval)
+        return;
+
+    /* Try again with the next batch on errors */
+    if (abrt_journal_save_cursor(watch->pending_cursor, watch->state_file) != 0)
+        return;
+
+    free(watch->pending_cursor);
+    watch->pending_cursor = NULL;
+    watch->last_commit = now;
+}
+
+static void abrt_journal_watch_dispatch_batch(abrt_journal_watch_t *watch)
+{
+    if (watch->batch_count == 0)
+        return;
+
+    log_debug("Processing a batch of %u journal entries", watch->batch_count);
+    watch->batch_callback(watch, watch->batch, watch->batch_count, watch->callback_data);
+
+    /* The call back moves the journal, continue after the last entry */
+    char *last = watch->batch[watch->batch_count - 1];
+    if (abrt_journal_set_cursor(watch->j, last) == 0)
+        sd_journal_next(watch->j->j);
+
+    for (unsigned i = 0; i < watch->batch_count - 1; ++i)
+        free(watch->batch[i]);
+    watch->batch_count = 0;
+
+    free(watch->pending_cursor);
+    watch->pending_cursor = last;
+    abrt_journal_watch_commit(watch, /*force*/false);
+}
+
+/* Waits for a pending commit or the idle call back at most */
+static struct timespec *abrt_journal_watch_poll_timeout(abrt_journal_watch_t *watch, int idle_timeout, struct timespec *timeout)
+{
+    if (watch->pending_cursor == NULL && idle_timeout < 0)
+        return NULL;
+
+    long msec = idle_timeout;
+    if (watch->pending_cursor != NULL)
+    {
+        const time_t now = time(NULL);
+        const time_t deadline = watch->last_commit + watch->commit_interval;
+        const long commit_msec = (now < deadline && now >= watch->last_commit) ? (deadline - now) * 1000L : 0;
+        if (msec < 0 || commit_msec < msec)
+            msec = commit_msec;
+    }
+
+    timeout->tv_sec = msec / 1000;
+    timeout->tv_nsec = (msec % 1000) * 1000000L;
+    return timeout;
+}
+
 int abrt_journal_watch_run_sync(abrt_journal_watch_t *watch)
 {
     sigset_t mask;
@@ -434,7 +582,25 @@ int abrt_journal_watch_run_sync(abrt_journal_watch_t *watch)
         }
         else if (r == 0)
         {
-            ppoll(&pollfd, 1, NULL, &mask);
+            /* All available entries have been read */
+            if (watch->batch_count != 0)
+            {
+                abrt_journal_watch_dispatch_batch(watch);
+                continue;
+            }
+
+            int idle_timeout = -1;
+            if (watch->idle_callback != NULL)
+            {
+                idle_timeout = watch->idle_callback(watch, watch->callback_data);
+                if (watch->state != ABRT_JOURNAL_WATCH_READY)
+                    break;
+            }
+
+            struct timespec timeout;
+            if (ppoll(&pollfd, 1, abrt_journal_watch_poll_timeout(watch, idle_timeout, &timeout), &mask) == 0)
+                abrt_journal_watch_commit(watch, /*force*/true);
+
             r = sd_journal_process(watch->j->j);
             if (r < 0)
             {
@@ -444,9 +610,24 @@ int abrt_journal_watch_run_sync(abrt_journal_watch_t *watch)
             continue;
         }
 
-        watch->callback(watch, watch->callback_data);
+        if (watch->batch_callback == NULL)
+        {
+            watch->callback(watch, watch->callback_data);
+            continue;
+        }
+
+        char *cursor = NULL;
+        if (abrt_journal_get_cursor(watch->j, &cursor) < 0)
+            continue;
+
+        watch->batch[watch->batch_count++] = cursor;
+        if (watch->batch_count == ABRT_JOURNAL_WATCH_BATCH_MAX)
+            abrt_journal_watch_dispatch_batch(watch);
     }
 
+    /* Entries of an unfinished batch are processed after restart */
+    abrt_journal_watch_commit(watch, /*force*/true);
+
     return r;
 }
 
@@ -484,3 +665,388 @@ void abrt_journal_watch_notify_strings(abrt_journal_watch_t *watch, void *data)
 /*
  * ABRT systemd-journal strings notifier - end
  */
+
+/*
+ * ABRT systemd-journal handlers
+ */
+
+/* Matches of a single field, an entry must match one of them */
+struct abrt_journal_field_matches
+{
+    char *field;                    ///< FIELD= prefix of the matches
+    GList *matches;                 ///< FIELD=value strings
+};
+
+struct abrt_journal_handler
+{
+    char *name;
+    GList *fields;                  ///< struct abrt_journal_field_matches
+
+    abrt_journal_handler_entry_callback entry_callback;
+    abrt_journal_handler_idle_callback idle_callback;
+    abrt_journal_handler_flush_callback flush_callback;
+    void *callback_data;
+
+    char *state_file;
+    char *pending_cursor;           ///< the last passed entry, not saved yet
+    bool settled;                   ///< all passed entries have been processed
+
+    /* Entries seen before the restored position are not passed */
+    bool skipping;
+    uint64_t skip_usec;             ///< realtime of the restored position
+    char *skip_cursor;              ///< the restored position or NULL
+};
+
+static void abrt_journal_field_matches_free(struct abrt_journal_field_matches *fm)
+{
+    free(fm->field);
+    list_free_with_free(fm->matches);
+    free(fm);
+}
+
+static void abrt_journal_handler_free(abrt_journal_handler_t *handler)
+{
+    free(handler->name);
+    g_list_free_full(handler->fields, (GDestroyNotify)abrt_journal_field_matches_free);
+    free(handler->state_file);
+    free(handler->pending_cursor);
+    free(handler->skip_cursor);
+    free(handler);
+}
+
+static gint abrt_journal_field_matches_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(((const struct abrt_journal_field_matches *)a)->field, (const char *)b);
+}
+
+abrt_journal_handler_t *abrt_journal_add_handler(abrt_journal_t *journal, const char *name,
+        GList *journal_filter_list,
+        abrt_journal_handler_entry_callback entry_callback,
+        abrt_journal_handler_idle_callback idle_callback,
+        void *callback_data)
+{
+    assert(entry_callback != NULL || !"ABRT journal handler needs valid callback ptr");
+
+    abrt_journal_handler_t *handler = xzalloc(sizeof(*handler));
+    handler->name = xstrdup(name);
+    handler->entry_callback = entry_callback;
+    handler->idle_callback = idle_callback;
+    handler->callback_data = callback_data;
+    handler->settled = true;
+
+    for (GList *l = journal_filter_list; l != NULL; l = l->next)
+    {
+        const char *filter = l->data;
+        const char *eq = strchr(filter, '=');
+        if (eq == NULL)
+        {
+            error_msg("Journal match '%s' of handler '%s' is not FIELD=value", filter, name);
+            abrt_journal_handler_free(handler);
+            return NULL;
+        }
+
+        char *field = xstrndup(filter, eq - filter + 1);
+        GList *found = g_list_find_custom(handler->fields, field, abrt_journal_field_matches_cmp);
+        struct abrt_journal_field_matches *fm;
+        if (found != NULL)
+        {
+            fm = found->data;
+            free(field);
+        }
+        else
+        {
+            fm = xzalloc(sizeof(*fm));
+            fm->field = field;
+            handler->fields = g_list_append(handler->fields, fm);
+        }
+        fm->matches = g_list_append(fm->matches, xstrdup(filter));
+    }
+
+    journal->handlers = g_list_append(journal->handlers, handler);
+    return handler;
+}
+
+void abrt_journal_handler_set_state_file(abrt_journal_handler_t *handler, const char *state_file)
+{
+    free(handler->state_file);
+    handler->state_file = xstrdup(state_file);
+}
+
+void abrt_journal_handler_set_flush_callback(abrt_journal_handler_t *handler,
+        abrt_journal_handler_flush_callback flush_callback)
+{
+    handler->flush_callback = flush_callback;
+}
+
+/* The same matching the journal does for a single term of its filter */
+static bool abrt_journal_handler_matches(abrt_journal_t *journal, abrt_journal_handler_t *handler)
+{
+    for (GList *f = handler->fields; f != NULL; f = f->next)
+    {
+        const struct abrt_journal_field_matches *fm = f->data;
+
+        const void *data;
+        size_t data_len;
+        /* The field name without the trailing '=' */
+        char field[strlen(fm->field)];
+        memcpy(field, fm->field, sizeof(field) - 1);
+        field[sizeof(field) - 1] = '\0';
+        if (sd_journal_get_data(journal->j, field, &data, &data_len) < 0)
+            return false;
+
+        GList *m = fm->matches;
+        for (; m != NULL; m = m->next)
+        {
+            const size_t match_len = strlen(m->data);
+            if (data_len == match_len && memcmp(data, m->data, match_len) == 0)
+                break;
+        }
+
+        if (m == NULL)
+            return false;
+    }
+
+    return true;
+}
+
+static bool abrt_journal_handler_skips(abrt_journal_t *journal, abrt_journal_handler_t *handler, uint64_t usec)
+{
+    if (!handler->skipping)
+        return false;
+
+    if (usec < handler->skip_usec)
+        return true;
+
+    if (handler->skip_cursor != NULL && usec == handler->skip_usec)
+    {
+        /* The restored position is the last processed entry */
+        if (sd_journal_test_cursor(journal->j, handler->skip_cursor) > 0)
+            handler->skipping = false;
+        return true;
+    }
+
+    /* Skip the entry at the end of journal too */
+    if (handler->skip_cursor == NULL && usec == handler->skip_usec)
+        return true;
+
+    handler->skipping = false;
+    return false;
+}
+
+static void abrt_journal_handler_commit(abrt_journal_handler_t *handler)
+{
+    if (handler->pending_cursor == NULL || handler->state_file == NULL)
+        return;
+
+    if (abrt_journal_save_cursor(handler->pending_cursor, handler->state_file) != 0)
+        return;
+
+    free(handler->pending_cursor);
+    handler->pending_cursor = NULL;
+}
+
+/* Finds where the handler continues. Returns realtime of the first entry it
+ * wants to see, 0 means the beginning of journal */
+static uint64_t abrt_journal_handler_restore_position(abrt_journal_t *journal, abrt_journal_handler_t *handler, int flags)
+{
+    char *cursor = NULL;
+    if (handler->state_file != NULL && abrt_journal_load_cursor(handler->state_file, &cursor) == 0)
+    {
+        if (sd_journal_seek_cursor(journal->j, cursor) >= 0
+            && sd_journal_next(journal->j) > 0
+            && sd_journal_test_cursor(journal->j, cursor) > 0
+            && sd_journal_get_realtime_usec(journal->j, &handler->skip_usec) >= 0)
+        {
+            log_debug("Handler '%s' continues after '%s'", handler->name, cursor);
+            handler->skip_cursor = cursor;
+            handler->skipping = true;
+            return handler->skip_usec;
+        }
+
+        error_msg(_("Failed to move the journal to a cursor from file '%s'"), handler->state_file);
+        free(cursor);
+    }
+
+    if (!(flags & ABRT_JOURNAL_HANDLERS_START_AT_END))
+        return 0;
+
+    /* Entries logged before the start are not passed */
+    if (sd_journal_seek_tail(journal->j) >= 0
+        && sd_journal_previous(journal->j) > 0
+        && sd_journal_get_realtime_usec(journal->j, &handler->skip_usec) >= 0)
+    {
+        handler->skipping = true;
+        return handler->skip_usec;
+    }
+
+    return 0;
+}
+
+static int abrt_journal_install_handler_filter(abrt_journal_t *journal)
+{
+    sd_journal_flush_matches(journal->j);
+
+    for (GList *h = journal->handlers; h != NULL; h = h->next)
+    {
+        const abrt_journal_handler_t *handler = h->data;
+
+        /* A handler without matches wants all entries */
+        if (handler->fields == NULL)
+        {
+            sd_journal_flush_matches(journal->j);
+            return 0;
+        }
+
+        for (GList *f = handler->fields; f != NULL; f = f->next)
+        {
+            const struct abrt_journal_field_matches *fm = f->data;
+            for (GList *m = fm->matches; m != NULL; m = m->next)
+            {
+                const char *filter = m->data;
+                const int r = sd_journal_add_match(journal->j, filter, strlen(filter));
+                if (r < 0)
+                {
+                    log_notice("Failed to set journal filter '%s': %s", filter,  strerror(-r));
+                    return r;
+                }
+                log_debug("Handler '%s' uses journal match: '%s'", handler->name, filter);
+            }
+        }
+
+        const int r = sd_journal_add_disjunction(journal->j);
+        if (r < 0)
+        {
+            log_notice("Failed to combine journal filters: %s", strerror(-r));
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+static void abrt_journal_dispatch_handlers(abrt_journal_watch_t *watch, void *data)
+{
+    abrt_journal_t *journal = (abrt_journal_t *)data;
+
+    uint64_t usec = 0;
+    sd_journal_get_realtime_usec(journal->j, &usec);
+
+    char *cursor = NULL;
+    for (GList *h = journal->handlers; h != NULL; h = h->next)
+    {
+        abrt_journal_handler_t *handler = h->data;
+        if (!abrt_journal_handler_matches(journal, handler)
+            || abrt_journal_handler_skips(journal, handler, usec))
+            continue;
+
+        if (cursor == NULL && abrt_journal_get_cursor(journal, &cursor) < 0)
+            cursor = NULL;
+
+        handler->entry_callback(journal, handler->callback_data);
+        if (handler->idle_callback != NULL)
+            handler->settled = false;
+
+        if (cursor != NULL)
+        {
+            free(handler->pending_cursor);
+            handler->pending_cursor = xstrdup(cursor);
+        }
+    }
+    free(cursor);
+}
+
+static int abrt_journal_handlers_idle(abrt_journal_watch_t *watch, void *data)
+{
+    abrt_journal_t *journal = (abrt_journal_t *)data;
+
+    int timeout = -1;
+    for (GList *h = journal->handlers; h != NULL; h = h->next)
+    {
+        abrt_journal_handler_t *handler = h->data;
+
+        int handler_timeout = -1;
+        if (handler->idle_callback != NULL)
+            handler_timeout = handler->idle_callback(journal, handler->callback_data);
+
+        if (handler_timeout >= 0)
+        {
+            /* Keeps unprocessed entries, the position must stay */
+            handler->settled = false;
+            if (timeout < 0 || handler_timeout < timeout)
+                timeout = handler_timeout;
+            continue;
+        }
+
+        handler->settled = true;
+        abrt_journal_handler_commit(handler);
+    }
+
+    return timeout;
+}
+
+int abrt_journal_run_handlers(abrt_journal_t *journal, int flags)
+{
+    if (journal->handlers == NULL)
+    {
+        error_msg("No journal handler registered");
+        return -EINVAL;
+    }
+
+    int r = abrt_journal_install_handler_filter(journal);
+    if (r < 0)
+        return r;
+
+    /* Start at the earliest position any of the handlers needs */
+    bool from_head = false;
+    uint64_t start_usec = UINT64_MAX;
+    for (GList *h = journal->handlers; h != NULL; h = h->next)
+    {
+        const uint64_t usec = abrt_journal_handler_restore_position(journal, h->data, flags);
+        if (usec == 0)
+            from_head = true;
+        else if (usec < start_usec)
+            start_usec = usec;
+    }
+
+    r = from_head ? sd_journal_seek_head(journal->j) : sd_journal_seek_realtime_usec(journal->j, start_usec);
+    if (r < 0)
+    {
+        log_notice("Failed to seek journal: %s", strerror(-r));
+        return r;
+    }
+
+    abrt_journal_watch_new(&journal->handlers_watch, journal, abrt_journal_dispatch_handlers, journal);
+    abrt_journal_watch_set_idle_callback(journal->handlers_watch, abrt_journal_handlers_idle);
+
+    r = abrt_journal_watch_run_sync(journal->handlers_watch);
+
+    abrt_journal_watch_free(journal->handlers_watch);
+    journal->handlers_watch = NULL;
+
+    /* Handlers keeping unprocessed entries either process them now or see
+     * them again after restart */
+    for (GList *h = journal->handlers; h != NULL; h = h->next)
+    {
+        abrt_journal_handler_t *handler = h->data;
+        if (!handler->settled && handler->flush_callback != NULL)
+        {
+            handler->flush_callback(journal, handler->callback_data);
+            handler->settled = true;
+        }
+
+        if (handler->settled)
+            abrt_journal_handler_commit(handler);
+    }
+
+    return r;
+}
+
+void abrt_journal_stop_handlers(abrt_journal_t *journal)
+{
+    if (journal->handlers_watch != NULL)
+        abrt_journal_watch_stop(journal->handlers_watch);
+}
+
+/*
+ * ABRT systemd-journal handlers - end
+ */
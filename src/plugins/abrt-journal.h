@@ -99,6 +99,31 @@ int abrt_journal_watch_new(abrt_journal_watch_t **watch,
                            abrt_journal_watch_callback callback,
                            void *callback_data);
 
+/*
+ * A watch which collects cursors of all available entries (at most
+ * ABRT_JOURNAL_WATCH_BATCH_MAX) and passes them to the call back at once.
+ * The call back moves the journal to the entries with
+ * abrt_journal_set_cursor() and abrt_journal_next().
+ *
+ * The position after the last processed batch is saved in state_file by
+ * an atomic rename, at most once per commit_interval seconds (0 means after
+ * every batch) and when the loop terminates. After a crash, the entries
+ * processed since the last save are read again.
+ */
+#define ABRT_JOURNAL_WATCH_BATCH_MAX 1024
+
+typedef void (* abrt_journal_watch_batch_callback)(struct abrt_journal_watch *watch,
+                                                   char **cursors,
+                                                   unsigned count,
+                                                   void *data);
+
+int abrt_journal_watch_new_batched(abrt_journal_watch_t **watch,
+                                   abrt_journal_t *journal,
+                                   abrt_journal_watch_batch_callback callback,
+                                   void *callback_data,
+                                   const char *state_file,
+                                   unsigned commit_interval);
+
 void abrt_journal_watch_free(abrt_journal_watch_t *watch);
 
 /*
@@ -106,6 +131,20 @@ void abrt_journal_watch_free(abrt_journal_watch_t *watch);
  */
 abrt_journal_t *abrt_journal_watch_get_journal(abrt_journal_watch_t *watch);
 
+/*
+ * A call back called when all available entries have been read, before the
+ * watch starts waiting for new entries. Gets the watch's call back data.
+ *
+ * Returns the number of milliseconds after which it wants to be called
+ * again if no new entries appear or a negative number to wait for new
+ * entries only.
+ */
+typedef int (* abrt_journal_watch_idle_callback)(struct abrt_journal_watch *watch,
+                                                 void *data);
+
+void abrt_journal_watch_set_idle_callback(abrt_journal_watch_t *watch,
+                                          abrt_journal_watch_idle_callback callback);
+
 /*
  * Starts reading journal messages and waiting for new messages in a loop.
  *
@@ -133,6 +172,79 @@ struct abrt_journal_watch_notify_strings
 
 void abrt_journal_watch_notify_strings(abrt_journal_watch_t *watch, void *data);
 
+/*
+ * Handlers sharing a single iteration of journal
+ *
+ * Every handler has its own list of matches (combined the same way as in
+ * abrt_journal_set_journal_filter()) and its own position. The journal is
+ * filtered to entries matching any handler and every entry is passed to
+ * all handlers it matches, so a single process wakes up on journal changes
+ * instead of a process per handler.
+ */
+struct abrt_journal_handler;
+typedef struct abrt_journal_handler abrt_journal_handler_t;
+
+/*
+ * Gets the journal at a matching entry and must not move the journal.
+ */
+typedef void (* abrt_journal_handler_entry_callback)(abrt_journal_t *journal,
+                                                     void *data);
+
+/*
+ * Called when all available entries have been read. Returns the number of
+ * milliseconds after which it wants to be called again if it keeps
+ * unprocessed entries or a negative number when all passed entries have been
+ * processed and the handler's position can be saved.
+ */
+typedef int (* abrt_journal_handler_idle_callback)(abrt_journal_t *journal,
+                                                   void *data);
+
+/*
+ * Called when abrt_journal_run_handlers() terminates while the handler keeps
+ * unprocessed entries. It must process them, the handler's position is
+ * saved right after it returns.
+ */
+typedef void (* abrt_journal_handler_flush_callback)(abrt_journal_t *journal,
+                                                     void *data);
+
+abrt_journal_handler_t *abrt_journal_add_handler(abrt_journal_t *journal,
+                                                 const char *name,
+                                                 GList *journal_filter_list,
+                                                 abrt_journal_handler_entry_callback entry_callback,
+                                                 abrt_journal_handler_idle_callback idle_callback,
+                                                 void *callback_data);
+
+/*
+ * The handler continues after the position saved in state_file and saves
+ * its position there whenever it gets settled.
+ */
+void abrt_journal_handler_set_state_file(abrt_journal_handler_t *handler,
+                                         const char *state_file);
+
+/*
+ * Without the flush callback unprocessed entries are dropped on termination
+ * and the handler sees them again after restart.
+ */
+void abrt_journal_handler_set_flush_callback(abrt_journal_handler_t *handler,
+                                             abrt_journal_handler_flush_callback flush_callback);
+
+enum abrt_journal_handlers_flags
+{
+    /* Handlers without a saved position start at the end of journal */
+    ABRT_JOURNAL_HANDLERS_START_AT_END = 1 << 0,
+};
+
+/*
+ * Passes the journal entries to the handlers in a loop and waits for new
+ * entries like abrt_journal_watch_run_sync().
+ */
+int abrt_journal_run_handlers(abrt_journal_t *journal, int flags);
+
+/*
+ * Can be used to terminate the loop in abrt_journal_run_handlers()
+ */
+void abrt_journal_stop_handlers(abrt_journal_t *journal);
+
 #ifdef __cplusplus
 }
 #endif
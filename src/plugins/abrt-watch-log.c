@@ -17,45 +17,149 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <sys/inotify.h>
+#include <poll.h>
 #include "libabrt.h"
+#include "oops-utils.h"
+#include "xorg-utils.h"
 
 #define MAX_SCAN_BLOCK  (4*1024*1024)
 #define READ_AHEAD          (10*1024)
+/* The extractors get the new data in pieces of this size at most */
+#define EXTRACT_CHUNK     (256*1024)
+
+#define ABRT_WATCH_LOG_OOPS_ANALYZER "abrt-oops"
 
 static unsigned page_size;
 
-static bool memstr(void *buf, unsigned size, const char *str)
+/*
+ * With -E, the crashes are extracted from the log in this process instead of
+ * running a scanner program for every change. The extractors keep the state
+ * of an oops or a crash which hasn't been completely written yet.
+ */
+enum {
+    EXTRACT_NONE,
+    EXTRACT_OOPS,
+    EXTRACT_XORG,
+};
+
+static int s_extract = EXTRACT_NONE;
+static struct abrt_oops_stream s_oops_stream;
+static struct abrt_xorg_stream s_xorg_stream;
+
+static void extractor_feed(const char *buffer, size_t len)
+{
+    if (s_extract == EXTRACT_OOPS)
+        abrt_oops_stream_feed_log(&s_oops_stream, buffer, len);
+    else
+        abrt_xorg_stream_feed(&s_xorg_stream, buffer, len);
+}
+
+/* Is an oops or a crash in progress? */
+static bool extractor_has_pending(void)
+{
+    if (s_extract == EXTRACT_OOPS)
+        return koops_extractor_has_pending(s_oops_stream.extractor);
+
+    return s_xorg_stream.lines != NULL || s_xorg_stream.partial->len != 0
+        || s_xorg_stream.pending != NULL;
+}
+
+static int extractor_idle(void)
+{
+    if (s_extract == EXTRACT_OOPS)
+        return abrt_oops_stream_idle(&s_oops_stream);
+
+    return abrt_xorg_stream_idle(&s_xorg_stream);
+}
+
+static void extractor_flush(void)
+{
+    if (s_extract == EXTRACT_OOPS)
+        abrt_oops_stream_flush(&s_oops_stream);
+    else
+        abrt_xorg_stream_flush(&s_xorg_stream);
+}
+
+/* The strings starting a crash, the parts of the log without them are not
+ * fed to the extractor */
+static GList *extractor_strings(void)
+{
+    if (s_extract == EXTRACT_OOPS)
+        return koops_suspicious_strings_list();
+
+    return g_list_append(NULL, (gpointer)XORG_SEARCH_STRING);
+}
+
+static void check_truncated(struct stat *statbuf, off_t cur_pos)
+{
+    /* If file was truncated, treat it as a new file.
+     * (changing inode# causes caller to think that file was closed or renamed)
+     */
+    if (statbuf->st_size < cur_pos)
+        statbuf->st_ino++;
+}
+
+static void run_extractor(int fd, struct stat *statbuf, const struct abrt_string_matcher *matcher)
 {
-    int len = strlen(str);
-    while ((int)size >= len)
+    /* fstat(fd, &statbuf) was just done by caller */
+
+    off_t cur_pos = lseek(fd, 0, SEEK_CUR);
+    if (statbuf->st_size <= cur_pos)
     {
-        //log("LOOKING FOR:'%s'", str);
-        char *first = memchr(buf, (unsigned char)str[0], size - len + 1);
-        if (!first)
+        check_truncated(statbuf, cur_pos);
+        return; /* we are at EOF, nothing to do */
+    }
+
+    log_info("File grew by %llu bytes, from %llu to %llu",
+        (long long)(statbuf->st_size - cur_pos),
+        (long long)(cur_pos),
+        (long long)(statbuf->st_size));
+
+    static char *buf;
+    if (buf == NULL)
+        buf = xmalloc(EXTRACT_CHUNK);
+
+    /* Reading in bounded pieces keeps the memory footprint constant
+     * no matter how much the file grew */
+    unsigned long long skipped = 0;
+    while (cur_pos < statbuf->st_size)
+    {
+        const size_t want = MIN(statbuf->st_size - cur_pos, EXTRACT_CHUNK);
+        const ssize_t len = safe_read(fd, buf, want);
+        if (len < 0)
+        {
+            perror_msg("Can't read the watched file");
             break;
-        //log("FOUND:'%.66s'", first);
-        first++;
-        if (len <= 1 || strncmp(first, str + 1, len - 1) == 0)
-            return true;
-        size -= (first - (char*)buf);
-        //log("SKIP TO:'%.66s' %d chars", first, (int)(first - (char*)buf));
-        buf = first;
+        }
+        if (len == 0)
+            break; /* truncated under our hands, the next fstat finds out */
+        cur_pos += len;
+
+        if (!extractor_has_pending() && !string_matcher_contains(matcher, buf, len))
+        {
+            /* Nothing to extract, only the unterminated last line
+             * can become a part of a crash */
+            const char *eol = memrchr(buf, '\n', len);
+            const size_t skip = eol ? eol + 1 - buf : 0;
+            skipped += skip;
+            extractor_feed(buf + skip, len - skip);
+            continue;
+        }
+
+        extractor_feed(buf, len);
     }
-    return false;
+
+    log_debug("Skipped %llu bytes without crashes", skipped);
 }
 
-static void run_scanner_prog(int fd, struct stat *statbuf, GList *match_list, char **prog)
+static void run_scanner_prog(int fd, struct stat *statbuf, const struct abrt_string_matcher *matcher, char **prog)
 {
     /* fstat(fd, &statbuf) was just done by caller */
 
     off_t cur_pos = lseek(fd, 0, SEEK_CUR);
     if (statbuf->st_size <= cur_pos)
     {
-        /* If file was truncated, treat it as a new file.
-         * (changing inode# causes caller to think that file was closed or renamed)
-         */
-        if (statbuf->st_size < cur_pos)
-            statbuf->st_ino++;
+        check_truncated(statbuf, cur_pos);
         return; /* we are at EOF, nothing to do */
     }
 
@@ -64,7 +168,7 @@ static void run_scanner_prog(int fd, struct stat *statbuf, GList *match_list, ch
         (long long)(cur_pos),
         (long long)(statbuf->st_size));
 
-    if (match_list && (statbuf->st_size - cur_pos) < MAX_SCAN_BLOCK)
+    if (matcher && (statbuf->st_size - cur_pos) < MAX_SCAN_BLOCK)
     {
         size_t length = statbuf->st_size - cur_pos;
 
@@ -75,17 +179,12 @@ static void run_scanner_prog(int fd, struct stat *statbuf, GList *match_list, ch
         if (map != MAP_FAILED)
         {
             char *start = (char*)map + (cur_pos & (page_size - 1));
-            for (GList *l = match_list; l; l = l->next)
+            log_debug("Searching in '%.*s'", length > 20 ? 20 : (int)length, start);
+            /* All strings at once */
+            if (string_matcher_contains(matcher, start, length))
             {
-                log_debug("Searching for '%s' in '%.*s'",
-                                (char*)l->data,
-                                length > 20 ? 20 : (int)length, start
-                );
-                if (memstr(start, length, (char*)l->data))
-                {
-                    log_debug("FOUND:'%s'", (char*)l->data);
-                    goto found;
-                }
+                log_debug("FOUND");
+                goto found;
             }
             /* None of the strings are found */
             log_debug("NOT FOUND");
@@ -122,6 +221,30 @@ static void run_scanner_prog(int fd, struct stat *statbuf, GList *match_list, ch
     }
 }
 
+static void scan_file(int fd, struct stat *statbuf, const struct abrt_string_matcher *matcher, char **prog)
+{
+    if (s_extract != EXTRACT_NONE)
+        run_extractor(fd, statbuf, matcher);
+    else
+        run_scanner_prog(fd, statbuf, matcher, prog);
+}
+
+/* Waits at most timeout milliseconds for a change of the watched file,
+ * forever if timeout is negative */
+static void wait_for_change(int inotify_fd, int timeout)
+{
+    struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+    const int r = poll(&pfd, 1, timeout);
+    if (r < 0 && errno != EINTR)
+        perror_msg("Error polling inotify fd");
+    if (r <= 0)
+        return;
+
+    char buf[4096];
+    if (read(inotify_fd, buf, sizeof(buf)) < 0 && errno != EINTR)
+        perror_msg("Error reading inotify fd");
+}
+
 int main(int argc, char **argv)
 {
     /* I18n */
@@ -136,22 +259,39 @@ int main(int argc, char **argv)
     page_size = sysconf(_SC_PAGE_SIZE);
 
     GList *match_list = NULL;
+    char *extractor = NULL;
+    char *dump_location = NULL;
 
     /* Can't keep these strings/structs static: _() doesn't support that */
     const char *program_usage_string = _(
         "& [-vs] [-F STR]... FILE PROG [ARGS]\n"
+        "or:\n"
+        "& [-vsxt] [-F STR]... [-d DIR] -E oops|xorg FILE\n"
         "\n"
-        "Watch log file FILE, run PROG when it grows or is replaced"
+        "Watch log file FILE, run PROG when it grows or is replaced\n"
+        "\n"
+        "With -E, kernel oopses or Xorg crashes are extracted from FILE directly\n"
+        "and a problem directory is created for each of them without running\n"
+        "any program"
     );
     enum {
         OPT_v = 1 << 0,
         OPT_s = 1 << 1,
+        OPT_F = 1 << 2,
+        OPT_E = 1 << 3,
+        OPT_d = 1 << 4,
+        OPT_x = 1 << 5,
+        OPT_t = 1 << 6,
     };
     /* Keep enum above and order of options below in sync! */
     struct options program_options[] = {
         OPT__VERBOSE(&g_verbose),
-        OPT_BOOL('s', NULL, NULL              , _("Log to syslog")),
-        OPT_LIST('F', NULL, &match_list, "STR", _("Don't run PROG if STRs aren't found")),
+        OPT_BOOL(  's', NULL, NULL              , _("Log to syslog")),
+        OPT_LIST(  'F', NULL, &match_list, "STR", _("Don't run PROG if STRs aren't found")),
+        OPT_STRING('E', NULL, &extractor , "oops|xorg", _("Extract kernel oopses or Xorg crashes instead of running PROG")),
+        OPT_STRING('d', NULL, &dump_location, "DIR", _("Create problem directories in DIR (default: DumpLocation from abrt.conf)")),
+        OPT_BOOL(  'x', NULL, NULL              , _("Make the problem directories world readable")),
+        OPT_BOOL(  't', NULL, NULL              , _("Throttle problem directory creation")),
         OPT_END()
     };
     unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
@@ -164,8 +304,20 @@ int main(int argc, char **argv)
         logmode = LOGMODE_JOURNAL;
     }
 
+    if (extractor == NULL)
+    {
+        if (opts & (OPT_d | OPT_x | OPT_t))
+            show_usage_and_die(program_usage_string, program_options);
+    }
+    else if (strcmp(extractor, "oops") == 0)
+        s_extract = EXTRACT_OOPS;
+    else if (strcmp(extractor, "xorg") == 0)
+        s_extract = EXTRACT_XORG;
+    else
+        error_msg_and_die(_("Unknown extractor '%s'"), extractor);
+
     argv += optind;
-    if (!argv[0] || !argv[1])
+    if (!argv[0] || (s_extract == EXTRACT_NONE && !argv[1]) || (s_extract != EXTRACT_NONE && argv[1]))
         show_usage_and_die(program_usage_string, program_options);
 
     /* We want to support -F "`echo foo; echo bar`" -
@@ -184,6 +336,51 @@ int main(int argc, char **argv)
         l = g_list_append(l, eol); /* in fact, always returns unchanged l */
     }
 
+    GList *extractor_list = NULL;
+    if (s_extract != EXTRACT_NONE)
+    {
+        if (dump_location == NULL)
+        {
+            load_abrt_conf();
+            dump_location = g_settings_dump_location;
+            g_settings_dump_location = NULL;
+            free_abrt_conf_data();
+        }
+
+        if (s_extract == EXTRACT_OOPS)
+        {
+            int flags = 0;
+            if (opts & OPT_x)
+                flags |= ABRT_OOPS_WORLD_READABLE;
+            if (opts & OPT_t)
+                flags |= ABRT_OOPS_THROTTLE_CREATION;
+            abrt_oops_stream_init(&s_oops_stream, dump_location, ABRT_WATCH_LOG_OOPS_ANALYZER, flags);
+        }
+        else
+        {
+            int flags = 0;
+            if (opts & OPT_x)
+                flags |= ABRT_XORG_WORLD_READABLE;
+            if (opts & OPT_t)
+                flags |= ABRT_XORG_THROTTLE_CREATION;
+            abrt_xorg_stream_init(&s_xorg_stream, dump_location, flags);
+        }
+
+        /* The extractor must see every crash start */
+        if (match_list == NULL)
+            match_list = extractor_list = extractor_strings();
+    }
+
+    struct abrt_string_matcher *matcher = NULL;
+    if (match_list)
+    {
+        matcher = string_matcher_new();
+        for (GList *l = match_list; l; l = l->next)
+            string_matcher_add(matcher, (char*)l->data, 0, 1);
+        string_matcher_compile(matcher);
+    }
+    g_list_free(extractor_list);
+
     const char *filename = *argv++;
 
     int inotify_fd = inotify_init();
@@ -203,7 +400,7 @@ int main(int argc, char **argv)
             memset(&statbuf, 0, sizeof(statbuf));
             if (fstat(file_fd, &statbuf) != 0)
                 goto close_fd;
-            run_scanner_prog(file_fd, &statbuf, match_list, argv);
+            scan_file(file_fd, &statbuf, matcher, argv);
 
             /* Was file deleted or replaced? */
             ino_t fd_ino = statbuf.st_ino;
@@ -211,6 +408,9 @@ int main(int argc, char **argv)
             {
                 log_info("Inode# changed, closing fd");
  close_fd:
+                /* The rest of a crash can't come anymore */
+                if (s_extract != EXTRACT_NONE)
+                    extractor_flush();
                 close(file_fd);
                 if (wd >= 0)
                     inotify_rm_watch(inotify_fd, wd);
@@ -244,13 +444,30 @@ int main(int argc, char **argv)
                     if (statbuf.st_size > (MAX_SCAN_BLOCK - READ_AHEAD))
                         lseek(file_fd, statbuf.st_size - (MAX_SCAN_BLOCK - READ_AHEAD), SEEK_SET);
                     /* Note that statbuf is filled by fstat by now,
-                     * run_scanner_prog needs that
+                     * scan_file needs that
                      */
-                    run_scanner_prog(file_fd, &statbuf, match_list, argv);
+                    scan_file(file_fd, &statbuf, matcher, argv);
                 }
             }
         }
 
+        if (s_extract != EXTRACT_NONE)
+        {
+            /* No need to sleep, scanning costs no fork and the extractors
+             * wait for the rest of a partially written crash themselves */
+            int timeout = extractor_idle();
+            if (wd < 0)
+            {
+                /* Nothing tells us about changes, poll the file */
+                const int poll_msec = (file_fd >= 0 ? 1 : 59) * 1000;
+                if (timeout < 0 || timeout > poll_msec)
+                    timeout = poll_msec;
+            }
+            log_debug("Waiting for '%s' to change", filename);
+            wait_for_change(inotify_fd, timeout);
+            continue;
+        }
+
         /* Even if log file grows all the time, say, a new line every 5 ms,
          * we don't want to scan it all the time. Sleep a bit and let it grow
          * in bigger increments.
@@ -0,0 +1,592 @@
+/*
+ * Copyright (C) 2014  ABRT team
+ * Copyright (C) 2014  RedHat Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "journal-core-utils.h"
+
+/*
+ * A journal message is a set of key value pairs in the following format:
+ *   FIELD_NAME=${binary data}
+ *
+ * A journal message contains many fields useful in syslog but ABRT doesn't
+ * need all of them. So the following list defines mapping between journal
+ * fields and ABRT problem items.
+ *
+ * ABRT goes through the list and for each item reads journal field called
+ * 'item.name' and saves its contents in $DUMP_DIRECTORY/'item.file'.
+ */
+static struct field_mapping {
+    const char *name;
+    const char *file;
+} fields [] = {
+    { .name = "COREDUMP_EXE",         .file = FILENAME_EXECUTABLE, },
+    { .name = "COREDUMP_CMDLINE",     .file = FILENAME_CMDLINE, },
+    { .name = "COREDUMP_PROC_STATUS", .file = FILENAME_PROC_PID_STATUS, },
+    { .name = "COREDUMP_PROC_MAPS",   .file = FILENAME_MAPS, },
+    { .name = "COREDUMP_PROC_LIMITS", .file = FILENAME_LIMITS, },
+    { .name = "COREDUMP_PROC_CGROUP", .file = FILENAME_CGROUP, },
+    { .name = "COREDUMP_ENVIRON",     .file = FILENAME_ENVIRON, },
+    { .name = "COREDUMP_CWD",         .file = FILENAME_PWD, },
+    { .name = "COREDUMP_ROOT",        .file = FILENAME_ROOTDIR, },
+    { .name = "COREDUMP_OPEN_FDS",    .file = FILENAME_OPEN_FDS, },
+    { .name = "COREDUMP_UID",         .file = FILENAME_UID, },
+    //{ .name = "COREDUMP_GID",         .file = FILENAME_GID, },
+    { .name = "COREDUMP_PID",         .file = FILENAME_PID, },
+};
+
+/*
+ * Something like 'struct problem_data' but optimized for copying data from
+ * journald to ABRT.
+ *
+ * 'struct problem_data' allocates a new memory for every single item and I
+ * found that very inefficient in this case.
+ *
+ * The following structure holds data that we already retreived from journald
+ * so we won't need to retrieve the data again.
+ *
+ * Why we retrieve data before we store them? Because we do some checking
+ * before we start saving data in ABRT. We check whether the signal is one of
+ * those we are interested in or whether the executable crashes too often to
+ * ignore the current crash ...
+ */
+struct crash_info
+{
+    abrt_journal_t *ci_journal;
+
+    int ci_signal_no;
+    const char *ci_signal_name;
+    char *ci_executable_path;          ///< /full/path/to/executable
+    const char *ci_executable_name;    ///< executable
+    uid_t ci_uid;
+
+    struct field_mapping *ci_mapping;
+    size_t ci_mapping_items;
+};
+
+
+/*
+ * Last occurrences of crashed executables used for throttling.
+ *
+ * A hash table maps executables to their occurrences and a queue keeps them
+ * in the order of use, the least recently crashed executable is forgotten
+ * when the table is full. The table is saved in the dump location, so
+ * throttling works across restarts of the service during crash loops:
+ *
+ *   <last problem time stamp> <count of crashes> <executable>
+ *
+ * The lines are ordered from the least recently crashed executable.
+ */
+#define OCCURRENCES_FILE "last-journal-core"
+
+struct occurrence
+{
+    char *oc_executable;
+    unsigned oc_stamp;      ///< time of the last created problem
+    unsigned oc_count;      ///< all crashes including throttled ones
+    GList oc_link;          ///< position in s_occurrences.ot_lru
+};
+
+static struct occurrence_table
+{
+    GHashTable *ot_executables;     ///< executable -> struct occurrence
+    GQueue ot_lru;                  ///< the most recently crashed first
+    unsigned ot_capacity;
+    char *ot_file;
+    bool ot_dirty;                  ///< counts changed since saving
+} s_occurrences;
+
+static void
+abrt_journal_occurrence_free(struct occurrence *oc)
+{
+    free(oc->oc_executable);
+    free(oc);
+}
+
+static void
+abrt_journal_occurrences_save(void)
+{
+    if (s_occurrences.ot_file == NULL)
+        return;
+
+    struct strbuf *buf = strbuf_new();
+    for (GList *l = s_occurrences.ot_lru.tail; l != NULL; l = l->prev)
+    {
+        const struct occurrence *oc = l->data;
+        strbuf_append_strf(buf, "%u %u %s\n", oc->oc_stamp, oc->oc_count, oc->oc_executable);
+    }
+
+    char *tmp_file = xasprintf("%s.new", s_occurrences.ot_file);
+    const int fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    if (fd < 0 || full_write(fd, buf->buf, buf->len) < 0 || close(fd) != 0
+        || rename(tmp_file, s_occurrences.ot_file) != 0)
+    {
+        perror_msg("Can't save '%s'", s_occurrences.ot_file);
+        unlink(tmp_file);
+    }
+    else
+        s_occurrences.ot_dirty = false;
+
+    free(tmp_file);
+    strbuf_free(buf);
+}
+
+static struct occurrence *
+abrt_journal_occurrence_touch(const char *executable)
+{
+    struct occurrence *oc = g_hash_table_lookup(s_occurrences.ot_executables, executable);
+    if (oc != NULL)
+    {
+        g_queue_unlink(&s_occurrences.ot_lru, &oc->oc_link);
+        g_queue_push_head_link(&s_occurrences.ot_lru, &oc->oc_link);
+        return oc;
+    }
+
+    if (g_hash_table_size(s_occurrences.ot_executables) >= s_occurrences.ot_capacity)
+    {
+        GList *lru = g_queue_pop_tail_link(&s_occurrences.ot_lru);
+        struct occurrence *old = lru->data;
+        log_debug("Forgetting the last occurrence of '%s'", old->oc_executable);
+        g_hash_table_remove(s_occurrences.ot_executables, old->oc_executable);
+    }
+
+    oc = xzalloc(sizeof(*oc));
+    oc->oc_executable = xstrdup(executable);
+    oc->oc_link.data = oc;
+    g_hash_table_insert(s_occurrences.ot_executables, oc->oc_executable, oc);
+    g_queue_push_head_link(&s_occurrences.ot_lru, &oc->oc_link);
+    return oc;
+}
+
+static void
+abrt_journal_occurrences_load(const char *file)
+{
+    char *data = xmalloc_open_read_close(file, /*maxsz*/NULL);
+    if (data == NULL)
+        return;
+
+    const unsigned current = time(NULL);
+
+    for (char *line = data, *eol; *line; line = eol)
+    {
+        eol = strchrnul(line, '\n');
+        if (*eol)
+            *eol++ = '\0';
+
+        unsigned stamp, count;
+        int executable = 0;
+        if (sscanf(line, "%u %u %n", &stamp, &count, &executable) != 2
+            || executable == 0 || line[executable] != '/')
+        {
+            log_notice("Ignoring invalid line in '%s': '%s'", file, line);
+            continue;
+        }
+
+        /* The clock might have been set back since saving */
+        struct occurrence *oc = abrt_journal_occurrence_touch(line + executable);
+        oc->oc_stamp = stamp > current ? current : stamp;
+        oc->oc_count = count;
+    }
+
+    free(data);
+}
+
+static void
+abrt_journal_occurrences_init(const abrt_watch_core_conf_t *conf)
+{
+    if (s_occurrences.ot_executables != NULL)
+        return;
+
+    s_occurrences.ot_executables = g_hash_table_new_full(g_str_hash, g_str_equal,
+            /*executable is freed by*/NULL, (GDestroyNotify)abrt_journal_occurrence_free);
+    g_queue_init(&s_occurrences.ot_lru);
+    s_occurrences.ot_capacity = conf->awc_throttle_capacity > 0
+            ? conf->awc_throttle_capacity : ABRT_JOURNAL_CORE_THROTTLE_CAPACITY;
+
+    if (conf->awc_dump_location != NULL)
+    {
+        s_occurrences.ot_file = concat_path_file(conf->awc_dump_location, OCCURRENCES_FILE);
+        abrt_journal_occurrences_load(s_occurrences.ot_file);
+    }
+}
+
+void
+abrt_journal_core_throttle_free(void)
+{
+    if (s_occurrences.ot_executables == NULL)
+        return;
+
+    if (s_occurrences.ot_dirty)
+        abrt_journal_occurrences_save();
+
+    /* The links are parts of the occurrences */
+    g_hash_table_destroy(s_occurrences.ot_executables);
+    free(s_occurrences.ot_file);
+    memset(&s_occurrences, 0, sizeof(s_occurrences));
+}
+
+/*
+ * Converts a journal message into an intermediate ABRT problem (struct crash_info).
+ *
+ * Refuses to create the problem in the following cases:
+ * - the crashed executable has 'abrt' prefix
+ * - the signals is not fatal (see signal_is_fatal())
+ * - the journal message misses one of the following fields
+ *   - COREDUMP_SIGNAL
+ *   - COREDUMP_EXE
+ *   - COREDUMP_UID
+ *   - COREDUMP_PROC_STATUS
+ * - if any data does not have an expected format
+ */
+static int
+abrt_journal_core_retrieve_information(abrt_journal_t *journal, struct crash_info *info)
+{
+    if (abrt_journal_get_int_field(journal, "COREDUMP_SIGNAL", &(info->ci_signal_no)) != 0)
+    {
+        log_info("Failed to get signal number from journal message");
+        return -EINVAL;
+    }
+
+    if (!signal_is_fatal(info->ci_signal_no, &(info->ci_signal_name)))
+    {
+        log_info("Signal '%d' is not fatal: ignoring crash", info->ci_signal_no);
+        return 1;
+    }
+
+    info->ci_executable_path = abrt_journal_get_string_field(journal, "COREDUMP_EXE", NULL);
+    if (info->ci_executable_path == NULL)
+    {
+        log_notice("Could not get crashed 'executable'.");
+        return -ENOENT;
+    }
+
+    info->ci_executable_name = strrchr(info->ci_executable_path, '/');
+    if (info->ci_executable_name == NULL)
+    {
+        info->ci_executable_name = info->ci_executable_path;
+    }
+    else if(strncmp(++(info->ci_executable_name), "abrt", 4) == 0)
+    {
+        error_msg("Ignoring crash of ABRT executable '%s'", info->ci_executable_path);
+        return 1;
+    }
+
+    if (abrt_journal_get_unsigned_field(journal, "COREDUMP_UID", &(info->ci_uid)))
+    {
+        log_info("Failed to get UID from journal message");
+        return -EINVAL;
+    }
+
+    char *proc_status = abrt_journal_get_string_field(journal, "COREDUMP_PROC_STATUS", NULL);
+    if (proc_status == NULL)
+    {
+        log_info("Failed to get /proc/[pid]/status from journal message");
+        return -ENOENT;
+    }
+
+    uid_t tmp_fsuid = get_fsuid(proc_status);
+    if (tmp_fsuid < 0)
+        return -EINVAL;
+
+    if (tmp_fsuid != info->ci_uid)
+    {
+        /* use root for suided apps unless it's explicitly set to UNSAFE */
+        info->ci_uid = (dump_suid_policy() != DUMP_SUID_UNSAFE) ? 0 : tmp_fsuid;
+    }
+
+    return 0;
+}
+
+/*
+ * Initializes ABRT problem directory and save the relevant journal message
+ * fileds in that directory.
+ */
+/*
+ * Coredumps stored by systemd-coredump are brought to problem directories by
+ * the cheapest available method:
+ * 1. a reflink sharing the blocks, if the file system supports it,
+ * 2. copy_file_resumable(), i.e. copy_file_range() of the data regions.
+ * A hard link is never used: the item would be the inode of systemd-coredump
+ * and changing the owner or mode of one would change the other.
+ * Compressed coredumps stay compressed, abrt-action-rehydrate unpacks them
+ * for the tools which need the raw coredump.
+ */
+static struct abrt_journal_core_stats s_core_stats;
+
+static int
+ingest_coredump_file(struct dump_dir *dd, const char *name, const char *src_path)
+{
+    const int src_fd = open(src_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat src_st;
+    if (src_fd < 0 || fstat(src_fd, &src_st) != 0 || !S_ISREG(src_st.st_mode))
+    {
+        perror_msg("Can't open '%s'", src_path);
+        if (src_fd >= 0)
+            close(src_fd);
+        return -1;
+    }
+
+    int r = -1;
+    struct stat dd_st;
+    if (fstat(dd->dd_fd, &dd_st) == 0 && dd_st.st_dev == src_st.st_dev)
+    {
+#ifdef FICLONE
+        const int dst_fd = openat(dd->dd_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, dd->mode);
+        if (dst_fd >= 0)
+        {
+            r = ioctl(dst_fd, FICLONE, src_fd);
+            if (r != 0)
+                log_debug("Can't clone '%s': %s", src_path, strerror(errno));
+            else if (fchown(dst_fd, dd->dd_uid, dd->dd_gid) != 0)
+            {
+                perror_msg("Can't change owner of '%s/%s'", dd->dd_dirname, name);
+                r = -1;
+            }
+
+            close(dst_fd);
+            if (r != 0)
+                unlinkat(dd->dd_fd, name, 0);
+        }
+#endif
+        if (r == 0)
+            log_info("Cloned '%s' to '%s/%s'", src_path, dd->dd_dirname, name);
+    }
+    close(src_fd);
+
+    if (r == 0)
+    {
+        s_core_stats.ajcs_referenced += src_st.st_size;
+        return 0;
+    }
+
+    char *dst_path = concat_path_file(dd->dd_dirname, name);
+    r = copy_file_resumable(src_path, dst_path, dd->mode, 0);
+    if (r == 0 && lchown(dst_path, dd->dd_uid, dd->dd_gid) != 0)
+    {
+        perror_msg("Can't change owner of '%s'", dst_path);
+        r = -1;
+    }
+
+    if (r == 0)
+        s_core_stats.ajcs_copied += src_st.st_size;
+    else
+        copy_file_resumable_abort(dst_path);
+
+    free(dst_path);
+    return r;
+}
+
+const struct abrt_journal_core_stats *
+abrt_journal_core_get_stats(void)
+{
+    return &s_core_stats;
+}
+
+void
+abrt_journal_core_log_stats(void)
+{
+    log_notice("Saved %u coredumps: %llu bytes copied, %llu bytes referenced",
+            s_core_stats.ajcs_cores, s_core_stats.ajcs_copied, s_core_stats.ajcs_referenced);
+}
+
+static int
+save_systemd_coredump_in_dump_directory(struct dump_dir *dd, struct crash_info *info)
+{
+    char coredump_path[PATH_MAX + 1] = { '\0' };
+    if (coredump_path != abrt_journal_get_string_field(info->ci_journal, "COREDUMP_FILENAME", coredump_path))
+        log_debug("Processing coredumpctl entry without a real file");
+
+    if (coredump_path[0] != '\0')
+    {
+        const char *packed_suffix = packed_coredump_suffix(coredump_path);
+        char *name = xasprintf(FILENAME_COREDUMP"%s", packed_suffix ? packed_suffix : "");
+        const int r = ingest_coredump_file(dd, name, coredump_path);
+        free(name);
+        if (r != 0)
+            return -1;
+    }
+    else
+    {
+        const char *data = NULL;
+        size_t data_len = 0;
+        int r = abrt_journal_get_field(info->ci_journal, "COREDUMP", (const void **)&data, &data_len);
+        if (r < 0)
+        {
+            log_info("Ignoring coredumpctl entry without core dump file.");
+            return -1;
+        }
+
+        dd_save_binary(dd, FILENAME_COREDUMP, data, data_len);
+        s_core_stats.ajcs_copied += data_len;
+    }
+    ++s_core_stats.ajcs_cores;
+
+    dd_save_text(dd, FILENAME_ABRT_VERSION, VERSION);
+    dd_save_text(dd, FILENAME_TYPE, "CCpp");
+    dd_save_text(dd, FILENAME_ANALYZER, "abrt-journal-core");
+
+    char *reason;
+    if (info->ci_signal_name != NULL)
+        reason = xasprintf("%s killed by signal %d", info->ci_executable_name, info->ci_signal_no);
+    else
+        reason = xasprintf("%s killed by SIG%s", info->ci_executable_name, info->ci_signal_name);
+
+    dd_save_text(dd, FILENAME_REASON, reason);
+    free(reason);
+
+    char *cursor = NULL;
+    if (abrt_journal_get_cursor(info->ci_journal, &cursor) == 0)
+        dd_save_text(dd, "journald_cursor", cursor);
+    free(cursor);
+
+    for (size_t i = 0; i < info->ci_mapping_items; ++i)
+    {
+        const char *data;
+        size_t data_len;
+        struct field_mapping *f = info->ci_mapping + i;
+
+        if (abrt_journal_get_field(info->ci_journal, f->name, (const void **)&data, &data_len))
+        {
+            log_info("systemd-coredump journald message misses field: '%s'", f->name);
+            continue;
+        }
+
+        dd_save_binary(dd, f->file, data, data_len);
+    }
+
+    return 0;
+}
+
+static int
+abrt_journal_core_to_abrt_problem(struct crash_info *info, const char *dump_location)
+{
+    struct dump_dir *dd = create_dump_dir(dump_location, "ccpp", /*fs owner*/0,
+            (save_data_call_back)save_systemd_coredump_in_dump_directory, info);
+
+    if (dd != NULL)
+    {
+        char *path = xstrdup(dd->dd_dirname);
+        dd_close(dd);
+        notify_new_path(path);
+        log_debug("ABRT daemon has been notified about directory: '%s'", path);
+        free(path);
+    }
+
+    return dd == NULL;
+}
+
+/*
+ * Creates an abrt problem from a journal message
+ */
+int
+abrt_journal_dump_core(abrt_journal_t *journal, const char *dump_location)
+{
+    struct crash_info info = { 0 };
+    info.ci_journal = journal;
+    info.ci_mapping = fields;
+    info.ci_mapping_items = sizeof(fields)/sizeof(*fields);
+
+    /* Compatibility hack, a watch's callback gets the journal already moved
+     * to a next message. */
+    abrt_journal_next(journal);
+
+    /* This the watch call back mentioned in the comment above. We use the
+     * following function also in abrt_journal_watch_cores(). */
+    int r = abrt_journal_core_retrieve_information(journal, &info);
+    if (r != 0)
+    {
+        if (r < 0)
+            error_msg(_("Failed to obtain all required information from journald"));
+
+        goto dump_cleanup;
+    }
+
+    r = abrt_journal_core_to_abrt_problem(&info, dump_location);
+
+dump_cleanup:
+    if (info.ci_executable_path != NULL)
+        free(info.ci_executable_path);
+
+    return r;
+}
+
+/*
+ * A function called for every new journal core.
+ *
+ * The function retrieves information from journal, checks the last occurrence
+ * time of the crashed executable and if there was no recent occurrence creates
+ * an ABRT problem from the journal message. Finally updates the last occurrence
+ * time.
+ */
+void
+abrt_journal_watch_core(abrt_journal_t *journal, const abrt_watch_core_conf_t *conf)
+{
+    struct crash_info info = { 0 };
+    info.ci_journal = journal;
+    info.ci_mapping = fields;
+    info.ci_mapping_items = sizeof(fields)/sizeof(*fields);
+
+    int r = abrt_journal_core_retrieve_information(journal, &info);
+    if (r)
+    {
+        if (r < 0)
+            error_msg(_("Failed to obtain all required information from journald"));
+
+        goto watch_cleanup;
+    }
+
+    // do not dump too often
+    //   ignore crashes of a single executable appearing in THROTTLE s
+    abrt_journal_occurrences_init(conf);
+
+    const unsigned current = time(NULL);
+    struct occurrence *oc = abrt_journal_occurrence_touch(info.ci_executable_path);
+    ++oc->oc_count;
+    s_occurrences.ot_dirty = true;
+
+    if (current < oc->oc_stamp)
+    {
+        error_msg("BUG: current time stamp lower than an old one");
+
+        if (g_verbose > 2)
+            abort();
+
+        goto watch_cleanup;
+    }
+
+    const unsigned sub = current - oc->oc_stamp;
+    if (sub < conf->awc_throttle)
+    {
+        /* We don't want to update the time stamp here. */
+        error_msg(_("Not saving repeating crash after %ds (limit is %ds)"), sub, conf->awc_throttle);
+        log_info("'%s' crashed %u times", oc->oc_executable, oc->oc_count);
+        goto watch_cleanup;
+    }
+
+    if (abrt_journal_core_to_abrt_problem(&info, conf->awc_dump_location))
+    {
+        error_msg(_("Failed to save detect problem data in abrt database"));
+        goto watch_cleanup;
+    }
+
+    oc->oc_stamp = current;
+    abrt_journal_occurrences_save();
+
+watch_cleanup:
+    if (info.ci_executable_path != NULL)
+        free(info.ci_executable_path);
+
+    return;
+}
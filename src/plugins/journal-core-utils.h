@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014  ABRT team
+ * Copyright (C) 2014  RedHat Inc
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef _ABRT_JOURNAL_CORE_UTILS_H_
+#define _ABRT_JOURNAL_CORE_UTILS_H_
+
+#include "libabrt.h"
+#include "abrt-journal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ABRT watch core configuration
+ */
+typedef struct
+{
+    const char *awc_dump_location;
+    int awc_throttle;
+    unsigned awc_throttle_capacity;     ///< 0 means the default
+}
+abrt_watch_core_conf_t;
+
+/* How many executables to remember for throttling by default */
+#define ABRT_JOURNAL_CORE_THROTTLE_CAPACITY 1024
+
+/*
+ * Creates an abrt problem from the next journal message
+ */
+int abrt_journal_dump_core(abrt_journal_t *journal, const char *dump_location);
+
+/*
+ * Creates an abrt problem from the current journal message unless the crashed
+ * executable crashed in the last conf->awc_throttle seconds.
+ */
+void abrt_journal_watch_core(abrt_journal_t *journal, const abrt_watch_core_conf_t *conf);
+
+/*
+ * Saves the last occurrences of the crashed executables in the dump location
+ * and releases them. Call it before exit.
+ */
+void abrt_journal_core_throttle_free(void);
+
+/*
+ * Coredumps saved in problem directories by this process
+ */
+struct abrt_journal_core_stats
+{
+    unsigned ajcs_cores;
+    unsigned long long ajcs_copied;         ///< bytes written to new blocks
+    unsigned long long ajcs_referenced;     ///< bytes shared with systemd-coredump
+};
+
+const struct abrt_journal_core_stats *abrt_journal_core_get_stats(void);
+void abrt_journal_core_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_ABRT_JOURNAL_CORE_UTILS_H_*/
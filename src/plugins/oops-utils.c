@@ -12,11 +12,209 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
  */
-#include <satyr/stacktrace.h>
-
 #include "oops-utils.h"
 #include "libabrt.h"
 
+/* Repeats of an oops are rate limited by a token bucket per signature.
+ * A new signature always gets through, further repeats consume tokens and
+ * when the bucket is empty, they are only counted and later added to the
+ * count of the problem at once.
+ *
+ * The buckets are kept in ABRT_OOPS_BUCKETS_FILE between the runs:
+ *   <signature> <tokens> <refilled> <pending> <duplicate hash or ->
+ *   ...
+ */
+struct oops_bucket
+{
+    unsigned tokens;
+    time_t refilled;
+    /* Throttled repeats not recorded yet */
+    unsigned long pending;
+    /* Duplicate hash of the oops, if any */
+    bool hashed;
+    char hash_str[SHA1_RESULT_LEN*2 + 1];
+};
+
+/* Signature -> struct oops_bucket, loaded on the first throttled oops */
+static GHashTable *s_oops_buckets;
+
+static void oops_buckets_load(void)
+{
+    s_oops_buckets = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+
+    FILE *fp = fopen(ABRT_OOPS_BUCKETS_FILE, "r");
+    if (fp == NULL)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open '%s'", ABRT_OOPS_BUCKETS_FILE);
+        return;
+    }
+
+    char *line;
+    while ((line = xmalloc_fgetline(fp)) != NULL)
+    {
+        char signature[strlen(line) + 1];
+        char hash_str[strlen(line) + 1];
+        unsigned tokens;
+        unsigned long refilled, pending;
+        if (sscanf(line, "%s %u %lu %lu %s", signature, &tokens, &refilled, &pending, hash_str) != 5
+            || strlen(signature) != SHA1_RESULT_LEN*2
+            || (strcmp(hash_str, "-") != 0 && strlen(hash_str) != SHA1_RESULT_LEN*2))
+        {
+            log_notice("Ignoring malformed line in '%s'", ABRT_OOPS_BUCKETS_FILE);
+            free(line);
+            continue;
+        }
+        free(line);
+
+        struct oops_bucket *bucket = xzalloc(sizeof(*bucket));
+        bucket->tokens = MIN(tokens, ABRT_OOPS_BUCKET_SIZE);
+        bucket->refilled = refilled;
+        bucket->pending = pending;
+        bucket->hashed = strcmp(hash_str, "-") != 0;
+        if (bucket->hashed)
+            strcpy(bucket->hash_str, hash_str);
+        g_hash_table_replace(s_oops_buckets, xstrdup(signature), bucket);
+    }
+    fclose(fp);
+
+    log_debug("Loaded %u oops buckets", g_hash_table_size(s_oops_buckets));
+}
+
+/* Replaced atomically, concurrent dumpers can lose an update only */
+static void oops_buckets_save(void)
+{
+    char *tmp_file = xasprintf("%s.tmp", ABRT_OOPS_BUCKETS_FILE);
+    FILE *fp = fopen(tmp_file, "w");
+    if (fp == NULL)
+    {
+        perror_msg("Can't create '%s'", tmp_file);
+        free(tmp_file);
+        return;
+    }
+
+    GHashTableIter iter;
+    gpointer signature, value;
+    g_hash_table_iter_init(&iter, s_oops_buckets);
+    while (g_hash_table_iter_next(&iter, &signature, &value))
+    {
+        const struct oops_bucket *bucket = value;
+        /* The same as a new bucket */
+        if (bucket->tokens == ABRT_OOPS_BUCKET_SIZE && bucket->pending == 0)
+            continue;
+
+        fprintf(fp, "%s %u %lu %lu %s\n", (const char *)signature, bucket->tokens,
+                (unsigned long)bucket->refilled, bucket->pending,
+                bucket->hashed ? bucket->hash_str : "-");
+    }
+
+    int r = 0;
+    if (fflush(fp) != 0 || ferror(fp))
+    {
+        perror_msg("Can't write '%s'", tmp_file);
+        r = -1;
+    }
+    fclose(fp);
+
+    if (r == 0 && rename(tmp_file, ABRT_OOPS_BUCKETS_FILE) != 0)
+    {
+        perror_msg("Can't rename '%s' to '%s'", tmp_file, ABRT_OOPS_BUCKETS_FILE);
+        r = -1;
+    }
+
+    if (r != 0)
+        unlink(tmp_file);
+
+    free(tmp_file);
+}
+
+static void oops_bucket_refill(struct oops_bucket *bucket, time_t now)
+{
+    /* The clock has been set back */
+    if (now < bucket->refilled)
+        bucket->refilled = now;
+
+    const time_t periods = (now - bucket->refilled) / ABRT_OOPS_BUCKET_REFILL_SEC;
+    if (periods == 0)
+        return;
+
+    bucket->tokens = MIN(ABRT_OOPS_BUCKET_SIZE, bucket->tokens + periods);
+    bucket->refilled += periods * ABRT_OOPS_BUCKET_REFILL_SEC;
+}
+
+static struct oops_bucket *oops_bucket_get(const char *backtrace, time_t now)
+{
+    if (s_oops_buckets == NULL)
+        oops_buckets_load();
+
+    char signature[SHA1_RESULT_LEN*2 + 1];
+    koops_signature_str(signature, backtrace);
+
+    struct oops_bucket *bucket = g_hash_table_lookup(s_oops_buckets, signature);
+    if (bucket == NULL)
+    {
+        bucket = xzalloc(sizeof(*bucket));
+        bucket->tokens = ABRT_OOPS_BUCKET_SIZE;
+        bucket->refilled = now;
+        g_hash_table_insert(s_oops_buckets, xstrdup(signature), bucket);
+    }
+    else
+        oops_bucket_refill(bucket, now);
+
+    return bucket;
+}
+
+/* Full buckets without pending repeats carry no information */
+static gboolean oops_bucket_is_idle(gpointer signature, gpointer value, gpointer now)
+{
+    struct oops_bucket *bucket = value;
+    oops_bucket_refill(bucket, *(time_t *)now);
+    return bucket->tokens == ABRT_OOPS_BUCKET_SIZE && bucket->pending == 0;
+}
+
+/* Records throttled repeats of oopses which got tokens again or all of them */
+static void oops_buckets_flush(struct abrt_koops_index *index, time_t now, bool all)
+{
+    if (s_oops_buckets == NULL)
+        return;
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, s_oops_buckets);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        struct oops_bucket *bucket = value;
+        if (bucket->pending == 0)
+            continue;
+
+        oops_bucket_refill(bucket, now);
+        if (!all && bucket->tokens == 0)
+            continue;
+
+        if (!bucket->hashed || index == NULL
+            || koops_index_record_occurrence(index, bucket->hash_str, now, bucket->pending) != 0)
+            log_notice("Dropping %lu repeats of an oops without a problem", bucket->pending);
+
+        bucket->pending = 0;
+    }
+
+    if (g_hash_table_size(s_oops_buckets) > ABRT_OOPS_MAX_BUCKETS)
+        g_hash_table_foreach_remove(s_oops_buckets, oops_bucket_is_idle, &now);
+}
+
+void abrt_oops_flush_throttled(const char *dump_location)
+{
+    if (s_oops_buckets == NULL || dump_location == NULL)
+        return;
+
+    struct abrt_koops_index *index = koops_index_load(ABRT_OOPS_INDEX_FILE, dump_location);
+    oops_buckets_flush(index, time(NULL), /*all*/true);
+    koops_index_save(index);
+    koops_index_free(index);
+
+    oops_buckets_save();
+}
+
 int abrt_oops_process_list(GList *oops_list, const char *dump_location, const char *analyzer, int flags)
 {
     unsigned errors = 0;
@@ -58,22 +256,6 @@ int abrt_oops_process_list(GList *oops_list, const char *dump_location, const ch
         }
     }
 
-    /* If we are run by a log watcher, this delays log rescan
-     * (because log watcher waits to us to terminate)
-     * and possibly prevents dreaded "abrt storm".
-     */
-    int unreported_cnt = oops_cnt - ABRT_OOPS_MAX_DUMPED_COUNT;
-    if (g_abrt_oops_sleep_woke_up_on_signal <= 0 &&
-            (unreported_cnt > 0 && (flags & ABRT_OOPS_THROTTLE_CREATION)))
-    {
-        /* Quadratic throttle time growth, but careful to not overflow in "n*n" */
-        int n = unreported_cnt > 30 ? 30 : unreported_cnt;
-        n = n * n;
-        if (n > 9)
-            log(_("Sleeping for %d seconds"), n);
-        abrt_oops_signaled_sleep(n); /* max 15 mins */
-    }
-
     return errors;
 }
 
@@ -83,7 +265,7 @@ unsigned abrt_oops_create_dump_dirs(GList *oops_list, const char *dump_location,
     const int oops_cnt = g_list_length(oops_list);
     unsigned countdown = ABRT_OOPS_MAX_DUMPED_COUNT; /* do not report hundreds of oopses */
 
-    log_notice("Saving %u oopses as problem dirs", oops_cnt >= countdown ? countdown : oops_cnt);
+    log_notice("Saving %u oopses as problem dirs", oops_cnt);
 
     char *cmdline_str = xmalloc_fopen_fgetline_fclose("/proc/cmdline");
     char *fips_enabled = xmalloc_fopen_fgetline_fclose("/proc/sys/crypto/fips_enabled");
@@ -93,11 +275,55 @@ unsigned abrt_oops_create_dump_dirs(GList *oops_list, const char *dump_location,
     time_t t = time(NULL);
     const char *iso_date = iso_date_string(&t);
 
+    struct abrt_koops_index *index = koops_index_load(ABRT_OOPS_INDEX_FILE, dump_location);
+
     pid_t my_pid = getpid();
     unsigned idx = 0;
+    unsigned throttled = 0;
     unsigned errors = 0;
-    while (idx < oops_cnt)
+    for (GList *iter = oops_list; iter; iter = g_list_next(iter), ++idx)
     {
+        char *oops = (char*)iter->data;
+
+        const char *backtrace = strchrnul(oops, '\n');
+        if (*backtrace)
+            ++backtrace;
+
+        struct oops_bucket *bucket = NULL;
+        if ((flags & ABRT_OOPS_THROTTLE_CREATION))
+        {
+            bucket = oops_bucket_get(backtrace, t);
+            if (bucket->tokens == 0)
+            {
+                bucket->pending++;
+                throttled++;
+                continue;
+            }
+            bucket->tokens--;
+        }
+
+        /* The only place the oops is parsed, the consumers load the results */
+        struct abrt_koops_info *info = koops_info_parse(oops);
+
+        /* Known oopses only bump the counter of the existing problem,
+         * don't waste time and space on a directory post-create would
+         * delete as a duplicate */
+        const char *hash_str = koops_info_index_hash(info);
+        if (bucket)
+        {
+            bucket->hashed = hash_str != NULL;
+            strcpy(bucket->hash_str, hash_str ? hash_str : "");
+        }
+
+        const unsigned long occurrences = 1 + (bucket ? bucket->pending : 0);
+        if (hash_str && koops_index_record_occurrence(index, hash_str, t, occurrences) == 0)
+        {
+            if (bucket)
+                bucket->pending = 0;
+            koops_info_free(info);
+            continue;
+        }
+
         char base[sizeof("oops-YYYY-MM-DD-hh:mm:ss-%lu-%lu") + 2 * sizeof(long)*3];
         sprintf(base, "oops-%s-%lu-%lu", iso_date, (long)my_pid, (long)idx);
         char *path = concat_path_file(dump_location, base);
@@ -106,7 +332,7 @@ unsigned abrt_oops_create_dump_dirs(GList *oops_list, const char *dump_location,
         if (dd)
         {
             dd_create_basic_files(dd, /*no uid*/(uid_t)-1L, NULL);
-            abrt_oops_save_data_in_dump_dir(dd, (char*)g_list_nth_data(oops_list, idx++), proc_modules);
+            abrt_oops_save_data_in_dump_dir(dd, oops, proc_modules, info);
             dd_save_text(dd, FILENAME_ABRT_VERSION, VERSION);
             dd_save_text(dd, FILENAME_ANALYZER, "abrt-oops");
             dd_save_text(dd, FILENAME_TYPE, "Kerneloops");
@@ -122,20 +348,35 @@ unsigned abrt_oops_create_dump_dirs(GList *oops_list, const char *dump_location,
                 dd_set_no_owner(dd);
             dd_close(dd);
             notify_new_path(path);
+
+            if (hash_str)
+                koops_index_add(index, hash_str, path);
         }
         else
             errors++;
 
+        koops_info_free(info);
         free(path);
 
-        if (--countdown == 0)
+        if (!(flags & ABRT_OOPS_THROTTLE_CREATION) && --countdown == 0)
+        {
+            if (iter->next)
+                log_notice("Not saving the remaining %u oopses", oops_cnt - idx - 1);
             break;
-
-        if (dd && (flags & ABRT_OOPS_THROTTLE_CREATION))
-            if (abrt_oops_signaled_sleep(1) > 0)
-                break;
+        }
     }
 
+    if (throttled)
+        log_notice("Throttled %u repeating oopses", throttled);
+
+    oops_buckets_flush(index, t, /*all*/false);
+
+    koops_index_save(index);
+    koops_index_free(index);
+
+    if (s_oops_buckets)
+        oops_buckets_save();
+
     free(cmdline_str);
     free(proc_modules);
     free(fips_enabled);
@@ -184,8 +425,12 @@ static char *abrt_oops_list_of_tainted_modules(const char *proc_modules)
     return strbuf_free_nobuf(result);
 }
 
-void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char *proc_modules)
+void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char *proc_modules, const struct abrt_koops_info *info)
 {
+    struct abrt_koops_info *parsed = NULL;
+    if (info == NULL)
+        info = parsed = koops_info_parse(oops);
+
     char *first_line = oops;
     char *second_line = (char*)strchr(first_line, '\n'); /* never NULL */
     *second_line++ = '\0';
@@ -193,6 +438,7 @@ void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char
     if (first_line[0])
         dd_save_text(dd, FILENAME_KERNEL, first_line);
     dd_save_text(dd, FILENAME_BACKTRACE, second_line);
+    dd_save_koops_info(dd, info);
 
     /* check if trace doesn't have line: 'Your BIOS is broken' */
     if (strstr(second_line, "Your BIOS is broken"))
@@ -204,72 +450,37 @@ void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char
         dd_save_text(dd, FILENAME_NOT_REPORTABLE,
                 _("A kernel problem occurred, but your hardware is unsupported, "
                   "therefore kernel maintainers are unable to fix this problem."));
-    else
+    else if (info->tainted)
     {
-        char *tainted_short = kernel_tainted_short(second_line);
-        if (tainted_short)
-        {
-            log_notice("Kernel is tainted '%s'", tainted_short);
-            dd_save_text(dd, FILENAME_TAINTED_SHORT, tainted_short);
+        log_notice("Kernel is tainted '%s'", info->tainted);
+        dd_save_text(dd, FILENAME_TAINTED_SHORT, info->tainted);
 
-            char *tnt_long = kernel_tainted_long(tainted_short);
-            dd_save_text(dd, FILENAME_TAINTED_LONG, tnt_long);
-            free(tnt_long);
+        char *tnt_long = kernel_tainted_long(info->tainted);
+        dd_save_text(dd, FILENAME_TAINTED_LONG, tnt_long);
+        free(tnt_long);
 
-            struct strbuf *reason = strbuf_new();
-            const char *fmt = _("A kernel problem occurred, but your kernel has been "
-                    "tainted (flags:%s). Kernel maintainers are unable to "
-                    "diagnose tainted reports.");
-            strbuf_append_strf(reason, fmt, tainted_short);
+        struct strbuf *reason = strbuf_new();
+        const char *fmt = _("A kernel problem occurred, but your kernel has been "
+                "tainted (flags:%s). Kernel maintainers are unable to "
+                "diagnose tainted reports.");
+        strbuf_append_strf(reason, fmt, info->tainted);
 
-            char *modlist = !proc_modules ? NULL : abrt_oops_list_of_tainted_modules(proc_modules);
-            if (modlist)
-            {
-                strbuf_append_strf(reason, _(" Tainted modules: %s."), modlist);
-                free(modlist);
-            }
-
-            dd_save_text(dd, FILENAME_NOT_REPORTABLE, reason->buf);
-            strbuf_free(reason);
-            free(tainted_short);
+        char *modlist = !proc_modules ? NULL : abrt_oops_list_of_tainted_modules(proc_modules);
+        if (modlist)
+        {
+            strbuf_append_strf(reason, _(" Tainted modules: %s."), modlist);
+            free(modlist);
         }
+
+        dd_save_text(dd, FILENAME_NOT_REPORTABLE, reason->buf);
+        strbuf_free(reason);
     }
 
     // TODO: add "Kernel oops: " prefix, so that all oopses have recognizable FILENAME_REASON?
     // kernel oops 1st line may look quite puzzling otherwise...
-    char *reason_pretty = NULL;
-    char *error = NULL;
-    struct sr_stacktrace *trace = sr_stacktrace_parse(SR_REPORT_KERNELOOPS, second_line, &error);
-    if (trace)
-    {
-        reason_pretty = sr_stacktrace_get_reason(trace);
-        sr_stacktrace_free(trace);
-    }
-    else
-        free(error);
+    dd_save_text(dd, FILENAME_REASON, info->reason ? info->reason : second_line);
 
-    if (reason_pretty)
-    {
-        dd_save_text(dd, FILENAME_REASON, reason_pretty);
-        free(reason_pretty);
-    }
-    else
-        dd_save_text(dd, FILENAME_REASON, second_line);
-}
-
-int abrt_oops_signaled_sleep(int seconds)
-{
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGTERM);
-    sigaddset(&set, SIGINT);
-    sigaddset(&set, SIGHUP);
-
-    struct timespec timeout;
-    timeout.tv_sec = seconds;
-    timeout.tv_nsec = 0;
-
-    return g_abrt_oops_sleep_woke_up_on_signal = sigtimedwait(&set, NULL, &timeout);
+    koops_info_free(parsed);
 }
 
 char *abrt_oops_string_filter_regex(void)
@@ -288,3 +499,138 @@ char *abrt_oops_string_filter_regex(void)
 
     return NULL;
 }
+
+GList *abrt_oops_suspicious_strings_filtered(void)
+{
+    GList *koops_strings = koops_suspicious_strings_list();
+
+    char *oops_string_filter_regex = abrt_oops_string_filter_regex();
+    if (oops_string_filter_regex)
+    {
+        regex_t filter_re;
+        if (regcomp(&filter_re, oops_string_filter_regex, REG_NOSUB) != 0)
+            perror_msg_and_die(_("Failed to compile regex"));
+
+        GList *iter = koops_strings;
+        while(iter != NULL)
+        {
+            GList *next = g_list_next(iter);
+
+            const int reti = regexec(&filter_re, (const char *)iter->data, 0, NULL, 0);
+            if (reti == 0)
+                koops_strings = g_list_delete_link(koops_strings, iter);
+            else if (reti != REG_NOMATCH)
+            {
+                char msgbuf[100];
+                regerror(reti, &filter_re, msgbuf, sizeof(msgbuf));
+                error_msg_and_die("Regex match failed: %s", msgbuf);
+            }
+
+            iter = next;
+        }
+
+        regfree(&filter_re);
+        free(oops_string_filter_regex);
+    }
+
+    return koops_strings;
+}
+
+void abrt_oops_stream_init(struct abrt_oops_stream *stream, const char *dump_location, const char *analyzer, int flags)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->dump_location = dump_location;
+    stream->analyzer = analyzer;
+    stream->flags = flags;
+    stream->extractor = koops_extractor_new();
+    stream->strings = abrt_oops_suspicious_strings_filtered();
+}
+
+void abrt_oops_stream_destroy(struct abrt_oops_stream *stream)
+{
+    koops_extractor_free(stream->extractor);
+    g_list_free(stream->strings);
+    stream->extractor = NULL;
+    stream->strings = NULL;
+}
+
+static bool abrt_oops_stream_is_suspicious(const struct abrt_oops_stream *stream, const char *oops)
+{
+    for (GList *s = stream->strings; s != NULL; s = g_list_next(s))
+        if (strstr(oops, s->data) != NULL)
+            return true;
+
+    return false;
+}
+
+static void abrt_oops_stream_process(struct abrt_oops_stream *stream, GList *oopses)
+{
+    /* Drop oopses made of the filtered out strings only (e.g. not fatal MCEs) */
+    for (GList *iter = oopses; iter != NULL; )
+    {
+        GList *next = g_list_next(iter);
+        if (!abrt_oops_stream_is_suspicious(stream, iter->data))
+        {
+            log_debug("Ignoring oops without suspicious strings");
+            free(iter->data);
+            oopses = g_list_delete_link(oopses, iter);
+        }
+        iter = next;
+    }
+
+    if (oopses != NULL)
+        abrt_oops_process_list(oopses, stream->dump_location, stream->analyzer, stream->flags);
+
+    list_free_with_free(oopses);
+}
+
+void abrt_oops_stream_feed(struct abrt_oops_stream *stream, const char *message, size_t len)
+{
+    GList *oopses = NULL;
+    koops_extractor_feed_message(stream->extractor, message, len, &oopses);
+    stream->fed = true;
+
+    /* The end of an oops has been seen, no reason to wait */
+    if (oopses != NULL)
+        abrt_oops_stream_process(stream, oopses);
+}
+
+void abrt_oops_stream_feed_log(struct abrt_oops_stream *stream, const char *buffer, size_t len)
+{
+    GList *oopses = NULL;
+    koops_extractor_feed(stream->extractor, buffer, len, &oopses);
+    stream->fed = true;
+
+    if (oopses != NULL)
+        abrt_oops_stream_process(stream, oopses);
+}
+
+void abrt_oops_stream_flush(struct abrt_oops_stream *stream)
+{
+    if (!koops_extractor_has_pending(stream->extractor))
+        return;
+
+    GList *oopses = NULL;
+    koops_extractor_flush(stream->extractor, &oopses);
+    abrt_oops_stream_process(stream, oopses);
+}
+
+int abrt_oops_stream_idle(struct abrt_oops_stream *stream)
+{
+    if (!koops_extractor_has_pending(stream->extractor))
+    {
+        stream->fed = false;
+        return -1;
+    }
+
+    /* Kernel messages of an oops come in a burst, give the logger a moment
+     * to store the rest of it */
+    if (stream->fed)
+    {
+        stream->fed = false;
+        return ABRT_OOPS_STREAM_IDLE_MSEC;
+    }
+
+    abrt_oops_stream_flush(stream);
+    return -1;
+}
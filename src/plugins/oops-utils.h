@@ -17,12 +17,26 @@
 
 #include "libabrt.h"
 
-/* How many problem dirs to create at most?
- * Also causes cooldown sleep with -t if exceeded -
- * useful when called from a log watcher.
+/* How many problem dirs to create at most without -t?
+ * With -t, the token buckets below limit the repeats instead.
  */
 #define ABRT_OOPS_MAX_DUMPED_COUNT  5
 
+/* How many repeats of an oops to process at once with -t?
+ * Further repeats are only counted until the bucket of the oops
+ * gets a new token - useful when called from a log watcher.
+ */
+#define ABRT_OOPS_BUCKET_SIZE  5
+#define ABRT_OOPS_BUCKET_REFILL_SEC  60
+/* Forget idle oops signatures above this count */
+#define ABRT_OOPS_MAX_BUCKETS  1024
+
+/* Maps duplicate hashes to problem directories of known oopses */
+#define ABRT_OOPS_INDEX_FILE VAR_STATE"/abrt-oops-index"
+/* Token buckets of the oops signatures, a log watcher runs a new dumper
+ * for every batch of oopses */
+#define ABRT_OOPS_BUCKETS_FILE VAR_STATE"/abrt-oops-buckets"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,13 +47,51 @@ enum {
     ABRT_OOPS_PRINT_STDOUT      = 1 << 2,
 };
 
-int g_abrt_oops_sleep_woke_up_on_signal;
-
 int abrt_oops_process_list(GList *oops_list, const char *dump_location, const char *analyzer, int flags);
 unsigned abrt_oops_create_dump_dirs(GList *oops_list, const char *dump_location, const char *analyzer, int flags);
-void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char *proc_modules);
-int abrt_oops_signaled_sleep(int seconds);
+/* Adds all throttled repeats to the counts of their problems, call it before exit */
+void abrt_oops_flush_throttled(const char *dump_location);
+/* Parses the oops if info is NULL */
+void abrt_oops_save_data_in_dump_dir(struct dump_dir *dd, char *oops, const char *proc_modules, const struct abrt_koops_info *info);
 char *abrt_oops_string_filter_regex(void);
+/* The suspicious strings without those filtered out by abrt_oops_string_filter_regex() */
+GList *abrt_oops_suspicious_strings_filtered(void);
+
+/*
+ * Kernel oopses extracted from a stream of kernel messages
+ *
+ * An oops is processed as soon as its end is seen. An oops without an end
+ * marker is processed after ABRT_OOPS_STREAM_IDLE_MSEC without new messages.
+ * Only the oopses containing one of the filtered suspicious strings are
+ * processed.
+ */
+#define ABRT_OOPS_STREAM_IDLE_MSEC 250
+
+struct abrt_oops_stream
+{
+    const char *dump_location;
+    const char *analyzer;
+    int flags;
+    struct abrt_koops_extractor *extractor;
+    GList *strings;     ///< the oopses must contain one of them
+    bool fed;           ///< new messages since the last idle call
+};
+
+void abrt_oops_stream_init(struct abrt_oops_stream *stream, const char *dump_location, const char *analyzer, int flags);
+void abrt_oops_stream_destroy(struct abrt_oops_stream *stream);
+/* Feeds a single kernel message, e.g. the MESSAGE field of a journal entry */
+void abrt_oops_stream_feed(struct abrt_oops_stream *stream, const char *message, size_t len);
+/* Feeds a chunk of a syslog or dmesg file, lines may be split between chunks */
+void abrt_oops_stream_feed_log(struct abrt_oops_stream *stream, const char *buffer, size_t len);
+/*
+ * Call it when no more messages are available. Returns the number of
+ * milliseconds after which it wants to be called again if an oops may still
+ * be in progress or a negative number when all fed messages have been
+ * processed.
+ */
+int abrt_oops_stream_idle(struct abrt_oops_stream *stream);
+/* Processes the oops in progress, if any, call it before exit */
+void abrt_oops_stream_flush(struct abrt_oops_stream *stream);
 
 #ifdef __cplusplus
 }
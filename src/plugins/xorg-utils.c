@@ -12,6 +12,8 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
  */
+#include <sys/mman.h>
+
 #include "libabrt.h"
 #include "xorg-utils.h"
 
@@ -182,7 +184,10 @@ struct xorg_crash_info *process_xorg_bt(char *(*get_next_line)(void *), void *da
          * [ 60244.273] (EE) Segmentation fault at address 0x7f61d93f6160
          */
         if (*p == '\0')
+        {
+            free(line);
             continue;
+        }
 
         /* xorg-server-1.12.0/os/osinit.c:
          * if (sip->si_code == SI_USER) {
@@ -253,3 +258,371 @@ struct xorg_crash_info *process_xorg_bt(char *(*get_next_line)(void *), void *da
     return NULL;
 
 }
+
+/* Backward scanning of Xorg log files.
+ *
+ * Xorg.0.log of a long-running session can grow to hundreds of megabytes,
+ * but the server crash, if any, is at its end. The log is mapped to memory,
+ * searched backwards line by line for the last "Backtrace:" line and only
+ * the lines of that block are parsed, without copying the log lines.
+ * The mapped lines are not NUL-terminated, all searches are bounded.
+ */
+
+/* skip_pfx() for a line which ends at end */
+static const char *skip_pfx_n(const char *str, const char *end)
+{
+    if (str < end && str[0] == '[')
+    {
+        const char *q = memchr(str, ']', end - str);
+        if (q)
+            str = q + 1;
+    }
+
+    if (str < end && str[0] == ' ')
+        ++str;
+
+    /* if there is (EE), ignore it */
+    if (end - str >= 4 && strncmp(str, "(EE)", 4) == 0)
+        /* if ' ' follows (EE), ignore it too */
+        return str + 4 + (end - str > 4 && str[4] == ' ');
+
+    return str;
+}
+
+static bool line_is_bt_start(const char *line, const char *end)
+{
+    const size_t len = strlen(XORG_SEARCH_STRING);
+
+    /* Cheap test first, most lines end differently */
+    if (end - line < (ptrdiff_t)len || memcmp(end - len, XORG_SEARCH_STRING, len) != 0)
+        return false;
+
+    return skip_pfx_n(line, end) == end - len;
+}
+
+/* The same as process_xorg_bt(), reads the lines following "Backtrace:" */
+static struct xorg_crash_info *process_xorg_bt_block(const char *line, const char *end)
+{
+    char *reason = NULL;
+    char *exe = NULL;
+    struct strbuf *bt = NULL;
+    unsigned cnt = 0;
+    for (const char *eol; line < end; line = eol + (eol < end))
+    {
+        eol = memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+
+        const char *p = skip_pfx_n(line, eol);
+
+        /* ignore empty lines */
+        if (p == eol)
+            continue;
+
+        if (*p < '0' || *p > '9')
+        {
+            if (memmem(p, eol - p, " at address ", strlen(" at address "))
+             || memmem(p, eol - p, " sent by process ", strlen(" sent by process ")))
+                reason = xstrndup(p, eol - p);
+            /* Here you can place other cases of useful reason string */
+            break;
+        }
+
+        const char *num_end = p;
+        while (num_end < eol && *num_end >= '0' && *num_end <= '9')
+            ++num_end;
+        if (num_end == eol || *num_end != ':')
+            break;
+
+        /* This looks like bt line */
+
+        /* Guess Xorg server's executable name from it */
+        if (!exe)
+        {
+            const char *filename = num_end + 1;
+            while (filename < eol && isspace(*filename))
+                ++filename;
+            const char *filename_end = filename;
+            while (filename_end < eol && !isspace(*filename_end))
+                ++filename_end;
+            /* Does it look like "[/usr]/[s]bin/Xfoo" or [/usr]/libexec/Xfoo"? */
+            if (memmem(filename, filename_end - filename, "bin/X", strlen("bin/X"))
+             || memmem(filename, filename_end - filename, "libexec/X", strlen("libexec/X")))
+                exe = xstrndup(filename, filename_end - filename);
+        }
+
+        if (bt == NULL)
+            bt = strbuf_new();
+        strbuf_append_strf(bt, "%.*s\n", (int)(eol - p), p);
+        if (++cnt > 255) /* prevent ridiculously large bts */
+            break;
+    }
+
+    if (bt == NULL)
+    {
+        free(reason);
+        free(exe);
+        return NULL;
+    }
+
+    struct xorg_crash_info *crash_info = xmalloc(sizeof(struct xorg_crash_info));
+    crash_info->backtrace = strbuf_free_nobuf(bt);
+    crash_info->reason = (reason ? reason : xstrdup(DEFAULT_XORG_CRASH_REASON));
+    crash_info->exe = exe;
+    return crash_info;
+}
+
+struct xorg_crash_info *xorg_crash_info_find_last(const char *log, size_t size, size_t start)
+{
+    if (start >= size)
+        return NULL;
+
+    const char *const begin = log + start;
+    const char *const end = log + size;
+
+    /* The trailing newline doesn't start an empty line */
+    const char *line_end = end;
+    if (line_end[-1] == '\n')
+        --line_end;
+
+    while (line_end >= begin)
+    {
+        const char *nl = memrchr(begin, '\n', line_end - begin);
+        const char *line = nl ? nl + 1 : begin;
+
+        if (line_is_bt_start(line, line_end))
+        {
+            struct xorg_crash_info *crash_info = process_xorg_bt_block(line_end + (line_end < end), end);
+            if (crash_info)
+                return crash_info;
+
+            log_warning(_("Failed to parse Backtrace from log file"));
+        }
+
+        if (nl == NULL)
+            break;
+        line_end = nl;
+    }
+
+    return NULL;
+}
+
+struct xorg_crash_info *xorg_crash_info_find_last_in_fd(int fd, off_t start, off_t *size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        perror_msg("fstat");
+        return NULL;
+    }
+
+    if (size)
+        *size = st.st_size;
+
+    if (st.st_size == 0 || start >= st.st_size)
+        return NULL;
+
+    void *log = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (log == MAP_FAILED)
+    {
+        perror_msg("Can't map Xorg log");
+        return NULL;
+    }
+
+    struct xorg_crash_info *crash_info = xorg_crash_info_find_last(log, st.st_size, start);
+
+    munmap(log, st.st_size);
+    return crash_info;
+}
+
+void abrt_xorg_process_list_of_crashes(GList *crashes, const char *dump_location, int flags)
+{
+    if (crashes == NULL)
+        return;
+
+    GList *list;
+    for (list = crashes; list != NULL; list = list->next)
+    {
+        xorg_crash_info_create_dump_dir(list->data, dump_location, (flags & ABRT_XORG_WORLD_READABLE));
+
+        if (flags & ABRT_XORG_PRINT_STDOUT)
+            xorg_crash_info_print_crash(list->data);
+
+        if (flags & ABRT_XORG_THROTTLE_CREATION)
+            if (abrt_xorg_signaled_sleep(1) > 0)
+                break;
+    }
+}
+
+void abrt_xorg_stream_init(struct abrt_xorg_stream *stream, const char *dump_location, int flags)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->dump_location = dump_location;
+    stream->flags = flags;
+    stream->partial = strbuf_new();
+}
+
+void abrt_xorg_stream_destroy(struct abrt_xorg_stream *stream)
+{
+    list_free_with_free(stream->lines);
+    g_list_free_full(stream->pending, (GDestroyNotify)xorg_crash_info_free);
+    strbuf_free(stream->partial);
+    stream->lines = NULL;
+    stream->line_count = 0;
+    stream->pending = NULL;
+    stream->partial = NULL;
+}
+
+void abrt_xorg_stream_feed_line(struct abrt_xorg_stream *stream, char *line)
+{
+    stream->fed = true;
+
+    /* Collect the lines of crashes only */
+    if ((stream->lines == NULL && strcmp(skip_pfx(line), XORG_SEARCH_STRING) != 0)
+        || stream->line_count >= ABRT_XORG_STREAM_MAX_LINES)
+    {
+        free(line);
+        return;
+    }
+
+    stream->lines = g_list_prepend(stream->lines, line);
+    ++stream->line_count;
+}
+
+void abrt_xorg_stream_feed(struct abrt_xorg_stream *stream, const char *buffer, size_t len)
+{
+    const char *const end = buffer + len;
+    while (buffer < end)
+    {
+        const char *eol = memchr(buffer, '\n', end - buffer);
+        if (eol == NULL)
+        {
+            /* The rest of the line comes with the next chunk */
+            strbuf_append_strf(stream->partial, "%.*s", (int)(end - buffer), buffer);
+            stream->fed = true;
+            return;
+        }
+
+        char *line;
+        if (stream->partial->len != 0)
+        {
+            strbuf_append_strf(stream->partial, "%.*s", (int)(eol - buffer), buffer);
+            line = xstrdup(stream->partial->buf);
+            strbuf_clear(stream->partial);
+        }
+        else
+            line = xstrndup(buffer, eol - buffer);
+
+        abrt_xorg_stream_feed_line(stream, line);
+        buffer = eol + 1;
+    }
+}
+
+static char *abrt_xorg_stream_next_line(void *data)
+{
+    GList **lines = (GList **)data;
+    if (*lines == NULL)
+        return NULL;
+
+    char *line = (*lines)->data;
+    *lines = g_list_delete_link(*lines, *lines);
+    return line;
+}
+
+/* Parses the collected lines, the crashes wait for saving in stream->pending */
+static void abrt_xorg_stream_parse(struct abrt_xorg_stream *stream)
+{
+    if (stream->partial->len != 0)
+    {
+        char *line = xstrdup(stream->partial->buf);
+        strbuf_clear(stream->partial);
+        abrt_xorg_stream_feed_line(stream, line);
+    }
+
+    if (stream->lines == NULL)
+        return;
+
+    GList *lines = g_list_reverse(stream->lines);
+    stream->lines = NULL;
+    stream->line_count = 0;
+
+    unsigned found = 0;
+    while (lines != NULL)
+    {
+        char *line = abrt_xorg_stream_next_line(&lines);
+        const bool crash = strcmp(skip_pfx(line), XORG_SEARCH_STRING) == 0;
+        free(line);
+        if (!crash)
+            continue;
+
+        struct xorg_crash_info *crash_info = process_xorg_bt(abrt_xorg_stream_next_line, &lines);
+        if (crash_info)
+        {
+            stream->pending = g_list_append(stream->pending, crash_info);
+            ++found;
+        }
+        else
+            log_warning(_("Failed to parse Backtrace"));
+    }
+
+    log("Found crashes: %d", found);
+}
+
+/* Saves the pending crashes. With ABRT_XORG_THROTTLE_CREATION, at most one
+ * per ABRT_XORG_STREAM_THROTTLE_MSEC unless all is true; the stream is fed
+ * from a shared loop which must not sleep.
+ *
+ * Returns the number of milliseconds until the next crash may be saved or
+ * a negative number if nothing is pending.
+ */
+static int abrt_xorg_stream_save_pending(struct abrt_xorg_stream *stream, bool all)
+{
+    while (stream->pending != NULL)
+    {
+        if ((stream->flags & ABRT_XORG_THROTTLE_CREATION) && !all)
+        {
+            const gint64 now = g_get_monotonic_time();
+            if (now < stream->next_save_usec)
+                return (stream->next_save_usec - now + 999) / 1000;
+
+            stream->next_save_usec = now + ABRT_XORG_STREAM_THROTTLE_MSEC * 1000;
+        }
+
+        struct xorg_crash_info *crash_info = stream->pending->data;
+        stream->pending = g_list_delete_link(stream->pending, stream->pending);
+
+        xorg_crash_info_create_dump_dir(crash_info, stream->dump_location, (stream->flags & ABRT_XORG_WORLD_READABLE));
+        if (stream->flags & ABRT_XORG_PRINT_STDOUT)
+            xorg_crash_info_print_crash(crash_info);
+
+        xorg_crash_info_free(crash_info);
+    }
+
+    return -1;
+}
+
+void abrt_xorg_stream_flush(struct abrt_xorg_stream *stream)
+{
+    abrt_xorg_stream_parse(stream);
+    abrt_xorg_stream_save_pending(stream, /*all*/true);
+}
+
+int abrt_xorg_stream_idle(struct abrt_xorg_stream *stream)
+{
+    if (stream->lines == NULL && stream->partial->len == 0)
+    {
+        stream->fed = false;
+        return abrt_xorg_stream_save_pending(stream, /*all*/false);
+    }
+
+    /* Xorg prints the backtrace line by line, give the writer a moment
+     * to finish it */
+    if (stream->fed)
+    {
+        stream->fed = false;
+        return ABRT_XORG_STREAM_IDLE_MSEC;
+    }
+
+    abrt_xorg_stream_parse(stream);
+    return abrt_xorg_stream_save_pending(stream, /*all*/false);
+}
@@ -93,6 +93,29 @@ char *xorg_get_next_line_from_fd(void *fd);
  */
 struct xorg_crash_info *process_xorg_bt(char *(*get_next_line)(void *), void *data);
 
+/*
+ * Finds the last Xorg crash in log
+ * The log is searched backwards from its end for "Backtrace:" and only
+ * the lines of the found crash are parsed. Lines don't need to be
+ * NUL-terminated.
+ *
+ * @param log Xorg log
+ * @param size size of the log
+ * @param start offset in the log where the searched part starts
+ * @returns extracted xorg crash data or NULL if there is no crash
+ */
+struct xorg_crash_info *xorg_crash_info_find_last(const char *log, size_t size, size_t start);
+
+/*
+ * Maps Xorg log file to memory and finds the last crash in it
+ *
+ * @param fd Xorg log file opened for reading
+ * @param start offset in the file where the searched part starts
+ * @param size if not NULL, the size of the searched file is stored here
+ * @returns extracted xorg crash data or NULL if there is no crash
+ */
+struct xorg_crash_info *xorg_crash_info_find_last_in_fd(int fd, off_t start, off_t *size);
+
 /*
  * Saves Xorg crash details in the dump directory
  *
@@ -112,6 +135,53 @@ int xorg_crash_info_save_in_dump_dir(struct xorg_crash_info *crash_info, struct
 void xorg_crash_info_create_dump_dir(struct xorg_crash_info *crash_info, const char *dump_location,
                                      bool world_readable);
 
+/*
+ * Creates dump dirs from the list of xorg crash infos according to flags
+ * (ABRT_XORG_*)
+ */
+void abrt_xorg_process_list_of_crashes(GList *crashes, const char *dump_location, int flags);
+
+/*
+ * Xorg crashes extracted from a stream of log lines
+ *
+ * The lines starting with "Backtrace:" are collected and parsed after
+ * ABRT_XORG_STREAM_IDLE_MSEC without new lines.
+ */
+#define ABRT_XORG_STREAM_IDLE_MSEC 1000
+/* The rate of ABRT_XORG_THROTTLE_CREATION */
+#define ABRT_XORG_STREAM_THROTTLE_MSEC 1000
+/* Xorg prints a few tens of lines after Backtrace: */
+#define ABRT_XORG_STREAM_MAX_LINES 1024
+
+struct abrt_xorg_stream
+{
+    const char *dump_location;
+    int flags;
+    GList *lines;               ///< lines since the last Backtrace: line, the last one first
+    unsigned line_count;
+    struct strbuf *partial;     ///< the unterminated last line of fed text
+    bool fed;                   ///< new lines since the last idle call
+    GList *pending;             ///< parsed crashes waiting for the rate limit
+    gint64 next_save_usec;      ///< monotonic time the next crash may be saved at
+};
+
+void abrt_xorg_stream_init(struct abrt_xorg_stream *stream, const char *dump_location, int flags);
+void abrt_xorg_stream_destroy(struct abrt_xorg_stream *stream);
+/* Feeds a single malloced line without the trailing \n, takes its ownership */
+void abrt_xorg_stream_feed_line(struct abrt_xorg_stream *stream, char *line);
+/* Feeds a chunk of a log file, lines may be split between chunks */
+void abrt_xorg_stream_feed(struct abrt_xorg_stream *stream, const char *buffer, size_t len);
+/*
+ * Call it when no more lines are available. Returns the number of
+ * milliseconds after which it wants to be called again if a crash may still
+ * be in progress or is waiting for ABRT_XORG_THROTTLE_CREATION, or a negative
+ * number when all fed lines have been processed. Never sleeps.
+ */
+int abrt_xorg_stream_idle(struct abrt_xorg_stream *stream);
+/* Processes the collected lines and saves all pending crashes, call it
+ * before exit */
+void abrt_xorg_stream_flush(struct abrt_xorg_stream *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,312 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <time.h>
+#include "libabrt.h"
+
+/* Benchmark of the compression of problem items.
+ *
+ * A spool of problems is filled with the compressible items (maps, environ,
+ * var_log_messages) of the sample problem directories given on the command
+ * line. The spool is measured with plain items, with the items compressed
+ * the way abrt-server compresses them after post-create and with the items
+ * compressed with the dictionary.
+ *
+ * For every spool the disk usage of the items and the latency of loading
+ * a problem the way abrt-dbus does in GetInfo (the items one by one) and in
+ * GetProblemData (the whole problem) are reported. The latency is the best
+ * of several runs over the whole spool, the page cache is warm.
+ */
+
+/* The items compressed by dd_compress_items() */
+static const char *const s_items[] = {
+    FILENAME_MAPS,
+    FILENAME_ENVIRON,
+    "var_log_messages",
+    NULL
+};
+
+enum spool_mode
+{
+    SPOOL_PLAIN,
+    SPOOL_COMPRESSED,
+    SPOOL_DICTIONARY,
+    SPOOL_COUNT,
+};
+
+static const char *const s_mode_names[SPOOL_COUNT] = {
+    "plain",
+    "zstd",
+    "zstd+dict",
+};
+
+struct bench_result
+{
+    unsigned long item_bytes;
+    unsigned long disk_bytes;
+    unsigned compressed;
+    double compress_usec;
+    double get_info_usec;
+    double get_problem_data_usec;
+};
+
+/* Items of one sample problem directory, NULL if missing */
+struct sample
+{
+    char *items[ARRAY_SIZE(s_items)];
+};
+
+static double elapsed_usec(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static GList *load_samples(char **dirs)
+{
+    GList *samples = NULL;
+    for (; *dirs; ++dirs)
+    {
+        struct sample *sample = xzalloc(sizeof(*sample));
+        bool found = false;
+        for (unsigned i = 0; s_items[i]; ++i)
+        {
+            char *path = concat_path_file(*dirs, s_items[i]);
+            sample->items[i] = xmalloc_open_read_close(path, NULL);
+            found |= sample->items[i] != NULL;
+            free(path);
+        }
+
+        if (found)
+            samples = g_list_prepend(samples, sample);
+        else
+        {
+            log_notice("No items in '%s'", *dirs);
+            free(sample);
+        }
+    }
+
+    if (samples == NULL)
+        error_msg_and_die("No sample items found");
+
+    return g_list_reverse(samples);
+}
+
+static void free_sample(struct sample *sample)
+{
+    for (unsigned i = 0; s_items[i]; ++i)
+        free(sample->items[i]);
+    free(sample);
+}
+
+static char *problem_path(const char *spool, unsigned i)
+{
+    return xasprintf("%s/ccpp-bench-%06u", spool, i);
+}
+
+static void create_spool(const char *spool, GList *samples, unsigned problems,
+                enum spool_mode mode, unsigned long threshold, struct bench_result *result)
+{
+    GList *l = samples;
+    for (unsigned i = 0; i < problems; ++i, l = l->next ? l->next : samples)
+    {
+        const struct sample *sample = l->data;
+
+        char *path = problem_path(spool, i);
+        struct dump_dir *dd = dd_create(path, (uid_t)-1, 0640);
+        if (dd == NULL)
+            xfunc_die();
+        free(path);
+
+        dd_create_basic_files(dd, (uid_t)-1, NULL);
+        for (unsigned j = 0; s_items[j]; ++j)
+            if (sample->items[j] != NULL)
+                dd_save_text(dd, s_items[j], sample->items[j]);
+
+        if (mode != SPOOL_PLAIN)
+        {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            result->compressed += dd_compress_items(dd, threshold);
+            result->compress_usec += elapsed_usec(&start);
+        }
+
+        dd_close(dd);
+    }
+}
+
+static void measure_disk_usage(const char *spool, unsigned problems, struct bench_result *result)
+{
+    for (unsigned i = 0; i < problems; ++i)
+    {
+        char *dir = problem_path(spool, i);
+        for (unsigned j = 0; s_items[j]; ++j)
+        {
+            struct stat st;
+            char *path = concat_path_file(dir, s_items[j]);
+            char *packed_path = xasprintf("%s"ABRT_COMPRESSED_ITEM_SUFFIX, path);
+            if (stat(path, &st) == 0 || stat(packed_path, &st) == 0)
+            {
+                result->item_bytes += st.st_size;
+                result->disk_bytes += st.st_blocks * 512;
+            }
+            free(packed_path);
+            free(path);
+        }
+        free(dir);
+    }
+}
+
+/* The way abrt-dbus loads a problem in GetInfo */
+static double get_info(const char *spool, unsigned problems)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned i = 0; i < problems; ++i)
+    {
+        char *path = problem_path(spool, i);
+        struct dump_dir *dd = dd_opendir(path, DD_OPEN_READONLY);
+        if (dd == NULL)
+            xfunc_die();
+        free(path);
+
+        for (unsigned j = 0; s_items[j]; ++j)
+            free(dd_load_text_decompress(dd, s_items[j], DD_LOAD_TEXT_RETURN_NULL_ON_FAILURE
+                                                         | DD_FAIL_QUIETLY_ENOENT));
+        dd_close(dd);
+    }
+
+    return elapsed_usec(&start) / problems;
+}
+
+/* The way abrt-dbus loads a problem in GetProblemData */
+static double get_problem_data(const char *spool, unsigned problems)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned i = 0; i < problems; ++i)
+    {
+        char *path = problem_path(spool, i);
+        struct dump_dir *dd = dd_opendir(path, DD_OPEN_READONLY);
+        if (dd == NULL)
+            xfunc_die();
+        free(path);
+
+        problem_data_t *pd = create_problem_data_from_dump_dir(dd);
+        problem_data_decompress_items(pd, dd);
+        problem_data_free(pd);
+        dd_close(dd);
+    }
+
+    return elapsed_usec(&start) / problems;
+}
+
+static void run_bench(GList *samples, unsigned problems, unsigned runs,
+                enum spool_mode mode, unsigned long threshold, struct bench_result *result)
+{
+    char spool[] = "/tmp/items-bench-XXXXXX";
+    if (mkdtemp(spool) == NULL)
+        perror_msg_and_die("Can't create a temporary directory");
+
+    memset(result, 0, sizeof(*result));
+    create_spool(spool, samples, problems, mode, threshold, result);
+    measure_disk_usage(spool, problems, result);
+
+    for (unsigned run = 0; run < runs; ++run)
+    {
+        const double get_info_usec = get_info(spool, problems);
+        const double get_problem_data_usec = get_problem_data(spool, problems);
+        if (run == 0 || get_info_usec < result->get_info_usec)
+            result->get_info_usec = get_info_usec;
+        if (run == 0 || get_problem_data_usec < result->get_problem_data_usec)
+            result->get_problem_data_usec = get_problem_data_usec;
+    }
+
+    for (unsigned i = 0; i < problems; ++i)
+    {
+        char *path = problem_path(spool, i);
+        delete_dump_dir(path);
+        free(path);
+    }
+    if (rmdir(spool) != 0)
+        perror_msg("Can't remove '%s'", spool);
+}
+
+int main(int argc, char **argv)
+{
+    abrt_init(argv);
+
+    const char *program_usage_string =
+        "& [-v] [-n PROBLEMS] [-r RUNS] [-t KIB] [-D FILE] SAMPLE_DIR...\n"
+        "\n"
+        "Measures the disk usage and the load latency of a spool of PROBLEMS\n"
+        "problems made of the compressible items of the problem directories\n"
+        "SAMPLE_DIR with plain items, with compressed items and with items\n"
+        "compressed with the dictionary FILE."
+    ;
+    enum {
+        OPT_v = 1 << 0,
+        OPT_n = 1 << 1,
+        OPT_r = 1 << 2,
+        OPT_t = 1 << 3,
+        OPT_D = 1 << 4,
+    };
+    int problems = 1000;
+    int runs = 3;
+    int threshold = g_settings_nItemCompressionThreshold;
+    const char *dictionary = NULL;
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_INTEGER('n', NULL, &problems, "Number of problems in the spool (default 1000)"),
+        OPT_INTEGER('r', NULL, &runs, "Take the best of RUNS runs (default 3)"),
+        OPT_INTEGER('t', NULL, &threshold, "Compress items bigger than KIB (ItemCompressionThreshold)"),
+        OPT_STRING('D', NULL, &dictionary, "FILE", "Dictionary (default: the installed one)"),
+        OPT_END()
+    };
+    parse_opts(argc, argv, program_options, program_usage_string);
+
+    argv += optind;
+    if (!argv[0] || problems <= 0 || runs <= 0 || threshold < 0)
+        show_usage_and_die(program_usage_string, program_options);
+
+    GList *samples = load_samples(argv);
+
+    printf("%-10s %10s %10s %10s %12s %12s %16s\n", "spool", "items KiB", "disk KiB",
+            "compressed", "compress us", "GetInfo us", "GetProblemData us");
+
+    for (int mode = 0; mode < SPOOL_COUNT; ++mode)
+    {
+        set_item_compression_dictionary(mode == SPOOL_DICTIONARY ? dictionary : "");
+
+        struct bench_result result;
+        run_bench(samples, problems, runs, mode, threshold * 1024UL, &result);
+
+        printf("%-10s %10lu %10lu %10u %12.1f %12.1f %16.1f\n", s_mode_names[mode],
+                result.item_bytes / 1024, result.disk_bytes / 1024, result.compressed,
+                result.compress_usec / problems, result.get_info_usec,
+                result.get_problem_data_usec);
+    }
+
+    g_list_free_full(samples, (GDestroyNotify)free_sample);
+
+    return 0;
+}
@@ -0,0 +1,377 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <time.h>
+#include <sys/resource.h>
+#include "libabrt.h"
+#include "abrt-journal.h"
+
+/* Benchmark of the journal watch.
+ *
+ * Replays a burst of systemd-coredump entries the way abrt-dump-journal-core
+ * watches them: once with a callback per entry saving the position after
+ * every entry and once with the batched watch committing the position once
+ * per batch. The per entry work is reduced to reading the crashed executable,
+ * so the results show the overhead of the watch and of the state file.
+ *
+ * The second part compares a watch per handler (core, oops, xorg), the way
+ * three daemons watch journal, with the handlers sharing a single iteration.
+ * Every watch is woken up by every journal write, so the number of wake-ups
+ * per write equals the number of watches. The CPU time is measured.
+ *
+ * The journal is generated by the -g mode in the journal export format and
+ * converted by systemd-journal-remote (see 'make benchmark'). Every coredump
+ * entry is followed by a kernel and an Xorg message.
+ */
+
+#define BENCH_STATE_FILE "journal-bench.state"
+#define BENCH_COREDUMP_MESSAGE_ID "fc2e22bc6ee647b6b90729ab34a250b1"
+#define BENCH_HANDLERS 3
+
+static const char *const s_handler_matches[BENCH_HANDLERS] = {
+    "MESSAGE_ID="BENCH_COREDUMP_MESSAGE_ID,
+    "SYSLOG_IDENTIFIER=kernel",
+    "_COMM=Xorg",
+};
+
+/* The state file is replaced by rename(), the library is linked statically,
+ * so this definition counts its commits */
+static unsigned long s_state_writes;
+
+int rename(const char *oldpath, const char *newpath)
+{
+    ++s_state_writes;
+    return renameat(AT_FDCWD, oldpath, AT_FDCWD, newpath);
+}
+
+struct bench_run
+{
+    unsigned expected;
+    unsigned entries;
+    unsigned callbacks;
+};
+
+static double cpu_usec(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static double elapsed_usec(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void generate(unsigned count)
+{
+    const unsigned long long realtime = 1500000000000000ULL;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        printf("__REALTIME_TIMESTAMP=%llu\n"
+               "__MONOTONIC_TIMESTAMP=%u\n"
+               "_BOOT_ID=a3c9fc3fb7a94b2e9bb21f9b1b8c9ed3\n"
+               "_TRANSPORT=journal\n"
+               "PRIORITY=2\n"
+               "SYSLOG_IDENTIFIER=systemd-coredump\n"
+               "MESSAGE_ID="BENCH_COREDUMP_MESSAGE_ID"\n"
+               "MESSAGE=Process %u (bench-%u) of user 1000 dumped core.\n"
+               "COREDUMP_PID=%u\n"
+               "COREDUMP_UID=1000\n"
+               "COREDUMP_GID=1000\n"
+               "COREDUMP_SIGNAL=11\n"
+               "COREDUMP_COMM=bench-%u\n"
+               "COREDUMP_EXE=/usr/bin/bench-%u\n"
+               "COREDUMP_TIMESTAMP=%llu\n"
+               "\n"
+               "__REALTIME_TIMESTAMP=%llu\n"
+               "__MONOTONIC_TIMESTAMP=%u\n"
+               "_BOOT_ID=a3c9fc3fb7a94b2e9bb21f9b1b8c9ed3\n"
+               "_TRANSPORT=kernel\n"
+               "PRIORITY=6\n"
+               "SYSLOG_IDENTIFIER=kernel\n"
+               "MESSAGE=usb 1-1: new high-speed USB device number %u using xhci_hcd\n"
+               "\n"
+               "__REALTIME_TIMESTAMP=%llu\n"
+               "__MONOTONIC_TIMESTAMP=%u\n"
+               "_BOOT_ID=a3c9fc3fb7a94b2e9bb21f9b1b8c9ed3\n"
+               "_TRANSPORT=stdout\n"
+               "PRIORITY=6\n"
+               "_COMM=Xorg\n"
+               "MESSAGE=[ %u.000] (II) event%u - bench: is tagged as supporting pointer acceleration\n"
+               "\n",
+               realtime + i * 100ULL, 1000000 + i * 100,
+               1000 + i, i % 64, 1000 + i, i % 64, i % 64, realtime + i * 100ULL,
+               realtime + i * 100ULL + 10, 1000000 + i * 100 + 10, i % 128,
+               realtime + i * 100ULL + 20, 1000000 + i * 100 + 20, i, i % 16);
+    }
+}
+
+static void process_entry(abrt_journal_t *journal, struct bench_run *run)
+{
+    char *executable = abrt_journal_get_string_field(journal, "COREDUMP_EXE", NULL);
+    if (executable != NULL)
+        ++run->entries;
+    free(executable);
+}
+
+/* The way abrt-dump-journal-core watched cores before the batched watch */
+static void per_entry_callback(abrt_journal_watch_t *watch, void *data)
+{
+    struct bench_run *run = data;
+    abrt_journal_t *journal = abrt_journal_watch_get_journal(watch);
+
+    ++run->callbacks;
+    process_entry(journal, run);
+    abrt_journal_save_current_position(journal, BENCH_STATE_FILE);
+
+    if (run->entries >= run->expected)
+        abrt_journal_watch_stop(watch);
+}
+
+static void batch_callback(abrt_journal_watch_t *watch, char **cursors, unsigned count, void *data)
+{
+    struct bench_run *run = data;
+    abrt_journal_t *journal = abrt_journal_watch_get_journal(watch);
+
+    ++run->callbacks;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (abrt_journal_set_cursor(journal, cursors[i]) == 0 && abrt_journal_next(journal) > 0)
+            process_entry(journal, run);
+    }
+
+    if (run->entries >= run->expected)
+        abrt_journal_watch_stop(watch);
+}
+
+static void run_bench(const char *directory, unsigned expected, bool batched, unsigned commit_interval)
+{
+    abrt_journal_t *journal = NULL;
+    if (abrt_journal_open_directory(&journal, directory) < 0)
+        error_msg_and_die("Cannot open journal directory '%s'", directory);
+
+    GList *coredump_filter = g_list_prepend(NULL, (char *)"MESSAGE_ID="BENCH_COREDUMP_MESSAGE_ID);
+    if (abrt_journal_set_journal_filter(journal, coredump_filter) < 0)
+        error_msg_and_die("Cannot filter systemd-journal to systemd-coredump data only");
+    g_list_free(coredump_filter);
+
+    struct bench_run run = { .expected = expected };
+    abrt_journal_watch_t *watch = NULL;
+    if (batched)
+        abrt_journal_watch_new_batched(&watch, journal, batch_callback, &run,
+                BENCH_STATE_FILE, commit_interval);
+    else
+        abrt_journal_watch_new(&watch, journal, per_entry_callback, &run);
+
+    s_state_writes = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    abrt_journal_watch_run_sync(watch);
+    const double usec = elapsed_usec(&start);
+
+    abrt_journal_watch_free(watch);
+    abrt_journal_free(journal);
+    unlink(BENCH_STATE_FILE);
+
+    if (run.entries != expected)
+        error_msg_and_die("Processed %u entries, expected %u", run.entries, expected);
+
+    char mode[32] = "per-entry";
+    if (batched)
+        snprintf(mode, sizeof(mode), "batched/%us", commit_interval);
+
+    printf("%-12s %10u %10u %12lu %12.0f %10.2f\n", mode, run.entries, run.callbacks,
+            s_state_writes, run.entries / (usec / 1e6), usec / run.entries);
+}
+
+/*
+ * Multiplexed handlers
+ */
+
+struct bench_handler
+{
+    unsigned *total;
+    unsigned expected;
+};
+
+static bool read_message(abrt_journal_t *journal)
+{
+    char *message = abrt_journal_get_string_field(journal, "MESSAGE", NULL);
+    free(message);
+    return message != NULL;
+}
+
+static void handler_entry(abrt_journal_t *journal, void *data)
+{
+    struct bench_handler *handler = data;
+    if (read_message(journal))
+        ++*handler->total;
+}
+
+/* The same work in a watch per handler */
+static void separate_callback(abrt_journal_watch_t *watch, void *data)
+{
+    struct bench_run *run = data;
+    if (read_message(abrt_journal_watch_get_journal(watch)))
+        ++run->entries;
+
+    if (run->entries >= run->expected)
+        abrt_journal_watch_stop(watch);
+}
+
+static int handler_idle(abrt_journal_t *journal, void *data)
+{
+    struct bench_handler *handler = data;
+    if (*handler->total >= handler->expected)
+        abrt_journal_stop_handlers(journal);
+    return -1;
+}
+
+static void open_journal(abrt_journal_t **journal, const char *directory)
+{
+    if (abrt_journal_open_directory(journal, directory) < 0)
+        error_msg_and_die("Cannot open journal directory '%s'", directory);
+}
+
+/* A watch per handler, in the real world they run in parallel */
+static double run_separate(const char *directory, unsigned count, unsigned *total)
+{
+    const double start = cpu_usec();
+    for (int i = 0; i < BENCH_HANDLERS; ++i)
+    {
+        abrt_journal_t *journal = NULL;
+        open_journal(&journal, directory);
+
+        GList *filter = g_list_prepend(NULL, (char *)s_handler_matches[i]);
+        if (abrt_journal_set_journal_filter(journal, filter) < 0)
+            error_msg_and_die("Cannot filter systemd-journal");
+        g_list_free(filter);
+
+        struct bench_run run = { .expected = count };
+        abrt_journal_watch_t *watch = NULL;
+        abrt_journal_watch_new(&watch, journal, separate_callback, &run);
+        abrt_journal_watch_run_sync(watch);
+        abrt_journal_watch_free(watch);
+        abrt_journal_free(journal);
+
+        *total += run.entries;
+    }
+
+    return cpu_usec() - start;
+}
+
+static double run_multiplexed(const char *directory, unsigned count, unsigned *total)
+{
+    const double start = cpu_usec();
+
+    abrt_journal_t *journal = NULL;
+    open_journal(&journal, directory);
+
+    struct bench_handler handler = { .total = total, .expected = count * BENCH_HANDLERS };
+    for (int i = 0; i < BENCH_HANDLERS; ++i)
+    {
+        GList *filter = g_list_prepend(NULL, (char *)s_handler_matches[i]);
+        abrt_journal_add_handler(journal, s_handler_matches[i], filter,
+                handler_entry, handler_idle, &handler);
+        g_list_free(filter);
+    }
+
+    abrt_journal_run_handlers(journal, /*flags*/0);
+    abrt_journal_free(journal);
+
+    return cpu_usec() - start;
+}
+
+static void run_handlers_bench(const char *directory, unsigned count)
+{
+    printf("\n%-12s %10s %10s %12s %12s\n", "handlers", "watches", "entries",
+            "wakeups/write", "cpu ms");
+
+    unsigned total = 0;
+    double usec = run_separate(directory, count, &total);
+    if (total != count * BENCH_HANDLERS)
+        error_msg_and_die("Processed %u entries, expected %u", total, count * BENCH_HANDLERS);
+    printf("%-12s %10d %10u %12d %12.1f\n", "separate", BENCH_HANDLERS, total, BENCH_HANDLERS, usec / 1e3);
+
+    total = 0;
+    usec = run_multiplexed(directory, count, &total);
+    if (total != count * BENCH_HANDLERS)
+        error_msg_and_die("Processed %u entries, expected %u", total, count * BENCH_HANDLERS);
+    printf("%-12s %10d %10u %12d %12.1f\n", "multiplexed", 1, total, 1, usec / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    abrt_init(argv);
+
+    const char *program_usage_string =
+        "& [-v] -g COUNT\n"
+        "or:\n"
+        "& [-v] [-n COUNT] JOURNAL_DIR\n"
+        "\n"
+        "Prints COUNT systemd-coredump, kernel and Xorg entries in the journal\n"
+        "export format or measures watching them in JOURNAL_DIR with a callback\n"
+        "per entry, with the batched watch, with a watch per handler and with\n"
+        "the handlers sharing a single watch."
+    ;
+    enum {
+        OPT_v = 1 << 0,
+        OPT_g = 1 << 1,
+        OPT_n = 1 << 2,
+    };
+    int count = 10000;
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_INTEGER('g', NULL, &count, "Generate COUNT entries"),
+        OPT_INTEGER('n', NULL, &count, "Number of entries in JOURNAL_DIR (default 10000)"),
+        OPT_END()
+    };
+    const unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
+
+    argv += optind;
+    if (count <= 0)
+        show_usage_and_die(program_usage_string, program_options);
+
+    if (opts & OPT_g)
+    {
+        if (argv[0])
+            show_usage_and_die(program_usage_string, program_options);
+
+        generate(count);
+        return 0;
+    }
+
+    if (!argv[0] || argv[1])
+        show_usage_and_die(program_usage_string, program_options);
+
+    printf("%-12s %10s %10s %12s %12s %10s\n", "mode", "entries", "callbacks",
+            "state writes", "entries/s", "us/entry");
+
+    run_bench(argv[0], count, /*batched*/false, 0);
+    run_bench(argv[0], count, /*batched*/true, 0);
+    run_bench(argv[0], count, /*batched*/true, 1);
+
+    run_handlers_bench(argv[0], count);
+
+    return 0;
+}
@@ -0,0 +1,554 @@
+/*
+    Copyright (C) 2017  ABRT Team
+    Copyright (C) 2017  RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <dirent.h>
+#include <time.h>
+#include "libabrt.h"
+
+/* Benchmark of the oops extractor.
+ *
+ * The kernel logs from the examples directory are mixed with ordinary
+ * kernel messages into large synthetic corpora in the formats consumed by
+ * abrt-dump-oops (dmesg, syslog) and abrt-dump-journal-oops (journal
+ * export format, one MESSAGE field per entry). Every corpus is parsed the
+ * same way the tools parse it and the best run is compared with a baseline.
+ *
+ * Throughput depends on the machine, so the baseline is created explicitly
+ * with -w (--update-baseline) and later runs must be done on the same
+ * machine. Allocation and oops counts are exact and don't depend on the
+ * machine.
+ */
+
+#define BENCH_CHUNK_SIZE (64 * 1024)
+/* Ordinary messages between two example logs */
+#define BENCH_NOISE_LINES 400
+#define BENCH_BASELINE_HEADER "# koops-bench baseline"
+
+/* Allocations made by the parser, glibc lets us count them by interposing
+ * the allocator */
+static unsigned long s_allocations;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    ++s_allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    ++s_allocations;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    ++s_allocations;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+enum corpus_format
+{
+    CORPUS_DMESG,
+    CORPUS_SYSLOG,
+    CORPUS_JOURNAL,
+    CORPUS_COUNT,
+};
+
+static const char *const s_format_names[CORPUS_COUNT] = {
+    "dmesg",
+    "syslog",
+    "journal",
+};
+
+struct bench_result
+{
+    unsigned long lines;
+    size_t size;
+    double seconds;
+    unsigned long allocations;
+    unsigned oopses;
+    /* Feeding of the message completing an oops, journal only */
+    double emit_max_usec;
+    double emit_sum_usec;
+    /* Parsing with the duplicate hash and rate limiting signature of an oops */
+    double hash_sum_usec;
+};
+
+struct baseline
+{
+    unsigned size_mb;
+    double mb_per_sec[CORPUS_COUNT];
+    double allocations_per_mb[CORPUS_COUNT];
+    unsigned oopses[CORPUS_COUNT];
+};
+
+static const char *const s_noise[] = {
+    "<6>usb 1-1.%u: new high-speed USB device number %u using ehci-pci",
+    "<6>EXT4-fs (dm-%u): re-mounted. Opts: commit=%u",
+    "<5>audit: type=1130 audit(1500000000.%u:%u): pid=1 uid=0 auid=4294967295 ses=4294967295 msg='unit=systemd-tmpfiles-clean comm=\"systemd\" exe=\"/usr/lib/systemd/systemd\" hostname=? addr=? terminal=? res=success'",
+    "<6>e1000e %u:00:19.%u enp0s25: NIC Link is Up 1000 Mbps Full Duplex, Flow Control: None",
+    "<4>ACPI Warning: SystemIO range 0x%04x-0x%04x conflicts with OpRegion (20170303/utaddress-247)",
+    "<6>IPv6: ADDRCONF(NETDEV_CHANGE): wlp%us%u: link becomes ready",
+    "<3>Bluetooth: hci%u: last event is not cmd complete (0x%02x)",
+    "<6>wlp3s0: authenticate with 00:11:22:33:%02x:%02x",
+    "<6>psmouse serio%u: synaptics: queried max coordinates: x [..5676], y [..%u]",
+    "<7>SELinux: initialized (dev tmpfs, type tmpfs), uses transition SIDs %u %u",
+    "<4>i915 0000:00:02.0: Resetting chip for hang on rcs%u, frame %u",
+    "<6>nf_conntrack: default automatic helper assignment has been turned off %u %u",
+};
+
+static unsigned s_seed = 42;
+
+static unsigned bench_rand(void)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 16) & 0x7fff;
+}
+
+/* Returns the kernel message of a line of an example log */
+static const char *bare_message(const char *line)
+{
+    const char *kernel = strstr(line, "kernel: ");
+    return kernel ? kernel + strlen("kernel: ") : line;
+}
+
+static void append_message(struct strbuf *corpus, enum corpus_format format, const char *msg, unsigned long *clock)
+{
+    *clock += 1 + bench_rand() % 5000;
+    const unsigned sec = *clock / 1000000;
+    const unsigned usec = *clock % 1000000;
+
+    switch (format)
+    {
+        case CORPUS_DMESG:
+            /* dmesg -r keeps the level in front of the time stamp */
+            if (msg[0] == '<' && msg[1] && msg[2] == '>')
+                strbuf_append_strf(corpus, "%.3s[%5u.%06u] %s\n", msg, sec, usec, msg + 3);
+            else if (msg[0] == '[')
+                strbuf_append_strf(corpus, "%s\n", msg);
+            else
+                strbuf_append_strf(corpus, "[%5u.%06u] %s\n", sec, usec, msg);
+            break;
+        case CORPUS_SYSLOG:
+            strbuf_append_strf(corpus, "Oct 18 %02u:%02u:%02u localhost kernel: %s\n",
+                    sec / 3600 % 24, sec / 60 % 60, sec % 60, msg);
+            break;
+        case CORPUS_JOURNAL:
+            strbuf_append_strf(corpus,
+                    "__REALTIME_TIMESTAMP=%lu\n"
+                    "_TRANSPORT=kernel\n"
+                    "SYSLOG_IDENTIFIER=kernel\n"
+                    "MESSAGE=%s\n"
+                    "\n",
+                    1500000000000000UL + *clock, msg);
+            break;
+        default:
+            abort();
+    }
+}
+
+static int is_example(const struct dirent *dent)
+{
+    const size_t len = strlen(dent->d_name);
+    return len > 5 && strcmp(dent->d_name + len - 5, ".test") == 0;
+}
+
+/* Loads all example logs in a stable order */
+static GList *load_examples(const char *examples_dir)
+{
+    struct dirent **namelist;
+    const int n = scandir(examples_dir, &namelist, is_example, alphasort);
+    if (n < 0)
+        perror_msg_and_die("Can't read '%s'", examples_dir);
+
+    GList *examples = NULL;
+    for (int i = 0; i < n; ++i)
+    {
+        char *path = concat_path_file(examples_dir, namelist[i]->d_name);
+        char *text = xmalloc_xopen_read_close(path, NULL);
+        examples = g_list_prepend(examples, text);
+        free(path);
+        free(namelist[i]);
+    }
+    free(namelist);
+
+    if (examples == NULL)
+        error_msg_and_die("No example logs in '%s'", examples_dir);
+
+    return g_list_reverse(examples);
+}
+
+static struct strbuf *build_corpus(GList *examples, enum corpus_format format, size_t size)
+{
+    s_seed = 42;
+    unsigned long clock = 0;
+    struct strbuf *corpus = strbuf_new();
+    while ((size_t)corpus->len < size)
+    {
+        for (GList *l = examples; l && (size_t)corpus->len < size; l = l->next)
+        {
+            for (unsigned i = 0; i < BENCH_NOISE_LINES; ++i)
+            {
+                char msg[512];
+                const char *fmt = s_noise[bench_rand() % ARRAY_SIZE(s_noise)];
+                snprintf(msg, sizeof(msg), fmt, bench_rand() % 16, bench_rand());
+                append_message(corpus, format, msg, &clock);
+            }
+
+            char *text = xstrdup(l->data);
+            for (char *line = text, *eol; *line; line = eol)
+            {
+                eol = strchrnul(line, '\n');
+                if (*eol)
+                    *eol++ = '\0';
+                append_message(corpus, format, bare_message(line), &clock);
+            }
+            free(text);
+        }
+    }
+
+    return corpus;
+}
+
+static double elapsed_usec(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* The way abrt-dump-oops reads files */
+static void parse_log(const struct strbuf *corpus, struct bench_result *result, GList **oops_list)
+{
+    struct abrt_koops_extractor *extractor = koops_extractor_new();
+    for (int pos = 0; pos < corpus->len; pos += BENCH_CHUNK_SIZE)
+    {
+        const size_t len = MIN(BENCH_CHUNK_SIZE, corpus->len - pos);
+        koops_extractor_feed(extractor, corpus->buf + pos, len, oops_list);
+    }
+    koops_extractor_flush(extractor, oops_list);
+    koops_extractor_free(extractor);
+
+    result->lines = 0;
+    for (const char *c = corpus->buf; (c = strchr(c, '\n')) != NULL; ++c)
+        ++result->lines;
+}
+
+/* The way abrt-dump-journal-oops reads the journal */
+static void parse_journal(const struct strbuf *corpus, struct bench_result *result, GList **oops_list)
+{
+    result->lines = 0;
+    result->emit_max_usec = result->emit_sum_usec = 0;
+
+    struct abrt_koops_extractor *extractor = koops_extractor_new();
+    GList *tail = g_list_last(*oops_list);
+    const char *end = corpus->buf + corpus->len;
+    for (const char *line = corpus->buf, *eol; line < end; line = eol + 1)
+    {
+        eol = memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+
+        if (strncmp(line, "MESSAGE=", strlen("MESSAGE=")) != 0)
+            continue;
+
+        ++result->lines;
+        const char *msg = line + strlen("MESSAGE=");
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        koops_extractor_feed_message(extractor, msg, eol - msg, oops_list);
+        const double usec = elapsed_usec(&start);
+
+        /* Oopses are appended to the list */
+        GList *next = tail ? tail->next : *oops_list;
+        if (next != NULL)
+        {
+            result->emit_sum_usec += usec;
+            result->emit_max_usec = MAX(result->emit_max_usec, usec);
+            tail = g_list_last(next);
+        }
+    }
+    koops_extractor_flush(extractor, oops_list);
+    koops_extractor_free(extractor);
+}
+
+static void hash_oopses(GList *oops_list, struct bench_result *result)
+{
+    result->hash_sum_usec = 0;
+    for (GList *l = oops_list; l; l = l->next)
+    {
+        const char *backtrace = strchrnul(l->data, '\n');
+        if (*backtrace)
+            ++backtrace;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        /* The same work abrt_oops_create_dump_dirs() does per oops */
+        char signature[SHA1_RESULT_LEN*2 + 1];
+        koops_signature_str(signature, backtrace);
+        struct abrt_koops_info *info = koops_info_parse(l->data);
+        koops_info_index_hash(info);
+        koops_info_free(info);
+
+        result->hash_sum_usec += elapsed_usec(&start);
+    }
+}
+
+static void run_bench(const struct strbuf *corpus, enum corpus_format format, unsigned runs, struct bench_result *best)
+{
+    memset(best, 0, sizeof(*best));
+    best->size = corpus->len;
+
+    for (unsigned run = 0; run < runs; ++run)
+    {
+        struct bench_result result = *best;
+        GList *oops_list = NULL;
+
+        const unsigned long allocations = s_allocations;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (format == CORPUS_JOURNAL)
+            parse_journal(corpus, &result, &oops_list);
+        else
+            parse_log(corpus, &result, &oops_list);
+
+        result.seconds = elapsed_usec(&start) / 1e6;
+        result.allocations = s_allocations - allocations;
+        result.oopses = g_list_length(oops_list);
+
+        /* The oopses are the output, their strings are counted too */
+        hash_oopses(oops_list, &result);
+        list_free_with_free(oops_list);
+
+        if (run == 0 || result.seconds < best->seconds)
+            *best = result;
+    }
+}
+
+static int load_baseline(const char *path, struct baseline *baseline)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    int ret = -1;
+    unsigned found = 0;
+    char *line = xmalloc_fgetline(fp);
+    if (line == NULL || strcmp(line, BENCH_BASELINE_HEADER) != 0)
+        goto finito;
+
+    while (free(line), (line = xmalloc_fgetline(fp)) != NULL)
+    {
+        char name[32];
+        double mb_per_sec, allocations_per_mb;
+        unsigned oopses;
+        if (sscanf(line, "size %u", &baseline->size_mb) == 1)
+            continue;
+
+        if (sscanf(line, "%31s %lf %lf %u", name, &mb_per_sec, &allocations_per_mb, &oopses) != 4)
+            goto finito;
+
+        for (int f = 0; f < CORPUS_COUNT; ++f)
+        {
+            if (strcmp(name, s_format_names[f]) == 0)
+            {
+                baseline->mb_per_sec[f] = mb_per_sec;
+                baseline->allocations_per_mb[f] = allocations_per_mb;
+                baseline->oopses[f] = oopses;
+                found |= 1 << f;
+            }
+        }
+    }
+    ret = found == (1 << CORPUS_COUNT) - 1 ? 0 : -1;
+
+ finito:
+    free(line);
+    fclose(fp);
+    if (ret != 0)
+        error_msg("'%s' is not a koops-bench baseline", path);
+    return ret;
+}
+
+static void save_baseline(const char *path, const struct baseline *baseline)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        perror_msg_and_die("Can't create '%s'", path);
+
+    fprintf(fp, BENCH_BASELINE_HEADER"\n");
+    fprintf(fp, "size %u\n", baseline->size_mb);
+    for (int f = 0; f < CORPUS_COUNT; ++f)
+        fprintf(fp, "%s %.3f %.3f %u\n", s_format_names[f], baseline->mb_per_sec[f],
+                baseline->allocations_per_mb[f], baseline->oopses[f]);
+
+    if (fclose(fp) != 0)
+        perror_msg_and_die("Can't write '%s'", path);
+
+    log("Saved baseline to '%s'", path);
+}
+
+/* Returns the number of regressions */
+static unsigned compare_with_baseline(const struct baseline *current, const struct baseline *baseline, unsigned threshold)
+{
+    if (current->size_mb != baseline->size_mb)
+    {
+        error_msg("The baseline was measured on a %u MiB corpus, not comparing", baseline->size_mb);
+        return 0;
+    }
+
+    unsigned regressions = 0;
+    const double tolerance = threshold / 100.0;
+    for (int f = 0; f < CORPUS_COUNT; ++f)
+    {
+        const char *name = s_format_names[f];
+        if (current->oopses[f] != baseline->oopses[f])
+        {
+            error_msg("%s: found %u oopses, baseline %u", name, current->oopses[f], baseline->oopses[f]);
+            ++regressions;
+        }
+
+        if (current->mb_per_sec[f] < baseline->mb_per_sec[f] * (1 - tolerance))
+        {
+            error_msg("%s: throughput %.1f MB/s, baseline %.1f MB/s", name,
+                    current->mb_per_sec[f], baseline->mb_per_sec[f]);
+            ++regressions;
+        }
+
+        if (current->allocations_per_mb[f] > baseline->allocations_per_mb[f] * (1 + tolerance))
+        {
+            error_msg("%s: %.1f allocations per MB, baseline %.1f", name,
+                    current->allocations_per_mb[f], baseline->allocations_per_mb[f]);
+            ++regressions;
+        }
+    }
+
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    abrt_init(argv);
+
+    const char *program_usage_string =
+        "& [-v] [-s MIB] [-r RUNS] [-t PERCENT] [-b FILE [-w]] EXAMPLES_DIR\n"
+        "\n"
+        "Measures the oops extractor on synthetic kernel logs made of the example\n"
+        "logs in EXAMPLES_DIR and ordinary kernel messages. Fails if the throughput\n"
+        "or the number of allocations regress by more than PERCENT compared\n"
+        "to the baseline FILE. -w creates or overwrites the baseline FILE."
+    ;
+    enum {
+        OPT_v = 1 << 0,
+        OPT_s = 1 << 1,
+        OPT_r = 1 << 2,
+        OPT_t = 1 << 3,
+        OPT_b = 1 << 4,
+        OPT_w = 1 << 5,
+    };
+    int size_mb = 16;
+    int runs = 3;
+    int threshold = 20;
+    const char *baseline_file = NULL;
+    /* Keep enum above and order of options below in sync! */
+    struct options program_options[] = {
+        OPT__VERBOSE(&g_verbose),
+        OPT_INTEGER('s', NULL, &size_mb, "Size of every corpus in MiB (default 16)"),
+        OPT_INTEGER('r', NULL, &runs, "Take the best of RUNS runs (default 3)"),
+        OPT_INTEGER('t', NULL, &threshold, "Tolerated regression in percent (default 20)"),
+        OPT_STRING('b', NULL, &baseline_file, "FILE", "Compare with the baseline FILE"),
+        OPT_BOOL('w', "update-baseline", NULL, "Save the results as the baseline FILE"),
+        OPT_END()
+    };
+    const unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
+
+    argv += optind;
+    if (!argv[0] || argv[1] || size_mb <= 0 || runs <= 0 || threshold < 0)
+        show_usage_and_die(program_usage_string, program_options);
+
+    GList *examples = load_examples(argv[0]);
+
+    struct baseline current = { .size_mb = size_mb };
+    printf("%-8s %12s %8s %10s %8s %16s %10s\n", "corpus", "lines/s", "MB/s",
+            "allocs/MB", "oopses", "emit avg/max us", "hash us");
+
+    for (int f = 0; f < CORPUS_COUNT; ++f)
+    {
+        struct strbuf *corpus = build_corpus(examples, f, (size_t)size_mb * 1024 * 1024);
+
+        struct bench_result result;
+        run_bench(corpus, f, runs, &result);
+        strbuf_free(corpus);
+
+        const double mb = result.size / 1e6;
+        current.mb_per_sec[f] = mb / result.seconds;
+        current.allocations_per_mb[f] = result.allocations / mb;
+        current.oopses[f] = result.oopses;
+
+        char emit[32] = "-";
+        if (f == CORPUS_JOURNAL && result.oopses)
+            snprintf(emit, sizeof(emit), "%.1f/%.1f",
+                    result.emit_sum_usec / result.oopses, result.emit_max_usec);
+
+        printf("%-8s %12.0f %8.1f %10.1f %8u %16s %10.1f\n", s_format_names[f],
+                result.lines / result.seconds, current.mb_per_sec[f],
+                current.allocations_per_mb[f], result.oopses, emit,
+                result.oopses ? result.hash_sum_usec / result.oopses : 0.0);
+    }
+
+    list_free_with_free(examples);
+
+    if (baseline_file == NULL)
+        return 0;
+
+    struct baseline baseline;
+    memset(&baseline, 0, sizeof(baseline));
+    if (opts & OPT_w)
+    {
+        save_baseline(baseline_file, &current);
+        return 0;
+    }
+
+    /* Passing without a comparison would hide regressions */
+    if (access(baseline_file, F_OK) != 0)
+    {
+        error_msg("No baseline '%s', run with -w to create it", baseline_file);
+        return 1;
+    }
+
+    if (load_baseline(baseline_file, &baseline) != 0)
+        return 1;
+
+    const unsigned regressions = compare_with_baseline(&current, &baseline, threshold);
+    if (regressions)
+    {
+        error_msg("%u regressions above %d%%, run with -w to accept the results", regressions, threshold);
+        return 1;
+    }
+
+    log("No regressions above %d%%", threshold);
+    return 0;
+}
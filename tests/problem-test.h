@@ -0,0 +1,66 @@
+/*
+    Copyright (C) 2017 RedHat inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <assert.h>
+#include <stdarg.h>
+
+/* Creates problem directory NAME in BASE with the basic files and the text
+ * items given as a NULL terminated list of item name and value pairs.
+ * Returns the open problem directory. */
+static inline struct dump_dir *create_problem_dd_v(const char *base, const char *name, va_list items)
+{
+    char *path = concat_path_file(base, name);
+    struct dump_dir *dd = dd_create(path, (uid_t)-1, 0640);
+    assert(dd != NULL);
+    free(path);
+
+    dd_create_basic_files(dd, (uid_t)-1, NULL);
+
+    const char *item;
+    while ((item = va_arg(items, const char *)) != NULL)
+    {
+        const char *value = va_arg(items, const char *);
+        assert(value != NULL);
+        dd_save_text(dd, item, value);
+    }
+
+    return dd;
+}
+
+static inline struct dump_dir *create_problem_dd(const char *base, const char *name, ...)
+{
+    va_list items;
+    va_start(items, name);
+    struct dump_dir *dd = create_problem_dd_v(base, name, items);
+    va_end(items);
+    return dd;
+}
+
+/* The same as create_problem_dd(), but closes the problem directory and
+ * returns its path */
+static inline char *create_problem(const char *base, const char *name, ...)
+{
+    va_list items;
+    va_start(items, name);
+    struct dump_dir *dd = create_problem_dd_v(base, name, items);
+    va_end(items);
+
+    char *path = xstrdup(dd->dd_dirname);
+    dd_close(dd);
+    return path;
+}